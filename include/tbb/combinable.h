@@ -67,6 +67,15 @@ namespace tbb {
         template <typename combine_func_t>
         void combine_each(combine_func_t f_combine) { my_ets.combine_each(f_combine); }
 
+        // combine_parallel and combine_parallel_in_place need tbb/parallel_reduce.h included
+        // combine_func_t has signature T(T,T) or T(const T&, const T&) and is associative
+        template <typename combine_func_t>
+        T combine_parallel(combine_func_t f_combine) { return my_ets.combine_parallel(f_combine); }
+
+        // combine_func_t has signature void(T&,const T&) and merges the second argument into the first one
+        template <typename combine_func_t>
+        T& combine_parallel_in_place(combine_func_t f_combine) { return my_ets.combine_parallel_in_place(f_combine); }
+
     };
 } // namespace tbb
 #endif /* __TBB_combinable_H */
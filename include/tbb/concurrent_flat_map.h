@@ -0,0 +1,567 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#ifndef __TBB_concurrent_flat_map_H
+#define __TBB_concurrent_flat_map_H
+
+#if ! TBB_PREVIEW_CONCURRENT_FLAT_MAP
+    #error Set TBB_PREVIEW_CONCURRENT_FLAT_MAP to include concurrent_flat_map.h
+#endif
+
+#include "tbb_stddef.h"
+#include "atomic.h"
+#include "cache_aligned_allocator.h"
+#include "spin_mutex.h"
+#include "blocked_range.h"
+#include "parallel_for.h"
+#include "concurrent_hash_map.h" // for tbb_hash_compare and solist_epochs
+#include "internal/_template_helpers.h"
+
+#include <new>          // Need placement new
+#include <cstring>      // Need std::memset
+#include <utility>      // Need std::pair
+
+#if (__TBB_x86_32 || __TBB_x86_64) && (__SSE2__ || _M_X64 || _M_IX86_FP >= 2)
+#define __TBB_FLAT_MAP_SSE2_PRESENT 1
+#include <emmintrin.h>
+#endif
+
+namespace tbb {
+namespace interface7 {
+
+//! @cond INTERNAL
+namespace internal {
+
+    //! States of a slot kept in its metadata byte
+    enum flat_map_slot_state {
+        slot_empty = 0,
+        //! The slot is claimed by an inserter that writes the key and the value
+        slot_busy = 1,
+        slot_erased = 2,
+        //! Empty and erased slots of a table being migrated
+        slot_frozen_empty = 3,
+        slot_frozen_erased = 4,
+        //! Full slot, combined with 6 bits of the hash code
+        slot_full = 0x80,
+        //! Full slot copied to the next table, combined with slot_full
+        slot_frozen = 0x40
+    };
+
+    //! Number of slots, which metadata is probed at once
+    static const size_t flat_map_group_size = 16;
+
+    //! Metadata of a group of slots
+    class flat_map_group {
+#if __TBB_FLAT_MAP_SSE2_PRESENT
+        __m128i my_meta;
+    public:
+        flat_map_group( const atomic<unsigned char> *meta )
+            : my_meta( _mm_load_si128( reinterpret_cast<const __m128i*>(meta) ) ) {
+            __TBB_acquire_consistency_helper(); // slots are read after the metadata
+        }
+        //! Bit mask of the slots with (meta & mask) == value
+        unsigned match( unsigned char mask, unsigned char value ) const {
+            return unsigned( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_and_si128( my_meta, _mm_set1_epi8( char(mask) ) ),
+                                                                 _mm_set1_epi8( char(value) ) ) ) );
+        }
+#else
+        unsigned char my_meta[flat_map_group_size];
+    public:
+        flat_map_group( const atomic<unsigned char> *meta ) {
+            for( size_t i = 0; i < flat_map_group_size; i++ )
+                my_meta[i] = meta[i]; // loads with acquire
+        }
+        //! Bit mask of the slots with (meta & mask) == value
+        unsigned match( unsigned char mask, unsigned char value ) const {
+            unsigned result = 0;
+            for( size_t i = 0; i < flat_map_group_size; i++ )
+                result |= unsigned( (my_meta[i] & mask) == value ) << i;
+            return result;
+        }
+#endif
+        //! Full slots with the tag, copied to the next table or not
+        unsigned match_full( unsigned char tagged ) const { return match( 0xFF & ~slot_frozen, tagged ); }
+        unsigned match_state( unsigned char state ) const { return match( 0xFF, state ); }
+        //! Slots that end the probe sequence
+        unsigned match_end() const { return match_state( slot_empty ) | match_state( slot_frozen_empty ); }
+        //! Slots of a table being migrated
+        unsigned match_frozen() const {
+            return match( slot_full|slot_frozen, slot_full|slot_frozen ) | match_state( slot_frozen_empty ) | match_state( slot_frozen_erased );
+        }
+        static size_t first( unsigned mask ) { return size_t( __TBB_Log2( mask & (0u - mask) ) ); }
+    };
+
+    //! Slots of concurrent_flat_map with their metadata
+    /** Tables replaced by migration are retired, and freed once the operations that
+        could read them have finished. **/
+    template<typename Key, typename T>
+    class flat_map_table : tbb::internal::no_copy {
+    public:
+        struct slot {
+            Key key;
+            T value;
+        };
+        //! Sharded counters of slots
+        struct counter {
+            atomic<size_t> claimed, erased;
+        };
+        static const size_t counters_number = 16;
+
+        size_t capacity; // power of 2, not less than flat_map_group_size
+        atomic<unsigned char> *meta;
+        slot *slots;
+        //! Table receiving the items while this one is migrated
+        atomic<flat_map_table*> next;
+        //! Next table in the list of retired tables
+        flat_map_table *retired_next;
+        //! Epoch of the operations when the table was replaced
+        uintptr_t retired_epoch;
+        //! Numbers of slots taken for migration and migrated
+        atomic<size_t> migration_claimed, migration_done;
+        tbb::internal::padded<counter> counters[counters_number];
+
+        template<typename Allocator>
+        static flat_map_table *allocate( Allocator &a, size_t capacity ) {
+            char *p = a.allocate( total_size( capacity ) );
+            flat_map_table *t = new( p ) flat_map_table;
+            t->capacity = capacity;
+            t->meta = reinterpret_cast<atomic<unsigned char>*>( p + header_size() );
+            t->slots = reinterpret_cast<slot*>( p + header_size() + aligned( capacity ) );
+            std::memset( static_cast<void*>(t->meta), 0, capacity );
+            t->next = NULL;
+            t->retired_next = NULL;
+            t->migration_claimed = t->migration_done = 0;
+            for( size_t i = 0; i < counters_number; i++ )
+                t->counters[i].claimed = t->counters[i].erased = 0;
+            return t;
+        }
+        template<typename Allocator>
+        static void free( Allocator &a, flat_map_table *t ) {
+            size_t size = total_size( t->capacity );
+            t->~flat_map_table();
+            a.deallocate( reinterpret_cast<char*>(t), size );
+        }
+        //! Counter of slots of hash codes
+        counter &counter_of( size_t h ) { return counters[(h >> 8) & (counters_number-1)]; }
+        size_t claimed() const {
+            size_t result = 0;
+            for( size_t i = 0; i < counters_number; i++ ) result += counters[i].claimed;
+            return result;
+        }
+        size_t erased() const {
+            size_t result = 0;
+            for( size_t i = 0; i < counters_number; i++ ) result += counters[i].erased;
+            return result;
+        }
+        //! Start of the probe sequence
+        size_t first_group( size_t h ) const { return h & (capacity-1) & ~(flat_map_group_size-1); }
+        size_t next_group( size_t g ) const { return (g + flat_map_group_size) & (capacity-1); }
+    private:
+        static size_t aligned( size_t size ) { return (size + NFS_MaxLineSize - 1) & ~size_t(NFS_MaxLineSize - 1); }
+        static size_t header_size() { return aligned( sizeof(flat_map_table) ); }
+        static size_t total_size( size_t capacity ) { return header_size() + aligned( capacity ) + capacity*sizeof(slot); }
+    };
+
+} // namespace internal
+//! @endcond
+
+//! Hash map with keys and values stored inline in an open-addressing table.
+/** Intended for small trivially copyable keys and values. Lookups take no locks,
+    and insertions claim slots by compare-and-swap on the metadata bytes, which are
+    probed by groups. When the table fills up, concurrent operations on the map
+    help to migrate items to a larger table, and big tables are migrated by
+    parallel_for. Values are not updated in place: insert() keeps the existing
+    value, and erase() leaves a tombstone, which is purged by the next migration.
+    A migration moves only the live items, to a table of the same capacity if
+    most of the claimed slots are erased. The replaced table is freed after the
+    operations that could read it have finished, which they register for.
+    @ingroup containers */
+template<typename Key, typename T, typename HashCompare = tbb_hash_compare<Key>,
+         typename Allocator = cache_aligned_allocator<std::pair<Key, T> > >
+class concurrent_flat_map : tbb::internal::no_copy {
+    typedef internal::flat_map_table<Key,T> table_type;
+    //! Tables are allocated as raw memory
+    typedef typename Allocator::template rebind<char>::other table_allocator_type;
+    typedef tbb::interface5::internal::solist_epochs epochs_type;
+    typedef typename table_type::slot slot_type;
+    typedef internal::flat_map_group group_type;
+#if __TBB_CPP11_TYPE_PROPERTIES_PRESENT
+    __TBB_STATIC_ASSERT( tbb::internal::tbb_trivially_copyable<Key>::value && tbb::internal::tbb_trivially_copyable<T>::value,
+                         "concurrent_flat_map requires trivially copyable keys and values" );
+#endif
+public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<Key,T> value_type;
+    typedef size_t size_type;
+    typedef HashCompare hash_compare_type;
+    typedef Allocator allocator_type;
+
+    //! Construct an empty map, with the capacity for n items
+    explicit concurrent_flat_map( size_type n = 0, const HashCompare &hash_compare = HashCompare(),
+                                  const allocator_type &a = allocator_type() )
+        : my_hash_compare( hash_compare ), my_allocator( a ) {
+        size_type capacity = internal::flat_map_group_size;
+        while( max_load( capacity ) < n )
+            capacity *= 2;
+        my_table = table_type::allocate( my_allocator, capacity );
+        my_retired = NULL;
+    }
+
+    ~concurrent_flat_map() { free_tables(); }
+
+    //! Insert the item if there is no item with the same key
+    /** Return true if the item is inserted, false if the key is in the map. */
+    bool insert( const Key &key, const T &value );
+    bool insert( const value_type &item ) { return insert( item.first, item.second ); }
+
+    //! Copy the value of the item with the key
+    /** Return true if the item is found, false otherwise. */
+    bool find( const Key &key, T &result ) const;
+
+    //! Return count of items (0 or 1)
+    size_type count( const Key &key ) const {
+        T value;
+        return find( key, value );
+    }
+
+    //! Erase the item with the key
+    /** Return true if the item was erased by this call. */
+    bool erase( const Key &key );
+
+    //! Number of items, can be inexact while modifications are running
+    size_type size() const {
+        epochs_type::guard guard( my_epochs );
+        table_type *t = my_table;
+        size_type claimed = t->claimed(), erased = t->erased();
+        return claimed > erased ? claimed - erased : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    //! Number of slots in the table
+    size_type capacity() const {
+        epochs_type::guard guard( my_epochs );
+        return my_table->capacity;
+    }
+
+    //! Erase all items and release replaced tables. Not thread-safe.
+    void clear() {
+        free_tables();
+        my_table = table_type::allocate( my_allocator, internal::flat_map_group_size );
+    }
+
+private:
+    atomic<table_type*> my_table;
+    HashCompare my_hash_compare;
+    table_allocator_type my_allocator;
+    //! Operations register in epochs while they can read tables
+    mutable epochs_type my_epochs;
+    //! Protects the list of retired tables
+    spin_mutex my_retired_mutex;
+    //! Tables replaced by migrations and not freed yet
+    atomic<table_type*> my_retired;
+
+    enum insert_result { insert_done, insert_found, insert_moved };
+
+    //! The table is migrated when claimed slots exceed 3/4 of the capacity
+    static size_type max_load( size_type capacity ) { return capacity / 4 * 3; }
+    //! Number of slots migrated at once
+    static size_type migration_chunk( size_type capacity ) { return capacity < 1024 ? capacity : 1024; }
+    //! Tables from this size are migrated by parallel_for
+    static const size_type parallel_migration_capacity = 64*1024;
+
+    //! Mix the hash code so that its lower bits are usable for the index and the higher ones for the tag
+    size_t hash( const Key &key ) const {
+        size_t h = my_hash_compare.hash( key ) * tbb::interface5::internal::hash_multiplier;
+        return h ^ (h >> 4*sizeof(size_t));
+    }
+    static unsigned char tag( size_t h ) {
+        return static_cast<unsigned char>( internal::slot_full | (h >> (8*sizeof(size_t) - 6)) );
+    }
+
+    insert_result insert_into( table_type *t, const Key &key, const T &value, size_t h );
+    bool erase_registered( const Key &key );
+    void insert_migrated( table_type *t, const slot_type &s );
+    void start_migration( table_type *t );
+    void migrate_chunk( table_type *t, size_type begin );
+    void help_migration( table_type *t, bool parallel );
+    void retire_table( table_type *t );
+    void reclaim_tables();
+
+    //! Body of parallel_for migrating the chunks that are not taken by other threads
+    class migration_body {
+        concurrent_flat_map *my_map;
+        table_type *my_table;
+    public:
+        migration_body( concurrent_flat_map *map, table_type *t ) : my_map(map), my_table(t) {}
+        void operator()( const blocked_range<size_type> &r ) const {
+            size_type chunk = migration_chunk( my_table->capacity );
+            for( size_type i = r.begin(); i != r.end(); ++i ) {
+                size_type begin = my_table->migration_claimed.fetch_and_add( chunk );
+                if( begin >= my_table->capacity )
+                    break;
+                my_map->migrate_chunk( my_table, begin );
+            }
+        }
+    };
+
+    void free_tables() {
+        table_type::free( my_allocator, my_table );
+        for( table_type *t = my_retired, *next; t; t = next ) {
+            next = t->retired_next;
+            table_type::free( my_allocator, t );
+        }
+        my_retired = NULL;
+    }
+};
+
+template<typename Key, typename T, typename HashCompare, typename A>
+bool concurrent_flat_map<Key,T,HashCompare,A>::find( const Key &key, T &result ) const {
+    size_t const h = hash( key );
+    unsigned char const tagged = tag( h );
+    // replaced tables are not freed while the operation is registered, and their items are not changed
+    epochs_type::guard guard( my_epochs );
+    table_type *t = my_table;
+    size_type g = t->first_group( h );
+    for( size_type probed = 0; probed < t->capacity; probed += internal::flat_map_group_size, g = t->next_group( g ) ) {
+        group_type group( t->meta + g );
+        for( unsigned m = group.match_full( tagged ); m; m &= m-1 ) {
+            slot_type &s = t->slots[g + group_type::first( m )];
+            if( my_hash_compare.equal( s.key, key ) ) {
+                result = s.value;
+                return true;
+            }
+        }
+        // an item in the sequence is never placed after an empty slot
+        if( group.match_end() )
+            return false;
+    }
+    return false;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+bool concurrent_flat_map<Key,T,HashCompare,A>::insert( const Key &key, const T &value ) {
+    size_t const h = hash( key );
+    insert_result r;
+    {
+        epochs_type::guard guard( my_epochs );
+        for( ;; ) {
+            table_type *t = my_table;
+            r = insert_into( t, key, value, h );
+            if( r != insert_moved )
+                break;
+            help_migration( t, /*parallel=*/false );
+        }
+    }
+    reclaim_tables();
+    return r == insert_done;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+typename concurrent_flat_map<Key,T,HashCompare,A>::insert_result
+concurrent_flat_map<Key,T,HashCompare,A>::insert_into( table_type *t, const Key &key, const T &value, size_t h ) {
+    unsigned char const tagged = tag( h );
+    size_type g = t->first_group( h );
+    for( size_type probed = 0; probed < t->capacity; ) {
+        group_type group( t->meta + g );
+        for( unsigned m = group.match_full( tagged ); m; m &= m-1 )
+            if( my_hash_compare.equal( t->slots[g + group_type::first( m )].key, key ) )
+                return insert_found;
+        if( unsigned busy = group.match_state( internal::slot_busy ) ) {
+            // the key being written can be the same
+            atomic<unsigned char> &state = t->meta[g + group_type::first( busy )];
+            for( tbb::internal::atomic_backoff backoff; state == internal::slot_busy; )
+                backoff.pause();
+            continue;
+        }
+        if( group.match_frozen() )
+            return insert_moved;
+        if( unsigned empty = group.match_state( internal::slot_empty ) ) {
+            size_type i = g + group_type::first( empty );
+            if( t->meta[i].compare_and_swap( internal::slot_busy, internal::slot_empty ) != internal::slot_empty )
+                continue; // probe the group again
+            t->slots[i].key = key;
+            t->slots[i].value = value;
+            t->meta[i] = tagged; // release
+            size_type claimed = ++t->counter_of( h ).claimed;
+            // sum the counters rarely, unless the table is small
+            if( ( !(claimed % 64) || t->capacity <= 64*table_type::counters_number ) && t->claimed() > max_load( t->capacity ) )
+                start_migration( t );
+            return insert_done;
+        }
+        probed += internal::flat_map_group_size;
+        g = t->next_group( g );
+    }
+    // all slots are claimed
+    start_migration( t );
+    return insert_moved;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+bool concurrent_flat_map<Key,T,HashCompare,A>::erase( const Key &key ) {
+    bool result;
+    {
+        epochs_type::guard guard( my_epochs );
+        result = erase_registered( key );
+    }
+    reclaim_tables();
+    return result;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+bool concurrent_flat_map<Key,T,HashCompare,A>::erase_registered( const Key &key ) {
+    size_t const h = hash( key );
+    unsigned char const tagged = tag( h );
+restart:
+    table_type *t = my_table;
+    size_type g = t->first_group( h );
+    for( size_type probed = 0; probed < t->capacity; ) {
+        group_type group( t->meta + g );
+        for( unsigned m = group.match_full( tagged ); m; m &= m-1 ) {
+            size_type i = g + group_type::first( m );
+            if( my_hash_compare.equal( t->slots[i].key, key ) ) {
+                unsigned char state = t->meta[i];
+                if( state == tagged && t->meta[i].compare_and_swap( internal::slot_erased, tagged ) == tagged ) {
+                    ++t->counter_of( h ).erased;
+                    return true;
+                }
+                if( t->meta[i] == internal::slot_erased )
+                    return false; // another thread was first
+                help_migration( t, /*parallel=*/false ); // the slot is frozen
+                goto restart;
+            }
+        }
+        if( group.match_end() )
+            return false;
+        probed += internal::flat_map_group_size;
+        g = t->next_group( g );
+    }
+    return false;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::start_migration( table_type *t ) {
+    if( !t->next ) {
+        size_type claimed = t->claimed(), erased = t->erased();
+        size_type live = claimed > erased ? claimed - erased : 0;
+        // at most a half of the new table is used, so it is not grown if most of the claimed slots are erased
+        size_type capacity = t->capacity;
+        while( capacity/2 < live )
+            capacity *= 2;
+        table_type *next = table_type::allocate( my_allocator, capacity );
+        if( t->next.compare_and_swap( next, NULL ) != NULL )
+            table_type::free( my_allocator, next ); // it was never visible
+    }
+    help_migration( t, /*parallel=*/true );
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::help_migration( table_type *t, bool parallel ) {
+    size_type chunk = migration_chunk( t->capacity );
+    if( parallel && t->capacity >= parallel_migration_capacity )
+        tbb::parallel_for( blocked_range<size_type>( 0, t->capacity/chunk ), migration_body( this, t ) );
+    else for( size_type begin; (begin = t->migration_claimed.fetch_and_add( chunk )) < t->capacity; )
+        migrate_chunk( t, begin );
+    for( tbb::internal::atomic_backoff backoff; t->migration_done < t->capacity; )
+        backoff.pause();
+    if( my_table.compare_and_swap( t->next, t ) == t )
+        retire_table( t );
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::retire_table( table_type *t ) {
+    spin_mutex::scoped_lock lock( my_retired_mutex );
+    // the table is already replaced, so operations registered later do not read it
+    t->retired_epoch = my_epochs.current();
+    t->retired_next = my_retired;
+    my_retired = t;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::reclaim_tables() {
+    if( !my_retired )
+        return;
+    spin_mutex::scoped_lock lock;
+    if( !lock.try_acquire( my_retired_mutex ) )
+        return; // another thread reclaims
+    // a table cannot be read once the epoch is advanced twice after its retirement
+    for( int i = 0; i < 2 && my_epochs.try_advance( my_epochs.current() ); i++ ) {}
+    uintptr_t epoch = my_epochs.current();
+    table_type *kept = NULL;
+    for( table_type *t = my_retired, *next; t; t = next ) {
+        next = t->retired_next;
+        if( epoch - t->retired_epoch >= 2 )
+            table_type::free( my_allocator, t );
+        else {
+            t->retired_next = kept;
+            kept = t;
+        }
+    }
+    my_retired = kept;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::migrate_chunk( table_type *t, size_type begin ) {
+    size_type end = begin + migration_chunk( t->capacity );
+    for( size_type i = begin; i < end; i++ ) {
+        for( tbb::internal::atomic_backoff backoff;; backoff.pause() ) {
+            unsigned char state = t->meta[i];
+            if( state == internal::slot_busy )
+                continue; // wait for the inserter
+            unsigned char frozen = state == internal::slot_empty ? (unsigned char)internal::slot_frozen_empty
+                                 : state == internal::slot_erased ? (unsigned char)internal::slot_frozen_erased
+                                 : (unsigned char)(state | internal::slot_frozen);
+            if( t->meta[i].compare_and_swap( frozen, state ) != state )
+                continue; // erased concurrently
+            if( state & internal::slot_full )
+                insert_migrated( t->next, t->slots[i] );
+            break;
+        }
+    }
+    t->migration_done += end - begin;
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_flat_map<Key,T,HashCompare,A>::insert_migrated( table_type *t, const slot_type &s ) {
+    // keys are unique and the table is not visible to other operations yet
+    size_t const h = hash( s.key );
+    for( size_type g = t->first_group( h );; ) {
+        group_type group( t->meta + g );
+        if( unsigned empty = group.match_state( internal::slot_empty ) ) {
+            size_type i = g + group_type::first( empty );
+            if( t->meta[i].compare_and_swap( internal::slot_busy, internal::slot_empty ) != internal::slot_empty )
+                continue;
+            t->slots[i] = s;
+            t->meta[i] = tag( h );
+            ++t->counter_of( h ).claimed;
+            return;
+        }
+        g = t->next_group( g );
+    }
+}
+
+} // namespace interface7
+
+using interface7::concurrent_flat_map;
+
+} // namespace tbb
+
+#endif /* __TBB_concurrent_flat_map_H */
@@ -41,10 +41,12 @@
 #include "cache_aligned_allocator.h"
 #include "tbb_allocator.h"
 #include "spin_rw_mutex.h"
+#include "spin_mutex.h"
 #include "atomic.h"
 #include "tbb_exception.h"
 #include "tbb_profiling.h"
 #include "internal/_concurrent_unordered_impl.h" // Need tbb_hasher
+#include "internal/_template_helpers.h"
 #if __TBB_INITIALIZER_LISTS_PRESENT
 #include <initializer_list>
 #endif
@@ -64,7 +66,7 @@ struct tbb_hash_compare {
     static bool equal( const Key& a, const Key& b ) { return a == b; }
 };
 
-namespace interface5 {
+namespace interface8 {
 
     template<typename Key, typename T, typename HashCompare = tbb_hash_compare<Key>, typename A = tbb_allocator<std::pair<Key, T> > >
     class concurrent_hash_map;
@@ -90,6 +92,83 @@ namespace interface5 {
     static hash_map_node_base *const rehash_req = reinterpret_cast<hash_map_node_base*>(size_t(3));
     //! Rehashed empty bucket flag
     static hash_map_node_base *const empty_rehashed = reinterpret_cast<hash_map_node_base*>(size_t(0));
+    //! Access to the table internals for the operations in concurrent_hash_map_parallel.h
+    template<typename Map> class hash_map_parallel_ops;
+
+    //! State of optimistic lookups, see concurrent_hash_map::enable_optimistic_reads()
+    /** Optimistic readers take no locks. What they read is validated by seqlocks, and
+        nodes excluded from the table are destroyed only after all readers that could
+        see them have left. Readers register in one of the slots selected by the stack
+        address, so threads mostly do not share the cache lines they modify. **/
+    class hash_map_optimistic_state : tbb::internal::no_copy {
+    public:
+        //! Seqlock, the counters differ while a writer is active
+        struct version_type {
+            atomic<uintptr_t> begin, end;
+            void start_write() { ++begin; } // full fence, prior to the data modification
+            void end_write() { ++end; }
+        };
+        //! Counters of readers registered in each of two phases
+        struct reader_slot {
+            atomic<intptr_t> count[2];
+        };
+        static const size_t value_versions_number = 128;
+        static const size_t reader_slots_number = 64;
+        //! Number of excluded nodes destroyed together
+        static const size_t retired_max = 256;
+
+        //! Protect values updated by writers through accessors
+        version_type value_versions[value_versions_number];
+        //! Protects node lists from moving of nodes between buckets
+        version_type split_version;
+        //! Readers register in the slots of the phase
+        atomic<uintptr_t> phase;
+        tbb::internal::padded<reader_slot> reader_slots[reader_slots_number];
+        //! Serializes waiting for readers
+        spin_mutex reclamation_mutex;
+        //! Protects the retired nodes
+        spin_mutex retired_mutex;
+        size_t retired_count;
+        hash_map_node_base *retired[retired_max];
+
+        hash_map_optimistic_state() {
+            std::memset( static_cast<void*>(this), 0, sizeof(*this) );
+        }
+        version_type &value_version( size_t h ) {
+            return value_versions[h & (value_versions_number-1)];
+        }
+
+        //! Registers an optimistic reader for its lifetime
+        class read_guard : tbb::internal::no_copy {
+            atomic<intptr_t> *my_count;
+        public:
+            read_guard( hash_map_optimistic_state &s ) {
+                int local;
+                // threads use separate stacks, so they mostly use different slots
+                size_t k = (reinterpret_cast<uintptr_t>(&local) >> 12) * tbb::interface5::internal::hash_multiplier;
+                reader_slot &slot = s.reader_slots[k >> (8*sizeof(size_t) - 6)];
+                my_count = &slot.count[s.phase & 1];
+                ++*my_count; // full fence, nodes are read after the registration is visible
+            }
+            ~read_guard() { --*my_count; }
+        };
+
+        //! Waits until all readers registered before the call have left
+        void wait_for_readers() {
+            spin_mutex::scoped_lock lock( reclamation_mutex );
+            // a reader can read the phase before its change and register after it,
+            // so the phase is changed twice
+            for( int i = 0; i < 2; i++ ) {
+                uintptr_t old_phase = phase.fetch_and_increment();
+                for( size_t k = 0; k < reader_slots_number; k++ )
+                    for( tbb::internal::atomic_backoff backoff; reader_slots[k].count[old_phase & 1]; )
+                        backoff.pause();
+            }
+        }
+    };
+    __TBB_STATIC_ASSERT( !(hash_map_optimistic_state::value_versions_number & (hash_map_optimistic_state::value_versions_number-1)),
+                         "number of value versions must be power of 2" );
+
     //! base class of concurrent_hash_map
     class hash_map_base {
     public:
@@ -130,6 +209,8 @@ namespace interface5 {
         atomic<size_type> my_size; // It must be in separate cache line from my_mask due to performance effects
         //! Zero segment
         bucket my_embedded_segment[embedded_buckets];
+        //! State of optimistic lookups, NULL if they are not enabled
+        hash_map_optimistic_state *my_optimistic_state;
 #if __TBB_STATISTICS
         atomic<unsigned> my_info_resizes; // concurrent ones
         mutable atomic<unsigned> my_info_restarts; // race collisions
@@ -143,6 +224,7 @@ namespace interface5 {
             for( size_type i = 0; i < embedded_block; i++ ) // fill the table
                 my_table[i] = my_embedded_segment + segment_base(i);
             my_mask = embedded_buckets - 1;
+            my_optimistic_state = NULL;
             __TBB_ASSERT( embedded_block <= first_block, "The first block number must include embedded blocks");
 #if __TBB_STATISTICS
             my_info_resizes = 0; // concurrent ones
@@ -184,7 +266,7 @@ namespace interface5 {
         static void add_to_bucket( bucket *b, node_base *n ) {
             __TBB_ASSERT(b->node_list != rehash_req, NULL);
             n->next = b->node_list;
-            b->node_list = n; // its under lock and flag is set
+            __TBB_store_with_release(b->node_list, n); // its under lock and flag is set; release for optimistic readers
         }
 
         //! Exception safety helper
@@ -305,6 +387,7 @@ namespace interface5 {
                 swap(this->my_embedded_segment[i].node_list, table.my_embedded_segment[i].node_list);
             for(size_type i = embedded_block; i < pointers_per_table; i++)
                 swap(this->my_table[i], table.my_table[i]);
+            swap(this->my_optimistic_state, table.my_optimistic_state);
         }
     };
 
@@ -355,7 +438,7 @@ namespace interface5 {
         }
 #if !defined(_MSC_VER) || defined(__INTEL_COMPILER)
         template<typename Key, typename T, typename HashCompare, typename A>
-        friend class interface5::concurrent_hash_map;
+        friend class interface8::concurrent_hash_map;
 #else
     public: // workaround
 #endif
@@ -552,6 +635,9 @@ class concurrent_hash_map : protected internal::hash_map_base {
     template<typename I>
     friend class internal::hash_map_range;
 
+    template<typename Map>
+    friend class internal::hash_map_parallel_ops;
+
 public:
     typedef Key key_type;
     typedef T mapped_type;
@@ -600,6 +686,61 @@ protected:
         my_allocator.deallocate( static_cast<node*>(n), 1);
     }
 
+    typedef internal::hash_map_optimistic_state optimistic_state;
+
+    //! Destroys the node excluded from the table, or defers it while optimistic readers can see it
+    void retire_node( node_base *n ) {
+        optimistic_state *s = my_optimistic_state;
+        if( !s ) {
+            delete_node( n );
+            return;
+        }
+        node_base *reclaimed[optimistic_state::retired_max];
+        {
+            spin_mutex::scoped_lock lock( s->retired_mutex );
+            if( s->retired_count < optimistic_state::retired_max ) {
+                // n->next is not reused, readers can still follow it
+                s->retired[s->retired_count++] = n;
+                return;
+            }
+            std::memcpy( reclaimed, s->retired, sizeof(reclaimed) );
+            s->retired[0] = n;
+            s->retired_count = 1;
+        }
+        s->wait_for_readers();
+        for( size_t i = 0; i < optimistic_state::retired_max; i++ )
+            delete_node( reclaimed[i] );
+    }
+
+    //! Destroys the retired nodes, there must be no concurrent operations
+    void reclaim_retired_nodes() {
+        if( optimistic_state *s = my_optimistic_state ) {
+            for( size_t i = 0; i < s->retired_count; i++ )
+                delete_node( s->retired[i] );
+            s->retired_count = 0;
+        }
+    }
+
+    //! Copy a trivially copyable value under the seqlock
+    static bool optimistic_copy( node *n, T &result, optimistic_state::version_type &v, tbb::internal::true_type ) {
+        uintptr_t end = v.end;
+        if( v.begin != end )
+            return false; // a writer is active
+        result = n->item.second;
+        __TBB_acquire_consistency_helper();
+        return v.begin == end;
+    }
+
+    //! Copy a value under the lock of the node, which is not destroyed while the reader is registered
+    /** The reader does not wait for the lock, since its owner can wait for the readers to leave. */
+    static bool optimistic_copy( node *n, T &result, optimistic_state::version_type &, tbb::internal::false_type ) {
+        typename node::scoped_t lock;
+        if( !lock.try_acquire( n->mutex, /*write=*/false ) )
+            return false;
+        result = n->item.second;
+        return true;
+    }
+
     static node* allocate_node_copy_construct(node_allocator_type& allocator, const Key &key, const T * t){
         return  new( allocator ) node(key, *t);
     }
@@ -653,7 +794,8 @@ protected:
 #if __TBB_STATISTICS
         my_info_rehashes++; // invocations of rehash_bucket
 #endif
-
+        // optimistic readers of the old bucket can miss the nodes being moved
+        split_guard split( my_optimistic_state );
         bucket_accessor b_old( this, h & mask );
 
         mask = (mask<<1) | 1; // get full mask for new bucket
@@ -677,6 +819,18 @@ protected:
         }
     }
 
+    //! Makes optimistic readers retry lookups that failed while nodes move between buckets
+    class split_guard : tbb::internal::no_copy {
+        optimistic_state::version_type *my_version;
+    public:
+        split_guard( optimistic_state *s ) : my_version( s ? &s->split_version : NULL ) {
+            if( my_version ) my_version->start_write();
+        }
+        ~split_guard() {
+            if( my_version ) my_version->end_write();
+        }
+    };
+
     struct call_clear_on_leave {
         concurrent_hash_map* my_ch_map;
         call_clear_on_leave( concurrent_hash_map* a_ch_map ) : my_ch_map(a_ch_map) {}
@@ -687,6 +841,7 @@ protected:
             }
         }
     };
+
 public:
 
     class accessor;
@@ -704,6 +859,7 @@ public:
         //! Set to null
         void release() {
             if( my_node ) {
+                end_write();
                 node::scoped_t::release();
                 my_node = 0;
             }
@@ -721,16 +877,26 @@ public:
         }
 
         //! Create empty result
-        const_accessor() : my_node(NULL) {}
+        const_accessor() : my_node(NULL), my_version(NULL) {}
 
         //! Destroy result after releasing the underlying reference.
         ~const_accessor() {
+            end_write();
             my_node = NULL; // scoped lock's release() is called in its destructor
         }
     protected:
         bool is_writer() { return node::scoped_t::is_writer; }
+        //! Let optimistic readers see that the value could be changed
+        void end_write() {
+            if( my_version ) {
+                my_version->end_write();
+                my_version = NULL;
+            }
+        }
         node *my_node;
         hashcode_t my_hash;
+        //! Seqlock of the value while it is accessed for write in optimistic mode
+        optimistic_state::version_type *my_version;
     };
 
     //! Allows write access to elements and combines data access, locking, and garbage collection.
@@ -793,12 +959,15 @@ public:
 #endif //__TBB_CPP11_RVALUE_REF_PRESENT
 
     //! Construction with copying iteration range and given allocator instance
+    /** See tbb::parallel_build() to insert a large random access range in parallel. */
     template<typename I>
     concurrent_hash_map( I first, I last, const allocator_type &a = allocator_type() )
         : my_allocator(a)
     {
+        call_clear_on_leave scope_guard(this);
         reserve( std::distance(first, last) ); // TODO: load_factor?
         internal_copy(first, last);
+        scope_guard.dismiss();
     }
 
 #if __TBB_INITIALIZER_LISTS_PRESENT
@@ -853,14 +1022,33 @@ public:
 
     //! Rehashes and optionally resizes the whole table.
     /** Useful to optimize performance before or after concurrent operations.
-        Also enables using of find() and count() concurrent methods in serial context. */
+        Also enables using of find() and count() concurrent methods in serial context.
+        See tbb::parallel_rehash() to rehash a large table in parallel. */
     void rehash(size_type n = 0);
 
     //! Clear table
     void clear();
 
     //! Clear table and destroy it.
-    ~concurrent_hash_map() { clear(); }
+    ~concurrent_hash_map() {
+        clear();
+        if( my_optimistic_state ) {
+            my_optimistic_state->~optimistic_state();
+            cache_aligned_allocator<optimistic_state>().deallocate( my_optimistic_state, 1 );
+        }
+    }
+
+    //! Enables lock-free lookups by optimistic_find().
+    /** Values accessed for write, and buckets being split, are protected by seqlocks,
+        and erased items are destroyed in batches after concurrent readers leave.
+        The method is not thread-safe, call it before concurrent operations. */
+    void enable_optimistic_reads() {
+        if( !my_optimistic_state )
+            my_optimistic_state = new( cache_aligned_allocator<optimistic_state>().allocate( 1 ) ) optimistic_state;
+    }
+
+    //! True if optimistic lookups are enabled
+    bool optimistic_reads_enabled() const { return my_optimistic_state != NULL; }
 
     //------------------------------------------------------------------------
     // Parallel algorithm support
@@ -909,6 +1097,14 @@ public:
         return const_cast<concurrent_hash_map*>(this)->lookup(/*insert*/false, key, NULL, NULL, /*write=*/false, &do_not_allocate_node );
     }
 
+    //! Find item and copy its value without acquiring locks.
+    /** If optimistic reads are enabled, readers do not write to shared data besides
+        a reader counter. Values of trivially copyable types are validated by seqlocks,
+        other ones are copied under a read lock on the item. Under contention, and
+        without optimistic reads enabled, it falls back to find() with const_accessor.
+        Return true if item is found, false otherwise. */
+    bool optimistic_find( const Key &key, T &result ) const;
+
     //! Find item and acquire a read lock on the item.
     /** Return true if item is found, false otherwise. */
     bool find( const_accessor &result, const Key &key ) const {
@@ -1004,6 +1200,9 @@ protected:
     template<typename I>
     void internal_copy( I first, I last );
 
+    //! Rehash the buckets [b, end) of a segment, which are scanned for rehashing
+    void rehash_range( hashcode_t b, hashcode_t end, hashcode_t mask );
+
     //! Fast find when no concurrent erasure is used. For internal use inside TBB only!
     /** Return pointer to item with given key, or NULL if no such item exists.
         Must not be called concurrently with erasure operations. */
@@ -1100,6 +1299,10 @@ bool concurrent_hash_map<Key,T,HashCompare,A>::lookup( bool op_insert, const Key
     }//lock scope
     result->my_node = n;
     result->my_hash = h;
+    if( write && my_optimistic_state ) {
+        result->my_version = &my_optimistic_state->value_version( h );
+        result->my_version->start_write(); // full fence before the value is changed
+    }
 check_growth:
     // [opt] grow the container
     if( grow_segment ) {
@@ -1113,6 +1316,40 @@ check_growth:
     return return_value;
 }
 
+template<typename Key, typename T, typename HashCompare, typename A>
+bool concurrent_hash_map<Key,T,HashCompare,A>::optimistic_find( const Key &key, T &result ) const {
+    if( optimistic_state *s = my_optimistic_state ) {
+        hashcode_t const h = my_hash_compare.hash( key );
+        optimistic_state::version_type &v = s->value_version( h );
+        typedef tbb::internal::bool_constant<tbb::internal::tbb_trivially_copyable<T>::value> copy_by_seqlock;
+        for( int attempt = 0; attempt < 16; attempt++ ) {
+            optimistic_state::read_guard guard( *s );
+            uintptr_t split = s->split_version.end;
+            if( s->split_version.begin != split )
+                continue; // nodes are moving between buckets
+            hashcode_t m = (hashcode_t) itt_load_word_with_acquire( my_mask );
+            node_base *n = __TBB_load_with_acquire( get_bucket( h & m )->node_list );
+            if( n == internal::rehash_req )
+                break; // the bucket must be rehashed under the lock
+            while( is_valid(n) && !my_hash_compare.equal( key, static_cast<node*>(n)->item.first ) )
+                n = __TBB_load_with_acquire( n->next );
+            if( !n ) {
+                if( s->split_version.begin != split || check_mask_race( h, m ) )
+                    continue;
+                return false;
+            }
+            if( optimistic_copy( static_cast<node*>(n), result, v, copy_by_seqlock() ) )
+                return true;
+            __TBB_Yield(); // a writer holds the value
+        }
+    }
+    const_accessor a;
+    if( !find( a, key ) )
+        return false;
+    result = a->second;
+    return true;
+}
+
 template<typename Key, typename T, typename HashCompare, typename A>
 template<typename I>
 std::pair<I, I> concurrent_hash_map<Key,T,HashCompare,A>::internal_equal_range( const Key& key, I end_ ) const {
@@ -1158,7 +1395,7 @@ bool concurrent_hash_map<Key,T,HashCompare,A>::exclude( const_accessor &item_acc
     if( !item_accessor.is_writer() ) // need to get exclusive lock
         item_accessor.upgrade_to_writer(); // return value means nothing here
     item_accessor.release();
-    delete_node( n ); // Only one thread can delete it
+    retire_node( n ); // Only one thread can delete it
     return true;
 }
 
@@ -1195,7 +1432,7 @@ restart:
         typename node::scoped_t item_locker( n->mutex, /*write=*/true );
     }
     // note: there should be no threads pretending to acquire this mutex again, do not try to upgrade const_accessor!
-    delete_node( n ); // Only one thread can delete it due to write lock on the bucket
+    retire_node( n ); // Only one thread can delete it due to write lock on the bucket
     return true;
 }
 
@@ -1209,13 +1446,10 @@ void concurrent_hash_map<Key,T,HashCompare,A>::swap(concurrent_hash_map<Key,T,Ha
 }
 
 template<typename Key, typename T, typename HashCompare, typename A>
-void concurrent_hash_map<Key,T,HashCompare,A>::rehash(size_type sz) {
-    reserve( sz ); // TODO: add reduction of number of buckets as well
-    hashcode_t mask = my_mask;
-    hashcode_t b = (mask+1)>>1; // size or first index of the last segment
-    __TBB_ASSERT((b&(b-1))==0, NULL); // zero or power of 2
-    bucket *bp = get_bucket( b ); // only the last segment should be scanned for rehashing
-    for(; b <= mask; b++, bp++ ) {
+void concurrent_hash_map<Key,T,HashCompare,A>::rehash_range( hashcode_t b, hashcode_t end, hashcode_t mask ) {
+    __TBB_ASSERT( segment_index_of( b ) == segment_index_of( end-1 ), "The range must be within a segment" );
+    bucket *bp = get_bucket( b );
+    for(; b < end; b++, bp++ ) {
         node_base *n = bp->node_list;
         __TBB_ASSERT( is_valid(n) || n == internal::empty_rehashed || n == internal::rehash_req, "Broken internal structure" );
         __TBB_ASSERT( *reinterpret_cast<intptr_t*>(&bp->mutex) == 0, "concurrent or unexpectedly terminated operation during rehash() execution" );
@@ -1239,12 +1473,23 @@ void concurrent_hash_map<Key,T,HashCompare,A>::rehash(size_type sz) {
             }
         }
     }
+}
+
+template<typename Key, typename T, typename HashCompare, typename A>
+void concurrent_hash_map<Key,T,HashCompare,A>::rehash(size_type sz) {
+    reserve( sz ); // TODO: add reduction of number of buckets as well
+    hashcode_t mask = my_mask;
+    hashcode_t b = (mask+1)>>1; // size or first index of the last segment
+    __TBB_ASSERT((b&(b-1))==0, NULL); // zero or power of 2
+    // only the last segment should be scanned for rehashing
+    rehash_range( b, mask+1, mask );
 #if TBB_USE_PERFORMANCE_WARNINGS
     int current_size = int(my_size), buckets = int(mask)+1, empty_buckets = 0, overpopulated_buckets = 0; // usage statistics
     static bool reported = false;
 #endif
 #if TBB_USE_ASSERT || TBB_USE_PERFORMANCE_WARNINGS
-    for( b = 0; b <= mask; b++ ) {// only last segment should be scanned for rehashing
+    bucket *bp = NULL;
+    for( b = 0; b <= mask; b++ ) {
         if( b & (b-2) ) ++bp; // not the beginning of a segment
         else bp = get_bucket( b );
         node_base *n = bp->node_list;
@@ -1325,6 +1570,7 @@ void concurrent_hash_map<Key,T,HashCompare,A>::clear() {
 #endif
 #endif//TBB_USE_ASSERT || TBB_USE_PERFORMANCE_WARNINGS || __TBB_STATISTICS
     my_size = 0;
+    reclaim_retired_nodes();
     segment_index_t s = segment_index_of( m );
     __TBB_ASSERT( s+1 == pointers_per_table || !my_table[s+1], "wrong mask or concurrent grow" );
     cache_aligned_allocator<bucket> alloc;
@@ -1384,9 +1630,9 @@ void concurrent_hash_map<Key,T,HashCompare,A>::internal_copy(I first, I last) {
     }
 }
 
-} // namespace interface5
+} // namespace interface8
 
-using interface5::concurrent_hash_map;
+using interface8::concurrent_hash_map;
 
 
 template<typename Key, typename T, typename HashCompare, typename A1, typename A2>
@@ -0,0 +1,154 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+
+#ifndef __TBB_concurrent_hash_map_parallel_H
+#define __TBB_concurrent_hash_map_parallel_H
+
+#include "concurrent_hash_map.h"
+#include "blocked_range.h"
+#include "parallel_for.h"
+
+namespace tbb {
+
+namespace interface8 {
+
+//! @cond INTERNAL
+namespace internal {
+
+    //! Number of items a task inserts when a table is built from a range in parallel
+    static const size_t parallel_build_grainsize = 1024;
+    //! Number of bucket classes rehashed in parallel, a power of 2
+    static const size_t rehash_classes = 1024;
+
+    //! Parallel construction and rehashing of a concurrent_hash_map
+    template<typename Map>
+    class hash_map_parallel_ops : tbb::internal::no_copy {
+        typedef typename Map::size_type size_type;
+        typedef typename Map::node node;
+        typedef typename Map::node_base node_base;
+        typedef typename Map::bucket bucket;
+        typedef typename Map::call_clear_on_leave call_clear_on_leave;
+
+        //! Inserts items of a range into buckets of a table not yet visible to other threads
+        template<typename I>
+        class build_body : tbb::internal::no_assign {
+            Map &my_map;
+            const I my_first;
+        public:
+            build_body( Map &map, I first ) : my_map(map), my_first(first) {}
+            void operator()( const blocked_range<size_type> &r ) const {
+                hash_map_parallel_ops::insert_items( my_map, my_first + r.begin(), my_first + r.end() );
+            }
+        };
+
+        //! Rehashes buckets of the last segment belonging to a range of residue classes
+        class rehash_body : tbb::internal::no_assign {
+            Map &my_map;
+            const hashcode_t my_mask;
+        public:
+            rehash_body( Map &map, hashcode_t mask ) : my_map(map), my_mask(mask) {}
+            void operator()( const blocked_range<hashcode_t> &r ) const {
+                hash_map_parallel_ops::rehash_buckets( my_map, r.begin(), r.end(), my_mask );
+            }
+        };
+
+        static void rehash_buckets( Map &map, hashcode_t begin, hashcode_t end, hashcode_t mask ) {
+            for( hashcode_t b = (mask+1)>>1; b <= mask; b += rehash_classes )
+                map.rehash_range( b + begin, b + end, mask );
+        }
+
+        template<typename I>
+        static void insert_items( Map &map, I first, I last ) {
+            hashcode_t m = map.my_mask;
+            size_type n = 0;
+            for( ; first != last; ++first, ++n ) {
+                node *q = new( map.my_allocator ) node( *first );
+                bucket *b = map.get_bucket( map.my_hash_compare.hash( q->item.first ) & m );
+                __TBB_ASSERT( b->node_list != rehash_req, "Invalid bucket in destination table");
+                // no locks are needed, other tasks can only push to the same bucket
+                node_base *head;
+                do {
+                    head = b->node_list;
+                    q->next = head;
+                } while( as_atomic( b->node_list ).compare_and_swap( q, head ) != head );
+            }
+            map.my_size += n;
+        }
+
+    public:
+        template<typename I>
+        static void build( Map &map, I first, I last ) {
+            __TBB_ASSERT( map.empty(), "The table must start out empty" );
+            size_type n = size_type( last - first );
+            call_clear_on_leave scope_guard( &map );
+            map.reserve( n );
+            if( n < 2*parallel_build_grainsize )
+                map.internal_copy( first, last );
+            else
+                parallel_for( blocked_range<size_type>( 0, n, parallel_build_grainsize ), build_body<I>( map, first ) );
+            scope_guard.dismiss();
+        }
+
+        static void rehash( Map &map, size_type sz ) {
+            map.reserve( sz );
+            hashcode_t mask = map.my_mask;
+            hashcode_t b = (mask+1)>>1; // size or first index of the last segment
+            if( b >= 2*rehash_classes ) {
+                // Once the buckets below rehash_classes are rehashed, a root of any other bucket lies
+                // in its residue class modulo rehash_classes, and so do all the nodes moved from the root.
+                // Thus the classes are independent and are rehashed in parallel.
+                map.rehash_range( rehash_classes/2, rehash_classes, mask );
+                parallel_for( blocked_range<hashcode_t>( 0, rehash_classes ), rehash_body( map, mask ) );
+            }
+            // the rest is rehashed serially, and the table is checked if TBB_USE_ASSERT
+            map.rehash();
+        }
+    };
+
+} // namespace internal
+//! @endcond
+
+//! Inserts a random access range into an empty table in parallel
+/** The table must not be used by other threads meanwhile. Like the range constructor,
+    it keeps items with equal keys, and which of them is found by find() is unspecified.
+    If an exception is thrown, the table is left empty.
+    @ingroup containers */
+template<typename Key, typename T, typename HashCompare, typename A, typename I>
+void parallel_build( concurrent_hash_map<Key,T,HashCompare,A> &table, I first, I last ) {
+    internal::hash_map_parallel_ops<concurrent_hash_map<Key,T,HashCompare,A> >::build( table, first, last );
+}
+
+//! Rehashes and optionally resizes the whole table like concurrent_hash_map::rehash(), in parallel for large tables
+/** The table must not be used by other threads meanwhile.
+    @ingroup containers */
+template<typename Key, typename T, typename HashCompare, typename A>
+void parallel_rehash( concurrent_hash_map<Key,T,HashCompare,A> &table, typename concurrent_hash_map<Key,T,HashCompare,A>::size_type n = 0 ) {
+    internal::hash_map_parallel_ops<concurrent_hash_map<Key,T,HashCompare,A> >::rehash( table, n );
+}
+
+} // namespace interface8
+
+using interface8::parallel_build;
+using interface8::parallel_rehash;
+
+} // namespace tbb
+
+#endif /* __TBB_concurrent_hash_map_parallel_H */
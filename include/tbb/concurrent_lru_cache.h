@@ -25,99 +25,149 @@
     #error Set TBB_PREVIEW_CONCURRENT_LRU_CACHE to include concurrent_lru_cache.h
 #endif
 
-#include <map>
-#include <list>
+#include <vector>
 
 #include "tbb_stddef.h"
 #include "atomic.h"
-#include "internal/_aggregator_impl.h"
+#include "spin_rw_mutex.h"
+#include "spin_mutex.h"
+#include "concurrent_hash_map.h" // for tbb_hash_compare
+#include "compat/condition_variable"
 
 namespace tbb{
 namespace interface6 {
 
-
-template <typename key_type, typename value_type, typename value_functor_type = value_type (*)(key_type) >
+//! Cache of values computed by a function of keys, that keeps the least recently used unused values
+/** Keys are spread over shards by their hash values, each shard keeps its own hash table
+    under a reader-writer lock, so threads using different shards do not interfere and
+    hits take only a shared lock. The LRU list of a shard keeps only values not referenced
+    by any handle, so it is locked only when the first handle to a value is taken or
+    the last one is released.
+    A value is computed once by the thread that missed, others wait for it blocked.
+    Unused values are kept up to the capacity and then evicted in LRU order within a shard.
+    The capacity is the number of unused values or, if a weight function is given, their
+    total weight (e.g. size in bytes). It is split evenly between the shards, which are
+    selected by mixed bits of the hash values, so keys with hash values differing only in
+    a few bits (e.g. pointers) are spread evenly too. Small caches use a single shard, so
+    their eviction order is global. **/
+template <typename key_type, typename value_type, typename value_functor_type = value_type (*)(key_type),
+          typename hash_compare_type = tbb::tbb_hash_compare<key_type> >
 class concurrent_lru_cache : internal::no_assign{
 private:
     typedef concurrent_lru_cache self_type;
     typedef value_functor_type value_function_type;
     typedef std::size_t ref_counter_type;
-    struct map_value_type;
-    typedef std::map<key_type, map_value_type> map_storage_type;
-    typedef std::list<typename map_storage_type::iterator> lru_list_type;
-    struct map_value_type {
-        value_type my_value;
-        ref_counter_type my_ref_counter;
-        typename lru_list_type::iterator my_lru_list_iterator;
-        bool my_is_ready;
-
-        map_value_type (value_type const& a_value,  ref_counter_type a_ref_counter,    typename lru_list_type::iterator a_lru_list_iterator, bool a_is_ready)
-            : my_value(a_value), my_ref_counter(a_ref_counter), my_lru_list_iterator (a_lru_list_iterator), my_is_ready(a_is_ready)
-        {}
-    };
-
+    struct node;
+    class shard;
     class handle_object;
 
-    struct aggregator_operation;
-    typedef aggregator_operation aggregated_operation_type;
-    typedef tbb::internal::aggregating_functor<self_type,aggregated_operation_type> aggregator_function_type;
-    friend class tbb::internal::aggregating_functor<self_type,aggregated_operation_type>;
-    typedef tbb::internal::aggregator<aggregator_function_type, aggregated_operation_type> aggregator_type;
+public:
+    typedef handle_object handle;
+    //! Returns the weight of a computed value, e.g. its size in bytes
+    typedef std::size_t (*weight_function_type)(key_type const&, value_type const&);
 
 private:
-    value_function_type my_value_function;
-    std::size_t const my_number_of_lru_history_items;
-    map_storage_type my_map_storage;
-    lru_list_type my_lru_list;
-    aggregator_type my_aggregator;
+    //! Shards are created only for caches that can keep that many unused values per shard
+    static const std::size_t min_shard_capacity = 64;
+    static const std::size_t max_number_of_shards = 64;
 
-public:
-    typedef handle_object handle;
+    value_function_type my_value_function;
+    weight_function_type my_weight_function;
+    hash_compare_type my_hash_compare;
+    std::size_t const my_capacity;
+    std::size_t my_number_of_shards;    // power of 2
+    std::size_t my_shard_index_shift;
+    tbb::internal::padded<shard> *my_shards;
 
 public:
     concurrent_lru_cache(value_function_type f, std::size_t number_of_lru_history_items)
-        : my_value_function(f),my_number_of_lru_history_items(number_of_lru_history_items)
+        : my_value_function(f), my_weight_function(NULL), my_capacity(number_of_lru_history_items)
     {
-        my_aggregator.initialize_handler(aggregator_function_type(this));
+        create_shards();
+    }
+    //! The capacity limits the total weight of unused values, as returned by weight_function
+    concurrent_lru_cache(value_function_type f, std::size_t capacity, weight_function_type weight_function)
+        : my_value_function(f), my_weight_function(weight_function), my_capacity(capacity)
+    {
+        create_shards();
+    }
+    ~concurrent_lru_cache(){
+        for (std::size_t i=0; i<my_number_of_shards; ++i){
+            std::vector<node*>& buckets = my_shards[i].my_buckets;
+            for (std::size_t j=0; j<buckets.size(); ++j){
+                for (node* n = buckets[j]; n; ){
+                    __TBB_ASSERT(!n->my_ref_counter,"cache destroyed while values are in use?");
+                    node* next = n->my_next_in_bucket;
+                    delete n;
+                    n = next;
+                }
+            }
+        }
+        delete[] my_shards;
     }
 
     handle_object operator[](key_type k){
-        retrieve_aggregator_operation op(k);
-        my_aggregator.execute(&op);
-        if (op.is_new_value_needed()){
-             op.result().second.my_value = my_value_function(k);
-             __TBB_store_with_release(op.result().second.my_is_ready, true);
-        }else{
-            tbb::internal::spin_wait_while_eq(op.result().second.my_is_ready,false);
-        }
-        return handle_object(*this,op.result());
+        std::size_t const h = my_hash_compare.hash(k);
+        shard& s = shard_for(h);
+        for (;;){
+            bool is_new_value_needed = false;
+            node& n = retrieve(s, k, h, is_new_value_needed);
+            if (is_new_value_needed){
+                compute_value(s, n);
+                return handle_object(*this, n);
+            }
+            if (wait_until_ready(s, n))
+                return handle_object(*this, n);
+            // the value function has thrown in other thread, try to compute the value again
+            signal_end_of_usage(n);
+        }
     }
 private:
-    void signal_end_of_usage(typename map_storage_type::reference value_ref){
-        signal_end_of_usage_aggregator_operation op(value_ref);
-        my_aggregator.execute(&op);
+    void signal_end_of_usage(node& n){
+        if (n.my_state == node::failed){
+            // failed nodes are already removed from the shard
+            if (!--n.my_ref_counter)
+                delete &n;
+            return;
+        }
+        // not the last reference, no need to lock
+        for (ref_counter_type c = n.my_ref_counter; c > 1; c = n.my_ref_counter)
+            if (n.my_ref_counter.compare_and_swap(c-1, c) == c)
+                return;
+        shard& s = shard_for(n.my_hash);
+        bool is_eviction_needed = false;
+        {
+            typename shard::list_mutex_type::scoped_lock lock(s.my_list_mutex);
+            if (!--n.my_ref_counter){
+                s.push_front(&n);
+                s.my_unused_weight += n.my_weight;
+                is_eviction_needed = s.my_unused_weight > s.my_capacity;
+            }
+        }
+        if (is_eviction_needed)
+            evict(s);
     }
 
 private:
     struct handle_move_t:no_assign{
         concurrent_lru_cache & my_cache_ref;
-        typename map_storage_type::reference my_map_record_ref;
-        handle_move_t(concurrent_lru_cache & cache_ref, typename map_storage_type::reference value_ref):my_cache_ref(cache_ref),my_map_record_ref(value_ref) {};
+        node& my_node_ref;
+        handle_move_t(concurrent_lru_cache & cache_ref, node& node_ref):my_cache_ref(cache_ref),my_node_ref(node_ref) {};
     };
     class handle_object {
         concurrent_lru_cache * my_cache_pointer;
-        typename map_storage_type::reference my_map_record_ref;
+        node& my_node_ref;
     public:
-        handle_object(concurrent_lru_cache & cache_ref, typename map_storage_type::reference value_ref):my_cache_pointer(&cache_ref), my_map_record_ref(value_ref) {}
-        handle_object(handle_move_t m):my_cache_pointer(&m.my_cache_ref), my_map_record_ref(m.my_map_record_ref){}
+        handle_object(concurrent_lru_cache & cache_ref, node& node_ref):my_cache_pointer(&cache_ref), my_node_ref(node_ref) {}
+        handle_object(handle_move_t m):my_cache_pointer(&m.my_cache_ref), my_node_ref(m.my_node_ref){}
         operator handle_move_t(){ return move(*this);}
         value_type& value(){
             __TBB_ASSERT(my_cache_pointer,"get value from moved from object?");
-            return my_map_record_ref.second.my_value;
+            return my_node_ref.my_value;
         }
         ~handle_object(){
             if (my_cache_pointer){
-                my_cache_pointer->signal_end_of_usage(my_map_record_ref);
+                my_cache_pointer->signal_end_of_usage(my_node_ref);
             }
         }
     private:
@@ -128,7 +178,7 @@ private:
             __TBB_ASSERT(h.my_cache_pointer,"move from the same object twice ?");
             concurrent_lru_cache * cache_pointer = NULL;
             std::swap(cache_pointer,h.my_cache_pointer);
-            return handle_move_t(*cache_pointer,h.my_map_record_ref);
+            return handle_move_t(*cache_pointer,h.my_node_ref);
         }
     private:
         void operator=(handle_object&);
@@ -139,91 +189,224 @@ private:
 #endif
         handle_object(handle_object &);
     };
+
 private:
-    //TODO: looks like aggregator_operation is a perfect match for statically typed variant type
-    struct aggregator_operation : tbb::internal::aggregated_operation<aggregator_operation>{
-        enum e_op_type {op_retive, op_signal_end_of_usage};
-        //TODO: try to use pointer to function apply_visitor here
-        //TODO: try virtual functions and measure the difference
-        e_op_type my_operation_type;
-        aggregator_operation(e_op_type operation_type): my_operation_type(operation_type) {}
-        void cast_and_handle(self_type& container ){
-            if (my_operation_type==op_retive){
-                static_cast<retrieve_aggregator_operation*>(this)->handle(container);
-            }else{
-                static_cast<signal_end_of_usage_aggregator_operation*>(this)->handle(container);
-            }
-        }
-    };
-    struct retrieve_aggregator_operation : aggregator_operation, private internal::no_assign {
+    struct node : tbb::internal::no_copy {
+        enum state_type {not_ready, ready, failed};
         key_type my_key;
-        typename map_storage_type::pointer my_result_map_record_pointer;
-        bool my_is_new_value_needed;
-        retrieve_aggregator_operation(key_type key):aggregator_operation(aggregator_operation::op_retive),my_key(key),my_is_new_value_needed(false){}
-        void handle(self_type& container ){
-            my_result_map_record_pointer = & container.retrieve_serial(my_key,my_is_new_value_needed);
-        }
-        typename map_storage_type::reference result(){ return * my_result_map_record_pointer; }
-        bool is_new_value_needed(){return my_is_new_value_needed;}
-    };
-    struct signal_end_of_usage_aggregator_operation : aggregator_operation, private internal::no_assign {
-        typename map_storage_type::reference my_map_record_ref;
-        signal_end_of_usage_aggregator_operation(typename map_storage_type::reference map_record_ref):aggregator_operation(aggregator_operation::op_signal_end_of_usage),my_map_record_ref(map_record_ref){}
-        void handle(self_type& container ){
-            container.signal_end_of_usage_serial(my_map_record_ref);
+        value_type my_value;
+        std::size_t const my_hash;
+        std::size_t my_weight;
+        tbb::atomic<ref_counter_type> my_ref_counter;
+        tbb::atomic<int> my_state;
+        node* my_next_in_bucket;
+        node* my_lru_prev;
+        node* my_lru_next;
+
+        node(key_type const& k, std::size_t h) : my_key(k), my_value(), my_hash(h), my_weight(1),
+            my_next_in_bucket(NULL), my_lru_prev(NULL), my_lru_next(NULL)
+        {
+            // the node is created for the thread that computes the value
+            my_ref_counter = 1;
+            my_state = not_ready;
         }
     };
 
-private:
-   void handle_operations(aggregator_operation* op_list){
-       while(op_list){
-           op_list->cast_and_handle(*this);
-           aggregator_operation* tmp = op_list;
-           op_list=op_list->next;
-           tbb::internal::itt_store_word_with_release(tmp->status, uintptr_t(1));
-       }
-   }
+    class shard : tbb::internal::no_copy {
+    public:
+        typedef tbb::spin_rw_mutex mutex_type;
+        typedef tbb::spin_mutex list_mutex_type;
+        //! Protects the hash table
+        mutex_type my_mutex;
+        std::vector<node*> my_buckets;      // size is power of 2
+        std::size_t my_size;
+        //! Protects the LRU list and the reference counters going from or to zero
+        list_mutex_type my_list_mutex;
+        //! Nodes not referenced by handles, the most recently used first
+        node* my_lru_head;
+        node* my_lru_tail;
+        std::size_t my_capacity;
+        std::size_t my_unused_weight;
+        //! Threads waiting for values to be computed
+        tbb::atomic<int> my_waiters_count;
+        tbb::mutex my_wait_mutex;
+        tbb::interface5::condition_variable my_wait_cv;
+
+        shard() : my_buckets(8), my_size(0), my_lru_head(NULL), my_lru_tail(NULL),
+                  my_capacity(0), my_unused_weight(0) {
+            my_waiters_count = 0;
+        }
+        node*& bucket_for(std::size_t h){
+            return my_buckets[h & (my_buckets.size()-1)];
+        }
+        void push_front(node* n){
+            n->my_lru_prev = NULL;
+            n->my_lru_next = my_lru_head;
+            if (my_lru_head)
+                my_lru_head->my_lru_prev = n;
+            else
+                my_lru_tail = n;
+            my_lru_head = n;
+        }
+        void remove_from_list(node* n){
+            __TBB_ASSERT(!n->my_ref_counter,"only unused nodes are in the list");
+            if (n->my_lru_prev)
+                n->my_lru_prev->my_lru_next = n->my_lru_next;
+            else
+                my_lru_head = n->my_lru_next;
+            if (n->my_lru_next)
+                n->my_lru_next->my_lru_prev = n->my_lru_prev;
+            else
+                my_lru_tail = n->my_lru_prev;
+        }
+        void grow(){
+            std::vector<node*> buckets(2*my_buckets.size());
+            my_buckets.swap(buckets);
+            for (std::size_t i=0; i<buckets.size(); ++i){
+                for (node* n = buckets[i]; n; ){
+                    node* next = n->my_next_in_bucket;
+                    n->my_next_in_bucket = bucket_for(n->my_hash);
+                    bucket_for(n->my_hash) = n;
+                    n = next;
+                }
+            }
+        }
+        void insert(node* n){
+            n->my_next_in_bucket = bucket_for(n->my_hash);
+            bucket_for(n->my_hash) = n;
+            ++my_size;
+        }
+        void remove(node* n){
+            node** p = &bucket_for(n->my_hash);
+            while (*p != n)
+                p = &(*p)->my_next_in_bucket;
+            *p = n->my_next_in_bucket;
+            --my_size;
+        }
+    };
 
 private:
-   typename map_storage_type::reference retrieve_serial(key_type k, bool& is_new_value_needed){
-        typename map_storage_type::iterator it = my_map_storage.find(k);
-        if (it == my_map_storage.end()){
-            it = my_map_storage.insert(it,std::make_pair(k,map_value_type(value_type(),0,my_lru_list.end(),false)));
-            is_new_value_needed = true;
-        }else {
-            typename lru_list_type::iterator list_it = it->second.my_lru_list_iterator;
-            if (list_it!=my_lru_list.end()) {
-                __TBB_ASSERT(!it->second.my_ref_counter,"item to be evicted should not have a live references");
-                //item is going to be used. Therefore it is not a subject for eviction
-                //so - remove it from LRU history.
-                my_lru_list.erase(list_it);
-                it->second.my_lru_list_iterator= my_lru_list.end();
+    void create_shards(){
+        std::size_t shards_limit = my_capacity / min_shard_capacity;
+        my_number_of_shards = 1;
+        my_shard_index_shift = 8*sizeof(std::size_t);
+        while (2*my_number_of_shards <= shards_limit && 2*my_number_of_shards <= max_number_of_shards){
+            my_number_of_shards *= 2;
+            --my_shard_index_shift;
+        }
+        my_shards = new tbb::internal::padded<shard>[my_number_of_shards];
+        for (std::size_t i=0; i<my_number_of_shards; ++i)
+            my_shards[i].my_capacity = my_capacity / my_number_of_shards;
+    }
+    shard& shard_for(std::size_t h){
+        // low bits select a bucket in the shard, and the top bits of the product depend on all bits
+        return my_number_of_shards==1? my_shards[0]
+            : my_shards[(h * tbb::interface5::internal::hash_multiplier) >> my_shard_index_shift];
+    }
+    node* find(shard& s, key_type const& k, std::size_t h){
+        for (node* n = s.bucket_for(h); n; n = n->my_next_in_bucket)
+            if (n->my_hash == h && my_hash_compare.equal(n->my_key, k))
+                return n;
+        return NULL;
+    }
+    //! Must be called under a lock on the hash table, so the node can not be evicted meanwhile
+    static void acquire(shard& s, node& n){
+        // the node is in use already, no need to lock the list
+        for (ref_counter_type c = n.my_ref_counter; c; c = n.my_ref_counter)
+            if (n.my_ref_counter.compare_and_swap(c+1, c) == c)
+                return;
+        typename shard::list_mutex_type::scoped_lock lock(s.my_list_mutex);
+        if (!n.my_ref_counter){
+            //item is going to be used. Therefore it is not a subject for eviction
+            s.remove_from_list(&n);
+            s.my_unused_weight -= n.my_weight;
+        }
+        ++n.my_ref_counter;
+    }
+    node& retrieve(shard& s, key_type const& k, std::size_t h, bool& is_new_value_needed){
+        {
+            typename shard::mutex_type::scoped_lock lock(s.my_mutex, /*is_writer=*/false);
+            if (node* n = find(s, k, h)){
+                acquire(s, *n);
+                return *n;
             }
         }
-        ++(it->second.my_ref_counter);
-        return *it;
+        typename shard::mutex_type::scoped_lock lock(s.my_mutex, /*is_writer=*/true);
+        // the value might be added while the lock was released
+        if (node* n = find(s, k, h)){
+            acquire(s, *n);
+            return *n;
+        }
+        if (s.my_size >= s.my_buckets.size())
+            s.grow();
+        node* n = new node(k, h);
+        s.insert(n);
+        is_new_value_needed = true;
+        return *n;
     }
-
-    void signal_end_of_usage_serial(typename map_storage_type::reference map_record_ref){
-        typename map_storage_type::iterator it = my_map_storage.find(map_record_ref.first);
-        __TBB_ASSERT(it!=my_map_storage.end(),"cache should not return past-end iterators to outer world");
-        __TBB_ASSERT(&(*it) == &map_record_ref,"dangling reference has been returned to outside world? data race ?");
-        __TBB_ASSERT( my_lru_list.end()== std::find(my_lru_list.begin(),my_lru_list.end(),it),
-                "object in use should not be in list of unused objects ");
-        if (! --(it->second.my_ref_counter)){
-            //it was the last reference so put it to the LRU history
-            if (my_lru_list.size()>=my_number_of_lru_history_items){
-                //evict items in order to get a space
-                size_t number_of_elements_to_evict = 1 + my_lru_list.size() - my_number_of_lru_history_items;
-                for (size_t i=0; i<number_of_elements_to_evict; ++i){
-                    typename map_storage_type::iterator it_to_evict = my_lru_list.back();
-                    __TBB_ASSERT(!it_to_evict->second.my_ref_counter,"item to be evicted should not have a live references");
-                    my_lru_list.pop_back();
-                    my_map_storage.erase(it_to_evict);
+    void compute_value(shard& s, node& n){
+        __TBB_TRY {
+            n.my_value = my_value_function(n.my_key);
+            if (my_weight_function)
+                n.my_weight = my_weight_function(n.my_key, n.my_value);
+        } __TBB_CATCH(...) {
+            {
+                typename shard::mutex_type::scoped_lock lock(s.my_mutex, /*is_writer=*/true);
+                s.remove(&n);
+            }
+            publish(s, n, node::failed);
+            signal_end_of_usage(n);
+            __TBB_RETHROW();
+        }
+        publish(s, n, node::ready);
+    }
+    static void publish(shard& s, node& n, int state){
+        // full fence orders the store with the load of the waiters count
+        n.my_state.fetch_and_store(state);
+        if (s.my_waiters_count){
+            tbb::interface5::unique_lock<tbb::mutex> lock(s.my_wait_mutex);
+            s.my_wait_cv.notify_all();
+        }
+    }
+    //! Returns false if the value function has thrown
+    static bool wait_until_ready(shard& s, node& n){
+        if (n.my_state == node::not_ready){
+            // values are computed for long usually, so spin only a little before blocking
+            tbb::internal::atomic_backoff backoff;
+            while (n.my_state == node::not_ready && backoff.bounded_pause())
+                continue;
+            if (n.my_state == node::not_ready){
+                ++s.my_waiters_count;
+                {
+                    tbb::interface5::unique_lock<tbb::mutex> lock(s.my_wait_mutex);
+                    while (n.my_state == node::not_ready)
+                        s.my_wait_cv.wait(lock);
                 }
+                --s.my_waiters_count;
             }
-            my_lru_list.push_front(it);
-            it->second.my_lru_list_iterator = my_lru_list.begin();
+        }
+        return n.my_state == node::ready;
+    }
+    static void evict(shard& s){
+        node* evicted = NULL;
+        {
+            typename shard::mutex_type::scoped_lock lock(s.my_mutex, /*is_writer=*/true);
+            typename shard::list_mutex_type::scoped_lock list_lock(s.my_list_mutex);
+            while (s.my_unused_weight > s.my_capacity){
+                node* n = s.my_lru_tail;
+                __TBB_ASSERT(n,"weight of unused nodes is broken");
+                s.remove_from_list(n);
+                s.remove(n);
+                s.my_unused_weight -= n->my_weight;
+                n->my_next_in_bucket = evicted;
+                evicted = n;
+            }
+        }
+        // destroy values out of the lock
+        while (evicted){
+            node* next = evicted->my_next_in_bucket;
+            delete evicted;
+            evicted = next;
         }
     }
 };
@@ -26,7 +26,9 @@
 #include "tbb_exception.h"
 #include "tbb_stddef.h"
 #include "tbb_profiling.h"
+#include "atomic.h"
 #include "internal/_aggregator_impl.h"
+#include "internal/_concurrent_monitor_impl.h"
 #include <vector>
 #include <iterator>
 #include <functional>
@@ -58,6 +60,9 @@ namespace internal {
     };
 #endif
 } // namespace internal
+} // namespace interface5
+
+namespace interface6 {
 
 using namespace tbb::internal;
 
@@ -84,15 +89,18 @@ class concurrent_priority_queue {
     typedef A allocator_type;
 
     //! Constructs a new concurrent_priority_queue with default capacity
-    explicit concurrent_priority_queue(const allocator_type& a = allocator_type()) : mark(0), my_size(0), data(a)
+    explicit concurrent_priority_queue(const allocator_type& a = allocator_type()) : mark(0), my_size(0),
+        my_capacity(max_capacity()), data(a)
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
     }
 
     //! Constructs a new concurrent_priority_queue with init_sz capacity
     explicit concurrent_priority_queue(size_type init_capacity, const allocator_type& a = allocator_type()) :
-        mark(0), my_size(0), data(a)
+        mark(0), my_size(0), my_capacity(max_capacity()), data(a)
     {
+        init_waiting();
         data.reserve(init_capacity);
         my_aggregator.initialize_handler(my_functor_t(this));
     }
@@ -100,8 +108,9 @@ class concurrent_priority_queue {
     //! [begin,end) constructor
     template<typename InputIterator>
     concurrent_priority_queue(InputIterator begin, InputIterator end, const allocator_type& a = allocator_type()) :
-        mark(0), data(begin, end, a)
+        mark(0), my_capacity(max_capacity()), data(begin, end, a)
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
         heapify();
         my_size = data.size();
@@ -110,8 +119,9 @@ class concurrent_priority_queue {
 #if __TBB_INITIALIZER_LISTS_PRESENT
     //! Constructor from std::initializer_list
     concurrent_priority_queue(std::initializer_list<T> init_list, const allocator_type &a = allocator_type()) :
-        mark(0),data(init_list.begin(), init_list.end(), a)
+        mark(0), my_capacity(max_capacity()), data(init_list.begin(), init_list.end(), a)
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
         heapify();
         my_size = data.size();
@@ -121,8 +131,9 @@ class concurrent_priority_queue {
     //! Copy constructor
     /** This operation is unsafe if there are pending concurrent operations on the src queue. */
     explicit concurrent_priority_queue(const concurrent_priority_queue& src) : mark(src.mark),
-        my_size(src.my_size), data(src.data.begin(), src.data.end(), src.data.get_allocator())
+        my_size(src.my_size), my_capacity(src.my_capacity), data(src.data.begin(), src.data.end(), src.data.get_allocator())
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
         heapify();
     }
@@ -130,12 +141,19 @@ class concurrent_priority_queue {
     //! Copy constructor with specific allocator
     /** This operation is unsafe if there are pending concurrent operations on the src queue. */
     concurrent_priority_queue(const concurrent_priority_queue& src, const allocator_type& a) : mark(src.mark),
-        my_size(src.my_size), data(src.data.begin(), src.data.end(), a)
+        my_size(src.my_size), my_capacity(src.my_capacity), data(src.data.begin(), src.data.end(), a)
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
         heapify();
     }
 
+    //! Destroys the queue; there must be no threads blocked in its operations
+    ~concurrent_priority_queue() {
+        if (my_monitor)
+            deallocate_concurrent_monitor(my_monitor);
+    }
+
     //! Assignment operator
     /** This operation is unsafe if there are pending concurrent operations on the src queue. */
     concurrent_priority_queue& operator=(const concurrent_priority_queue& src) {
@@ -143,6 +161,7 @@ class concurrent_priority_queue {
             vector_t(src.data.begin(), src.data.end(), src.data.get_allocator()).swap(data);
             mark = src.mark;
             my_size = src.my_size;
+            my_capacity = src.my_capacity;
         }
         return *this;
     }
@@ -151,15 +170,16 @@ class concurrent_priority_queue {
     //! Move constructor
     /** This operation is unsafe if there are pending concurrent operations on the src queue. */
     concurrent_priority_queue(concurrent_priority_queue&& src) : mark(src.mark),
-        my_size(src.my_size), data(std::move(src.data))
+        my_size(src.my_size), my_capacity(src.my_capacity), data(std::move(src.data))
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
     }
 
     //! Move constructor with specific allocator
     /** This operation is unsafe if there are pending concurrent operations on the src queue. */
     concurrent_priority_queue(concurrent_priority_queue&& src, const allocator_type& a) : mark(src.mark),
-        my_size(src.my_size),
+        my_size(src.my_size), my_capacity(src.my_capacity),
 #if __TBB_ALLOCATOR_TRAITS_PRESENT
         data(std::move(src.data), a)
 #else
@@ -168,6 +188,7 @@ class concurrent_priority_queue {
         data(a)
 #endif //__TBB_ALLOCATOR_TRAITS_PRESENT
     {
+        init_waiting();
         my_aggregator.initialize_handler(my_functor_t(this));
 #if !__TBB_ALLOCATOR_TRAITS_PRESENT
         if (a != src.data.get_allocator()){
@@ -185,6 +206,7 @@ class concurrent_priority_queue {
         if (this != &src) {
             mark = src.mark;
             my_size = src.my_size;
+            my_capacity = src.my_capacity;
 #if !__TBB_ALLOCATOR_TRAITS_PRESENT
             if (data.get_allocator() != src.data.get_allocator()){
                 vector_t(std::make_move_iterator(src.data.begin()), std::make_move_iterator(src.data.end()), data.get_allocator()).swap(data);
@@ -228,26 +250,67 @@ class concurrent_priority_queue {
         This operation reads shared data and will trigger a race condition. */
     size_type size() const { return __TBB_load_with_acquire(my_size); }
 
-    //! Pushes elem onto the queue, increasing capacity of queue if necessary
-    /** This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    //! Returns the maximum number of elements in the queue
+    size_type capacity() const { return my_capacity; }
+
+    //! Sets the maximum number of elements in the queue
+    /** While the queue holds that many elements, push waits and try_push fails.
+        Unlike the capacity passed to the constructor, this does not reserve storage.
+        The queue is unbounded unless the capacity is set. */
+    void set_capacity(size_type new_capacity) {
+        // pushes waiting for the old capacity may fit now, so the handler sets it
+        cpq_operation op_data(SET_CAPACITY_OP);
+        op_data.sz = new_capacity;
+        my_aggregator.execute(&op_data);
+    }
+
+    //! Pushes elem onto the queue, waiting while the queue is at its capacity
+    /** Blocked pushes get freed slots in the order they blocked, though operations arriving
+        at the same time may get them first.
+        This operation can be safely used concurrently with other push, try_pop or emplace operations. */
     void push(const_reference elem) {
 #if __TBB_CPP11_IS_COPY_CONSTRUCTIBLE_PRESENT
         __TBB_STATIC_ASSERT( std::is_copy_constructible<value_type>::value, "The type is not copy constructible. Copying push operation is impossible." );
+#endif
+        cpq_operation op_data(elem, PUSH_OP);
+        execute_waiting(op_data);
+        if (op_data.status == FAILED) // exception thrown
+            throw_exception(eid_bad_alloc);
+    }
+
+    //! Pushes elem onto the queue if the queue is not at its capacity
+    /** Returns true if elem was pushed, false if the queue is full.
+        This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    bool try_push(const_reference elem) {
+#if __TBB_CPP11_IS_COPY_CONSTRUCTIBLE_PRESENT
+        __TBB_STATIC_ASSERT( std::is_copy_constructible<value_type>::value, "The type is not copy constructible. Copying push operation is impossible." );
 #endif
         cpq_operation op_data(elem, PUSH_OP);
         my_aggregator.execute(&op_data);
         if (op_data.status == FAILED) // exception thrown
             throw_exception(eid_bad_alloc);
+        return op_data.status == SUCCEEDED;
     }
 
 #if __TBB_CPP11_RVALUE_REF_PRESENT
-    //! Pushes elem onto the queue, increasing capacity of queue if necessary
+    //! Pushes elem onto the queue, waiting while the queue is at its capacity
     /** This operation can be safely used concurrently with other push, try_pop or emplace operations. */
     void push(value_type &&elem) {
+        cpq_operation op_data(elem, PUSH_RVALUE_OP);
+        execute_waiting(op_data);
+        if (op_data.status == FAILED) // exception thrown
+            throw_exception(eid_bad_alloc);
+    }
+
+    //! Moves elem onto the queue if the queue is not at its capacity
+    /** Returns true if elem was pushed, false if the queue is full; elem is not moved then.
+        This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    bool try_push(value_type &&elem) {
         cpq_operation op_data(elem, PUSH_RVALUE_OP);
         my_aggregator.execute(&op_data);
         if (op_data.status == FAILED) // exception thrown
             throw_exception(eid_bad_alloc);
+        return op_data.status == SUCCEEDED;
     }
 
 #if __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
@@ -271,6 +334,25 @@ class concurrent_priority_queue {
         return op_data.status==SUCCEEDED;
     }
 
+    //! Gets a reference to and removes highest priority element, waiting while the queue is empty
+    /** The thread sleeps until a push makes an element available. Blocked pops get elements
+        in the order they blocked, though operations arriving at the same time may get them first.
+        This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    void pop(reference elem) {
+        cpq_operation op_data(POP_OP);
+        op_data.elem = &elem;
+        execute_waiting(op_data);
+    }
+
+#if TBB_USE_EXCEPTIONS
+    //! Aborts the pop and push operations waiting at the time of the call
+    /** They throw tbb::user_abort. */
+    void abort() {
+        cpq_operation op_data(ABORT_OP);
+        my_aggregator.execute(&op_data);
+    }
+#endif /* TBB_USE_EXCEPTIONS */
+
     //! Clear the queue; not thread-safe
     /** This operation is unsafe if there are pending concurrent operations on the queue.
         Resets size, effectively emptying queue; does not free space.
@@ -288,25 +370,48 @@ class concurrent_priority_queue {
         data.swap(q.data);
         swap(mark, q.mark);
         swap(my_size, q.my_size);
+        swap(my_capacity, q.my_capacity);
     }
 
     //! Return allocator object
     allocator_type get_allocator() const { return data.get_allocator(); }
 
  private:
-    enum operation_type {INVALID_OP, PUSH_OP, POP_OP, PUSH_RVALUE_OP};
-    enum operation_status { WAIT=0, SUCCEEDED, FAILED };
+    enum operation_type {INVALID_OP, PUSH_OP, POP_OP, PUSH_RVALUE_OP, SET_CAPACITY_OP, ABORT_OP};
+    enum operation_status { WAIT=0, SUCCEEDED, FAILED, FULL, BLOCKED, ABORTED };
 
     class cpq_operation : public aggregated_operation<cpq_operation> {
      public:
         operation_type type;
+        //! Whether the operation waits in the queue instead of failing when the queue is full or empty
+        bool blocking;
         union {
             value_type *elem;
             size_type sz;
         };
         cpq_operation(const_reference e, operation_type t) :
-            type(t), elem(const_cast<value_type*>(&e)) {}
-        cpq_operation(operation_type t) : type(t) {}
+            type(t), blocking(false), elem(const_cast<value_type*>(&e)) {}
+        cpq_operation(operation_type t) : type(t), blocking(false) {}
+    };
+
+    //! Blocked operations in the order they were blocked; accessed by the handler only
+    class blocked_list {
+        cpq_operation *head, *tail;
+     public:
+        void init() { head = tail = NULL; }
+        bool empty() const { return !head; }
+        void push_back(cpq_operation *op) {
+            itt_hide_store_word(op->next, (cpq_operation*)NULL);
+            if (tail) itt_hide_store_word(tail->next, op);
+            else head = op;
+            tail = op;
+        }
+        cpq_operation *pop_front() {
+            cpq_operation *op = head;
+            head = itt_hide_load_word(op->next);
+            if (!head) tail = NULL;
+            return op;
+        }
     };
 
     class my_functor_t {
@@ -319,6 +424,65 @@ class concurrent_priority_queue {
         }
     };
 
+    //! Holds when the handler has completed the blocked operation
+    class operation_completed : public concurrent_monitor_predicate, no_copy {
+        cpq_operation &my_op;
+    public:
+        operation_completed(cpq_operation &op) : my_op(op) {}
+        /*override*/ bool operator()() {
+            return itt_load_word_with_acquire(my_op.status) != uintptr_t(BLOCKED);
+        }
+    };
+
+    //! Executes the operation, and sleeps while it is blocked in the queue
+    /** The handler completes blocked operations as slots or elements become available, and wakes
+        only the threads whose operations it has completed, using the operation address as the context. */
+    void execute_waiting(cpq_operation& op) {
+        op.blocking = true;
+        my_aggregator.execute(&op);
+        if (op.status == uintptr_t(BLOCKED)) {
+            // The thread checks the status after it is put into the wait queue, so a completion
+            // before the monitor is published cannot be missed.
+            operation_completed until(op);
+            concurrent_monitor_wait(get_monitor(), until, uintptr_t(&op));
+        }
+        if (op.status == uintptr_t(ABORTED))
+            throw_exception(eid_user_abort);
+    }
+
+    //! Wakes the thread of the blocked operation; the operation must not be accessed afterwards
+    void complete_blocked(cpq_operation *op, operation_status status) {
+        uintptr_t context = uintptr_t(op);
+        itt_store_word_with_release(op->status, uintptr_t(status));
+        // The waiter publishes the monitor and then checks the status, so the status store
+        // must not be reordered after the monitor load, or neither side sees the other.
+        atomic_fence();
+        if (concurrent_monitor* m = my_monitor)
+            concurrent_monitor_notify(*m, context);
+    }
+
+    void init_waiting() {
+        my_monitor = NULL;
+        my_blocked_pushes.init();
+        my_blocked_pops.init();
+    }
+
+    //! Returns the monitor for the threads waiting in pop or push, allocating it on first use
+    concurrent_monitor& get_monitor() {
+        concurrent_monitor* m = my_monitor;
+        if (!m) {
+            concurrent_monitor* new_monitor = allocate_concurrent_monitor();
+            m = my_monitor.compare_and_swap(new_monitor, NULL);
+            if (m)
+                deallocate_concurrent_monitor(new_monitor);
+            else
+                m = new_monitor;
+        }
+        return *m;
+    }
+
+    static size_type max_capacity() { return ~size_type(0); }
+
     typedef tbb::internal::aggregator< my_functor_t, cpq_operation > aggregator_t;
     aggregator_t my_aggregator;
     //! Padding added to avoid false sharing
@@ -326,9 +490,13 @@ class concurrent_priority_queue {
     //! The point at which unsorted elements begin
     size_type mark;
     __TBB_atomic size_type my_size;
+    //! Maximum number of elements; push waits while the queue has that many
+    __TBB_atomic size_type my_capacity;
+    //! Threads blocked in pop or push sleep on it; NULL until a thread waits
+    atomic<concurrent_monitor*> my_monitor;
     Compare compare;
     //! Padding added to avoid false sharing
-    char padding2[NFS_MaxLineSize - (2*sizeof(size_type)) - sizeof(Compare)];
+    char padding2[NFS_MaxLineSize - (3*sizeof(size_type)) - sizeof(atomic<concurrent_monitor*>) - sizeof(Compare)];
     //! Storage for the heap of elements in queue, plus unheapified elements
     /** data has the following structure:
 
@@ -349,6 +517,8 @@ class concurrent_priority_queue {
         mark through my_size-1. */
     typedef std::vector<value_type, allocator_type> vector_t;
     vector_t data;
+    //! Operations blocked in push while the queue is full, and in pop while it is empty
+    blocked_list my_blocked_pushes, my_blocked_pops;
 
     void handle_operations(cpq_operation *op_list) {
         cpq_operation *tmp, *pop_list=NULL;
@@ -383,19 +553,26 @@ class concurrent_priority_queue {
                     itt_hide_store_word(tmp->next, pop_list);
                     pop_list = tmp;
                 }
+            } else if (tmp->type == SET_CAPACITY_OP) {
+                __TBB_store_with_release(my_capacity, tmp->sz);
+                itt_store_word_with_release(tmp->status, uintptr_t(SUCCEEDED));
+            } else if (tmp->type == ABORT_OP) {
+                while (!my_blocked_pushes.empty())
+                    complete_blocked(my_blocked_pushes.pop_front(), ABORTED);
+                while (!my_blocked_pops.empty())
+                    complete_blocked(my_blocked_pops.pop_front(), ABORTED);
+                itt_store_word_with_release(tmp->status, uintptr_t(SUCCEEDED));
             } else { // PUSH_OP or PUSH_RVALUE_OP
                 __TBB_ASSERT(tmp->type == PUSH_OP || tmp->type == PUSH_RVALUE_OP, "Unknown operation" );
-                __TBB_TRY{
-                    if (tmp->type == PUSH_OP) {
-                        push_back_helper(*(tmp->elem), typename internal::use_element_copy_constructor<value_type>::type());
-                    } else {
-                        data.push_back(move(*(tmp->elem)));
-                    }
-                    __TBB_store_with_release(my_size, my_size + 1);
-                    itt_store_word_with_release(tmp->status, uintptr_t(SUCCEEDED));
-                } __TBB_CATCH(...) {
-                    itt_store_word_with_release(tmp->status, uintptr_t(FAILED));
+                if (data.size() >= my_capacity) {
+                    if (tmp->blocking) {
+                        my_blocked_pushes.push_back(tmp);
+                        itt_store_word_with_release(tmp->status, uintptr_t(BLOCKED));
+                    } else
+                        itt_store_word_with_release(tmp->status, uintptr_t(FULL));
+                    continue;
                 }
+                itt_store_word_with_release(tmp->status, uintptr_t(push_element(tmp)));
             }
         }
 
@@ -405,7 +582,11 @@ class concurrent_priority_queue {
             pop_list = itt_hide_load_word(pop_list->next);
             __TBB_ASSERT(tmp->type == POP_OP, NULL);
             if (data.empty()) {
-                itt_store_word_with_release(tmp->status, uintptr_t(FAILED));
+                if (tmp->blocking) {
+                    my_blocked_pops.push_back(tmp);
+                    itt_store_word_with_release(tmp->status, uintptr_t(BLOCKED));
+                } else
+                    itt_store_word_with_release(tmp->status, uintptr_t(FAILED));
             }
             else {
                 __TBB_ASSERT(mark<=data.size(), NULL);
@@ -431,6 +612,40 @@ class concurrent_priority_queue {
         // batch of operations
         if (mark<data.size()) heapify();
         __TBB_ASSERT(mark == data.size(), NULL);
+
+        // give the freed slots and the new elements to the blocked operations, the oldest first,
+        // so each slot or element wakes one thread at most
+        for (;;) {
+            if (!my_blocked_pushes.empty() && data.size() < my_capacity) {
+                tmp = my_blocked_pushes.pop_front();
+                operation_status status = push_element(tmp);
+                heapify();
+                complete_blocked(tmp, status);
+            } else if (!my_blocked_pops.empty() && !data.empty()) {
+                tmp = my_blocked_pops.pop_front();
+                *(tmp->elem) = move(data[0]);
+                __TBB_store_with_release(my_size, my_size-1);
+                reheap();
+                complete_blocked(tmp, SUCCEEDED);
+            } else
+                break;
+        }
+        __TBB_ASSERT(mark == data.size(), NULL);
+    }
+
+    //! Appends the element of the push operation, returns the status of the operation
+    operation_status push_element(cpq_operation *op) {
+        __TBB_TRY{
+            if (op->type == PUSH_OP) {
+                push_back_helper(*(op->elem), typename interface5::internal::use_element_copy_constructor<value_type>::type());
+            } else {
+                data.push_back(move(*(op->elem)));
+            }
+            __TBB_store_with_release(my_size, my_size + 1);
+            return SUCCEEDED;
+        } __TBB_CATCH(...) {
+            return FAILED;
+        }
     }
 
     //! Merge unsorted elements into heap
@@ -480,9 +695,9 @@ class concurrent_priority_queue {
     }
 };
 
-} // namespace interface5
+} // namespace interface6
 
-using interface5::concurrent_priority_queue;
+using interface6::concurrent_priority_queue;
 
 } // namespace tbb
 
@@ -61,6 +61,24 @@ class concurrent_queue: public internal::concurrent_queue_base_v3<T> {
         new (location) T( std::move(*static_cast<T*>(const_cast<void*>(src))) );
     }
 #endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
+
+    //! Constructs the item from the iterator src points to, and advances the iterator
+    template<typename Iterator>
+    static void copy_construct_range_item(T* location, const void* src) {
+        Iterator& next = *static_cast<Iterator*>(const_cast<void*>(src));
+        new (location) T(*next);
+        ++next;
+    }
+
+    //! Assigns the item to the iterator dst points to, and advances the iterator; drops the item if dst is NULL
+    template<typename Iterator>
+    static void assign_range_item(void* dst, T& src) {
+        if( dst ) {
+            Iterator& next = *static_cast<Iterator*>(dst);
+            *next = tbb::internal::move( src );
+            ++next;
+        }
+    }
 public:
     //! Element type in the queue.
     typedef T value_type;
@@ -146,6 +164,14 @@ public:
 #endif //__TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
 #endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
 
+    //! Enqueue copies of the items in [first,last) at tail of queue.
+    /** The places for all the items are reserved at once, so the items are adjacent in the queue. */
+    template<typename ForwardIterator>
+    void push_range( ForwardIterator first, ForwardIterator last ) {
+        size_type n = std::distance( first, last );
+        this->internal_push_range( n, &first, copy_construct_range_item<ForwardIterator> );
+    }
+
     //! Attempt to dequeue an item from head of queue.
     /** Does not wait for item to become available.
         Returns true if successful; false otherwise. */
@@ -153,6 +179,14 @@ public:
         return this->internal_try_pop( &result );
     }
 
+    //! Attempt to dequeue up to max_items items from head of queue to the output iterator.
+    /** Does not wait for items to become available; the items are claimed at once.
+        Returns the number of items dequeued. */
+    template<typename OutputIterator>
+    size_type try_pop_many( OutputIterator result, size_type max_items ) {
+        return this->internal_try_pop_many( max_items, &result, assign_range_item<OutputIterator> );
+    }
+
     //! Return the number of items in the queue; thread unsafe
     size_type unsafe_size() const {return this->internal_size();}
 
@@ -257,6 +291,26 @@ class concurrent_bounded_queue: public internal::concurrent_queue_base_v8 {
         *static_cast<T*>(dst) = tbb::internal::move( from );
     }
 
+    //! Constructs the item from the iterator range points to, and advances the iterator
+    template<typename Iterator>
+    static void construct_range_item( void* range, page& dst, size_t index ) {
+        Iterator& next = *static_cast<Iterator*>(range);
+        new( &(&static_cast<padded_page*>(static_cast<void*>(&dst))->last)[index] ) T(*next);
+        ++next;
+    }
+
+    //! Assigns the item to the iterator range points to, and advances the iterator; drops the item if range is NULL
+    template<typename Iterator>
+    static void assign_range_item( void* range, page& src, size_t index ) {
+        T& from = (&static_cast<padded_page*>(static_cast<void*>(&src))->last)[index];
+        destroyer d(from);
+        if( range ) {
+            Iterator& next = *static_cast<Iterator*>(range);
+            *next = tbb::internal::move( from );
+            ++next;
+        }
+    }
+
     /*override*/ virtual page *allocate_page() {
         size_t n = sizeof(padded_page) + (items_per_page-1)*sizeof(T);
         page *p = reinterpret_cast<page*>(my_allocator.allocate( n ));
@@ -359,6 +413,16 @@ public:
 #endif /* __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT */
 #endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
 
+    //! Enqueue copies of the items in [first,last) at tail of queue.
+    /** The places for all the items are reserved at once, and waiting consumers are woken
+        once for all the items rather than for each one.
+        Blocks while the queue is full, as push does. */
+    template<typename ForwardIterator>
+    void push_range( ForwardIterator first, ForwardIterator last ) {
+        size_t n = std::distance( first, last );
+        internal_push_range( n, construct_range_item<ForwardIterator>, &first );
+    }
+
     //! Dequeue item from head of queue.
     /** Block until an item becomes available, and then dequeue it. */
     void pop( T& destination ) {
@@ -401,6 +465,15 @@ public:
         return internal_pop_if_present( &destination );
     }
 
+    //! Attempt to dequeue up to max_items items from head of queue to the output iterator.
+    /** Does not wait for items to become available. The items are claimed at once,
+        and waiting producers are woken once for all the items rather than for each one.
+        Returns the number of items dequeued. */
+    template<typename OutputIterator>
+    size_type try_pop_many( OutputIterator result, size_type max_items ) {
+        return max_items>0 ? internal_pop_many_if_present( max_items, assign_range_item<OutputIterator>, &result ) : 0;
+    }
+
     //! Return number of pushes minus number of pops.
     /** Note that the result can be negative if there are pops waiting for the 
         corresponding pushes.  The result can also exceed capacity() if there 
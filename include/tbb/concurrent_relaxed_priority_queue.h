@@ -0,0 +1,335 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#ifndef __TBB_concurrent_relaxed_priority_queue_H
+#define __TBB_concurrent_relaxed_priority_queue_H
+
+#if ! TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE
+    #error Set TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE to include concurrent_relaxed_priority_queue.h
+#endif
+
+#include "tbb_stddef.h"
+#include "tbb_machine.h"
+#include "spin_mutex.h"
+#include "cache_aligned_allocator.h"
+#include "task_scheduler_init.h"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <new>          // Need placement new
+
+#if __TBB_INITIALIZER_LISTS_PRESENT
+    #include <initializer_list>
+#endif
+
+namespace tbb {
+namespace interface7 {
+
+//! @cond INTERNAL
+namespace internal {
+
+    //! One of the heaps of concurrent_relaxed_priority_queue, with the lock that protects it
+    template<typename T, typename A>
+    struct relaxed_heap : tbb::internal::no_copy {
+        typedef std::vector<T, A> vector_type;
+        spin_mutex my_mutex;
+        //! Number of elements, read without the lock to skip empty heaps
+        __TBB_atomic size_t my_size;
+        vector_type my_data;
+        char pad[tbb::internal::NFS_MaxLineSize - (sizeof(spin_mutex)+sizeof(size_t)+sizeof(vector_type))%tbb::internal::NFS_MaxLineSize];
+        explicit relaxed_heap( const A &a ) : my_size(0), my_data(a) {}
+    };
+
+    //! State of the random number generator which picks the heaps
+    struct relaxed_random_state {
+        unsigned my_seed;
+    };
+
+} // namespace internal
+//! @endcond
+
+//! Concurrent priority queue with relaxed ordering
+/** The elements are kept in several heaps, twice as many as the default number of threads,
+    each protected by its own lock. A push goes to a random heap; a pop takes the higher
+    priority top of two random heaps. Threads rarely contend for a heap, so throughput
+    scales with the number of threads, but try_pop may return an element that is not the
+    highest priority one in the queue. The popped elements are still near the top: the
+    expected rank of a popped element is proportional to the number of heaps.
+    Use concurrent_priority_queue if the exact order is required.
+    @ingroup containers */
+template <typename T, typename Compare=std::less<T>, typename A=cache_aligned_allocator<T> >
+class concurrent_relaxed_priority_queue : tbb::internal::no_copy {
+public:
+    //! Element type in the queue.
+    typedef T value_type;
+
+    //! Reference type
+    typedef T& reference;
+
+    //! Const reference type
+    typedef const T& const_reference;
+
+    //! Integral type for representing size of the queue.
+    typedef size_t size_type;
+
+    //! Difference type for iterator
+    typedef ptrdiff_t difference_type;
+
+    //! Allocator type
+    typedef A allocator_type;
+
+    //! Number of heaps per thread of the default concurrency level
+    static const size_type heaps_per_thread = 2;
+
+    //! Constructs a new queue
+    explicit concurrent_relaxed_priority_queue( const allocator_type &a = allocator_type() ) : my_allocator(a) {
+        initialize(0);
+    }
+
+    //! Constructs a new queue with the storage for init_capacity elements reserved
+    explicit concurrent_relaxed_priority_queue( size_type init_capacity, const allocator_type &a = allocator_type() ) : my_allocator(a) {
+        initialize(init_capacity);
+    }
+
+    //! [begin,end) constructor
+    template<typename InputIterator>
+    concurrent_relaxed_priority_queue( InputIterator begin, InputIterator end, const allocator_type &a = allocator_type() ) : my_allocator(a) {
+        initialize(0);
+        internal_assign(begin, end);
+    }
+
+#if __TBB_INITIALIZER_LISTS_PRESENT
+    //! Constructor from std::initializer_list
+    concurrent_relaxed_priority_queue( std::initializer_list<T> init_list, const allocator_type &a = allocator_type() ) : my_allocator(a) {
+        initialize(0);
+        internal_assign(init_list.begin(), init_list.end());
+    }
+#endif //# __TBB_INITIALIZER_LISTS_PRESENT
+
+    ~concurrent_relaxed_priority_queue() {
+        destroy();
+    }
+
+    //! Returns true if empty, false otherwise
+    /** Returned value may not reflect results of pending operations.
+        This operation reads shared data and will trigger a race condition. */
+    bool empty() const { return size()==0; }
+
+    //! Returns the current number of elements contained in the queue
+    /** Returned value may not reflect results of pending operations.
+        This operation reads shared data and will trigger a race condition. */
+    size_type size() const {
+        size_type n = 0;
+        for( size_type i = 0; i < my_n_heaps; ++i )
+            n += __TBB_load_with_acquire(my_heaps[i].my_size);
+        return n;
+    }
+
+    //! Pushes elem onto the queue
+    /** This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    void push( const_reference elem ) {
+        internal_push(elem);
+    }
+
+#if __TBB_CPP11_RVALUE_REF_PRESENT
+    //! Pushes elem onto the queue
+    /** This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    void push( value_type &&elem ) {
+        internal_push(std::move(elem));
+    }
+
+#if __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
+    //! Constructs a new element using args as the arguments for its construction and pushes it onto the queue
+    /** This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    template<typename... Args>
+    void emplace( Args&&... args ) {
+        push(value_type(std::forward<Args>(args)...));
+    }
+#endif /* __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT */
+#endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
+
+    //! Gets a reference to and removes a high priority element
+    /** If a high priority element was found, returns true; elem is assigned the value of the
+        element and the element is removed from the queue. The element is the highest priority
+        one of its heap, not necessarily of the queue. Returns false only if all the heaps
+        were seen empty.
+        This operation can be safely used concurrently with other push, try_pop or emplace operations. */
+    bool try_pop( reference elem ) {
+        random_heap_index random(*this);
+        for( size_type attempt = 0; attempt < my_n_heaps; ++attempt ) {
+            heap_type *first = &my_heaps[random()], *second = &my_heaps[random()];
+            if( !__TBB_load_with_acquire(first->my_size) )
+                std::swap(first, second);
+            if( !__TBB_load_with_acquire(first->my_size) )
+                break; // the queue is likely to be almost empty
+            if( first == second || !__TBB_load_with_acquire(second->my_size) )
+                second = NULL;
+            spin_mutex::scoped_lock first_lock, second_lock;
+            if( !first_lock.try_acquire(first->my_mutex) || first->my_data.empty() )
+                first = NULL;
+            if( second && (!second_lock.try_acquire(second->my_mutex) || second->my_data.empty()) )
+                second = NULL;
+            if( !first ) {
+                if( !second )
+                    continue; // both heaps are busy or have become empty, pick others
+                first = second;
+            } else if( second && my_compare(first->my_data.front(), second->my_data.front()) ) {
+                first = second;
+            }
+            pop_top(*first, elem);
+            return true;
+        }
+        // Look through all the heaps, so that an element is not missed
+        for( size_type i = 0, start = random(); i < my_n_heaps; ++i ) {
+            heap_type &h = my_heaps[(start+i)%my_n_heaps];
+            if( __TBB_load_with_acquire(h.my_size) ) {
+                spin_mutex::scoped_lock lock(h.my_mutex);
+                if( !h.my_data.empty() ) {
+                    pop_top(h, elem);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    //! Clear the queue; not thread-safe
+    /** This operation is unsafe if there are pending concurrent operations on the queue.
+        Resets size, effectively emptying queue; does not free space.
+        May not clear elements added in pending operations. */
+    void clear() {
+        for( size_type i = 0; i < my_n_heaps; ++i ) {
+            my_heaps[i].my_data.clear();
+            __TBB_store_with_release(my_heaps[i].my_size, 0);
+        }
+    }
+
+    //! Return allocator object
+    allocator_type get_allocator() const { return my_allocator; }
+
+private:
+    typedef internal::relaxed_heap<T, A> heap_type;
+    typedef typename A::template rebind<heap_type>::other heap_allocator_type;
+    typedef tbb::internal::padded<internal::relaxed_random_state> random_state_type;
+    typedef typename A::template rebind<random_state_type>::other random_state_allocator_type;
+
+    allocator_type my_allocator;
+    size_type my_n_heaps;
+    heap_type *my_heaps;
+    //! States of the random number generators, one per heap
+    /** A thread uses the state selected by the address of its stack. The threads that
+        happen to share a state may get the same heaps, which affects the performance only. */
+    random_state_type *my_random_states;
+    Compare my_compare;
+
+    //! Picks the heaps at random
+    class random_heap_index : tbb::internal::no_copy {
+        const size_type my_n_heaps;
+        unsigned &my_shared_seed;
+        unsigned my_seed;
+    public:
+        random_heap_index( concurrent_relaxed_priority_queue &q ) :
+            my_n_heaps(q.my_n_heaps),
+            my_shared_seed(q.my_random_states[(unsigned(uintptr_t(this)>>12)*0x9e3779b1u>>16) % q.my_n_heaps].my_seed),
+            my_seed(tbb::internal::__TBB_load_relaxed(my_shared_seed)) {}
+        ~random_heap_index() { tbb::internal::__TBB_store_relaxed(my_shared_seed, my_seed); }
+        size_type operator()() {
+            my_seed = my_seed*1664525u + 1013904223u;
+            return size_type(my_seed>>16) % my_n_heaps;
+        }
+    };
+
+    void initialize( size_type init_capacity ) {
+        my_n_heaps = heaps_per_thread * size_type(task_scheduler_init::default_num_threads());
+        my_heaps = heap_allocator_type(my_allocator).allocate(my_n_heaps);
+        for( size_type i = 0; i < my_n_heaps; ++i )
+            new( static_cast<void*>(&my_heaps[i]) ) heap_type(my_allocator);
+        my_random_states = NULL;
+        __TBB_TRY {
+            my_random_states = random_state_allocator_type(my_allocator).allocate(my_n_heaps);
+            for( size_type i = 0; i < my_n_heaps; ++i ) {
+                my_random_states[i].my_seed = unsigned(i)*0x9e3779b1u + 1;
+                if( init_capacity )
+                    my_heaps[i].my_data.reserve(init_capacity/my_n_heaps + 1);
+            }
+        } __TBB_CATCH(...) {
+            destroy();
+            __TBB_RETHROW();
+        }
+    }
+
+    void destroy() {
+        for( size_type i = 0; i < my_n_heaps; ++i )
+            my_heaps[i].~heap_type();
+        heap_allocator_type(my_allocator).deallocate(my_heaps, my_n_heaps);
+        if( my_random_states )
+            random_state_allocator_type(my_allocator).deallocate(my_random_states, my_n_heaps);
+    }
+
+    //! Deals the elements to the heaps in turn
+    template<typename InputIterator>
+    void internal_assign( InputIterator begin, InputIterator end ) {
+        __TBB_TRY {
+            for( size_type i = 0; begin != end; ++begin, i = (i+1)%my_n_heaps )
+                my_heaps[i].my_data.push_back(*begin);
+            for( size_type i = 0; i < my_n_heaps; ++i ) {
+                std::make_heap(my_heaps[i].my_data.begin(), my_heaps[i].my_data.end(), my_compare);
+                my_heaps[i].my_size = my_heaps[i].my_data.size();
+            }
+        } __TBB_CATCH(...) {
+            destroy();
+            __TBB_RETHROW();
+        }
+    }
+
+    template<typename Arg>
+    void internal_push( __TBB_FORWARDING_REF(Arg) elem ) {
+        random_heap_index random(*this);
+        spin_mutex::scoped_lock lock;
+        heap_type *h = &my_heaps[random()];
+        // Try other heaps while the chosen one is busy, then wait for the last one
+        for( size_type attempt = 1; !lock.try_acquire(h->my_mutex); ++attempt ) {
+            h = &my_heaps[random()];
+            if( attempt == my_n_heaps ) {
+                lock.acquire(h->my_mutex);
+                break;
+            }
+        }
+        h->my_data.push_back(tbb::internal::forward<Arg>(elem));
+        std::push_heap(h->my_data.begin(), h->my_data.end(), my_compare);
+        __TBB_store_with_release(h->my_size, h->my_data.size());
+    }
+
+    //! Moves the top element of the locked heap to elem
+    void pop_top( heap_type &h, reference elem ) {
+        elem = tbb::internal::move(h.my_data.front());
+        std::pop_heap(h.my_data.begin(), h.my_data.end(), my_compare);
+        h.my_data.pop_back();
+        __TBB_store_with_release(h.my_size, h.my_data.size());
+    }
+};
+
+} // namespace interface7
+
+using interface7::concurrent_relaxed_priority_queue;
+
+} // namespace tbb
+
+#endif /* __TBB_concurrent_relaxed_priority_queue_H */
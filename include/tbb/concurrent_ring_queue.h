@@ -0,0 +1,345 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#ifndef __TBB_concurrent_ring_queue_H
+#define __TBB_concurrent_ring_queue_H
+
+#if ! TBB_PREVIEW_CONCURRENT_RING_QUEUE
+    #error Set TBB_PREVIEW_CONCURRENT_RING_QUEUE to include concurrent_ring_queue.h
+#endif
+
+#include "tbb_stddef.h"
+#include "tbb_machine.h"
+#include "atomic.h"
+#include "aligned_space.h"
+#include "cache_aligned_allocator.h"
+#include "tbb_exception.h"
+
+#include <new>          // Need placement new
+
+namespace tbb {
+namespace interface7 {
+
+//! Which threads push to and pop from a concurrent_ring_queue
+enum ring_queue_kind {
+    //! Any number of threads push and pop concurrently
+    ring_queue_mpmc,
+    //! At most one thread pushes and at most one thread pops at a time
+    ring_queue_spsc
+};
+
+//! @cond INTERNAL
+namespace internal {
+
+    //! Slot of the ring buffer
+    /** The sequence number tells the state of the slot in the MPMC queue:
+        it is equal to the position which may be pushed into the slot,
+        or greater by one when the item at the position may be popped. */
+    template<typename T>
+    struct ring_queue_slot {
+        atomic<size_t> my_sequence;
+        //! False if the item constructor has thrown, the position is skipped by consumers
+        bool my_valid;
+        aligned_space<T> my_item;
+    };
+
+} // namespace internal
+//! @endcond
+
+//! A bounded non-blocking queue over a preallocated ring buffer.
+/** The capacity is fixed at construction and rounded up to a power of two; no memory is
+    allocated after construction. Each slot of the MPMC queue has a sequence number, so
+    producers and consumers synchronize by a CAS on the queue end and the slot's sequence only.
+    The SPSC queue uses no atomic read-modify-write operations at all.
+    Each slot is padded to NFS_MaxLineSize, so a queue of small items takes a cache line per item.
+    push and pop spin until the queue is not full or not empty; they are meant for hand-offs
+    between threads that keep up with each other. Use concurrent_bounded_queue to block instead.
+    @ingroup containers */
+template<typename T, ring_queue_kind Kind = ring_queue_mpmc, typename A = cache_aligned_allocator<T> >
+class concurrent_ring_queue : tbb::internal::no_copy {
+    //! Each slot takes whole cache lines, so threads at adjacent positions do not false-share
+    typedef tbb::internal::padded<internal::ring_queue_slot<T> > slot_type;
+    typedef typename A::template rebind<slot_type>::other slot_allocator_type;
+    typedef tbb::internal::bool_constant<Kind == ring_queue_spsc> is_spsc;
+
+    slot_allocator_type my_allocator;
+    slot_type *my_slots;
+    size_t my_mask;
+    char pad0[tbb::internal::NFS_MaxLineSize];
+
+    //! Position for the next push
+    atomic<size_t> my_tail;
+    //! Position for the next pop as it was seen by the SPSC producer
+    size_t my_cached_head;
+    char pad1[tbb::internal::NFS_MaxLineSize - sizeof(atomic<size_t>) - sizeof(size_t)];
+
+    //! Position for the next pop
+    atomic<size_t> my_head;
+    //! Position for the next push as it was seen by the SPSC consumer
+    size_t my_cached_tail;
+    char pad2[tbb::internal::NFS_MaxLineSize - sizeof(atomic<size_t>) - sizeof(size_t)];
+
+    static size_t round_up_capacity( size_t n ) {
+        size_t capacity = 2;
+        while( capacity < n )
+            capacity *= 2;
+        return capacity;
+    }
+
+    T& item( size_t position ) {
+        return *my_slots[position & my_mask].my_item.begin();
+    }
+
+    //! Claims the position for a push in the MPMC queue, or returns false if the queue is full
+    bool claim_tail( size_t &position ) {
+        position = my_tail;
+        for(;;) {
+            intptr_t difference = intptr_t(my_slots[position & my_mask].my_sequence - position);
+            if( difference == 0 ) {
+                size_t observed = my_tail.compare_and_swap( position+1, position );
+                if( observed == position )
+                    return true;
+                position = observed;
+            } else if( difference < 0 ) {
+                return false;
+            } else {
+                position = my_tail;
+            }
+        }
+    }
+
+    //! Claims the position for a pop in the MPMC queue, or returns false if the queue is empty
+    bool claim_head( size_t &position ) {
+        position = my_head;
+        for(;;) {
+            intptr_t difference = intptr_t(my_slots[position & my_mask].my_sequence - (position+1));
+            if( difference == 0 ) {
+                size_t observed = my_head.compare_and_swap( position+1, position );
+                if( observed == position )
+                    return true;
+                position = observed;
+            } else if( difference < 0 ) {
+                return false;
+            } else {
+                position = my_head;
+            }
+        }
+    }
+
+    //! Publishes the slot to consumers even if the item constructor throws
+    class publish_slot : tbb::internal::no_copy {
+        slot_type &my_slot;
+        size_t my_position;
+    public:
+        bool my_valid;
+        publish_slot( slot_type &s, size_t position ) : my_slot(s), my_position(position), my_valid(false) {}
+        ~publish_slot() {
+            my_slot.my_valid = my_valid;
+            my_slot.my_sequence = my_position+1;
+        }
+    };
+
+    //! Returns the slot to producers even if the assignment throws; the item is lost then
+    class release_slot : tbb::internal::no_copy {
+        slot_type &my_slot;
+        size_t my_sequence;
+    public:
+        release_slot( slot_type &s, size_t sequence ) : my_slot(s), my_sequence(sequence) {}
+        ~release_slot() {
+            if( my_slot.my_valid )
+                my_slot.my_item.begin()->~T();
+            my_slot.my_sequence = my_sequence;
+        }
+    };
+
+    template<typename Arg>
+    bool internal_try_push( __TBB_FORWARDING_REF(Arg) src, tbb::internal::false_type ) {
+        size_t position;
+        if( !claim_tail( position ) )
+            return false;
+        slot_type &s = my_slots[position & my_mask];
+        publish_slot guard( s, position );
+        new( static_cast<void*>(s.my_item.begin()) ) T( tbb::internal::forward<Arg>(src) );
+        guard.my_valid = true;
+        return true;
+    }
+
+    template<typename Arg>
+    bool internal_try_push( __TBB_FORWARDING_REF(Arg) src, tbb::internal::true_type ) {
+        size_t position = my_tail;
+        if( position - my_cached_head > my_mask ) {
+            my_cached_head = my_head;
+            if( position - my_cached_head > my_mask )
+                return false;
+        }
+        // The item is published only after it is constructed, so the constructor may throw
+        new( static_cast<void*>(&item(position)) ) T( tbb::internal::forward<Arg>(src) );
+        my_tail = position+1;
+        return true;
+    }
+
+    bool internal_try_pop( T &dst, tbb::internal::false_type ) {
+        for(;;) {
+            size_t position;
+            if( !claim_head( position ) )
+                return false;
+            slot_type &s = my_slots[position & my_mask];
+            release_slot guard( s, position+my_mask+1 );
+            if( s.my_valid ) {
+                dst = tbb::internal::move( *s.my_item.begin() );
+                return true;
+            }
+        }
+    }
+
+    bool internal_try_pop( T &dst, tbb::internal::true_type ) {
+        size_t position = my_head;
+        if( position == my_cached_tail ) {
+            my_cached_tail = my_tail;
+            if( position == my_cached_tail )
+                return false;
+        }
+        // The item stays in the queue if the assignment throws
+        T &src = item(position);
+        dst = tbb::internal::move( src );
+        src.~T();
+        my_head = position+1;
+        return true;
+    }
+
+public:
+    //! Element type in the queue.
+    typedef T value_type;
+
+    //! Reference type
+    typedef T& reference;
+
+    //! Const reference type
+    typedef const T& const_reference;
+
+    //! Integral type for representing size of the queue.
+    typedef size_t size_type;
+
+    //! Difference type for iterator
+    typedef ptrdiff_t difference_type;
+
+    //! Allocator type
+    typedef A allocator_type;
+
+    //! Construct an empty queue, which keeps at least the given number of items
+    explicit concurrent_ring_queue( size_type capacity, const allocator_type &a = allocator_type() ) :
+        my_allocator( a ), my_slots( NULL ), my_mask( round_up_capacity( capacity ) - 1 ),
+        my_cached_head( 0 ), my_cached_tail( 0 )
+    {
+        my_slots = my_allocator.allocate( my_mask+1 );
+        if( !my_slots )
+            tbb::internal::throw_exception( tbb::internal::eid_bad_alloc );
+        for( size_t i = 0; i <= my_mask; ++i ) {
+            my_slots[i].my_sequence = i;
+            my_slots[i].my_valid = true;
+        }
+        my_tail = 0;
+        my_head = 0;
+    }
+
+    //! Destroy the queue and the items in it
+    ~concurrent_ring_queue() {
+        clear();
+        my_allocator.deallocate( my_slots, my_mask+1 );
+    }
+
+    //! Push a copy of the item if the queue is not full.
+    /** Returns true if the item was pushed, false if the queue is full. */
+    bool try_push( const T &src ) {
+        return internal_try_push( src, is_spsc() );
+    }
+
+#if __TBB_CPP11_RVALUE_REF_PRESENT
+    //! Move the item to the queue if the queue is not full.
+    bool try_push( T &&src ) {
+        return internal_try_push( std::move(src), is_spsc() );
+    }
+
+    //! Move the item to the queue, waiting while the queue is full.
+    void push( T &&src ) {
+        for( tbb::internal::atomic_backoff b; !try_push( std::move(src) ); b.pause() ) {}
+    }
+#endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
+
+    //! Push a copy of the item, waiting while the queue is full.
+    void push( const T &src ) {
+        for( tbb::internal::atomic_backoff b; !try_push( src ); b.pause() ) {}
+    }
+
+    //! Pop an item if the queue is not empty.
+    /** Returns true if the item was popped, false if the queue is empty. */
+    bool try_pop( T &dst ) {
+        return internal_try_pop( dst, is_spsc() );
+    }
+
+    //! Pop an item, waiting while the queue is empty.
+    void pop( T &dst ) {
+        for( tbb::internal::atomic_backoff b; !try_pop( dst ); b.pause() ) {}
+    }
+
+    //! Return the number of items in the queue; may be inaccurate when there are concurrent operations
+    size_type size() const {
+        size_t head = my_head, tail = my_tail;
+        return tail - head <= my_mask+1 ? tail - head : 0;
+    }
+
+    //! Equivalent to size()==0.
+    bool empty() const {
+        return size() == 0;
+    }
+
+    //! Maximum number of items the queue keeps
+    size_type capacity() const {
+        return my_mask+1;
+    }
+
+    //! Destroy the items in the queue; not thread-safe
+    void clear() {
+        size_t tail = my_tail;
+        for( size_t position = my_head; position != tail; ++position ) {
+            slot_type &s = my_slots[position & my_mask];
+            if( s.my_valid )
+                s.my_item.begin()->~T();
+            s.my_valid = true;
+            s.my_sequence = position+my_mask+1;
+        }
+        my_head = tail;
+        my_cached_head = my_cached_tail = tail;
+    }
+
+    //! Return allocator object
+    allocator_type get_allocator() const { return my_allocator; }
+};
+
+} // namespace interface7
+
+using interface7::ring_queue_kind;
+using interface7::ring_queue_mpmc;
+using interface7::ring_queue_spsc;
+using interface7::concurrent_ring_queue;
+
+} // namespace tbb
+
+#endif /* __TBB_concurrent_ring_queue_H */
@@ -29,7 +29,7 @@
 namespace tbb
 {
 
-namespace interface5 {
+namespace interface9 {
 
 // Template class for hash map traits
 template<typename Key, typename T, typename Hash_compare, typename Allocator, bool Allow_multimapping>
@@ -316,10 +316,10 @@ public:
     }
 #endif
 };
-} // namespace interface5
+} // namespace interface9
 
-using interface5::concurrent_unordered_map;
-using interface5::concurrent_unordered_multimap;
+using interface9::concurrent_unordered_map;
+using interface9::concurrent_unordered_multimap;
 
 } // namespace tbb
 
@@ -29,7 +29,7 @@
 namespace tbb
 {
 
-namespace interface5 {
+namespace interface9 {
 
 // Template class for hash set traits
 template<typename Key, typename Hash_compare, typename Allocator, bool Allow_multimapping>
@@ -259,10 +259,10 @@ public:
     }
 #endif //__TBB_CPP11_RVALUE_REF_PRESENT
 };
-} // namespace interface5
+} // namespace interface9
 
-using interface5::concurrent_unordered_set;
-using interface5::concurrent_unordered_multiset;
+using interface9::concurrent_unordered_set;
+using interface9::concurrent_unordered_multiset;
 
 } // namespace tbb
 
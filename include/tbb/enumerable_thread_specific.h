@@ -22,6 +22,7 @@
 #define __TBB_enumerable_thread_specific_H
 
 #include "concurrent_vector.h"
+#include "blocked_range.h"
 #include "tbb_thread.h"
 #include "tbb_allocator.h"
 #include "tbb_profiling.h"
@@ -43,7 +44,15 @@
 namespace tbb {
 
 //! enum for selecting between single key and key-per-instance versions
-enum ets_key_usage_type { ets_key_per_instance, ets_no_key };
+/** ets_worker_index gives TBB worker threads direct access to their copies by their index
+    in the scheduler; other threads use the hash table of ets_no_key. */
+enum ets_key_usage_type { ets_key_per_instance, ets_no_key, ets_worker_index };
+
+namespace internal {
+    //! Returns the index of the calling TBB worker thread, from 1 up to the number of workers; 0 for other threads
+    /** The stamp of a worker is never reused, unlike the index when the scheduler is restarted. */
+    size_t __TBB_EXPORTED_FUNC current_worker_index( size_t& stamp );
+} // namespace internal
 
 namespace interface6 {
 
@@ -294,6 +303,75 @@ namespace interface6 {
             }
         };
 
+        //! Specialization that indexes the copies of TBB worker threads directly
+        /** The index of a worker does not change during the worker's lifetime, but a worker of
+            a restarted scheduler can get the index of a finished one, so the slots keep the stamps
+            of their workers. The first lookup by a worker goes through the hash table, so all
+            the copies are enumerated there. */
+        template <>
+        class ets_base<ets_worker_index>: protected ets_base<ets_no_key> {
+            typedef ets_base<ets_no_key> super;
+            //! Number of segments of the direct table; segment s holds the copies of workers [2^s, 2^(s+1))
+            static const size_t n_segments = 8*sizeof(size_t);
+            //! Copy of the worker with the stamp
+            struct slot {
+                void* local;
+                size_t stamp;
+            };
+            //! Segments of the slots; NULL until a worker of the segment looks up its copy
+            atomic<slot*> my_segments[n_segments];
+            virtual void* create_local() = 0;
+            virtual void* create_array(size_t _size) = 0;  // _size in bytes
+            virtual void free_array(void* ptr, size_t _size) = 0; // size in bytes
+            static size_t segment_bytes( size_t s ) { return (size_t(1)<<s)*sizeof(slot); }
+            slot* segment( size_t s ) {
+                slot* locals = my_segments[s];
+                if( !locals ) {
+                    // zero stamps do not match any worker
+                    slot* new_locals = static_cast<slot*>(create_array(segment_bytes(s)));
+                    std::memset( new_locals, 0, segment_bytes(s) );
+                    locals = my_segments[s].compare_and_swap(new_locals, NULL);
+                    if( locals )
+                        free_array(new_locals, segment_bytes(s));
+                    else
+                        locals = new_locals;
+                }
+                return locals;
+            }
+        public:
+            ets_base() {
+                for( size_t s = 0; s < n_segments; ++s )
+                    my_segments[s] = NULL;
+            }
+            ~ets_base() {
+                for( size_t s = 0; s < n_segments; ++s )
+                    __TBB_ASSERT(!my_segments[s], NULL);
+            }
+            void* table_lookup( bool& exists ) {
+                size_t stamp;
+                const size_t k = tbb::internal::current_worker_index(stamp);
+                if( !k )
+                    return super::table_lookup(exists);
+                const size_t s = size_t(__TBB_Log2(k));
+                slot& local = segment(s)[k - (size_t(1)<<s)];
+                if( local.stamp == stamp ) {
+                    exists = true;
+                    return local.local;
+                }
+                local.local = super::table_lookup(exists);
+                local.stamp = stamp;
+                return local.local;
+            }
+            void table_clear() {
+                for( size_t s = 0; s < n_segments; ++s )
+                    if( slot* locals = my_segments[s] ) {
+                        free_array(locals, segment_bytes(s));
+                        my_segments[s] = NULL;
+                    }
+                super::table_clear();
+            }
+        };
+
         //! Random access iterator for traversing the thread local copies.
         template< typename Container, typename Value >
         class enumerable_thread_specific_iterator
@@ -712,6 +790,67 @@ namespace interface6 {
             ~ets_element() {unconstruct();}
         };
 
+        //! Body of parallel_reduce that combines the thread-local copies into a new object
+        template<typename T, typename Collection, typename Combine>
+        class ets_combine_body {
+            Collection& my_locals;
+            Combine my_combine;
+            tbb::aligned_space<T> my_result;
+            bool my_has_result;
+            void accumulate( const T& value ) {
+                if( my_has_result )
+                    *my_result.begin() = my_combine( *my_result.begin(), value );
+                else {
+                    new( my_result.begin() ) T( value );
+                    my_has_result = true;
+                }
+            }
+            void operator=( const ets_combine_body& );
+        public:
+            ets_combine_body( Collection& locals, Combine combine ) : my_locals(locals), my_combine(combine), my_has_result(false) {}
+            ets_combine_body( ets_combine_body& other, split ) : my_locals(other.my_locals), my_combine(other.my_combine), my_has_result(false) {}
+            ~ets_combine_body() {
+                if( my_has_result )
+                    my_result.begin()->~T();
+            }
+            void operator()( const blocked_range<size_t>& r ) {
+                for( size_t i = r.begin(); i != r.end(); ++i )
+                    accumulate( *my_locals[i].value() );
+            }
+            void join( ets_combine_body& rhs ) {
+                if( rhs.my_has_result )
+                    accumulate( *rhs.my_result.begin() );
+            }
+            T& result() { __TBB_ASSERT( my_has_result, NULL ); return *my_result.begin(); }
+        };
+
+        //! Body of parallel_reduce that merges the thread-local copies into one of them
+        template<typename T, typename Collection, typename Combine>
+        class ets_combine_in_place_body {
+            Collection& my_locals;
+            Combine my_combine;
+            T* my_result;
+            void accumulate( T& value ) {
+                if( my_result )
+                    my_combine( *my_result, value );
+                else
+                    my_result = &value;
+            }
+            void operator=( const ets_combine_in_place_body& );
+        public:
+            ets_combine_in_place_body( Collection& locals, Combine combine ) : my_locals(locals), my_combine(combine), my_result(NULL) {}
+            ets_combine_in_place_body( ets_combine_in_place_body& other, split ) : my_locals(other.my_locals), my_combine(other.my_combine), my_result(NULL) {}
+            void operator()( const blocked_range<size_t>& r ) {
+                for( size_t i = r.begin(); i != r.end(); ++i )
+                    accumulate( *my_locals[i].value() );
+            }
+            void join( ets_combine_in_place_body& rhs ) {
+                if( rhs.my_result )
+                    accumulate( *rhs.my_result );
+            }
+            T& result() { __TBB_ASSERT( my_result, NULL ); return *my_result; }
+        };
+
         // A predicate that can be used for a compile-time compatibility check of ETS instances
         // Ideally, it should have been declared inside the ETS class, but unfortunately
         // in that case VS2013 does not enable the variadic constructor.
@@ -743,7 +882,7 @@ namespace interface6 {
         - thread-local copies do not move (during lifetime, and excepting clear()) so the address of a copy is invariant.
         - the contained objects need not have operator=() defined if combine is not used.
         - enumerable_thread_specific containers may be copy-constructed or assigned.
-        - thread-local copies can be managed by hash-table, or can be accessed via TLS storage for speed.
+        - thread-local copies can be managed by hash-table, or can be accessed via TLS storage or by the index of TBB worker threads for speed.
         - outside of parallel contexts, the contents of all thread-local copies are accessible by iterator or using combine or combine_each methods
 
     @par Segmented iterator
@@ -756,6 +895,12 @@ namespace interface6 {
         - neither method modifies the contents of the object (though there is no guarantee that the applied methods do not modify the object.)
         - Both are evaluated in serial context (the methods are assumed to be non-benign.)
 
+    @par combine_parallel and combine_parallel_in_place
+        - Both reduce the thread-local copies in a tree with parallel_reduce, so the combining function must be associative.
+        - Both need tbb/parallel_reduce.h included where they are used; it is not included by this header.
+        - combine_parallel() has the requirements of combine() and does not modify the thread-local copies.
+        - combine_parallel_in_place() merges the copies into one of them and returns it, leaving the other copies modified.
+
     @ingroup containers */
     template <typename T,
               typename Allocator=cache_aligned_allocator<T>,
@@ -992,6 +1137,33 @@ namespace interface6 {
             }
         }
 
+        //! Combines the thread-local copies in parallel, reducing them in a tree
+        /** combine_func_t has signature T(T,T) or T(const T&, const T&) and must be associative. */
+        template <typename combine_func_t>
+        T combine_parallel(combine_func_t f_combine) {
+            if(begin() == end())
+                return combine(f_combine);
+            internal::ets_combine_body<T, internal_collection_type, combine_func_t> body( my_locals, f_combine );
+            // found by argument-dependent lookup where the method is instantiated
+            parallel_reduce( blocked_range<size_t>(0, my_locals.size()), body );
+            return body.result();
+        }
+
+        //! Merges the thread-local copies in parallel into one of them, without making copies
+        /** combine_func_t has signature void(T&, const T&) or void(T&, T&), merges the second
+            argument into the first one, and must be associative. The other copies may be left
+            modified. Returns the copy that holds the result; if there are no copies, it is
+            created by local(). */
+        template <typename combine_func_t>
+        T& combine_parallel_in_place(combine_func_t f_combine) {
+            if(begin() == end())
+                return local();
+            internal::ets_combine_in_place_body<T, internal_collection_type, combine_func_t> body( my_locals, f_combine );
+            // found by argument-dependent lookup where the method is instantiated
+            parallel_reduce( blocked_range<size_t>(0, my_locals.size()), body );
+            return body.result();
+        }
+
     }; // enumerable_thread_specific
 
     template <typename T, typename Allocator, ets_key_usage_type ETS_key_type>
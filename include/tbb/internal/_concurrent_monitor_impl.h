@@ -0,0 +1,62 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#ifndef __TBB__concurrent_monitor_impl_H
+#define __TBB__concurrent_monitor_impl_H
+
+#include "../tbb_stddef.h"
+
+namespace tbb {
+namespace internal {
+
+//! Wait queue of the library on which the threads of blocking containers sleep
+class concurrent_monitor;
+
+//! Condition that a thread blocked on a concurrent_monitor waits for
+/** It is checked after the thread is put into the wait queue, so a notification
+    issued after the condition changes cannot be missed. */
+class concurrent_monitor_predicate {
+public:
+    virtual bool operator()() = 0;
+protected:
+    virtual ~concurrent_monitor_predicate() {}
+};
+
+//! Allocate and construct a concurrent_monitor
+concurrent_monitor* __TBB_EXPORTED_FUNC allocate_concurrent_monitor();
+
+//! Destroy and deallocate the concurrent_monitor; threads still waiting on it are aborted
+void __TBB_EXPORTED_FUNC deallocate_concurrent_monitor( concurrent_monitor* m );
+
+//! Block the calling thread until the predicate holds
+/** The thread sleeps with the given context and is woken by concurrent_monitor_notify for the same context.
+    Throws tbb::user_abort if concurrent_monitor_abort is called while the thread sleeps. */
+void __TBB_EXPORTED_FUNC concurrent_monitor_wait( concurrent_monitor& m, concurrent_monitor_predicate& until, uintptr_t context );
+
+//! Wake the threads sleeping with the given context
+void __TBB_EXPORTED_FUNC concurrent_monitor_notify( concurrent_monitor& m, uintptr_t context );
+
+//! Wake all the sleeping threads with tbb::user_abort
+void __TBB_EXPORTED_FUNC concurrent_monitor_abort( concurrent_monitor& m );
+
+} // namespace internal
+} // namespace tbb
+
+#endif /* __TBB__concurrent_monitor_impl_H */
@@ -146,6 +146,7 @@ template<typename T>
 class micro_queue : no_copy {
 public:
     typedef void (*item_constructor_t)(T* location, const void* src);
+    typedef void (*item_assigner_t)(void* dst, T& src);
 private:
     typedef concurrent_queue_rep_base::page page;
 
@@ -168,10 +169,10 @@ private:
         construct_item( &get_ref(dst, dindex), static_cast<const void*>(&src_item) );
     }
 
-    void assign_and_destroy_item( void* dst, page& src, size_t index ) {
+    void assign_and_destroy_item( void* dst, page& src, size_t index, item_assigner_t assign_item ) {
         T& from = get_ref(src,index);
         destroyer d(from);
-        *static_cast<T*>(dst) = tbb::internal::move( from );
+        assign_item( dst, from );
     }
 
     void spin_wait_until_my_turn( atomic<ticket>& counter, ticket k, concurrent_queue_rep_base& rb ) const ;
@@ -203,7 +204,7 @@ public:
     void push( const void* item, ticket k, concurrent_queue_base_v3<T>& base,
         item_constructor_t construct_item ) ;
 
-    bool pop( void* dst, ticket k, concurrent_queue_base_v3<T>& base ) ;
+    bool pop( void* dst, ticket k, concurrent_queue_base_v3<T>& base, item_assigner_t assign_item ) ;
 
     micro_queue& assign( const micro_queue& src, concurrent_queue_base_v3<T>& base,
         item_constructor_t construct_item ) ;
@@ -260,6 +261,14 @@ void micro_queue<T>::push( const void* item, ticket k, concurrent_queue_base_v3<
         p = tail_page;
     }
 
+    if( !item ) {
+        // No item; the ticket is passed by internal_push_range after a failure
+        ++base.my_rep->n_invalid_entries;
+        call_itt_notify(releasing, &tail_counter);
+        tail_counter += concurrent_queue_rep_base::n_queue;
+        return;
+    }
+
     __TBB_TRY {
         copy_item( *p, index, item, construct_item );
         // If no exception was thrown, mark item as present.
@@ -275,7 +284,7 @@ void micro_queue<T>::push( const void* item, ticket k, concurrent_queue_base_v3<
 }
 
 template<typename T>
-bool micro_queue<T>::pop( void* dst, ticket k, concurrent_queue_base_v3<T>& base ) {
+bool micro_queue<T>::pop( void* dst, ticket k, concurrent_queue_base_v3<T>& base, item_assigner_t assign_item ) {
     k &= -concurrent_queue_rep_base::n_queue;
     if( head_counter!=k ) spin_wait_until_eq( head_counter, k );
     call_itt_notify(acquired, &head_counter);
@@ -289,7 +298,7 @@ bool micro_queue<T>::pop( void* dst, ticket k, concurrent_queue_base_v3<T>& base
         micro_queue_pop_finalizer<T> finalizer( *this, base, k+concurrent_queue_rep_base::n_queue, index==base.my_rep->items_per_page-1 ? &p : NULL );
         if( p.mask & uintptr_t(1)<<index ) {
             success = true;
-            assign_and_destroy_item( dst, p, index );
+            assign_and_destroy_item( dst, p, index, assign_item );
         } else {
             --base.my_rep->n_invalid_entries;
         }
@@ -449,6 +458,11 @@ protected:
 private:
     typedef typename micro_queue<T>::padded_page padded_page;
     typedef typename micro_queue<T>::item_constructor_t item_constructor_t;
+    typedef typename micro_queue<T>::item_assigner_t item_assigner_t;
+
+    static void assign_to_item( void* dst, T& src ) {
+        *static_cast<T*>(dst) = tbb::internal::move( src );
+    }
 
     /* override */ virtual page *allocate_page() {
         concurrent_queue_rep<T>& r = *my_rep;
@@ -487,10 +501,19 @@ protected:
          r.choose(k).push( src, k, *this, construct_item );
     }
 
+    //! Enqueue n items at tail of queue, taking their tickets at once
+    /** construct_item is called for the items in order with the same src. */
+    void internal_push_range( size_t n, const void* src, item_constructor_t construct_item ) ;
+
     //! Attempt to dequeue item from queue.
     /** NULL if there was no item to dequeue. */
     bool internal_try_pop( void* dst ) ;
 
+    //! Attempt to dequeue up to n items from queue, taking their tickets at once
+    /** assign_item is called for the items in order with the same dst.
+        Returns the number of items dequeued. */
+    size_t internal_try_pop_many( size_t n, void* dst, item_assigner_t assign_item ) ;
+
     //! Get size of queue; result may be invalid if queue is modified concurrently
     size_t internal_size() const ;
 
@@ -560,10 +583,64 @@ bool concurrent_queue_base_v3<T>::internal_try_pop( void* dst ) {
                 break;
             // Another thread snatched the item, retry.
         }
-    } while( !r.choose( k ).pop( dst, k, *this ) );
+    } while( !r.choose( k ).pop( dst, k, *this, &assign_to_item ) );
     return true;
 }
 
+template<typename T>
+void concurrent_queue_base_v3<T>::internal_push_range( size_t n, const void* src, item_constructor_t construct_item ) {
+    concurrent_queue_rep<T>& r = *my_rep;
+    ticket k = r.tail_counter.fetch_and_add( n );
+    const ticket end = k+n;
+    __TBB_TRY {
+        for( ; k!=end; ++k )
+            r.choose(k).push( src, k, *this, construct_item );
+    } __TBB_CATCH (...) {
+        // Pass the tickets left, or the pushes and pops behind them would wait forever
+        for( ++k; k!=end; ++k ) {
+            __TBB_TRY {
+                r.choose(k).push( NULL, k, *this, construct_item );
+            } __TBB_CATCH (...) {}
+        }
+        __TBB_RETHROW();
+    }
+}
+
+template<typename T>
+size_t concurrent_queue_base_v3<T>::internal_try_pop_many( size_t n, void* dst, item_assigner_t assign_item ) {
+    concurrent_queue_rep<T>& r = *my_rep;
+    size_t popped = 0;
+    while( popped<n ) {
+        ticket k = r.head_counter, end;
+        for(;;) {
+            ptrdiff_t available = r.tail_counter-k;
+            if( available<=0 ) {
+                // Queue is empty
+                return popped;
+            }
+            // Attempt to get all the items we need among those the queue had when we looked.
+            end = k + (n-popped < size_t(available) ? n-popped : size_t(available));
+            ticket tk=k;
+            k = r.head_counter.compare_and_swap( end, tk );
+            if( k==tk )
+                break;
+            // Another thread snatched some items, retry.
+        }
+        for( ; k!=end; ++k ) {
+            __TBB_TRY {
+                if( r.choose( k ).pop( dst, k, *this, assign_item ) )
+                    ++popped;
+            } __TBB_CATCH (...) {
+                // Pop the tickets left so that the queue keeps going; their items are lost
+                for( ++k; k!=end; ++k )
+                    r.choose( k ).pop( NULL, k, *this, assign_item );
+                __TBB_RETHROW();
+            }
+        }
+    }
+    return popped;
+}
+
 template<typename T>
 size_t concurrent_queue_base_v3<T>::internal_size() const {
     concurrent_queue_rep<T>& r = *my_rep;
@@ -841,6 +918,7 @@ private:
     friend class micro_queue_pop_finalizer;
     friend class concurrent_queue_iterator_rep;
     friend class concurrent_queue_iterator_base_v3;
+    friend class concurrent_queue_base_v8;
 protected:
     //! Prefix on a page
     struct page {
@@ -957,6 +1035,21 @@ protected:
 
     //! Enqueue item at tail of queue using move operation
     void __TBB_EXPORTED_METHOD internal_push_move( const void* src );
+
+    //! Constructs the next item of a range at the given place of the page
+    typedef void (*range_item_constructor)( void* range, page& dst, size_t index );
+
+    //! Assigns the item at the given place of the page to the next place of a range, and destroys it
+    /** range is NULL when the item must only be destroyed. */
+    typedef void (*range_item_assigner)( void* range, page& src, size_t index );
+
+    //! Enqueue n items at tail of queue, taking their tickets at once
+    /** Blocks while the queue is full; waiting consumers are notified once for all the items. */
+    void __TBB_EXPORTED_METHOD internal_push_range( size_t n, range_item_constructor construct_item, void* range );
+
+    //! Attempt to dequeue up to n items from head of queue, taking their tickets at once
+    /** Returns the number of items dequeued; waiting producers are notified once for all the items. */
+    size_t __TBB_EXPORTED_METHOD internal_pop_many_if_present( size_t n, range_item_assigner assign_item, void* range );
 private:
     friend struct micro_queue;
     virtual void move_page_item( page& dst, size_t dindex, const page& src, size_t sindex ) = 0;
@@ -49,16 +49,137 @@
 #include "../atomic.h"
 #include "../tbb_exception.h"
 #include "../tbb_allocator.h"
+#include "../cache_aligned_allocator.h"
+#include "../spin_mutex.h"
 
 #if __TBB_INITIALIZER_LISTS_PRESENT
     #include <initializer_list>
 #endif
 
 namespace tbb {
+
+//! @cond INTERNAL
+namespace internal {
+    //! Declares a quiescent state of the calling thread if it is a TBB worker which the scheduler tracks.
+    /** Returns false for other threads, which register their operations in the epochs. **/
+    bool __TBB_EXPORTED_FUNC notify_worker_quiescent_state();
+
+    //! Starts a new generation of quiescent states of the TBB worker threads, and returns it
+    uintptr_t __TBB_EXPORTED_FUNC advance_worker_generation();
+
+    //! Returns true if each tracked worker thread has been in a quiescent state since the generation started
+    bool __TBB_EXPORTED_FUNC workers_quiescent_since( uintptr_t generation );
+} // namespace internal
+//! @endcond
+
 namespace interface5 {
 //! @cond INTERNAL
 namespace internal {
 
+//! Hash multiplier
+static const size_t hash_multiplier = tbb::internal::select_size_t_constant<2654435769U, 11400714819323198485ULL>::value;
+
+//! Epochs of operations on a split-ordered list, for reclamation of concurrently erased nodes
+/** An operation registers in the current epoch for its duration, in one of the slots selected
+    by the stack address, so threads mostly do not share the cache lines they modify. The epoch
+    is advanced when no operation is registered in the previous one, so nodes unlinked in an
+    epoch cannot be reached by any operation once the epoch is advanced twice. **/
+class solist_epochs : tbb::internal::no_copy {
+    //! Counters of operations registered in each of three consecutive epochs
+    struct slot {
+        atomic<intptr_t> count[3];
+    };
+    static const size_t slots_number = 16;
+
+    atomic<uintptr_t> my_epoch;
+    tbb::internal::padded<slot> my_slots[slots_number];
+public:
+    solist_epochs() {
+        my_epoch = 0;
+        for( size_t k = 0; k < slots_number; k++ )
+            for( int i = 0; i < 3; i++ )
+                my_slots[k].count[i] = 0;
+    }
+
+    //! Registers an operation for its lifetime, unless its thread is tracked otherwise
+    class guard : tbb::internal::no_copy {
+        atomic<intptr_t> *my_count;
+
+        void enter( solist_epochs &e ) {
+            int local;
+            // threads use separate stacks, so they mostly use different slots
+            size_t k = (reinterpret_cast<uintptr_t>(&local) >> 12) * hash_multiplier;
+            slot &s = e.my_slots[k >> (8*sizeof(size_t) - 4)];
+            for(;;) {
+                uintptr_t epoch = e.my_epoch;
+                my_count = &s.count[epoch % 3];
+                ++*my_count; // full fence, nodes are read after the registration is visible
+                if( e.my_epoch == epoch )
+                    break;
+                // the epoch was advanced meanwhile, without regard to this registration
+                --*my_count;
+            }
+        }
+    public:
+        guard( solist_epochs &e, bool registered = true ) : my_count(NULL) {
+            if( registered )
+                enter( e );
+        }
+        //! Does nothing if there are no epochs
+        guard( solist_epochs *e, bool registered ) : my_count(NULL) {
+            if( e && registered )
+                enter( *e );
+        }
+        ~guard() {
+            if( my_count )
+                --*my_count;
+        }
+    };
+
+    uintptr_t current() const { return my_epoch; }
+
+    //! Advances the epoch if no operation is registered in the previous one
+    bool try_advance( uintptr_t epoch ) {
+        for( size_t k = 0; k < slots_number; k++ )
+            if( my_slots[k].count[(epoch+2) % 3] )
+                return false;
+        return my_epoch.compare_and_swap( epoch+1, epoch ) == epoch;
+    }
+};
+
+} // namespace internal
+//! @endcond
+
+//! Hasher functions
+template<typename T>
+inline size_t tbb_hasher( const T& t ) {
+    return static_cast<size_t>( t ) * internal::hash_multiplier;
+}
+template<typename P>
+inline size_t tbb_hasher( P* ptr ) {
+    size_t const h = reinterpret_cast<size_t>( ptr );
+    return (h >> 3) ^ h;
+}
+template<typename E, typename S, typename A>
+inline size_t tbb_hasher( const std::basic_string<E,S,A>& s ) {
+    size_t h = 0;
+    for( const E* c = s.c_str(); *c; ++c )
+        h = static_cast<size_t>(*c) ^ (h * internal::hash_multiplier);
+    return h;
+}
+template<typename F, typename S>
+inline size_t tbb_hasher( const std::pair<F,S>& p ) {
+    return tbb_hasher(p.first) ^ tbb_hasher(p.second);
+}
+} // namespace interface5
+using interface5::tbb_hasher;
+
+namespace interface9 {
+//! @cond INTERNAL
+namespace internal {
+
+using tbb::interface5::internal::solist_epochs;
+
 template <typename T, typename Allocator>
 class split_ordered_list;
 template <typename Traits>
@@ -90,7 +211,7 @@ public:
     pointer operator->() const { return &**this; }
 
     flist_iterator& operator++() {
-        my_node_ptr = my_node_ptr->my_next;
+        my_node_ptr = my_node_ptr->get_next();
         return *this;
     }
 
@@ -252,6 +373,26 @@ public:
             return (my_order_key & 0x1) == 0;
         }
 
+        // The lowest bit of the next pointer is set when the element is erased concurrently. Such node is
+        // unlinked by any operation which finds it, and it is reclaimed once no operation can reach it.
+        static nodeptr_t marked(nodeptr_t pnode) {
+            return reinterpret_cast<nodeptr_t>(reinterpret_cast<uintptr_t>(pnode) | 1);
+        }
+
+        static nodeptr_t unmarked(nodeptr_t pnode) {
+            return reinterpret_cast<nodeptr_t>(reinterpret_cast<uintptr_t>(pnode) & ~uintptr_t(1));
+        }
+
+        // Checks if the element is erased concurrently
+        bool is_erased() const {
+            return (reinterpret_cast<uintptr_t>(__TBB_load_with_acquire(my_next)) & 1) != 0;
+        }
+
+        // Returns the next element, whether this one is erased or not
+        nodeptr_t get_next() const {
+            return unmarked(__TBB_load_with_acquire(my_next));
+        }
+
 
         nodeptr_t  my_next;      // Next element in the list
         value_type my_element;   // Element storage
@@ -260,7 +401,7 @@ public:
 
     // Allocate a new node with the given order key; used to allocate dummy nodes
     nodeptr_t create_node(sokey_t order_key) {
-        nodeptr_t pnode = my_node_allocator.allocate(1);
+        nodeptr_t pnode = allocate_node();
         pnode->init(order_key);
         return (pnode);
     }
@@ -268,14 +409,14 @@ public:
     // Allocate a new node with the given order key and value
     template<typename Arg>
     nodeptr_t create_node(sokey_t order_key, __TBB_FORWARDING_REF(Arg) t){
-        nodeptr_t pnode = my_node_allocator.allocate(1);
+        nodeptr_t pnode = allocate_node();
 
         //TODO: use RAII scoped guard instead of explicit catch
         __TBB_TRY {
             new(static_cast<void*>(&pnode->my_element)) T(tbb::internal::forward<Arg>(t));
             pnode->init(order_key);
         } __TBB_CATCH(...) {
-            my_node_allocator.deallocate(pnode, 1);
+            free_node(pnode);
             __TBB_RETHROW();
         }
 
@@ -285,13 +426,13 @@ public:
     // Allocate a new node with the given parameters for constructing value
     template<typename __TBB_PARAMETER_PACK Args>
     nodeptr_t create_node_v( __TBB_FORWARDING_REF(Args) __TBB_PARAMETER_PACK args){
-        nodeptr_t pnode = my_node_allocator.allocate(1);
+        nodeptr_t pnode = allocate_node();
 
         //TODO: use RAII scoped guard instead of explicit catch
         __TBB_TRY {
             new(static_cast<void*>(&pnode->my_element)) T(__TBB_PACK_EXPANSION(tbb::internal::forward<Args>(args)));
         } __TBB_CATCH(...) {
-            my_node_allocator.deallocate(pnode, 1);
+            free_node(pnode);
             __TBB_RETHROW();
         }
 
@@ -301,9 +442,13 @@ public:
    split_ordered_list(allocator_type a = allocator_type())
        : my_node_allocator(a), my_element_count(0)
     {
+        my_reclamation = NULL;
+        my_chunk = NULL;
+        my_free_nodes = NULL;
         // Immediately allocate a dummy node with order key of 0. This node
-        // will always be the head of the list.
-        my_head = create_node(sokey_t(0));
+        // will always be the head of the list. It is not pooled, so that clear() frees all the chunks.
+        my_head = my_node_allocator.allocate(1);
+        my_head->init(sokey_t(0));
     }
 
     ~split_ordered_list()
@@ -317,7 +462,13 @@ public:
 
         __TBB_ASSERT(pnode != NULL && pnode->my_next == NULL, "Invalid head list node");
 
-        destroy_node(pnode);
+        my_node_allocator.deallocate(pnode, 1);
+
+        if (my_reclamation)
+        {
+            my_reclamation->~reclamation_state();
+            cache_aligned_allocator<reclamation_state>().deallocate(my_reclamation, 1);
+        }
     }
 
     // Common forward list functions
@@ -327,6 +478,8 @@ public:
     }
 
     void clear() {
+        reclaim_retired_nodes();
+
         nodeptr_t pnext;
         nodeptr_t pnode = my_head;
 
@@ -335,14 +488,16 @@ public:
         pnode->my_next = NULL;
         pnode = pnext;
 
+        // The nodes are freed with their chunks, only the elements are destroyed one by one
         while (pnode != NULL)
         {
             pnext = pnode->my_next;
-            destroy_node(pnode);
+            if (!pnode->is_dummy()) my_node_allocator.destroy(pnode);
             pnode = pnext;
         }
 
         my_element_count = 0;
+        release_pool();
     }
 
     // Returns a first non-dummy element in the SOL
@@ -397,6 +552,14 @@ public:
 
             std::swap(my_element_count, other.my_element_count);
             std::swap(my_head, other.my_head);
+            std::swap(my_reclamation, other.my_reclamation);
+
+            node_chunk *chunk = my_chunk;
+            my_chunk = other.my_chunk;
+            other.my_chunk = chunk;
+            nodeptr_t free_nodes = my_free_nodes;
+            my_free_nodes = other.my_free_nodes;
+            other.my_free_nodes = free_nodes;
     }
 
     // Split-order list functions
@@ -474,10 +637,10 @@ public:
         return const_iterator(it.get_node_ptr(), this);
     }
 
-    // Erase an element using the allocator
+    // Erase an element and return its node to the pool
     void destroy_node(nodeptr_t pnode) {
         if (!pnode->is_dummy()) my_node_allocator.destroy(pnode);
-        my_node_allocator.deallocate(pnode, 1);
+        free_node(pnode);
     }
 
     // Try to insert a new element in the list.
@@ -509,6 +672,7 @@ public:
     raw_iterator insert_dummy(raw_iterator it, sokey_t order_key)
     {
         raw_iterator last = raw_end();
+        raw_iterator parent = it;
         raw_iterator where = it;
 
         __TBB_ASSERT(where != last, "Invalid head node");
@@ -522,6 +686,16 @@ public:
         {
             __TBB_ASSERT(it != last, "Invalid head list node");
 
+            if (where != last && where.get_node_ptr()->is_erased())
+            {
+                // Unlink the erased element, or start over from the parent dummy node which is never erased
+                if (!try_unlink(it, where))
+                    it = parent;
+                where = it;
+                ++where;
+                continue;
+            }
+
             // If the head iterator is at the end of the list, or past the point where this dummy
             // node needs to be inserted, then try to insert it.
             if (where == last || get_order_key(where) > order_key)
@@ -542,8 +716,9 @@ public:
                     // Insertion failed: either dummy node was inserted by another thread, or
                     // a real element was inserted at exactly the same place as dummy node.
                     // Proceed with the search from the previous location where order key was
-                    // known to be larger (note: this is legal only because there is no safe
-                    // concurrent erase operation supported).
+                    // known to be larger, unless the element there is erased meanwhile.
+                    if (it.get_node_ptr()->is_erased())
+                        it = parent;
                     where = it;
                     ++where;
                     continue;
@@ -563,6 +738,37 @@ public:
 
     }
 
+    // Marks the element as erased; returns false if it is already erased by another thread
+    bool try_mark_erased(raw_iterator where)
+    {
+        nodeptr_t pnode = where.get_node_ptr();
+        __TBB_ASSERT(!pnode->is_dummy(), "Dummy nodes are never erased concurrently");
+        for (;;)
+        {
+            nodeptr_t next = __TBB_load_with_acquire(pnode->my_next);
+            if (reinterpret_cast<uintptr_t>(next) & 1)
+                return false;
+            if (tbb::internal::as_atomic(pnode->my_next).compare_and_swap(node::marked(next), next) == next)
+            {
+                tbb::internal::as_atomic(my_element_count).fetch_and_decrement();
+                return true;
+            }
+        }
+    }
+
+    // Unlinks the erased element following the previous one. Fails if the previous element
+    // is changed or erased itself, then the search has to be restarted.
+    bool try_unlink(raw_iterator previous, raw_iterator where)
+    {
+        nodeptr_t pnode = where.get_node_ptr();
+        nodeptr_t next = pnode->get_next();
+        // Not atomic_set_next, which cannot tell a failure when the node is unlinked by another thread
+        if (tbb::internal::as_atomic(previous.get_node_ptr()->my_next).compare_and_swap(next, pnode) != pnode)
+            return false;
+        retire_node(pnode);
+        return true;
+    }
+
     // This erase function can handle both real and dummy nodes
     void erase_node(raw_iterator previous, raw_const_iterator& where)
     {
@@ -611,16 +817,249 @@ public:
     }
 
 
+    // Registers an operation in the epochs if concurrent erase is enabled, unless the operation
+    // runs on a TBB worker tracked by the scheduler
+    class epoch_guard : public solist_epochs::guard {
+    public:
+        epoch_guard( solist_epochs *e ) : solist_epochs::guard( e, e && !tbb::internal::notify_worker_quiescent_state() ) {}
+    };
+
+    // Returns NULL unless concurrent erase is enabled
+    solist_epochs* epochs() const {
+        return my_reclamation;
+    }
+
+    // Starts tracking operations for reclamation of concurrently erased elements
+    void enable_concurrent_erase() {
+        if (!my_reclamation)
+            my_reclamation = new( cache_aligned_allocator<reclamation_state>().allocate(1) ) reclamation_state;
+    }
+
 private:
     //Need to setup private fields of split_ordered_list in move constructor and assignment of concurrent_unordered_base
     template <typename Traits>
     friend class concurrent_unordered_base;
 
-    // Check the list for order violations
+    // Elements unlinked in an epoch
+    struct retired_block {
+        static const size_t capacity = 62;
+        retired_block *next;
+        size_t count;
+        nodeptr_t nodes[capacity];
+    };
+
+    // Operations of TBB workers are not registered in the epochs. A worker declares a quiescent
+    // state when it starts an operation and between tasks, so the epoch is advanced only when
+    // each worker has been quiescent since the previous advance, and elements unlinked in an
+    // epoch cannot be reached by workers either once the epoch is advanced twice.
+    struct reclamation_state : solist_epochs {
+        // Number of retired elements between attempts to advance the epoch
+        static const size_t advance_period = 32;
+
+        spin_mutex mutex; // protects the fields below
+        size_t retired_since_advance;
+        uintptr_t worker_generation; // started at the latest advance
+        uintptr_t list_epochs[3];
+        retired_block *lists[3];
+
+        reclamation_state() : retired_since_advance(0) {
+            worker_generation = tbb::internal::advance_worker_generation();
+            for (int i = 0; i < 3; i++)
+            {
+                list_epochs[i] = 0;
+                lists[i] = NULL;
+            }
+        }
+    };
+
+    typedef tbb::tbb_allocator<retired_block> block_allocator_type;
+
+    // Nodes are carved from chunks allocated by the node allocator, so that bulk insertion makes
+    // few allocations and the nodes inserted together are adjacent in memory. Chunks double in size
+    // up to max_chunk_nodes, which keeps both the number of chunks freed by clear() and the unused
+    // tail of the latest chunk small. The chunk header takes the first nodes of the chunk.
+    struct node_chunk {
+        static const size_t initial_nodes = 32;
+        static const size_t max_chunk_nodes = 64*1024;
+
+        node_chunk *next;       // the chunk allocated before this one
+        size_t capacity;        // number of nodes in the chunk, including the header ones
+        atomic<size_t> used;    // number of nodes taken; exceeds the capacity when the chunk is exhausted
+
+        static size_t header_nodes() {
+            return (sizeof(node_chunk) + sizeof(node) - 1) / sizeof(node);
+        }
+    };
+
+    // Takes a node from the pool; the node is uninitialized
+    nodeptr_t allocate_node()
+    {
+        if (my_free_nodes)
+        {
+            // Only one thread removes from the free list at a time, so a removed node cannot be
+            // returned meanwhile (the ABA problem). Allocation from a chunk is cheaper than waiting.
+            spin_mutex::scoped_lock lock;
+            if (lock.try_acquire(my_pool_mutex))
+            {
+                nodeptr_t pnode = my_free_nodes;
+                while (pnode)
+                {
+                    nodeptr_t head = my_free_nodes.compare_and_swap(pnode->my_next, pnode);
+                    if (head == pnode)
+                        return pnode;
+                    pnode = head;
+                }
+            }
+        }
+        for (;;)
+        {
+            node_chunk *chunk = my_chunk;
+            if (chunk)
+            {
+                size_t index = chunk->used.fetch_and_increment();
+                if (index < chunk->capacity)
+                    return reinterpret_cast<nodeptr_t>(chunk) + index;
+            }
+            grow_pool(chunk);
+        }
+    }
+
+    // Allocates the next chunk unless another thread has done it
+    void grow_pool(node_chunk *exhausted)
+    {
+        spin_mutex::scoped_lock lock(my_pool_mutex);
+        if (my_chunk != exhausted)
+            return;
+        size_t capacity = exhausted ? exhausted->capacity*2 : node_chunk::initial_nodes;
+        if (capacity > node_chunk::max_chunk_nodes)
+            capacity = node_chunk::max_chunk_nodes;
+        node_chunk *chunk = new( static_cast<void*>(my_node_allocator.allocate(capacity)) ) node_chunk;
+        chunk->next = exhausted;
+        chunk->capacity = capacity;
+        chunk->used = node_chunk::header_nodes();
+        my_chunk = chunk;
+    }
+
+    // Returns the node to the pool; nodes are pushed concurrently without the lock
+    void free_node(nodeptr_t pnode)
+    {
+        for (;;)
+        {
+            nodeptr_t head = my_free_nodes;
+            pnode->my_next = head;
+            if (my_free_nodes.compare_and_swap(pnode, head) == head)
+                return;
+        }
+    }
+
+    // Frees all the chunks; there must be no concurrent operations
+    void release_pool()
+    {
+        node_chunk *chunk = my_chunk;
+        while (chunk)
+        {
+            node_chunk *next = chunk->next;
+            size_t capacity = chunk->capacity;
+            chunk->~node_chunk();
+            my_node_allocator.deallocate(reinterpret_cast<nodeptr_t>(chunk), capacity);
+            chunk = next;
+        }
+        my_chunk = NULL;
+        my_free_nodes = NULL;
+    }
+
+    // Keeps the unlinked element until no operation can reach it
+    void retire_node(nodeptr_t pnode)
+    {
+        if (!my_reclamation)
+        {
+            // Erasure is not concurrent with other operations
+            destroy_node(pnode);
+            return;
+        }
+        reclamation_state &s = *my_reclamation;
+        retired_block *expired = NULL;
+        {
+            spin_mutex::scoped_lock lock(s.mutex);
+            uintptr_t epoch = s.current();
+            size_t k = epoch % 3;
+            if (s.list_epochs[k] != epoch)
+            {
+                // The list was filled three or more epochs ago
+                expired = s.lists[k];
+                s.lists[k] = NULL;
+                s.list_epochs[k] = epoch;
+            }
+            retired_block *block = s.lists[k];
+            if (!block || block->count == retired_block::capacity)
+            {
+                if (expired)
+                {
+                    block = expired;
+                    expired = expired->next;
+                    destroy_retired(block);
+                }
+                else
+                    block = block_allocator_type().allocate(1);
+                block->count = 0;
+                block->next = s.lists[k];
+                s.lists[k] = block;
+            }
+            block->nodes[block->count++] = pnode;
+
+            if (++s.retired_since_advance >= reclamation_state::advance_period
+                && tbb::internal::workers_quiescent_since(s.worker_generation) && s.try_advance(epoch))
+            {
+                s.retired_since_advance = 0;
+                s.worker_generation = tbb::internal::advance_worker_generation();
+                // The elements unlinked in the previous epoch are not reachable now
+                k = (epoch+2) % 3;
+                while (retired_block *b = s.lists[k])
+                {
+                    s.lists[k] = b->next;
+                    b->next = expired;
+                    expired = b;
+                }
+            }
+        }
+        free_retired(expired);
+    }
+
+    // Destroys the retired elements; there must be no concurrent operations
+    void reclaim_retired_nodes()
+    {
+        if (!my_reclamation)
+            return;
+        reclamation_state &s = *my_reclamation;
+        for (int i = 0; i < 3; i++)
+        {
+            free_retired(s.lists[i]);
+            s.lists[i] = NULL;
+        }
+    }
+
+    void destroy_retired(retired_block *block)
+    {
+        for (size_t i = 0; i < block->count; i++)
+            destroy_node(block->nodes[i]);
+    }
+
+    void free_retired(retired_block *block)
+    {
+        while (block)
+        {
+            retired_block *next = block->next;
+            destroy_retired(block);
+            block_allocator_type().deallocate(block, 1);
+            block = next;
+        }
+    }
+
+    // Check the list for order violations; the last node may be unlinked concurrently
     void check_range( raw_iterator first, raw_iterator last )
     {
 #if TBB_USE_ASSERT
-        for (raw_iterator it = first; it != last; ++it)
+        for (raw_iterator it = first; it != last && it != raw_end(); ++it)
         {
             raw_iterator next = it;
             ++next;
@@ -641,6 +1080,10 @@ private:
     typename allocator_type::template rebind<node>::other my_node_allocator;  // allocator object for nodes
     size_type                                             my_element_count;   // Total item count, not counting dummy nodes
     nodeptr_t                                             my_head;            // pointer to head node
+    reclamation_state                                    *my_reclamation;     // epochs and retired nodes
+    atomic<node_chunk*>                                   my_chunk;           // the latest chunk of the node pool
+    atomic<nodeptr_t>                                     my_free_nodes;      // destroyed nodes to be reused
+    spin_mutex                                            my_pool_mutex;      // serializes chunk allocation and removal of free nodes
 };
 
 // Template class for hash compare
@@ -1050,6 +1493,43 @@ public:
         return item_count;
     }
 
+    //! Erases the elements with the key, returns their number.
+    /** Can be called concurrently with insertion, lookup and erasure if enable_concurrent_erase()
+        was called; otherwise it is not concurrency safe, like unsafe_erase(). An erased element
+        is destroyed once no operation can reach it, so it must not be accessed through iterators
+        or references after it is erased, unless they are protected by a lookup_guard. Traversal
+        of the container concurrently with erasure is not safe. Operations on TBB worker threads
+        are not registered for reclamation, so the hash function, key comparison and element
+        constructors must not wait for TBB tasks. */
+    size_type erase(const key_type& key) {
+        return internal_concurrent_erase(key);
+    }
+
+    //! Makes erase() safe to call concurrently with other operations.
+    /** Operations then track their lifetime, so that erased elements are destroyed only
+        after all the operations which could see them are finished. This costs a call into
+        the library per operation, and two atomic updates per operation on threads other than
+        TBB workers. The method is not thread-safe, call it before concurrent operations.
+        The mode is not copied with the container. */
+    void enable_concurrent_erase() {
+        my_solist.enable_concurrent_erase();
+    }
+
+    //! True if erase() is concurrency safe
+    bool concurrent_erase_enabled() const {
+        return my_solist.epochs() != NULL;
+    }
+
+    //! Keeps elements from being destroyed by a concurrent erase() while the guard exists.
+    /** Iterators and references obtained by lookups after the guard is created can be used
+        until it is destroyed, even if the elements are erased meanwhile. A guard delays the
+        destruction of all the elements erased during its lifetime, so it should be short.
+        The guard does nothing unless concurrent erase is enabled. */
+    class lookup_guard : solist_epochs::guard {
+    public:
+        lookup_guard( const concurrent_unordered_base &table ) : solist_epochs::guard( table.my_solist.epochs(), true ) {}
+    };
+
     void swap(concurrent_unordered_base& right) {
         if (this != &right) {
             std::swap(my_hash_compare, right.my_hash_compare); // TODO: check what ADL meant here
@@ -1083,6 +1563,10 @@ public:
     }
 
     // Lookup
+
+    //! Returns the iterator to an element with the key, or end().
+    /** If erase() is called concurrently, the element may be accessed only while a lookup_guard
+        created before find() exists. The same holds for equal_range(). */
     iterator find(const key_type& key) {
         return internal_find(key);
     }
@@ -1093,9 +1577,7 @@ public:
 
     size_type count(const key_type& key) const {
         if(allow_multimapping) {
-            paircc_t answer = equal_range(key);
-            size_type item_count = internal_distance(answer.first, answer.second);
-            return item_count;
+            return const_cast<self_type*>(this)->internal_count(key);
         } else {
             return const_cast<self_type*>(this)->internal_find(key) == end()?0:1;
         }
@@ -1287,6 +1769,7 @@ private:
     template< typename ValueType>
     std::pair<iterator, bool> internal_insert( __TBB_FORWARDING_REF(ValueType) value, nodeptr_t pnode = NULL)
     {
+        typename solist_t::epoch_guard guard(my_solist.epochs());
         sokey_t order_key = (sokey_t) my_hash_compare(get_key(value));
         size_type bucket = order_key % my_number_of_buckets;
 
@@ -1308,6 +1791,15 @@ private:
 
         for (;;)
         {
+            if (where != last && where.get_node_ptr()->is_erased())
+            {
+                // Unlink the erased element, or start over from the dummy node which is never erased
+                if (!my_solist.try_unlink(it, where))
+                    it = get_bucket(bucket);
+                where = it;
+                ++where;
+                continue;
+            }
             if (where == last || solist_t::get_order_key(where) > order_key)
             {
                  if (!pnode)
@@ -1327,8 +1819,9 @@ private:
                     // Insertion failed: either the same node was inserted by another thread, or
                     // another element was inserted at exactly the same place as this node.
                     // Proceed with the search from the previous location where order key was
-                    // known to be larger (note: this is legal only because there is no safe
-                    // concurrent erase operation supported).
+                    // known to be larger, unless the element there is erased meanwhile.
+                    if (it.get_node_ptr()->is_erased())
+                        it = get_bucket(bucket);
                     where = it;
                     ++where;
                     continue;
@@ -1351,6 +1844,7 @@ private:
     // Find the element in the split-ordered list
     iterator internal_find(const key_type& key)
     {
+        typename solist_t::epoch_guard guard(my_solist.epochs());
         sokey_t order_key = (sokey_t) my_hash_compare(key);
         size_type bucket = order_key % my_number_of_buckets;
 
@@ -1374,7 +1868,7 @@ private:
                 // The fact that order keys match does not mean that the element is found.
                 // Key function comparison has to be performed to check whether this is the
                 // right element. If not, keep searching while order key is the same.
-                if (!my_hash_compare(get_key(*it), key))
+                if (!my_hash_compare(get_key(*it), key) && !it.get_node_ptr()->is_erased())
                     return my_solist.get_iterator(it);
             }
         }
@@ -1382,6 +1876,33 @@ private:
         return end();
     }
 
+    // Count the elements with the key in one pass, so that concurrently erased elements are not accessed afterwards
+    size_type internal_count(const key_type& key)
+    {
+        typename solist_t::epoch_guard guard(my_solist.epochs());
+        sokey_t order_key = (sokey_t) my_hash_compare(key);
+        size_type bucket = order_key % my_number_of_buckets;
+
+        // If bucket is empty, initialize it first
+        if (!is_initialized(bucket))
+            init_bucket(bucket);
+
+        order_key = split_order_key_regular(order_key);
+        raw_iterator last = my_solist.raw_end();
+        size_type item_count = 0;
+
+        for (raw_iterator it = get_bucket(bucket); it != last; ++it)
+        {
+            if (solist_t::get_order_key(it) > order_key)
+                break;
+            if (solist_t::get_order_key(it) == order_key && !my_hash_compare(get_key(*it), key)
+                && !it.get_node_ptr()->is_erased())
+                ++item_count;
+        }
+
+        return item_count;
+    }
+
     // Erase an element from the list. This is not a concurrency safe function.
     iterator internal_erase(const_iterator it)
     {
@@ -1417,10 +1938,65 @@ private:
         }
     }
 
+    // Erase the elements with the key from the list, concurrently with other operations.
+    // An element is erased when its node is marked, then the node is unlinked by this or any
+    // other operation which finds it.
+    size_type internal_concurrent_erase(const key_type& key)
+    {
+        typename solist_t::epoch_guard guard(my_solist.epochs());
+        sokey_t order_key = (sokey_t) my_hash_compare(key);
+        size_type bucket = order_key % my_number_of_buckets;
+
+        // If bucket is empty, initialize it first
+        if (!is_initialized(bucket))
+            init_bucket(bucket);
+
+        order_key = split_order_key_regular(order_key);
+
+        size_type item_count = 0;
+        raw_iterator it = get_bucket(bucket);
+        raw_iterator last = my_solist.raw_end();
+        raw_iterator where = it;
+
+        __TBB_ASSERT(where != last, "Invalid head node");
+
+        // First node is a dummy node
+        ++where;
+
+        // Stop past the elements with the order key, when the marked ones are unlinked
+        while (where != last)
+        {
+            if (!where.get_node_ptr()->is_erased())
+            {
+                sokey_t current_key = solist_t::get_order_key(where);
+                if (current_key > order_key)
+                    break;
+                if (current_key != order_key || (item_count && !allow_multimapping)
+                    || my_hash_compare(get_key(*where), key))
+                {
+                    // Move the iterator forward
+                    it = where;
+                    ++where;
+                    continue;
+                }
+                if (!my_solist.try_mark_erased(where))
+                    continue; // erased by another thread meanwhile
+                ++item_count;
+            }
+            // Unlink the erased element, or start over from the dummy node which is never erased
+            if (!my_solist.try_unlink(it, where))
+                it = get_bucket(bucket);
+            where = it;
+            ++where;
+        }
+        return item_count;
+    }
+
     // Return the [begin, end) pair of iterators with the same key values.
     // This operation makes sense only if mapping is many-to-one.
     pairii_t internal_equal_range(const key_type& key)
     {
+        typename solist_t::epoch_guard guard(my_solist.epochs());
         sokey_t order_key = (sokey_t) my_hash_compare(key);
         size_type bucket = order_key % my_number_of_buckets;
 
@@ -1438,7 +2014,8 @@ private:
                 // There is no element with the given key
                 return pairii_t(end(), end());
             }
-            else if (solist_t::get_order_key(it) == order_key && !my_hash_compare(get_key(*it), key))
+            else if (solist_t::get_order_key(it) == order_key && !my_hash_compare(get_key(*it), key)
+                     && !it.get_node_ptr()->is_erased())
             {
                 iterator first = my_solist.get_iterator(it);
                 iterator last = first;
@@ -1562,33 +2139,9 @@ private:
 #pragma warning(pop) // warning 4127 is back
 #endif
 
-//! Hash multiplier
-static const size_t hash_multiplier = tbb::internal::select_size_t_constant<2654435769U, 11400714819323198485ULL>::value;
 } // namespace internal
 //! @endcond
-//! Hasher functions
-template<typename T>
-inline size_t tbb_hasher( const T& t ) {
-    return static_cast<size_t>( t ) * internal::hash_multiplier;
-}
-template<typename P>
-inline size_t tbb_hasher( P* ptr ) {
-    size_t const h = reinterpret_cast<size_t>( ptr );
-    return (h >> 3) ^ h;
-}
-template<typename E, typename S, typename A>
-inline size_t tbb_hasher( const std::basic_string<E,S,A>& s ) {
-    size_t h = 0;
-    for( const E* c = s.c_str(); *c; ++c )
-        h = static_cast<size_t>(*c) ^ (h * internal::hash_multiplier);
-    return h;
-}
-template<typename F, typename S>
-inline size_t tbb_hasher( const std::pair<F,S>& p ) {
-    return tbb_hasher(p.first) ^ tbb_hasher(p.second);
-}
-} // namespace interface5
-using interface5::tbb_hasher;
+} // namespace interface9
 
 
 // Template class for hash compare
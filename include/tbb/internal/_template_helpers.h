@@ -22,6 +22,9 @@
 #define __TBB_template_helpers_H
 
 #include <utility>
+#if __TBB_CPP11_TYPE_PROPERTIES_PRESENT || __TBB_TR1_TYPE_PROPERTIES_IN_STD_PRESENT
+#include <type_traits>
+#endif
 
 namespace tbb { namespace internal {
 
@@ -54,6 +57,25 @@ template<typename T, size_t N> struct strip<const volatile T(&)[N]> { typedef co
 template<class U, class V> struct is_same_type      { static const bool value = false; };
 template<class W>          struct is_same_type<W,W> { static const bool value = true; };
 
+// Obtain type properties in one or another way
+#if   __TBB_CPP11_TYPE_PROPERTIES_PRESENT
+template<typename T> struct tbb_trivially_copyable { enum { value = std::is_trivially_copyable<T>::value }; };
+#elif __TBB_TR1_TYPE_PROPERTIES_IN_STD_PRESENT
+template<typename T> struct tbb_trivially_copyable { enum { value = std::has_trivial_copy_constructor<T>::value }; };
+#else
+// Explicitly list the types known to be trivially copyable and not bigger than a pointer.
+template<typename T> struct tbb_trivially_copyable { enum { value = false }; };
+template<typename T> struct tbb_trivially_copyable <T*> { enum { value = true }; };
+template<> struct tbb_trivially_copyable <short> { enum { value = true }; };
+template<> struct tbb_trivially_copyable <unsigned short> { enum { value = true }; };
+template<> struct tbb_trivially_copyable <int> { enum { value = sizeof(int) <= sizeof(void*) }; };
+template<> struct tbb_trivially_copyable <unsigned int> { enum { value = sizeof(int) <= sizeof(void*) }; };
+template<> struct tbb_trivially_copyable <long> { enum { value = sizeof(long) <= sizeof(void*) }; };
+template<> struct tbb_trivially_copyable <unsigned long> { enum { value = sizeof(long) <= sizeof(void*) }; };
+template<> struct tbb_trivially_copyable <float> { enum { value = sizeof(float) <= sizeof(void*) }; };
+template<> struct tbb_trivially_copyable <double> { enum { value = sizeof(double) <= sizeof(void*) }; };
+#endif // Obtaining type properties
+
 #if __TBB_CPP11_RVALUE_REF_PRESENT && __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
 
 //! Allows to store a function parameter pack as a variable and later pass it to another function
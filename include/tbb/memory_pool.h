@@ -27,6 +27,13 @@
 /** @file */
 
 #include "scalable_allocator.h"
+#include "atomic.h"
+#if TBB_PREVIEW_LOCAL_OBSERVER
+#include "task_arena.h"
+#include "task_scheduler_observer.h"
+#include "enumerable_thread_specific.h"
+#include <vector>
+#endif
 #include <new> // std::bad_alloc
 #if __TBB_ALLOCATOR_CONSTRUCT_VARIADIC
 #include <utility> // std::forward
@@ -40,6 +47,9 @@
 
 namespace tbb {
 namespace interface6 {
+#if TBB_PREVIEW_LOCAL_OBSERVER && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+class arena_pool_binding;
+#endif
 //! @cond INTERNAL
 namespace internal {
 
@@ -57,17 +67,35 @@ public:
     //! The "free" analogue to discard a previously allocated piece of memory.
     void free(void* ptr) { rml::pool_free(my_pool, ptr); }
 
+    //! Allocate count objects of size bytes, returns how many were allocated
+    size_t malloc_batch(size_t size, size_t count, void **ptrs) {
+        return rml::pool_malloc_batch(my_pool, size, count, ptrs);
+    }
+
+    //! Discard count objects at once, NULL pointers are skipped
+    void free_batch(void **ptrs, size_t count) { rml::pool_free_batch(my_pool, ptrs, count); }
+
     //! The "realloc" analogue complementing pool_malloc.
     // Enables some low-level optimization possibilities
     void *realloc(void* ptr, size_t size) {
         return rml::pool_realloc(my_pool, ptr, size);
     }
 
+    //! Limit memory the pool requests from its provider, 0 means no limit.
+    /** When a request would exceed the limit, it fails unless the callback
+        returns true, that causes the request to be retried. */
+    void set_limit(size_t bytes, rml::memLimitCallbackType callback = NULL) {
+        rml::pool_set_limit(my_pool, bytes, callback);
+    }
+
 protected:
     //! destroy pool - must be called in a child class
     void destroy() { rml::pool_destroy(my_pool); }
 
     rml::MemoryPool *my_pool;
+#if TBB_PREVIEW_LOCAL_OBSERVER && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+    friend class interface6::arena_pool_binding;
+#endif
 };
 
 } // namespace internal
@@ -209,6 +237,96 @@ public:
     ~fixed_pool() { destroy(); }
 };
 
+//! Thread-safe pool of objects of the same size over a caller-provided buffer
+/** Unlike fixed_pool, it never locks or calls the OS: malloc and free are
+    a single CAS on a tagged list head in the absence of contention, and
+    never-used objects are taken by an atomic increment, so construction
+    does not touch the buffer. Requests larger than the object size fail.
+    Usable with memory_pool_allocator<T, fixed_object_pool> for node-based
+    containers. */
+class fixed_object_pool : tbb::internal::no_copy {
+    typedef tbb::internal::uint32_t index_type;
+    typedef tbb::internal::uint64_t head_type;
+
+    char *my_objects;
+    size_t my_object_size;
+    size_t my_capacity;
+    //! Free list: number of updates in the upper half, index+1 of the first object in the lower
+    atomic<head_type> my_head;
+    //! Index of the first object that was never allocated
+    atomic<size_t> my_bump;
+
+    void *object( size_t index ) const { return my_objects + index*my_object_size; }
+    static head_type make_head( head_type old_head, index_type index ) {
+        return ((old_head>>32)+1)<<32 | index;
+    }
+public:
+    //! construct pool of objects of object_size bytes in the buffer
+    inline fixed_object_pool( void *buf, size_t size, size_t object_size );
+
+    //! Allocate an object, NULL if the pool is exhausted or size is too big
+    inline void *malloc( size_t size );
+
+    //! Return a previously allocated object to the pool
+    inline void free( void *ptr );
+
+    //! Reset pool to reuse its memory (free all objects at once), not thread-safe
+    void recycle() { my_head = 0; my_bump = 0; }
+
+    //! Size of the objects, taking alignment into account
+    size_t object_size() const { return my_object_size; }
+
+    //! Maximal number of objects allocated at the same time
+    size_t capacity() const { return my_capacity; }
+};
+
+//! Pointer kept as a distance from itself
+/** Stays valid when the memory holding both the pointer and the object
+    is mapped at another address, so data in a mapped_file_pool should
+    be linked with it. */
+template<typename T>
+class offset_ptr {
+    //! 1 means NULL, as a pointer can't point inside itself
+    ptrdiff_t my_offset;
+    void set( T *p ) { my_offset = p ? (char*)p - (char*)this : 1; }
+public:
+    offset_ptr( T *p = NULL ) { set(p); }
+    offset_ptr( const offset_ptr &src ) { set(src.get()); }
+    offset_ptr &operator=( const offset_ptr &src ) { set(src.get()); return *this; }
+    offset_ptr &operator=( T *p ) { set(p); return *this; }
+
+    T *get() const { return my_offset == 1 ? NULL : (T*)((char*)this + my_offset); }
+    operator T*() const { return get(); }
+    T *operator->() const { return get(); }
+};
+
+//! Pool whose heap, including the allocator metadata, is kept in a file
+/** The file is created of size bytes if it does not exist, otherwise it is
+    mapped as is, possibly at a new address. Link data in the pool with
+    offset_ptr and mark its entry point by set_root() to find it after
+    the file is opened again. */
+class mapped_file_pool : tbb::internal::no_copy {
+    rml::MappedPool *my_pool;
+public:
+    //! open pool in the file at path
+    inline mapped_file_pool( const char *path, size_t size );
+
+    //! flush the heap to the file and unmap it
+    ~mapped_file_pool() { rml::mapped_pool_close(my_pool); }
+
+    //! The "malloc" analogue to allocate block of memory of size bytes
+    void *malloc( size_t size ) { return rml::mapped_pool_malloc(my_pool, size); }
+
+    //! The "free" analogue to discard a previously allocated piece of memory
+    void free( void *ptr ) { rml::mapped_pool_free(my_pool, ptr); }
+
+    //! Remember an object as the entry point to the data
+    void set_root( void *ptr ) { rml::mapped_pool_set_root(my_pool, ptr); }
+
+    //! The object set by set_root(), maybe in a previous run; NULL if none
+    void *root() const { return rml::mapped_pool_get_root(my_pool); }
+};
+
 //////////////// Implementation ///////////////
 
 template <typename Alloc>
@@ -259,10 +377,119 @@ inline void *fixed_pool::allocate_request(intptr_t pool_id, size_t & bytes) {
     return self.my_buffer;
 }
 
+inline fixed_object_pool::fixed_object_pool( void *buf, size_t size, size_t object_size ) {
+    // objects of 16 bytes and more are aligned as by malloc,
+    // smaller ones must be able to keep an index of the next free object
+    const size_t alignment = object_size >= 16 ? 16 : 8;
+    my_object_size = (object_size + alignment-1) & ~(alignment-1);
+    uintptr_t begin = (uintptr_t(buf) + alignment-1) & ~uintptr_t(alignment-1);
+    if( !buf || !object_size || uintptr_t(buf)+size < begin+my_object_size )
+        __TBB_THROW(std::bad_alloc());
+    my_objects = reinterpret_cast<char*>(begin);
+    my_capacity = (uintptr_t(buf)+size-begin) / my_object_size;
+    if( my_capacity > index_type(-1)-1 )
+        my_capacity = index_type(-1)-1;
+    recycle();
+}
+inline void *fixed_object_pool::malloc( size_t size ) {
+    if( size > my_object_size )
+        return NULL;
+    head_type head = my_head;
+    while( index_type index = index_type(head) ) {
+        void *ptr = object(index-1);
+        // can be read after the object is taken by another thread,
+        // in that case the head has changed and the CAS fails
+        index_type next = *static_cast<volatile index_type*>(ptr);
+        head_type old_head = my_head.compare_and_swap( make_head(head, next), head );
+        if( old_head == head )
+            return ptr;
+        head = old_head;
+    }
+    // the free list is empty, take an object that was never used
+    if( my_bump < my_capacity ) {
+        size_t index = my_bump++;
+        if( index < my_capacity )
+            return object(index);
+    }
+    return NULL;
+}
+inline void fixed_object_pool::free( void *ptr ) {
+    if( !ptr )
+        return;
+    __TBBMALLOC_ASSERT( (char*)ptr >= my_objects && (char*)ptr < (char*)object(my_capacity)
+                        && ((char*)ptr-my_objects) % my_object_size == 0, "Object is not from this pool." );
+    const index_type index = index_type(((char*)ptr-my_objects) / my_object_size) + 1;
+    head_type head = my_head;
+    for( ;; ) {
+        *static_cast<volatile index_type*>(ptr) = index_type(head);
+        head_type old_head = my_head.compare_and_swap( make_head(head, index), head );
+        if( old_head == head )
+            return;
+        head = old_head;
+    }
+}
+
+inline mapped_file_pool::mapped_file_pool( const char *path, size_t size ) {
+    rml::MemPoolError res = rml::mapped_pool_open(path, size, &my_pool);
+    if( res!=rml::POOL_OK ) __TBB_THROW(std::bad_alloc());
+}
+
+#if TBB_PREVIEW_LOCAL_OBSERVER && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+//! Makes a pool the default for scalable_malloc and friends in threads working inside an arena
+/** Objects allocated this way are released by scalable_free as usual. A thread leaving
+    the arena gets back the default pool it had before entering.
+    The binding must be destroyed before the pool, by a thread outside the arena, and when
+    no more work is submitted to the arena (e.g. after task_arena::terminate()). The destructor
+    waits for the threads inside the arena to leave it, so none of them keeps the pool
+    as its default. */
+class arena_pool_binding : public task_scheduler_observer {
+    rml::MemoryPool *my_pool;
+    //! Number of entries to the arena that have not left it yet
+    atomic<intptr_t> my_entries;
+    //! Defaults of a thread before its entries, nested entries to the arena included
+    enumerable_thread_specific<std::vector<rml::MemoryPool*> > my_previous_defaults;
+public:
+    arena_pool_binding( task_arena &arena, internal::pool_base &pool )
+        : task_scheduler_observer(arena), my_pool(pool.my_pool) {
+        my_entries = 0;
+        observe(true);
+    }
+    ~arena_pool_binding() {
+        __TBB_ASSERT( my_previous_defaults.local().empty(), "arena_pool_binding is destroyed inside its arena" );
+        // workers leave the arena once it is out of work
+        for( tbb::internal::atomic_backoff b; my_entries; b.pause() )
+            ;
+        observe(false);
+        __TBB_ASSERT( !my_entries, "a thread entered the arena while arena_pool_binding was destroyed" );
+    }
+
+    /*override*/ void on_scheduler_entry( bool ) {
+        my_previous_defaults.local().push_back( rml::pool_get_thread_default() );
+        rml::pool_set_thread_default(my_pool);
+        ++my_entries;
+    }
+    /*override*/ void on_scheduler_exit( bool ) {
+        std::vector<rml::MemoryPool*> &previous = my_previous_defaults.local();
+        // the observer could be enabled when the thread was inside the arena already
+        if( !previous.empty() ) {
+            rml::pool_set_thread_default( previous.back() );
+            previous.pop_back();
+            --my_entries;
+        }
+    }
+};
+#endif /* TBB_PREVIEW_LOCAL_OBSERVER && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA */
+
 } //namespace interface6
 using interface6::memory_pool_allocator;
 using interface6::memory_pool;
 using interface6::fixed_pool;
+using interface6::fixed_object_pool;
+using interface6::offset_ptr;
+using interface6::mapped_file_pool;
+#if TBB_PREVIEW_LOCAL_OBSERVER && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+using interface6::arena_pool_binding;
+#endif
 } //namespace tbb
 
 #undef __TBBMALLOC_ASSERT
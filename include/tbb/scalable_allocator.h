@@ -50,6 +50,24 @@ void * __TBB_EXPORTED_FUNC scalable_malloc (size_t size);
     @ingroup memory_allocation */
 void   __TBB_EXPORTED_FUNC scalable_free (void* ptr);
 
+/** The "free" analogue for a piece of memory whose size is known.
+    ptr must be obtained from scalable_malloc, scalable_calloc or scalable_realloc,
+    and size must be the size requested there (the total size for scalable_calloc).
+    The size lets the allocator skip some checks of the object kind.
+    @ingroup memory_allocation */
+void   __TBB_EXPORTED_FUNC scalable_free_sized (void* ptr, size_t size);
+
+/** Allocate count objects of size bytes each into objects[].
+    Returns the number of allocated objects, less than count if memory is exhausted.
+    @ingroup memory_allocation */
+size_t __TBB_EXPORTED_FUNC scalable_malloc_batch (size_t size, size_t count, void** objects);
+
+/** Free count objects from objects[], NULL elements are skipped.
+    Objects placed next to each other in objects[] in order of allocation
+    are released faster.
+    @ingroup memory_allocation */
+void   __TBB_EXPORTED_FUNC scalable_free_batch (void** objects, size_t count);
+
 /** The "realloc" analogue complementing scalable_malloc.
     @ingroup memory_allocation */
 void * __TBB_EXPORTED_FUNC scalable_realloc (void* ptr, size_t size);
@@ -90,14 +108,26 @@ typedef enum {
 } ScalableAllocationResult;
 
 /* Setting TBB_MALLOC_USE_HUGE_PAGES environment variable to 1 enables huge pages.
-   scalable_allocation_mode call has priority over environment variable. */
+   Setting TBB_MALLOC_USE_PERCPU_CACHES environment variable to 1 enables
+   per-CPU caches. TBB_MALLOC_USE_GUARDED_MODE environment variable takes the same
+   values as TBBMALLOC_USE_GUARDED_MODE parameter.
+   scalable_allocation_mode call has priority over environment variables. */
 typedef enum {
     TBBMALLOC_USE_HUGE_PAGES,  /* value turns using huge pages on and off */
     /* deprecated, kept for backward compatibility only */
     USE_HUGE_PAGES = TBBMALLOC_USE_HUGE_PAGES,
     /* try to limit memory consumption value Bytes, clean internal buffers
        if limit is exceeded, but not prevents from requesting memory from OS */
-    TBBMALLOC_SET_SOFT_HEAP_LIMIT
+    TBBMALLOC_SET_SOFT_HEAP_LIMIT,
+    /* value turns on and off caching of free slabs and large objects per CPU
+       rather than per thread; supported on Linux only */
+    TBBMALLOC_USE_PERCPU_CACHES,
+    /* value 1 turns on guarded mode for scalable_malloc and friends: objects get
+       redzones checked on release, and released ones stay in a quarantine;
+       value N > 1 also places 1 of N objects before an inaccessible page
+       (POSIX only); 0 turns the mode off. Heap misuse found aborts the process.
+       Objects aligned to a page or more are not guarded. */
+    TBBMALLOC_USE_GUARDED_MODE
 } AllocationModeParam;
 
 /** Set TBB allocator-specific allocation modes.
@@ -186,11 +216,63 @@ MemPoolError pool_create_v1(intptr_t pool_id, const MemPoolPolicy *policy,
 
 bool  pool_destroy(MemoryPool* memPool);
 void *pool_malloc(MemoryPool* memPool, size_t size);
+size_t pool_malloc_batch(MemoryPool* memPool, size_t size, size_t count, void **objects);
 void *pool_realloc(MemoryPool* memPool, void *object, size_t size);
 void *pool_aligned_malloc(MemoryPool* mPool, size_t size, size_t alignment);
 void *pool_aligned_realloc(MemoryPool* mPool, void *ptr, size_t size, size_t alignment);
 bool  pool_reset(MemoryPool* memPool);
 bool  pool_free(MemoryPool *memPool, void *object);
+bool  pool_free_batch(MemoryPool *memPool, void **objects, size_t count);
+
+// Called when a pool is going to exceed its limit. If it returns true,
+// the request is tried again, e.g. after the limit has been raised.
+typedef bool (*memLimitCallbackType)(intptr_t pool_id, size_t limit, size_t bytes);
+
+// Limit memory that the pool takes from pAlloc to limit bytes, 0 means no limit.
+// Requests above the limit fail after callback, if any, returns false.
+MemPoolError pool_set_limit(MemoryPool *memPool, size_t limit, memLimitCallbackType callback);
+// Serve scalable_malloc and friends called by the current thread from memPool,
+// NULL restores the default pool. Objects allocated so can be released by
+// scalable_free, but the pool must not be destroyed while a thread uses it.
+bool  pool_set_thread_default(MemoryPool *memPool);
+// The pool set by pool_set_thread_default for the current thread, or NULL
+MemoryPool *pool_get_thread_default();
+
+// How the memory got by a pool is used, in bytes
+struct MemPoolStats {
+    size_t mapped,       // got from the OS or from pAlloc, metadata included
+           slabs,        // slabs of small objects owned by threads or orphaned
+           smallObjects, // part of the slabs taken by allocated small objects
+           emptySlabs,   // empty slabs kept by thread-local and per-CPU caches
+           largeObjects, // blocks of allocated large objects
+           largeCached,  // large object blocks kept by caches for reuse
+           backendFree;  // free blocks in the backend bins
+};
+
+// Walk the slabs, caches and backend bins of memPool and summarize how its
+// memory is used; NULL means the pool of scalable_malloc. The walk does not
+// synchronize with the owner threads of the slabs, so no other thread may
+// allocate or release objects of the pool meanwhile. Large objects of 129MB
+// and bigger are not counted.
+bool  pool_get_stats(MemoryPool *memPool, MemPoolStats *stats);
+
+class MappedPool;
+
+// Open a pool whose whole heap, metadata included, is kept in the file at path.
+// If the file does not exist or is empty, it is created of size bytes, otherwise
+// size is ignored. The heap refers to objects by offsets, so the file can be
+// mapped at another address next time. The file is locked while the pool is open.
+// Supported on POSIX systems only.
+MemPoolError mapped_pool_open(const char *path, size_t size, MappedPool **pool);
+// Flush the heap to the file and unmap it.
+bool  mapped_pool_close(MappedPool *pool);
+void *mapped_pool_malloc(MappedPool *pool, size_t size);
+bool  mapped_pool_free(MappedPool *pool, void *object);
+// Address the file is mapped at now, offsets of objects are relative to it.
+void *mapped_pool_base(MappedPool *pool);
+// Remember an object as the entry point to the data kept in the pool.
+bool  mapped_pool_set_root(MappedPool *pool, void *object);
+void *mapped_pool_get_root(MappedPool *pool);
 }
 
 #include <new>      /* To use new with the placement argument */
@@ -247,8 +329,8 @@ public:
     }
 
     //! Free previously allocated block of memory
-    void deallocate( pointer p, size_type ) {
-        scalable_free( p );
+    void deallocate( pointer p, size_type n ) {
+        scalable_free_sized( p, n * sizeof(value_type) );
     }
 
     //! Largest value for which method allocate might succeed.
@@ -40,11 +40,21 @@
 #include "cache_aligned_allocator.h"
 #include "combinable.h"
 #include "concurrent_hash_map.h"
+#include "concurrent_hash_map_parallel.h"
+#if TBB_PREVIEW_CONCURRENT_FLAT_MAP
+#include "concurrent_flat_map.h"
+#endif
 #if TBB_PREVIEW_CONCURRENT_LRU_CACHE
 #include "concurrent_lru_cache.h"
 #endif
 #include "concurrent_priority_queue.h"
+#if TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE
+#include "concurrent_relaxed_priority_queue.h"
+#endif
 #include "concurrent_queue.h"
+#if TBB_PREVIEW_CONCURRENT_RING_QUEUE
+#include "concurrent_ring_queue.h"
+#endif
 #include "concurrent_unordered_map.h"
 #include "concurrent_unordered_set.h"
 #include "concurrent_vector.h"
@@ -30,6 +30,8 @@
 #include "tbb/tick_count.h"
 #include "tbb/cache_aligned_allocator.h"
 #include "tbb/concurrent_priority_queue.h"
+#define TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE 1
+#include "tbb/concurrent_relaxed_priority_queue.h"
 #include "../test/harness.h"
 #include "../examples/common/utility/utility.h"
 #if _MSC_VER
@@ -39,6 +41,8 @@
 #define IMPL_SERIAL 0
 #define IMPL_STL 1
 #define IMPL_CPQ 2
+#define IMPL_BLOCKING 3
+#define IMPL_RELAXED 4
 
 using namespace tbb;
 
@@ -100,6 +104,9 @@ std::priority_queue<my_data_type, std::vector<my_data_type>, my_less > *stl_cpq;
 // TBB concurrent_priority_queue
 concurrent_priority_queue<my_data_type, my_less > *agg_cpq;
 
+// TBB concurrent_relaxed_priority_queue
+concurrent_relaxed_priority_queue<my_data_type, my_less > *relaxed_cpq;
+
 // Busy work and calibration helpers
 unsigned int one_us_iters = 345; // default value
 
@@ -132,9 +139,12 @@ void do_push(my_data_type elem, int nThr, int impl) {
         tbb::spin_mutex::scoped_lock myLock(*my_mutex);
         stl_cpq->push(elem);
     }
-    else if (impl == IMPL_CPQ) {
+    else if (impl == IMPL_CPQ || impl == IMPL_BLOCKING) {
         agg_cpq->push(elem);
     }
+    else if (impl == IMPL_RELAXED) {
+        relaxed_cpq->push(elem);
+    }
 }
 
 // Pop from priority queue, depending on implementation
@@ -160,6 +170,15 @@ my_data_type do_pop(int nThr, int impl) {
             return elem;
         }
     }
+    else if (impl == IMPL_BLOCKING) {
+        // every thread pops only as many elements as it has pushed, so the pop never waits forever
+        agg_cpq->pop(elem);
+    }
+    else if (impl == IMPL_RELAXED) {
+        if (relaxed_cpq->try_pop(elem)) {
+            return elem;
+        }
+    }
     return elem;
 }
 
@@ -242,6 +261,32 @@ void TestThroughputCpqOnNThreads(int nThreads) {
         
         printf("CPQ  %3d %10d\n", nThreads, int(operation_count/(now-start).seconds()));
     }
+    else if (impl == IMPL_BLOCKING) {
+        agg_cpq = new concurrent_priority_queue<my_data_type, my_less >;
+        // the bound is never reached, so this measures the cost of the capacity checks and notifications
+        agg_cpq->set_capacity(preload + nThreads*pushes_per_iter);
+        for (int i=0; i<preload; ++i) do_push(input_data[i], nThreads, IMPL_BLOCKING);
+
+        TestThroughputBody my_blocking_test(nThreads, IMPL_BLOCKING);
+        start = tbb::tick_count::now();
+        NativeParallelFor(nThreads, my_blocking_test);
+        now = tbb::tick_count::now();
+        delete agg_cpq;
+
+        printf("BCPQ %3d %10d\n", nThreads, int(operation_count/(now-start).seconds()));
+    }
+    else if (impl == IMPL_RELAXED) {
+        relaxed_cpq = new concurrent_relaxed_priority_queue<my_data_type, my_less >;
+        for (int i=0; i<preload; ++i) do_push(input_data[i], nThreads, IMPL_RELAXED);
+
+        TestThroughputBody my_relaxed_test(nThreads, IMPL_RELAXED);
+        start = tbb::tick_count::now();
+        NativeParallelFor(nThreads, my_relaxed_test);
+        now = tbb::tick_count::now();
+        delete relaxed_cpq;
+
+        printf("RCPQ %3d %10d\n", nThreads, int(operation_count/(now-start).seconds()));
+    }
 }
 
 
@@ -249,13 +294,13 @@ int main(int argc, char *argv[]) {
     utility::thread_number_range threads(tbb::task_scheduler_init::default_num_threads);
     struct select_impl{
         static bool validate(const int & impl){
-            return  ((impl == IMPL_SERIAL) || (impl == IMPL_STL) || (impl == IMPL_CPQ));
+            return  ((impl == IMPL_SERIAL) || (impl == IMPL_STL) || (impl == IMPL_CPQ) || (impl == IMPL_BLOCKING) || (impl == IMPL_RELAXED));
         }
     };
     utility::parse_cli_arguments(argc,argv,utility::cli_argument_pack()
             .positional_arg(threads,"n-of-threads",utility::thread_number_range_desc)
             .positional_arg(contention,"contention"," busywork between operations, in us")
-            .positional_arg(impl,"queue_type", "which implementation to test. One of 0(SERIAL), 1(STL), 2(CPQ) ", select_impl::validate)
+            .positional_arg(impl,"queue_type", "which implementation to test. One of 0(SERIAL), 1(STL), 2(CPQ), 3(blocking CPQ), 4(relaxed CPQ) ", select_impl::validate)
             .positional_arg(preload,"preload","number of elements to pre-load queue with")
             .positional_arg(ops_per_iteration, "batch size" ,"minimum: 2 (1 push, 1 pop)")
             .positional_arg(throughput_window, "duration", "in seconds")
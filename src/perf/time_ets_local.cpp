@@ -0,0 +1,81 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// Measures the cost of enumerable_thread_specific::local() called in a hot loop
+// for each way of looking up the thread's copy.
+
+#include "../examples/common/utility/utility.h"
+#include "tbb/tick_count.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+
+#define HARNESS_CUSTOM_MAIN 1
+#define HARNESS_NO_PARSE_COMMAND_LINE 1
+
+#include "../src/test/harness.h"
+
+#include <cstdio>
+
+template<tbb::ets_key_usage_type Key>
+class count_body : NoAssign {
+    typedef tbb::enumerable_thread_specific<long, tbb::cache_aligned_allocator<long>, Key> ets_type;
+    ets_type &my_ets;
+public:
+    count_body( ets_type &ets ) : my_ets(ets) {}
+    void operator()( const tbb::blocked_range<long> &r ) const {
+        for( long i = r.begin(); i != r.end(); ++i )
+            ++my_ets.local();
+    }
+};
+
+//! Returns nanoseconds per call of local() on a thread
+template<tbb::ets_key_usage_type Key>
+double time_local( int threads, long calls ) {
+    tbb::enumerable_thread_specific<long, tbb::cache_aligned_allocator<long>, Key> ets( 0L );
+    tbb::tick_count start = tbb::tick_count::now();
+    tbb::parallel_for( tbb::blocked_range<long>( 0, calls, 10000 ), count_body<Key>( ets ) );
+    double seconds = (tbb::tick_count::now() - start).seconds();
+    long total = 0;
+    for( typename tbb::enumerable_thread_specific<long, tbb::cache_aligned_allocator<long>, Key>::iterator i = ets.begin(); i != ets.end(); ++i )
+        total += *i;
+    ASSERT( total == calls, NULL );
+    return seconds * threads / calls * 1e9;
+}
+
+int main( int argc, const char** args ) {
+    utility::thread_number_range threads( tbb::task_scheduler_init::default_num_threads, 1 );
+    long calls = 50*1000*1000;
+
+    utility::parse_cli_arguments( argc, args, utility::cli_argument_pack()
+        .positional_arg( threads, "n-of-threads", utility::thread_number_range_desc )
+        .arg( calls, "calls", "number of calls of local() in each measurement" )
+        );
+
+    printf( "ns per local() call on a thread\n" );
+    printf( "%7s %12s %12s %12s\n", "threads", "no_key", "per_instance", "worker_index" );
+    for( int p = threads.first; p <= threads.last; p = threads.step(p) ) {
+        tbb::task_scheduler_init init( p );
+        printf( "%7d %12.2f %12.2f %12.2f\n", p, time_local<tbb::ets_no_key>( p, calls ),
+                time_local<tbb::ets_key_per_instance>( p, calls ), time_local<tbb::ets_worker_index>( p, calls ) );
+    }
+    return 0;
+}
@@ -58,6 +58,7 @@
 // for test
 #include "tbb/spin_mutex.h"
 #include "time_framework.h"
+#include "tbb/concurrent_unordered_map.h"
 
 
 using namespace tbb;
@@ -76,6 +77,7 @@ namespace version_current {
     #include "tbb/concurrent_hash_map.h"
 }
 typedef version_current::tbb::concurrent_hash_map<int,int> IntTable;
+typedef tbb::concurrent_unordered_map<int,int> UnorderedTable;
 
 #if OLDTABLE
 #undef __TBB_concurrent_hash_map_H
@@ -92,6 +94,7 @@ typedef version_base::tbb::concurrent_hash_map<int,int> OldTable;
 namespace version_new {
     namespace tbb { using namespace ::tbb; namespace internal { using namespace ::tbb::internal; } }
     namespace tbb { namespace interface5 { using namespace ::tbb::interface5; namespace internal { using namespace ::tbb::interface5::internal; } } }
+    namespace tbb { namespace interface9 { using namespace ::tbb::interface9; namespace internal { using namespace ::tbb::interface9::internal; } } }
     #include TESTTABLEHEADER
 }
 typedef version_new::tbb::concurrent_unordered_map<int,int> TestTable;
@@ -151,6 +154,123 @@ struct TestTBBMap : TesterBase {
     }
 };
 
+static const char *read_testnames[] = {
+    "1.fill", "2.find95%", "3.find-hot"
+};
+
+//! Read-heavy workloads, lookups by find(const_accessor) or by optimistic_find()
+template<typename TableType, bool Optimistic>
+struct TestTBBMapReads : TesterBase {
+    TableType Table;
+    int n_items;
+
+    TestTBBMapReads() : TesterBase(3), Table(MaxThread*4) {
+        if( Optimistic ) Table.enable_optimistic_reads();
+    }
+    void init() { n_items = value/threads_count; }
+
+    std::string get_name(int testn) {
+        return std::string(read_testnames[testn]);
+    }
+
+    bool find( int key, int &result ) {
+        if( Optimistic )
+            return Table.optimistic_find( key, result );
+        typename TableType::const_accessor a;
+        if( !Table.find( a, key ) )
+            return false;
+        result = a->second;
+        return true;
+    }
+
+    double test(int test, int t)
+    {
+        int r;
+        switch(test) {
+          case 0: // fill
+            for(int i = t*n_items, e = (t+1)*n_items; i < e; i++) {
+                Table.insert( std::make_pair(i,i) );
+            }
+            break;
+          case 1: // 95% of lookups over the whole table, the rest erases and inserts again
+            for(int i = 0, k = t*n_items; i < n_items; i++, k = (k*1103515245u + 12345u) % value) {
+                if( i % 40 == 0 ) {
+                    Table.erase( k );
+                } else if( i % 40 == 1 ) {
+                    typename TableType::accessor a;
+                    Table.insert( a, k );
+                    a->second = k;
+                } else if( find( k, r ) )
+                    ASSERT( r == k, NULL );
+            }
+            break;
+          case 2: // all threads look up the same few items
+            for(int i = 0; i < n_items; i++) {
+                if( find( i & 63, r ) ) // can be erased by the previous test
+                    ASSERT( r == (i & 63), NULL );
+            }
+            break;
+        }
+        return 0;
+    }
+};
+
+static const char *churn_testnames[] = {
+    "1.fill", "2.churn", "3.find", "4.drain"
+};
+
+template<typename TableType>
+void EnableConcurrentErase( TableType & ) {}
+
+void EnableConcurrentErase( UnorderedTable &table ) {
+    table.enable_concurrent_erase();
+}
+
+//! Erase-heavy workloads, items are erased and inserted again while other threads look them up
+template<typename TableType>
+struct TestChurn : TesterBase {
+    TableType Table;
+    int n_items;
+
+    TestChurn() : TesterBase(4), Table(MaxThread*4) { EnableConcurrentErase( Table ); }
+    void init() { n_items = value/threads_count; }
+
+    std::string get_name(int testn) {
+        return std::string(churn_testnames[testn]);
+    }
+
+    double test(int test, int t)
+    {
+        switch(test) {
+          case 0: // fill
+            for(int i = t*n_items, e = (t+1)*n_items; i < e; i++) {
+                Table.insert( std::make_pair(i,i) );
+            }
+            break;
+          case 1: // a third of erases, a third of inserts and a third of lookups over the whole table
+            for(int i = 0, k = t*n_items; i < n_items; i++, k = (k*1103515245u + 12345u) % value) {
+                switch( i % 3 ) {
+                  case 0: Table.erase( k ); break;
+                  case 1: Table.insert( std::make_pair(k,k) ); break;
+                  default: Table.count( k );
+                }
+            }
+            break;
+          case 2: // lookups after the churn
+            for(int i = t*n_items, e = (t+1)*n_items; i < e; i++) {
+                Table.count( i );
+            }
+            break;
+          case 3: // drain
+            for(int i = t*n_items, e = (t+1)*n_items; i < e; i++) {
+                Table.erase( i );
+            }
+            break;
+        }
+        return 0;
+    }
+};
+
 template<typename M>
 struct TestSTLMap : TesterBase {
     std::map<int, int> Table;
@@ -229,6 +349,10 @@ public:
             run("old::hmap", new NanosecPerValue<TestTBBMap<OldTable> >() ),
 #endif
             run("tbb::hmap", new NanosecPerValue<TestTBBMap<IntTable> >() ),
+            run("hmap::find", new NanosecPerValue<TestTBBMapReads<IntTable,false> >() ),
+            run("hmap::optimistic_find", new NanosecPerValue<TestTBBMapReads<IntTable,true> >() ),
+            run("hmap::churn", new NanosecPerValue<TestChurn<IntTable> >() ),
+            run("umap::churn", new NanosecPerValue<TestChurn<UnorderedTable> >() ),
 #if TESTTABLE
             run("new::hmap", new NanosecPerValue<TestTBBMap<TestTable> >() ),
 #endif
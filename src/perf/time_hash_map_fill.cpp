@@ -41,6 +41,11 @@ int MAX_TABLE_SIZE = 2000000;
 #define BOX3TEST ValuePerSecond<Uniques<tbb::concurrent_hash_map<int,int> >, 1000000/*ns*/>
 #define BOX3HEADER "tbb/concurrent_hash_map-5468.h"
 
+// enable/disable tests for:
+#define BOX4 "CFMap"
+#define BOX4TEST ValuePerSecond<Uniques<tbb::concurrent_flat_map<int,int> >, 1000000/*ns*/>
+// its header is included below
+
 #define TBB_USE_THREADING_TOOLS 0
 //////////////////////////////////////////////////////////////////////////////////
 
@@ -67,6 +72,10 @@ int MAX_TABLE_SIZE = 2000000;
 // for test
 #include "tbb/spin_mutex.h"
 #include "time_framework.h"
+// after the framework, which runs testers by parallel_for if it is included, and
+// before the sandboxes, since it brings SSE intrinsics
+#define TBB_PREVIEW_CONCURRENT_FLAT_MAP 1
+#include "tbb/concurrent_flat_map.h"
 
 
 using namespace tbb;
@@ -0,0 +1,357 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// configuration:
+
+//! number of messages in flight between a producer and its consumer
+#define PIPE_DEPTH 256
+
+//! number of messages passed by each producer, or objects allocated by each thread
+#define MESSAGES_PER_PRODUCER 1000000
+
+//! number of objects each thread keeps alive while allocating objects of varying size
+#define LIVE_OBJECTS 64
+
+//////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include "tbb/tbb_stddef.h"
+#include "tbb/atomic.h"
+#include "tbb/scalable_allocator.h"
+#include "time_framework.h"
+
+using namespace tbb;
+
+//! Single-producer/single-consumer ring of pointers
+class Pipe : NoCopy {
+    void *slots[PIPE_DEPTH];
+    atomic<size_t> head;
+    char pad1[internal::NFS_MaxLineSize-sizeof(atomic<size_t>)];
+    atomic<size_t> tail;
+    char pad2[internal::NFS_MaxLineSize-sizeof(atomic<size_t>)];
+public:
+    Pipe() { head = 0; tail = 0; }
+    void push( void *p ) {
+        while( tail - head == PIPE_DEPTH )
+            __TBB_Yield();
+        slots[tail % PIPE_DEPTH] = p;
+        tail = tail + 1;
+    }
+    void *pop() {
+        while( head == tail )
+            __TBB_Yield();
+        void *p = slots[head % PIPE_DEPTH];
+        head = head + 1;
+        return p;
+    }
+};
+
+static const size_t pc_sizes[] = { 16, 64, 512, 4096 };
+static const char *pc_testnames[] = { "1.16B", "2.64B", "3.512B", "4.4KB" };
+
+//! Even threads allocate messages, odd threads release them.
+/** Every release is done by a thread that does not own the memory,
+    so the test measures the cost of cross-thread deallocation. */
+struct ProducerConsumer : TesterBase {
+    Pipe *pipes;
+
+    ProducerConsumer() : TesterBase(sizeof(pc_sizes)/sizeof(pc_sizes[0])), pipes(NULL) {}
+    ~ProducerConsumer() { delete [] pipes; }
+    void init() { pipes = new Pipe[threads_count/2+1]; }
+
+    std::string get_name(int testn) {
+        return std::string(pc_testnames[testn]);
+    }
+
+    double test(int testn, int t)
+    {
+        Pipe &pipe = pipes[t/2];
+        if( t%2 == 0 ) {
+            if( t+1 == threads_count ) // no pair, nothing to do
+                return 0;
+            for( arg_t i = 0; i < value; i++ ) {
+                void *p = scalable_malloc( pc_sizes[testn] );
+                ASSERT( p, NULL );
+                *(arg_t*)p = i;
+                pipe.push( p );
+            }
+        } else {
+            for( arg_t i = 0; i < value; i++ ) {
+                void *p = pipe.pop();
+                ASSERT( *(arg_t*)p == i, "messages are reordered or corrupted" );
+                scalable_free( p );
+            }
+        }
+        return 0;
+    }
+};
+
+static const size_t sc_max_sizes[] = { 1024, 8*1024 };
+static const char *sc_testnames[] = { "1.up to 1KB", "2.up to 8KB" };
+
+//! Each thread allocates objects of pseudo-random small sizes and frees them in FIFO order
+/** Stresses the mapping of requested sizes to size classes. */
+struct SizeClasses : TesterBase {
+    SizeClasses() : TesterBase(sizeof(sc_max_sizes)/sizeof(sc_max_sizes[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(sc_testnames[testn]);
+    }
+
+    double test(int testn, int t)
+    {
+        void *live[LIVE_OBJECTS] = {};
+        unsigned seed = 2*t+1;
+        for( arg_t i = 0; i < value; i++ ) {
+            seed = seed*1103515245 + 12345;
+            size_t size = (seed>>8) % sc_max_sizes[testn] + 1;
+            void *&slot = live[i % LIVE_OBJECTS];
+            scalable_free( slot );
+            slot = scalable_malloc( size );
+            ASSERT( slot, NULL );
+        }
+        for( int i = 0; i < LIVE_OBJECTS; i++ )
+            scalable_free( live[i] );
+        return 0;
+    }
+};
+
+static const size_t fs_sizes[] = { 16, 1024, 4000, 64*1024 };
+static const char *fs_testnames[] = { "1.16B free", "2.16B free_sized", "3.1KB free", "4.1KB free_sized",
+                                      "5.4KB free", "6.4KB free_sized", "7.64KB free", "8.64KB free_sized" };
+
+//! Each thread allocates a batch of objects and releases it with either scalable_free or scalable_free_sized
+struct SizedFree : TesterBase {
+    SizedFree() : TesterBase(sizeof(fs_testnames)/sizeof(fs_testnames[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(fs_testnames[testn]);
+    }
+
+    double test(int testn, int /*t*/)
+    {
+        const size_t size = fs_sizes[testn/2];
+        const bool sized = testn%2;
+        void *live[LIVE_OBJECTS];
+        for( arg_t i = 0; i < value; i += LIVE_OBJECTS ) {
+            for( int j = 0; j < LIVE_OBJECTS; j++ ) {
+                live[j] = scalable_malloc( size );
+                ASSERT( live[j], NULL );
+            }
+            if( sized )
+                for( int j = 0; j < LIVE_OBJECTS; j++ )
+                    scalable_free_sized( live[j], size );
+            else
+                for( int j = 0; j < LIVE_OBJECTS; j++ )
+                    scalable_free( live[j] );
+        }
+        return 0;
+    }
+};
+
+static const size_t lo_sizes[] = { 32*1024, 64*1024, 512*1024, 2*1024*1024, 8*1024*1024 };
+static const char *lo_testnames[] = { "1.32KB", "2.64KB", "3.512KB", "4.2MB", "5.8MB" };
+
+//! Each thread allocates and releases batches of large objects of the same size
+/** The batch does not fit into the thread-local large object cache,
+    so the global large object cache is stressed. */
+struct LargeObjects : TesterBase {
+    LargeObjects() : TesterBase(sizeof(lo_sizes)/sizeof(lo_sizes[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(lo_testnames[testn]);
+    }
+
+    double test(int testn, int /*t*/)
+    {
+        void *live[LIVE_OBJECTS];
+        for( arg_t i = 0; i < value; i += LIVE_OBJECTS ) {
+            for( int j = 0; j < LIVE_OBJECTS; j++ ) {
+                live[j] = scalable_malloc( lo_sizes[testn] );
+                ASSERT( live[j], NULL );
+                *(char*)live[j] = 1;
+            }
+            for( int j = 0; j < LIVE_OBJECTS; j++ )
+                scalable_free( live[j] );
+        }
+        return 0;
+    }
+};
+
+static const size_t rg_start_sizes[] = { 256*1024, 1024*1024 };
+static const char *rg_testnames[] = { "1.+256KB up to 32MB", "2.x2 up to 64MB" };
+
+//! Each thread grows an object with scalable_realloc, then releases it and starts again
+/** Only a byte per page of the added part is touched, so the cost of
+    moving the old content dominates. */
+struct ReallocGrowth : TesterBase {
+    ReallocGrowth() : TesterBase(sizeof(rg_start_sizes)/sizeof(rg_start_sizes[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(rg_testnames[testn]);
+    }
+
+    double test(int testn, int /*t*/)
+    {
+        const size_t start = rg_start_sizes[testn], limit = testn? 64*1024*1024 : 32*1024*1024;
+        size_t size = start;
+        char *p = (char*)scalable_malloc( size );
+        for( arg_t i = 0; i < value; i++ ) {
+            size_t newSize = testn? 2*size : size+start;
+            if( newSize > limit ) {
+                scalable_free( p );
+                newSize = start;
+                p = (char*)scalable_malloc( newSize );
+            } else
+                p = (char*)scalable_realloc( p, newSize );
+            ASSERT( p, NULL );
+            for( size_t j = size < newSize? size : 0; j < newSize; j += 4096 )
+                p[j] = 1;
+            size = newSize;
+        }
+        scalable_free( p );
+        return 0;
+    }
+};
+
+static const size_t cs_sizes[] = { 16*1024*1024, 256*1024*1024 };
+static const char *cs_testnames[] = { "1.16MB, reused", "2.256MB, mapped" };
+
+//! Each thread callocs a matrix, reads a row per 64 pages of it, and releases it
+/** Models startup of an application that zero-initializes big arrays
+    but touches them sparsely. 16MB blocks are reused from the cache,
+    while 256MB ones are too big to be cached and come fresh from the OS. */
+struct CallocStartup : TesterBase {
+    CallocStartup() : TesterBase(sizeof(cs_sizes)/sizeof(cs_sizes[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(cs_testnames[testn]);
+    }
+
+    double test(int testn, int /*t*/)
+    {
+        const size_t size = cs_sizes[testn];
+        for( arg_t i = 0; i < value; i++ ) {
+            char *p = (char*)scalable_calloc( size, 1 );
+            ASSERT( p, NULL );
+            for( size_t j = 0; j < size; j += 64*4096 )
+                ASSERT( !p[j], "calloc returned non-zeroed memory" );
+            p[size-1] = 1;
+            scalable_free( p );
+        }
+        return 0;
+    }
+};
+
+static const size_t ba_sizes[] = { 64, 64, 512, 512 };
+static const char *ba_testnames[] = { "1.64B, per object", "2.64B, batch", "3.512B, per object", "4.512B, batch" };
+static const int BATCH_SIZE = 64;
+
+//! Each thread allocates and releases messages in groups of BATCH_SIZE
+/** Odd tests use scalable_malloc_batch/scalable_free_batch, even ones
+    do the same work object by object. */
+struct BatchAlloc : TesterBase {
+    BatchAlloc() : TesterBase(sizeof(ba_sizes)/sizeof(ba_sizes[0])) {}
+
+    std::string get_name(int testn) {
+        return std::string(ba_testnames[testn]);
+    }
+
+    double test(int testn, int /*t*/)
+    {
+        void *msgs[BATCH_SIZE];
+        const size_t size = ba_sizes[testn];
+        for( arg_t i = 0; i < value; i += BATCH_SIZE ) {
+            if( testn&1 ) {
+                size_t got = scalable_malloc_batch( size, BATCH_SIZE, msgs );
+                ASSERT( got == BATCH_SIZE, NULL );
+            } else {
+                for( int j = 0; j < BATCH_SIZE; j++ ) {
+                    msgs[j] = scalable_malloc( size );
+                    ASSERT( msgs[j], NULL );
+                }
+            }
+            for( int j = 0; j < BATCH_SIZE; j++ )
+                *(char*)msgs[j] = 1;
+            if( testn&1 )
+                scalable_free_batch( msgs, BATCH_SIZE );
+            else
+                for( int j = 0; j < BATCH_SIZE; j++ )
+                    scalable_free( msgs[j] );
+        }
+        return 0;
+    }
+};
+
+//! Average share of an object that is unused because of rounding up to the size class
+static double size_class_waste( size_t max_size ) {
+    double waste = 0;
+    for( size_t size = 1; size <= max_size; size++ ) {
+        void *p = scalable_malloc( size );
+        size_t usable = scalable_msize( p );
+        waste += double(usable - size) / usable;
+        scalable_free( p );
+    }
+    return 100 * waste / max_size;
+}
+
+class test_malloc : public TestProcessor {
+public:
+    test_malloc() : TestProcessor("time_malloc") {}
+    void factory(int value, int threads) {
+        if(Verbose) printf("Processing with %d threads: %d...\n", threads, value);
+        process( value, threads,
+            run("prod-cons", new NanosecPerValue<ProducerConsumer>() ),
+            run("size-classes", new NanosecPerValue<SizeClasses>() ),
+            run("sized-free", new NanosecPerValue<SizedFree>() ),
+            run("batch", new NanosecPerValue<BatchAlloc>() ),
+        end );
+        // large objects are much slower, so the value is reduced
+        process( value/100, threads,
+            run("large", new NanosecPerValue<LargeObjects>() ),
+        end );
+        // every step of growth moves megabytes
+        process( value/1000, threads,
+            run("realloc-growth", new NanosecPerValue<ReallocGrowth>() ),
+            run("calloc-startup", new NanosecPerValue<CallocStartup>() ),
+        end );
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+    if(argc>1) Verbose = true;
+    MinThread = 2; MaxThread = task_scheduler_init::default_num_threads();
+    ParseCommandLine( argc, argv );
+    if( MaxThread < 2 ) MaxThread = 2;
+
+    for( size_t i = 0; i < sizeof(sc_max_sizes)/sizeof(sc_max_sizes[0]); i++ )
+        printf("Internal fragmentation for sizes %s: %.2f%%\n", sc_testnames[i]+2, size_class_waste(sc_max_sizes[i]));
+    {
+        test_malloc the_test;
+        for( int t=MinThread; t <= MaxThread; t+=2 )
+            the_test.factory(MESSAGES_PER_PRODUCER, t);
+        the_test.report.SetTitle("Microseconds per object of (Mode) for object size (Name)");
+        the_test.report.SetStatisticFormula("1AVG per size", "=AVERAGE(ROUNDS)");
+        the_test.report.Print(StatisticsCollector::HTMLFile|StatisticsCollector::ExcelXML);
+    }
+    return 0;
+}
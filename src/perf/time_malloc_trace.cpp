@@ -0,0 +1,249 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// Replays an allocation trace against tbbmalloc and reports RSS, fragmentation
+// and throughput while the trace goes. The trace is a text file, one operation
+// per line, objects are identified by arbitrary numbers:
+//   a <id> <size>   allocate an object
+//   f <id>          free it
+//   r <id> <size>   reallocate it
+// Empty lines and lines started with '#' are skipped. Without a trace file,
+// a synthetic one is generated, with the live set growing and shrinking.
+
+#include "../examples/common/utility/utility.h"
+#include "tbb/tick_count.h"
+#include "tbb/scalable_allocator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+#if __linux__
+#include <unistd.h>
+#endif
+
+struct TraceOp {
+    char   kind;    // 'a', 'f' or 'r'
+    size_t obj;     // dense index of the object
+    size_t size;
+};
+
+typedef std::vector<TraceOp> Trace;
+
+//! Read the trace, returns the number of distinct objects
+static size_t loadTrace(const std::string &path, Trace &trace) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        throw std::invalid_argument("can't open trace file '"+path+"'");
+    std::map<unsigned long long, size_t> ids;
+    char line[256];
+    for (int lineNum=1; fgets(line, sizeof(line), f); lineNum++) {
+        char kind;
+        unsigned long long id, size = 0;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+        int n = sscanf(line, " %c %llu %llu", &kind, &id, &size);
+        if (n < 2 || (kind != 'f' && ((kind != 'a' && kind != 'r') || n < 3))) {
+            fclose(f);
+            char msg[64];
+            sprintf(msg, "bad trace line %d", lineNum);
+            throw std::invalid_argument(msg);
+        }
+        std::map<unsigned long long, size_t>::iterator it =
+            ids.insert(std::make_pair(id, ids.size())).first;
+        TraceOp op = { kind, it->second, (size_t)size };
+        trace.push_back(op);
+    }
+    fclose(f);
+    return ids.size();
+}
+
+//! Generate phases of allocations of log-distributed sizes mixed with
+//! releases, so that objects of different lifetimes interleave in memory.
+static size_t generateTrace(size_t opsNum, Trace &trace) {
+    const size_t maxLive = 64*1024;
+    std::vector<size_t> live, freeIds;
+    size_t objects = 0;
+    unsigned rnd = 42;
+
+    for (size_t i=0; i<opsNum; i++) {
+        rnd = rnd*1103515245 + 12345;
+        unsigned r = rnd >> 8;
+        // the live set grows in the first half of each phase and shrinks in the second
+        bool growing = (i / (opsNum/8+1)) % 2 == 0;
+        unsigned allocShare = growing? 70 : 30;
+        TraceOp op;
+        if (live.empty() || (r % 100 < allocShare && live.size() < maxLive)) {
+            op.kind = 'a';
+            if (freeIds.empty())
+                op.obj = objects++;
+            else {
+                op.obj = freeIds.back();
+                freeIds.pop_back();
+            }
+            // mostly small objects, 1 of 64 is large
+            op.size = r % 64? 8 + (r>>6) % (1<<(3 + (r>>16) % 8)) : 8*1024 + (r>>6) % (1024*1024);
+            live.push_back(op.obj);
+        } else {
+            size_t pos = (r>>7) % live.size();
+            op.obj = live[pos];
+            op.size = r % 8? 0 : 8 + (r>>11) % 4096;
+            op.kind = op.size? 'r' : 'f';
+            if (op.kind == 'f') {
+                live[pos] = live.back();
+                live.pop_back();
+                freeIds.push_back(op.obj);
+            }
+        }
+        trace.push_back(op);
+    }
+    return objects;
+}
+
+static size_t getRSS() {
+#if __linux__
+    unsigned long size, resident = 0;
+    if (FILE *f = fopen("/proc/self/statm", "r")) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+//! Write to every page of the object, as an application would do
+static inline void touch(void *ptr, size_t size) {
+    for (size_t off=0; off<size; off+=4*1024)
+        ((volatile char*)ptr)[off] = 1;
+}
+
+class TraceReplay {
+    const Trace &trace;
+    std::vector<void*> objects;
+    bool touchObjects;
+    size_t reportEvery;
+    double peakFragmentation;
+    size_t peakRSS;
+
+    static double toMB(size_t bytes) { return bytes/1024.0/1024.0; }
+
+    void report(size_t ops, double opsTime, double intervalMops) {
+        rml::MemPoolStats st;
+        rml::pool_get_stats(NULL, &st);
+        size_t rss = getRSS(),
+               used = st.smallObjects + st.largeObjects;
+        double fragmentation = st.mapped? 1 - (double)used/st.mapped : 0;
+        if (rss > peakRSS) peakRSS = rss;
+        if (fragmentation > peakFragmentation) peakFragmentation = fragmentation;
+        printf("%10lu %8.3f %8.2f %9.1f %9.1f %8.1f %6.1f%% %6.1f%% %8.1f %8.1f %8.1f\n",
+               (unsigned long)ops, opsTime, intervalMops, toMB(rss), toMB(st.mapped),
+               toMB(used), 100*fragmentation,
+               st.slabs? 100.0*st.smallObjects/st.slabs : 100.0,
+               toMB(st.emptySlabs), toMB(st.largeCached), toMB(st.backendFree));
+    }
+    void execute(const TraceOp &op) {
+        void *&obj = objects[op.obj];
+        switch (op.kind) {
+        case 'a':
+            scalable_free(obj); // the trace can lack free for an object
+            obj = scalable_malloc(op.size);
+            if (touchObjects && obj) touch(obj, op.size);
+            break;
+        case 'r':
+            obj = scalable_realloc(obj, op.size);
+            if (touchObjects && obj) touch(obj, op.size);
+            break;
+        default:
+            scalable_free(obj);
+            obj = NULL;
+        }
+    }
+public:
+    TraceReplay(const Trace &t, size_t objectsNum, bool touchObj, size_t every) :
+        trace(t), objects(objectsNum), touchObjects(touchObj), reportEvery(every),
+        peakFragmentation(0), peakRSS(0) {}
+
+    //! Returns time spent in the allocator calls only
+    double operator()() {
+        double opsTime = 0;
+        printf("%10s %8s %8s %9s %9s %8s %7s %7s %8s %8s %8s\n", "ops", "time,s", "Mops/s",
+               "RSS,MB", "mapped,MB", "used,MB", "frag", "slabs", "emptySl", "LOC,MB", "free,MB");
+        for (size_t begin=0; begin<trace.size(); begin+=reportEvery) {
+            size_t end = std::min(begin+reportEvery, trace.size());
+            tbb::tick_count t0 = tbb::tick_count::now();
+            for (size_t i=begin; i<end; i++)
+                execute(trace[i]);
+            double interval = (tbb::tick_count::now() - t0).seconds();
+            opsTime += interval;
+            report(end, opsTime, interval? (end-begin)/interval/1e6 : 0);
+        }
+        for (size_t i=0; i<objects.size(); i++) {
+            scalable_free(objects[i]);
+            objects[i] = NULL;
+        }
+        return opsTime;
+    }
+    double getPeakFragmentation() const { return peakFragmentation; }
+    size_t getPeakRSS() const { return peakRSS; }
+};
+
+int main(int argc, const char** args) {
+    std::string tracePath;
+    size_t generatedOps = 4*1000*1000;
+    size_t reportEvery = 250*1000;
+    size_t repeats = 1;
+    bool noTouch = false;
+
+    try {
+        utility::parse_cli_arguments(argc, args, utility::cli_argument_pack()
+            .arg(tracePath, "trace", "trace file to replay, a synthetic trace is used if not set")
+            .arg(generatedOps, "generated-ops", "number of operations in the synthetic trace")
+            .arg(reportEvery, "report-every", "number of operations between reports")
+            .arg(repeats, "repeats", "how many times to replay the trace")
+            .arg(noTouch, "no-touch", "do not write to allocated objects")
+            );
+        Trace trace;
+        size_t objectsNum = tracePath.empty()?
+            generateTrace(generatedOps, trace) : loadTrace(tracePath, trace);
+        if (!reportEvery)
+            reportEvery = trace.size();
+
+        for (size_t r=0; r<repeats; r++) {
+            TraceReplay replay(trace, objectsNum, !noTouch, reportEvery);
+            double time = replay();
+            printf("replay %lu: %lu ops in %.3f s, %.2f Mops/s, peak RSS %.1f MB, "
+                   "peak fragmentation %.1f%%\n", (unsigned long)r, (unsigned long)trace.size(),
+                   time, time? trace.size()/time/1e6 : 0,
+                   replay.getPeakRSS()/1024.0/1024.0, 100*replay.getPeakFragmentation());
+        }
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// Compares moving items through concurrent_bounded_queue and concurrent_queue one at a time
+// with moving them in batches by push_range and try_pop_many.
+
+#include "../examples/common/utility/utility.h"
+#include "tbb/tick_count.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/concurrent_queue.h"
+
+#define HARNESS_CUSTOM_MAIN 1
+#define HARNESS_NO_PARSE_COMMAND_LINE 1
+
+#include "../src/test/harness.h"
+#include "../src/test/harness_barrier.h"
+
+#include <cstdio>
+#include <vector>
+
+typedef tbb::concurrent_bounded_queue<long> bounded_queue;
+typedef tbb::concurrent_queue<long> unbounded_queue;
+
+//! Pops up to n items one at a time, as the consumers do without try_pop_many
+template<typename Queue>
+size_t pop_each( Queue &q, long *items, size_t n ) {
+    size_t i = 0;
+    while( i < n && q.try_pop( items[i] ) )
+        ++i;
+    return i;
+}
+
+template<typename Queue>
+class transfer_body : NoAssign {
+    Queue &my_queue;
+    const int my_producers;
+    const long my_items;
+    const size_t my_batch;
+    Harness::SpinBarrier &my_barrier;
+    tbb::tick_count &my_start;
+    tbb::atomic<long> &my_popped;
+public:
+    transfer_body( Queue &q, int producers, long items, size_t batch, Harness::SpinBarrier &barrier,
+                   tbb::tick_count &start, tbb::atomic<long> &popped )
+        : my_queue(q), my_producers(producers), my_items(items), my_batch(batch), my_barrier(barrier),
+          my_start(start), my_popped(popped) {}
+    void operator()( int id ) const {
+        std::vector<long> buffer( my_batch );
+        my_barrier.wait();
+        if( id == 0 )
+            my_start = tbb::tick_count::now();
+        if( id < my_producers ) {
+            for( long i = id*long(my_batch); i < my_items; i += my_producers*long(my_batch) ) {
+                size_t n = size_t( my_items-i < long(my_batch) ? my_items-i : long(my_batch) );
+                for( size_t j = 0; j < n; ++j )
+                    buffer[j] = i+long(j);
+                if( my_batch > 1 )
+                    my_queue.push_range( buffer.begin(), buffer.begin()+n );
+                else
+                    my_queue.push( buffer[0] );
+            }
+        } else {
+            while( my_popped < my_items ) {
+                size_t n = my_batch > 1 ? size_t( my_queue.try_pop_many( buffer.begin(), my_batch ) )
+                                        : pop_each( my_queue, &buffer[0], 1 );
+                if( n )
+                    my_popped += long(n);
+                else
+                    __TBB_Yield();
+            }
+        }
+    }
+};
+
+//! Returns millions of items moved per second; a batch of 1 means push and try_pop
+template<typename Queue>
+double transfer( Queue &q, int producers, int consumers, long items, size_t batch ) {
+    Harness::SpinBarrier barrier( producers+consumers );
+    tbb::tick_count start;
+    tbb::atomic<long> popped;
+    popped = 0;
+    NativeParallelFor( producers+consumers, transfer_body<Queue>( q, producers, items, batch, barrier, start, popped ) );
+    return items / (tbb::tick_count::now() - start).seconds() / 1e6;
+}
+
+template<typename Queue>
+void report( const char *name, Queue &q, int threads, long items ) {
+    static const size_t batches[] = { 1, 16, 64, 256, 1024 };
+    printf( "%-10s %7d", name, threads );
+    for( size_t i = 0; i < sizeof(batches)/sizeof(batches[0]); ++i )
+        printf( " %9.2f", transfer( q, threads, threads, items, batches[i] ) );
+    printf( "\n" );
+}
+
+int main( int argc, const char** args ) {
+    utility::thread_number_range threads( tbb::task_scheduler_init::default_num_threads, 1 );
+    long items = 4*1000*1000;
+    long capacity = 4096;
+
+    utility::parse_cli_arguments( argc, args, utility::cli_argument_pack()
+        .positional_arg( threads, "n-of-threads", utility::thread_number_range_desc )
+        .arg( items, "items", "number of items moved in each measurement" )
+        .arg( capacity, "capacity", "capacity of the bounded queue" )
+        );
+
+    printf( "Mitems/s moved by N producers to N consumers, by batch size\n" );
+    printf( "%-10s %7s %9s %9s %9s %9s %9s\n", "queue", "N", "1", "16", "64", "256", "1024" );
+    for( int p = threads.first; p <= threads.last; p = threads.step(p) ) {
+        bounded_queue bq;
+        bq.set_capacity( capacity );
+        report( "bounded", bq, p, items );
+        unbounded_queue uq;
+        report( "unbounded", uq, p, items );
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// Compares concurrent_ring_queue with concurrent_bounded_queue of the same capacity:
+// the throughput of producers and consumers handing items over, and the round trip
+// time of an item sent by one thread to another and back.
+
+#include "../examples/common/utility/utility.h"
+#include "tbb/tick_count.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/concurrent_queue.h"
+#define TBB_PREVIEW_CONCURRENT_RING_QUEUE 1
+#include "tbb/concurrent_ring_queue.h"
+
+#define HARNESS_CUSTOM_MAIN 1
+#define HARNESS_NO_PARSE_COMMAND_LINE 1
+
+#include "../src/test/harness.h"
+#include "../src/test/harness_barrier.h"
+
+#include <cstdio>
+
+typedef tbb::concurrent_bounded_queue<long> bounded_queue;
+typedef tbb::concurrent_ring_queue<long, tbb::ring_queue_mpmc> mpmc_ring_queue;
+typedef tbb::concurrent_ring_queue<long, tbb::ring_queue_spsc> spsc_ring_queue;
+
+//! Creates a queue of the given capacity
+template<typename Queue>
+struct queue_holder : NoCopy {
+    Queue queue;
+    queue_holder( size_t capacity ) : queue( capacity ) {}
+};
+
+template<>
+struct queue_holder<bounded_queue> : NoCopy {
+    bounded_queue queue;
+    queue_holder( size_t capacity ) { queue.set_capacity( capacity ); }
+};
+
+template<typename Queue>
+class throughput_body : NoAssign {
+    Queue &my_queue;
+    const int my_producers, my_consumers;
+    const long my_items;
+    Harness::SpinBarrier &my_barrier;
+    tbb::tick_count &my_start;
+public:
+    throughput_body( Queue &q, int producers, int consumers, long items, Harness::SpinBarrier &barrier, tbb::tick_count &start )
+        : my_queue(q), my_producers(producers), my_consumers(consumers), my_items(items), my_barrier(barrier), my_start(start) {}
+    void operator()( int id ) const {
+        my_barrier.wait();
+        if( id == 0 )
+            my_start = tbb::tick_count::now();
+        if( id < my_producers ) {
+            for( long i = id; i < my_items; i += my_producers )
+                my_queue.push( i );
+        } else {
+            int consumer = id - my_producers;
+            long item;
+            for( long i = consumer; i < my_items; i += my_consumers )
+                my_queue.pop( item );
+        }
+    }
+};
+
+//! Returns millions of items handed over per second
+template<typename Queue>
+double throughput( size_t capacity, int producers, int consumers, long items ) {
+    queue_holder<Queue> h( capacity );
+    Harness::SpinBarrier barrier( producers+consumers );
+    tbb::tick_count start;
+    NativeParallelFor( producers+consumers, throughput_body<Queue>( h.queue, producers, consumers, items, barrier, start ) );
+    return items / (tbb::tick_count::now() - start).seconds() / 1e6;
+}
+
+template<typename Queue>
+class ping_pong_body : NoAssign {
+    Queue &my_ping, &my_pong;
+    const long my_rounds;
+public:
+    ping_pong_body( Queue &ping, Queue &pong, long rounds ) : my_ping(ping), my_pong(pong), my_rounds(rounds) {}
+    void operator()( int id ) const {
+        long item;
+        for( long i = 0; i < my_rounds; i++ ) {
+            if( id == 0 ) {
+                my_ping.push( i );
+                my_pong.pop( item );
+                ASSERT( item == i, NULL );
+            } else {
+                my_ping.pop( item );
+                my_pong.push( item );
+            }
+        }
+    }
+};
+
+//! Returns the average round trip time in nanoseconds
+template<typename Queue>
+double round_trip( size_t capacity, long rounds ) {
+    queue_holder<Queue> ping( capacity ), pong( capacity );
+    tbb::tick_count start = tbb::tick_count::now();
+    NativeParallelFor( 2, ping_pong_body<Queue>( ping.queue, pong.queue, rounds ) );
+    return (tbb::tick_count::now() - start).seconds() / rounds * 1e9;
+}
+
+int main( int argc, const char** args ) {
+    utility::thread_number_range threads( tbb::task_scheduler_init::default_num_threads, 1 );
+    long items = 4*1000*1000;
+    long rounds = 100*1000;
+    size_t capacity = 1024;
+
+    utility::parse_cli_arguments( argc, args, utility::cli_argument_pack()
+        .positional_arg( threads, "n-of-threads", utility::thread_number_range_desc )
+        .arg( items, "items", "number of items handed over in the throughput test" )
+        .arg( rounds, "rounds", "number of round trips in the latency test" )
+        .arg( capacity, "capacity", "capacity of the queues" )
+        );
+
+    printf( "%-12s %9s %9s %12s\n", "queue", "producers", "consumers", "Mitems/s" );
+    printf( "%-12s %9d %9d %12.2f\n", "bounded", 1, 1, throughput<bounded_queue>( capacity, 1, 1, items ) );
+    printf( "%-12s %9d %9d %12.2f\n", "ring mpmc", 1, 1, throughput<mpmc_ring_queue>( capacity, 1, 1, items ) );
+    printf( "%-12s %9d %9d %12.2f\n", "ring spsc", 1, 1, throughput<spsc_ring_queue>( capacity, 1, 1, items ) );
+    for( int p = threads.first; p <= threads.last; p = threads.step(p) ) {
+        if( p == 1 ) continue;
+        printf( "%-12s %9d %9d %12.2f\n", "bounded", p, p, throughput<bounded_queue>( capacity, p, p, items ) );
+        printf( "%-12s %9d %9d %12.2f\n", "ring mpmc", p, p, throughput<mpmc_ring_queue>( capacity, p, p, items ) );
+    }
+
+    printf( "\n%-12s %16s\n", "queue", "round trip, ns" );
+    printf( "%-12s %16.0f\n", "bounded", round_trip<bounded_queue>( capacity, rounds ) );
+    printf( "%-12s %16.0f\n", "ring mpmc", round_trip<mpmc_ring_queue>( capacity, rounds ) );
+    printf( "%-12s %16.0f\n", "ring spsc", round_trip<spsc_ring_queue>( capacity, rounds ) );
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+// Measures the cost of concurrent_unordered_map::find() without erasure. The first column is
+// a map without concurrent erase, the other ones are a map with concurrent erase enabled.
+// Lookups on native threads register in the reclamation epochs; lookups in parallel_for run
+// mostly on the workers, which do not register; with one thread, parallel_for runs on the
+// master thread, which registers. The last column is the registration alone.
+
+#include "../examples/common/utility/utility.h"
+#include "tbb/tick_count.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "tbb/concurrent_unordered_map.h"
+
+#define HARNESS_CUSTOM_MAIN 1
+#define HARNESS_NO_PARSE_COMMAND_LINE 1
+
+#include "../src/test/harness.h"
+
+#include <cstdio>
+
+typedef tbb::concurrent_unordered_map<long, long> map_type;
+
+static const long items = 4*1024;
+
+//! Looks up the keys of a range, asserting that each is found
+class find_body : NoAssign {
+    map_type &my_map;
+public:
+    find_body( map_type &m ) : my_map(m) {}
+    void operator()( const tbb::blocked_range<long> &r ) const {
+        for( long i = r.begin(); i != r.end(); ++i ) {
+            long k = (i * 2654435761u) % items;
+            ASSERT( my_map.find( k )->second == k, NULL );
+        }
+    }
+};
+
+//! Runs a share of the lookups on each native thread
+class native_body : NoAssign {
+    map_type &my_map;
+    long my_calls;
+    int my_threads;
+public:
+    native_body( map_type &m, long calls, int threads ) : my_map(m), my_calls(calls), my_threads(threads) {}
+    void operator()( int t ) const {
+        find_body body( my_map );
+        body( tbb::blocked_range<long>( my_calls/my_threads*t, my_calls/my_threads*(t+1) ) );
+    }
+};
+
+//! Registers in the epochs of a map without looking anything up
+class guard_body : NoAssign {
+    tbb::interface5::internal::solist_epochs &my_epochs;
+    long my_calls;
+    int my_threads;
+public:
+    guard_body( tbb::interface5::internal::solist_epochs &e, long calls, int threads ) : my_epochs(e), my_calls(calls), my_threads(threads) {}
+    void operator()( int ) const {
+        for( long i = 0, n = my_calls/my_threads; i < n; ++i )
+            tbb::interface5::internal::solist_epochs::guard g( my_epochs );
+    }
+};
+
+int main( int argc, const char** args ) {
+    utility::thread_number_range threads( tbb::task_scheduler_init::default_num_threads, 1 );
+    long calls = 20*1000*1000;
+
+    utility::parse_cli_arguments( argc, args, utility::cli_argument_pack()
+        .positional_arg( threads, "n-of-threads", utility::thread_number_range_desc )
+        .arg( calls, "calls", "number of calls of find() in each measurement" )
+        );
+
+    map_type plain_map, map;
+    map.enable_concurrent_erase();
+    for( long k = 0; k < items; ++k ) {
+        plain_map.insert( std::make_pair( k, k ) );
+        map.insert( std::make_pair( k, k ) );
+    }
+    tbb::interface5::internal::solist_epochs epochs;
+
+    printf( "ns per find() call on a thread, %ld items\n", items );
+    printf( "%7s %14s %14s %14s %14s\n", "threads", "no_erase", "native_thread", "tbb_worker", "registration" );
+    for( int p = threads.first; p <= threads.last; p = threads.step(p) ) {
+        tbb::task_scheduler_init init( p );
+        tbb::tick_count tp = tbb::tick_count::now();
+        NativeParallelFor( p, native_body( plain_map, calls, p ) );
+        tbb::tick_count t0 = tbb::tick_count::now();
+        NativeParallelFor( p, native_body( map, calls, p ) );
+        tbb::tick_count t1 = tbb::tick_count::now();
+        tbb::parallel_for( tbb::blocked_range<long>( 0, calls, 10000 ), find_body( map ) );
+        tbb::tick_count t2 = tbb::tick_count::now();
+        NativeParallelFor( p, guard_body( epochs, calls, p ) );
+        tbb::tick_count t3 = tbb::tick_count::now();
+        printf( "%7d %14.2f %14.2f %14.2f %14.2f\n", p, (t0-tp).seconds()*p/calls*1e9, (t1-t0).seconds()*p/calls*1e9,
+                (t2-t1).seconds()*p/calls*1e9, (t3-t2).seconds()*p/calls*1e9 );
+    }
+    return 0;
+}
@@ -73,6 +73,8 @@ void arena::process( generic_scheduler& s ) {
     my_cpu_ctl_env.set_env();
 #endif
 
+    s.set_quiescence_tracking( /*in_arena=*/true );
+
 #if __TBB_SCHEDULER_OBSERVER
     __TBB_ASSERT( !s.my_last_local_observer, "There cannot be notified local observers when entering arena" );
     my_observers.notify_entry_observers( s.my_last_local_observer, /*worker=*/true );
@@ -105,6 +107,7 @@ void arena::process( generic_scheduler& s ) {
     my_observers.notify_exit_observers( s.my_last_local_observer, /*worker=*/true );
     s.my_last_local_observer = NULL;
 #endif /* __TBB_SCHEDULER_OBSERVER */
+    s.set_quiescence_tracking( /*in_arena=*/false );
 #if __TBB_TASK_PRIORITY
     if ( s.my_offloaded_tasks )
         orphan_offloaded_tasks( s );
@@ -19,6 +19,8 @@
 */
 
 #include "concurrent_monitor.h"
+#include "tbb/internal/_concurrent_monitor_impl.h"
+#include "tbb/cache_aligned_allocator.h"
 
 namespace tbb {
 namespace internal {
@@ -133,5 +135,45 @@ void concurrent_monitor::abort_all_relaxed() {
 #endif
 }
 
+//------------------------------------------------------------------------
+// Entry points for the blocking containers of the headers
+//------------------------------------------------------------------------
+concurrent_monitor* allocate_concurrent_monitor() {
+    concurrent_monitor* m = cache_aligned_allocator<concurrent_monitor>().allocate(1);
+    return new( m ) concurrent_monitor;
+}
+
+void deallocate_concurrent_monitor( concurrent_monitor* m ) {
+    m->~concurrent_monitor();
+    cache_aligned_allocator<concurrent_monitor>().deallocate( m, 1 );
+}
+
+namespace {
+    struct predicate_until {
+        concurrent_monitor_predicate& my_until;
+        predicate_until( concurrent_monitor_predicate& until ) : my_until(until) {}
+        bool operator()() const { return my_until(); }
+    };
+
+    struct predicate_context {
+        uintptr_t my_context;
+        predicate_context( uintptr_t context ) : my_context(context) {}
+        uintptr_t operator()() const { return my_context; }
+        bool operator()( uintptr_t context ) const { return context==my_context; }
+    };
+}
+
+void concurrent_monitor_wait( concurrent_monitor& m, concurrent_monitor_predicate& until, uintptr_t context ) {
+    m.wait( predicate_until(until), predicate_context(context) );
+}
+
+void concurrent_monitor_notify( concurrent_monitor& m, uintptr_t context ) {
+    m.notify( predicate_context(context) );
+}
+
+void concurrent_monitor_abort( concurrent_monitor& m ) {
+    m.abort_all();
+}
+
 } // namespace internal
 } // namespace tbb
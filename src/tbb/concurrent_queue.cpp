@@ -74,12 +74,16 @@ struct micro_queue {
 
     spin_mutex page_mutex;
 
+    //! Pushes the item; if construct_item is given, it constructs the item from the range item points to
     void push( const void* item, ticket k, concurrent_queue_base& base,
-               concurrent_queue_base::copy_specifics op_type );
+               concurrent_queue_base::copy_specifics op_type,
+               concurrent_queue_base_v8::range_item_constructor construct_item = NULL );
 
     void abort_push( ticket k, concurrent_queue_base& base );
 
-    bool pop( void* dst, ticket k, concurrent_queue_base& base );
+    //! Pops the item; if assign_item is given, it assigns the item to the range dst points to
+    bool pop( void* dst, ticket k, concurrent_queue_base& base,
+              concurrent_queue_base_v8::range_item_assigner assign_item = NULL );
 
     micro_queue& assign( const micro_queue& src, concurrent_queue_base& base,
                          concurrent_queue_base::copy_specifics op_type );
@@ -158,6 +162,10 @@ public:
         return array[index(k)];
     }
 
+    //! Wait until the item with ticket k fits into the capacity of the queue
+    /** If the wait is aborted, passes the ticket and rethrows. */
+    void wait_for_slot( ticket k, concurrent_queue_base& base );
+
     //! Value for effective_capacity that denotes unbounded queue.
     static const ptrdiff_t infinite_capacity = ptrdiff_t(~size_t(0)/2);
 };
@@ -174,7 +182,8 @@ static void* invalid_page;
 // micro_queue
 //------------------------------------------------------------------------
 void micro_queue::push( const void* item, ticket k, concurrent_queue_base& base,
-                        concurrent_queue_base::copy_specifics op_type ) {
+                        concurrent_queue_base::copy_specifics op_type,
+                        concurrent_queue_base_v8::range_item_constructor construct_item ) {
     k &= -concurrent_queue_rep::n_queue;
     page* p = NULL;
     // find index on page where we would put the data
@@ -215,7 +224,9 @@ void micro_queue::push( const void* item, ticket k, concurrent_queue_base& base,
         p = tail_page;
         ITT_NOTIFY( sync_acquired, p );
         __TBB_TRY {
-            if( concurrent_queue_base::copy == op_type ) {
+            if( construct_item ) {
+                construct_item( const_cast<void*>(item), *p, index );
+            } else if( concurrent_queue_base::copy == op_type ) {
                 base.copy_item( *p, index, item );
             } else {
                 __TBB_ASSERT( concurrent_queue_base::move == op_type, NULL );
@@ -241,7 +252,8 @@ void micro_queue::abort_push( ticket k, concurrent_queue_base& base ) {
     push(NULL, k, base, concurrent_queue_base::copy);
 }
 
-bool micro_queue::pop( void* dst, ticket k, concurrent_queue_base& base ) {
+bool micro_queue::pop( void* dst, ticket k, concurrent_queue_base& base,
+                       concurrent_queue_base_v8::range_item_assigner assign_item ) {
     k &= -concurrent_queue_rep::n_queue;
     spin_wait_until_eq( head_counter, k );
     spin_wait_while_eq( tail_counter, k );
@@ -255,7 +267,10 @@ bool micro_queue::pop( void* dst, ticket k, concurrent_queue_base& base ) {
             success = true;
             ITT_NOTIFY( sync_acquired, dst );
             ITT_NOTIFY( sync_acquired, head_page );
-            base.assign_and_destroy_item( dst, p, index );
+            if( assign_item )
+                assign_item( dst, p, index );
+            else
+                base.assign_and_destroy_item( dst, p, index );
             ITT_NOTIFY( sync_releasing, head_page );
         } else {
             --base.my_rep->n_invalid_entries;
@@ -345,6 +360,30 @@ void micro_queue::make_invalid( ticket k )
     #pragma warning( pop )
 #endif // warning 4146 is back
 
+//------------------------------------------------------------------------
+// concurrent_queue_rep
+//------------------------------------------------------------------------
+void concurrent_queue_rep::wait_for_slot( ticket k, concurrent_queue_base& base ) {
+    ptrdiff_t e = base.my_capacity;
+    bool slept = false;
+    concurrent_monitor::thread_context thr_ctx;
+    slots_avail.prepare_wait( thr_ctx, ((ptrdiff_t)(k-e)) );
+    while( (ptrdiff_t)(k-head_counter)>=const_cast<volatile ptrdiff_t&>(e = base.my_capacity) ) {
+        __TBB_TRY {
+            slept = slots_avail.commit_wait( thr_ctx );
+        } __TBB_CATCH( tbb::user_abort& ) {
+            choose(k).abort_push(k, base);
+            __TBB_RETHROW();
+        } __TBB_CATCH(...) {
+            __TBB_RETHROW();
+        }
+        if (slept == true) break;
+        slots_avail.prepare_wait( thr_ctx, ((ptrdiff_t)(k-e)) );
+    }
+    if( !slept )
+        slots_avail.cancel_wait( thr_ctx );
+}
+
 //------------------------------------------------------------------------
 // concurrent_queue_base
 //------------------------------------------------------------------------
@@ -385,34 +424,17 @@ void concurrent_queue_base_v8::internal_push_move( const void* src ) {
 void concurrent_queue_base_v3::internal_insert_item( const void* src, copy_specifics op_type ) {
     concurrent_queue_rep& r = *my_rep;
     ticket k = r.tail_counter++;
-    ptrdiff_t e = my_capacity;
 #if DO_ITT_NOTIFY
     bool sync_prepare_done = false;
 #endif
-    if( (ptrdiff_t)(k-r.head_counter)>=e ) { // queue is full
+    if( (ptrdiff_t)(k-r.head_counter)>=my_capacity ) { // queue is full
 #if DO_ITT_NOTIFY
         if( !sync_prepare_done ) {
             ITT_NOTIFY( sync_prepare, &sync_prepare_done );
             sync_prepare_done = true;
         }
 #endif
-        bool slept = false;
-        concurrent_monitor::thread_context thr_ctx;
-        r.slots_avail.prepare_wait( thr_ctx, ((ptrdiff_t)(k-e)) );
-        while( (ptrdiff_t)(k-r.head_counter)>=const_cast<volatile ptrdiff_t&>(e = my_capacity) ) {
-            __TBB_TRY {
-                slept = r.slots_avail.commit_wait( thr_ctx );
-            } __TBB_CATCH( tbb::user_abort& ) {
-                r.choose(k).abort_push(k, *this);
-                __TBB_RETHROW();
-            } __TBB_CATCH(...) {
-                __TBB_RETHROW();
-            }
-            if (slept == true) break;
-            r.slots_avail.prepare_wait( thr_ctx, ((ptrdiff_t)(k-e)) );
-        }
-        if( !slept )
-            r.slots_avail.cancel_wait( thr_ctx );
+        r.wait_for_slot( k, *this );
     }
     ITT_NOTIFY( sync_acquired, &sync_prepare_done );
     __TBB_ASSERT( (ptrdiff_t)(k-r.head_counter)<my_capacity, NULL);
@@ -518,6 +540,74 @@ bool concurrent_queue_base_v3::internal_insert_if_not_full( const void* src, cop
     return true;
 }
 
+void concurrent_queue_base_v8::internal_push_range( size_t n, range_item_constructor construct_item, void* range ) {
+    concurrent_queue_rep& r = *my_rep;
+    ticket k = r.tail_counter.fetch_and_add( n );
+    const ticket end = k+n;
+    __TBB_TRY {
+        for( ; k!=end; ++k ) {
+            if( (ptrdiff_t)(k-r.head_counter)>=my_capacity ) { // queue is full
+                // Let consumers take the items pushed so far before we wait for them
+                r.items_avail.notify( predicate_leq(k-1) );
+                r.wait_for_slot( k, *this );
+            }
+            r.choose(k).push( range, k, *this, copy, construct_item );
+        }
+    } __TBB_CATCH(...) {
+        // Pass the tickets left, or the pushes and pops behind them would wait forever
+        for( ++k; k!=end; ++k ) {
+            __TBB_TRY {
+                r.choose(k).abort_push( k, *this );
+            } __TBB_CATCH(...) {}
+        }
+        r.items_avail.notify( predicate_leq(end-1) );
+        __TBB_RETHROW();
+    }
+    r.items_avail.notify( predicate_leq(end-1) );
+}
+
+size_t concurrent_queue_base_v8::internal_pop_many_if_present( size_t n, range_item_assigner assign_item, void* range ) {
+    concurrent_queue_rep& r = *my_rep;
+    size_t popped = 0;
+    while( popped<n ) {
+        ticket k = r.head_counter, end;
+        for(;;) {
+            ptrdiff_t available = r.tail_counter-k;
+            if( available<=0 ) {
+                // Queue is empty
+                return popped;
+            }
+            // Producers of the tickets we take may wait for earlier tickets of the batch
+            // to be popped, so a batch must not exceed the capacity.
+            size_t m = n-popped;
+            if( m>size_t(available) ) m = available;
+            if( m>size_t(my_capacity) && my_capacity>0 ) m = my_capacity;
+            end = k+m;
+            // Queue had the items when we looked.  Attempt to get them.
+            ticket tk=k;
+            k = r.head_counter.compare_and_swap( end, tk );
+            if( k==tk )
+                break;
+            // Another thread snatched some items, retry.
+        }
+        for( ; k!=end; ++k ) {
+            __TBB_TRY {
+                if( r.choose(k).pop( range, k, *this, assign_item ) )
+                    ++popped;
+            } __TBB_CATCH(...) {
+                // Pop the tickets left so that the queue keeps going; their items are lost
+                for( ++k; k!=end; ++k )
+                    r.choose(k).pop( NULL, k, *this, assign_item );
+                r.slots_avail.notify( predicate_leq(end-1) );
+                __TBB_RETHROW();
+            }
+        }
+        // wake up producers..
+        r.slots_avail.notify( predicate_leq(end-1) );
+    }
+    return popped;
+}
+
 ptrdiff_t concurrent_queue_base_v3::internal_size() const {
     __TBB_ASSERT( sizeof(ptrdiff_t)<=sizeof(size_t), NULL );
     return ptrdiff_t(my_rep->tail_counter-my_rep->head_counter-my_rep->n_invalid_entries);
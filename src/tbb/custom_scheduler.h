@@ -170,6 +170,8 @@ task* custom_scheduler<SchedulerTraits>::receive_or_steal_task( __TBB_atomic ref
     // and denotes that a sync_prepare has not yet been issued.
     for( int failure_count = -static_cast<int>(SchedulerTraits::itt_possible);; ++failure_count) {
         __TBB_ASSERT( my_arena->my_limit > 0, NULL );
+        if( my_quiescent_ack )
+            note_quiescent_state();
         __TBB_ASSERT( my_arena_index <= n, NULL );
         if( completion_ref_count==1 ) {
             if( SchedulerTraits::itt_possible ) {
@@ -532,6 +534,8 @@ void custom_scheduler<SchedulerTraits>::local_wait_for_all( task& parent, task*
                         break;
 #endif /* TBB_USE_ASSERT */
                 }
+                if( my_quiescent_ack )
+                    note_quiescent_state();
                 GATHER_STATISTIC( t_next ? ++my_counters.spawns_bypassed : 0 );
                 t = t_next;
             } // end of scheduler bypass loop
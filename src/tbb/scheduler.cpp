@@ -42,6 +42,69 @@ inline generic_scheduler* allocate_scheduler ( arena* a, size_t index ) {
     return AllocateSchedulerPtr(a, index);
 }
 
+//! The stamp of the latest worker created, see generic_scheduler::my_worker_stamp
+static atomic<size_t> the_last_worker_stamp;
+
+//------------------------------------------------------------------------
+// Quiescent states of worker threads
+//------------------------------------------------------------------------
+uintptr_t the_worker_generation = 2;
+
+//! Generation published by a worker out of arenas
+static const uintptr_t offline_generation = 1;
+
+//! Number of workers whose quiescent states are tracked
+/** Operations of workers with larger indices are registered like those of other threads. **/
+static const size_t tracked_workers_number = 255;
+
+//! Generation published by a worker, on a separate cache line
+struct quiescent_ack {
+    uintptr_t generation;
+};
+
+//! Generations published by the workers, indexed by the worker index
+static padded<quiescent_ack> the_quiescent_acks[tracked_workers_number+1];
+
+//! The largest index of a tracked worker created so far
+static atomic<size_t> the_quiescent_acks_limit;
+
+void generic_scheduler::set_quiescence_tracking( bool in_arena ) {
+    if( !my_quiescent_ack )
+        return;
+    if( in_arena ) {
+        my_quiescent_generation = __TBB_load_with_acquire(the_worker_generation);
+        // Full fence, nodes are read after the state is visible to the reclaiming threads
+        as_atomic(*my_quiescent_ack).fetch_and_store( my_quiescent_generation );
+    } else {
+        my_quiescent_generation = offline_generation;
+        __TBB_store_with_release( *my_quiescent_ack, offline_generation );
+    }
+}
+
+bool notify_worker_quiescent_state() {
+    generic_scheduler* s = governor::local_scheduler_if_initialized();
+    if( !s || !s->my_quiescent_ack || s->my_quiescent_generation == offline_generation )
+        return false;
+    s->note_quiescent_state();
+    return true;
+}
+
+uintptr_t advance_worker_generation() {
+    // Full fence, nodes unlinked before cannot be reached by workers that see the generation
+    return __TBB_FetchAndAddW( &the_worker_generation, 2 ) + 2;
+}
+
+bool workers_quiescent_since( uintptr_t generation ) {
+    __TBB_ASSERT( !(generation & 1), "not a generation of quiescent states" );
+    for( size_t i = 1, n = the_quiescent_acks_limit; i <= n; ++i ) {
+        uintptr_t g = __TBB_load_with_acquire(the_quiescent_acks[i].generation);
+        if( g != offline_generation && intptr_t(g - generation) < 0 )
+            return false;
+    }
+    return true;
+}
+
+
 #if __TBB_TASK_GROUP_CONTEXT
 context_state_propagation_mutex_type the_context_state_propagation_mutex;
 
@@ -88,6 +151,10 @@ scheduler::~scheduler( ) {}
 generic_scheduler::generic_scheduler( arena* a, size_t index )
     : my_stealing_threshold(0)
     , my_market(NULL)
+    , my_worker_index(0)
+    , my_worker_stamp(0)
+    , my_quiescent_generation(offline_generation)
+    , my_quiescent_ack(NULL)
     , my_random( this )
     , my_free_list(NULL)
 #if __TBB_HOARD_NONLOCAL_TASKS
@@ -1025,6 +1092,15 @@ generic_scheduler* generic_scheduler::create_worker( market& m, size_t index ) {
     s->my_context_state_propagation_epoch = the_context_state_propagation_epoch;
 #endif /* __TBB_TASK_GROUP_CONTEXT */
     s->my_market = &m;
+    s->my_worker_index = index;
+    s->my_worker_stamp = ++the_last_worker_stamp;
+    if( index <= tracked_workers_number ) {
+        s->my_quiescent_ack = &the_quiescent_acks[index].generation;
+        // A finished worker of the same index has left it offline
+        if( !*s->my_quiescent_ack )
+            __TBB_store_with_release( *s->my_quiescent_ack, offline_generation );
+        atomic_update( the_quiescent_acks_limit, index, std::less<size_t>() );
+    }
     s->init_stack_info();
 #if __TBB_TASK_PRIORITY
     s->my_ref_top_priority = &s->my_market->my_global_top_priority;
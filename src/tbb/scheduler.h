@@ -138,6 +138,27 @@ public: // almost every class in TBB uses generic_scheduler
     //! The market I am in
     market* my_market;
 
+    //! Index of the worker thread in the market, starting from 1; 0 for master threads.
+    /** Unlike my_arena_index, it does not change when the worker migrates between arenas. **/
+    size_t my_worker_index;
+
+    //! Number telling the worker thread from the finished ones of the same index, 0 for master threads.
+    /** Worker indices are reused when the market is created again, stamps are not. **/
+    size_t my_worker_stamp;
+
+    //! Generation of quiescent states seen at the latest quiescent point, see the_worker_generation
+    uintptr_t my_quiescent_generation;
+
+    //! Slot publishing my_quiescent_generation; NULL for master threads and the untracked workers.
+    uintptr_t* my_quiescent_ack;
+
+    //! Publishes the current generation of quiescent states if it has changed.
+    /** Called by workers between tasks, where they are not inside container operations. **/
+    inline void note_quiescent_state();
+
+    //! Starts or stops publishing the quiescent states when the worker enters or leaves an arena.
+    void set_quiescence_tracking( bool in_arena );
+
     //! Random number generator used for picking a random victim from which to steal.
     FastRandom my_random;
 
@@ -551,6 +572,16 @@ inline bool generic_scheduler::is_worker() {
     return my_arena_index != 0; //TODO: rework for multiple master
 }
 
+inline void generic_scheduler::note_quiescent_state() {
+    __TBB_ASSERT( my_quiescent_ack, NULL );
+    uintptr_t g = __TBB_load_with_acquire(the_worker_generation);
+    if( g != my_quiescent_generation ) {
+        my_quiescent_generation = g;
+        // Release fence, nodes read before are not accessed after the state is published
+        __TBB_store_with_release( *my_quiescent_ack, g );
+    }
+}
+
 inline unsigned generic_scheduler::number_of_workers_in_my_arena() {
     return my_arena->my_max_num_workers;
 }
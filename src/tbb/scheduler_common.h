@@ -144,6 +144,14 @@ typedef scheduler_mutex_type context_state_propagation_mutex_type;
 extern context_state_propagation_mutex_type the_context_state_propagation_mutex;
 #endif /* __TBB_TASK_GROUP_CONTEXT */
 
+//! Latest generation of quiescent states of the worker threads
+/** A worker thread is in a quiescent state between the tasks it executes and out of arenas,
+    because operations on concurrent containers do not wait for tasks. Each worker publishes
+    the generation it has seen at such points, see generic_scheduler::note_quiescent_state,
+    so that containers reclaim memory without registering the operations of workers.
+    Generations are even, and are advanced by 2; the odd value marks workers out of arenas. **/
+extern uintptr_t the_worker_generation;
+
 //! Alignment for a task object
 const size_t task_alignment = 32;
 
@@ -157,6 +157,17 @@ size_t get_initial_auto_partitioner_divisor() {
     return X_FACTOR * (1+governor::local_scheduler()->number_of_workers_in_my_arena());
 }
 
+//------------------------------------------------------------------------
+// Support for enumerable_thread_specific
+//------------------------------------------------------------------------
+size_t current_worker_index( size_t& stamp ) {
+    generic_scheduler* s = governor::local_scheduler_if_initialized();
+    if( !s )
+        return 0;
+    stamp = s->my_worker_stamp;
+    return s->my_worker_index;
+}
+
 //------------------------------------------------------------------------
 // Methods of affinity_partitioner_base_v3
 //------------------------------------------------------------------------
@@ -82,6 +82,34 @@ int UnmapMemory(void *area, size_t bytes)
     return ret;
 }
 
+#if __linux__ && defined(MREMAP_MAYMOVE)
+#define MEMORY_REMAP_SUPPORTED 1
+// Resize the mapping, moving it if it can't be grown in place.
+// Page contents are preserved by the OS without copying.
+void* RemapMemory (void *area, size_t oldBytes, size_t newBytes)
+{
+    int prevErrno = errno;
+    void *result = mremap(area, oldBytes, newBytes, MREMAP_MAYMOVE);
+    if (result==MAP_FAILED)
+        errno = prevErrno;
+    return result==MAP_FAILED? 0: result;
+}
+#endif
+
+#if __linux__ && defined(MADV_DONTNEED)
+#define MEMORY_DISCARD_SUPPORTED 1
+// Drop physical pages of a private anonymous mapping,
+// they are zero-filled again on next access.
+int DiscardMemory(void *area, size_t bytes)
+{
+    int prevErrno = errno;
+    int ret = madvise(area, bytes, MADV_DONTNEED);
+    if (-1 == ret)
+        errno = prevErrno;
+    return ret;
+}
+#endif
+
 #elif (_WIN32 || _WIN64) && !_XBOX && !__TBB_WIN8UI_SUPPORT
 #include <windows.h>
 
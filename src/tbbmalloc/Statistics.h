@@ -19,7 +19,7 @@
 */
 
 #define MAX_THREADS 1024
-#define NUM_OF_BINS 30
+#define NUM_OF_BINS 36
 #define ThreadCommonCounters NUM_OF_BINS
 
 enum counter_type {
@@ -51,6 +51,26 @@ bool freeRawMemory (void *object, size_t size) {
     return UnmapMemory(object, size);
 }
 
+// returns false if the pages were not dropped, their content is intact then
+bool discardRawMemory (void *object, size_t size) {
+#if MEMORY_DISCARD_SUPPORTED
+    return !DiscardMemory(object, size);
+#else
+    suppress_unused_warning(object, size);
+    return false;
+#endif
+}
+
+// returns NULL if the mapping can't be resized, the old one is intact then
+void* remapRawMemory (void *object, size_t oldSize, size_t newSize) {
+#if MEMORY_REMAP_SUPPORTED
+    return RemapMemory(object, oldSize, newSize);
+#else
+    suppress_unused_warning(object, oldSize, newSize);
+    return NULL;
+#endif
+}
+
 void HugePagesStatus::registerAllocation(bool gotPage)
 {
     if (gotPage) {
@@ -98,6 +118,21 @@ void HugePagesStatus::doPrintStatus(bool state, const char *stateName)
     fputs("\n", stderr);
 }
 
+// Account size bytes as taken by the pool, if this does not exceed the pool limit
+bool Backend::reserveRawMem(size_t size) const
+{
+    for (;;) {
+        size_t limit = FencedLoad((intptr_t&)extMemPool->memLimit);
+        size_t total = AtomicAdd((intptr_t&)totalMemSize, size) + size;
+        if (!limit || total <= limit)
+            return true;
+        AtomicAdd((intptr_t&)totalMemSize, -size);
+        memLimitCallbackType callback = extMemPool->limitCallback;
+        if (!callback || !(*callback)(extMemPool->poolId, limit, size))
+            return false;
+    }
+}
+
 void *Backend::allocRawMem(size_t &size) const
 {
     void *res = NULL;
@@ -107,7 +142,12 @@ void *Backend::allocRawMem(size_t &size) const
         // memory from fixed pool is asked once and only once
         if (!extMemPool->fixedPool || !rawMemReceived) {
             allocSize = alignUpGeneric(size, extMemPool->granularity);
+            const size_t reservedSize = allocSize;
+            if (!reserveRawMem(reservedSize))
+                return NULL;
             res = (*extMemPool->rawAlloc)(extMemPool->poolId, allocSize);
+            // the callback is allowed to change the size
+            AtomicAdd((intptr_t&)totalMemSize, res? allocSize-reservedSize : -reservedSize);
             if (extMemPool->fixedPool)
                 const_cast<bool&>(rawMemReceived) = true;
         }
@@ -116,20 +156,26 @@ void *Backend::allocRawMem(size_t &size) const
         // if 1st try is unsuccessful, no more trying
         if (FencedLoad(hugePages.enabled)) {
             allocSize = alignUpGeneric(size, hugePages.getSize());
-            res = getRawMemory(allocSize, /*hugePages=*/true);
-            hugePages.registerAllocation(res);
+            if (reserveRawMem(allocSize)) {
+                res = getRawMemory(allocSize, /*hugePages=*/true);
+                hugePages.registerAllocation(res);
+                if (!res)
+                    AtomicAdd((intptr_t&)totalMemSize, -allocSize);
+            }
         }
 
         if ( !res ) {
             allocSize = alignUpGeneric(size, extMemPool->granularity);
+            if (!reserveRawMem(allocSize))
+                return NULL;
             res = getRawMemory(allocSize, /*hugePages=*/false);
+            if (!res)
+                AtomicAdd((intptr_t&)totalMemSize, -allocSize);
         }
     }
 
-    if ( res ) {
+    if ( res )
         size = allocSize;
-        AtomicAdd((intptr_t&)totalMemSize, size);
-    }
 
     return res;
 }
@@ -181,6 +227,12 @@ public:
         }
         return sz;
     }
+    bool isLastRegionBlock() const { return value==LAST_REGION_BLOCK; }
+    // size of the block or 0 if it is locked or a special one
+    size_t getSize() const {
+        size_t sz = FencedLoad((intptr_t&)value);
+        return sz > MAX_SPEC_VAL? sz : 0;
+    }
     void unlock(size_t size) {
         MALLOC_ASSERT(value <= MAX_LOCKED_VAL, "The lock is not locked");
         MALLOC_ASSERT(size > MAX_LOCKED_VAL, ASSERT_TEXT);
@@ -231,6 +283,8 @@ public:
     void initHeader() { myL.initLocked(); leftL.initLocked(); }
     void setMeFree(size_t size) { myL.unlock(size); }
     size_t trySetMeUsed(GuardedSize::State s) { return myL.tryLock(s); }
+    bool isLastRegionBlock() const { return myL.isLastRegionBlock(); }
+    size_t getFreeSize() const { return myL.getSize(); }
 
     void setLeftFree(size_t sz) { leftL.unlock(sz); }
     size_t trySetLeftUsed(GuardedSize::State s) { return leftL.tryLock(s); }
@@ -721,7 +775,8 @@ FreeBlock *Backend::IndexedBins::
 
 // try to allocate size Byte block in available bins
 // needAlignedRes is true if result must be slab-aligned
-FreeBlock *Backend::genericGetBlock(int num, size_t size, bool needAlignedBlock)
+FreeBlock *Backend::genericGetBlock(int num, size_t size, bool needAlignedBlock,
+                                    bool *newRegion)
 {
     FreeBlock *block = NULL;
     const size_t totalReqSize = num*size;
@@ -792,16 +847,22 @@ FreeBlock *Backend::genericGetBlock(int num, size_t size, bool needAlignedBlock)
             splitUnalignedBlock(block, num, size, needAlignedBlock);
     // matched blockConsumed() from startUseBlock()
     bkndSync.blockReleased();
+    // a block that is not splittable is a sole block of a region just added
+    if (newRegion)
+        *newRegion = !splittable;
 
     return block;
 }
 
 LargeMemoryBlock *Backend::getLargeBlock(size_t size)
 {
+    bool newRegion;
     LargeMemoryBlock *lmb =
-        (LargeMemoryBlock*)genericGetBlock(1, size, /*needAlignedRes=*/false);
+        (LargeMemoryBlock*)genericGetBlock(1, size, /*needAlignedRes=*/false, &newRegion);
     if (lmb) {
         lmb->unalignedSize = size;
+        // only headers were written into a just mapped region
+        lmb->knownZero = newRegion && !inUserPool();
         if (extMemPool->userPool())
             extMemPool->lmbList.add(lmb);
     }
@@ -881,6 +942,106 @@ void Backend::returnLargeObject(LargeMemoryBlock *lmb)
     STAT_increment(getThreadId(), ThreadCommonCounters, freeLargeObj);
 }
 
+// Zero a large object by dropping its whole pages instead of writing them,
+// so pages are not touched before the application needs them.
+// Returns false if it is not possible, nothing is written then.
+bool Backend::zeroPages(void *object, size_t size)
+{
+    // raw memory of user pools is unknown, huge pages can't be dropped partially
+    if (inUserPool() || FencedLoad(hugePages.wasObserved) || size < getMaxBinnedSize())
+        return false;
+    const uintptr_t begin = alignUp((uintptr_t)object, extMemPool->granularity),
+        end = alignDown((uintptr_t)object + size, extMemPool->granularity);
+    if (!discardRawMemory((void*)begin, end - begin))
+        return false;
+    memset(object, 0, begin - (uintptr_t)object);
+    memset((void*)end, 0, (uintptr_t)object + size - end);
+    return true;
+}
+
+// Grow a large object that is the only block in its region by resizing
+// the region mapping, so the OS moves pages instead of copying them.
+// Returns NULL if it is not possible, the object is intact then.
+void *Backend::remap(void *ptr, size_t newSize, size_t alignment)
+{
+    // user pools get memory from callbacks, huge pages might be not remappable
+    if (inUserPool() || FencedLoad(hugePages.wasObserved)
+        // object offset in a region is kept, so is alignment up to a page
+        || !isAligned(ptr, alignment) || alignment > extMemPool->granularity)
+        return NULL;
+    LargeObjectHdr *header = (LargeObjectHdr*)ptr - 1;
+    LargeMemoryBlock *lmb = header->memoryBlock;
+    FreeBlock *right = ((FreeBlock*)lmb)->rightNeig(lmb->unalignedSize);
+    // only one block in a region has the last block as a right neighbor,
+    // and it is ours, so no synchronization is needed
+    if (!right->isLastRegionBlock())
+        return NULL;
+    MemRegion *region = static_cast<LastFreeBlock*>(right)->memRegion;
+    // a free block of such region can be split, and the object is in its tail then
+    if (region->type != MEMREG_ONE_BLOCK || region->blockSz != lmb->unalignedSize
+        || (uintptr_t)lmb != alignUp((uintptr_t)region + sizeof(MemRegion), largeObjectAlignment))
+        return NULL;
+
+    const size_t blockOffset = (uintptr_t)lmb - (uintptr_t)region,
+        objectOffset = (uintptr_t)ptr - (uintptr_t)lmb,
+        newBlockSz = LargeObjectCache::alignToBin(objectOffset + newSize),
+        oldAllocSz = region->allocSz,
+        newAllocSz = alignUpGeneric(blockOffset + newBlockSz + sizeof(LastFreeBlock),
+                                    extMemPool->granularity);
+    if (newBlockSz < newSize || newAllocSz < newBlockSz) // wrapped around?
+        return NULL;
+    if (newAllocSz <= oldAllocSz || !reserveRawMem(newAllocSz - oldAllocSz))
+        return NULL;
+
+    // the region is out of the list while its address is not valid
+    {
+        MallocMutex::scoped_lock lock(regionListLock);
+        if (regionList == region)
+            regionList = region->next;
+        if (region->next)
+            region->next->prev = region->prev;
+        if (region->prev)
+            region->prev->next = region->next;
+    }
+    MemRegion *newRegion = (MemRegion*)remapRawMemory(region, oldAllocSz, newAllocSz);
+    if (!newRegion) {
+        AtomicAdd((intptr_t&)totalMemSize, -(newAllocSz - oldAllocSz));
+        newRegion = region;
+    } else {
+        newRegion->allocSz = newAllocSz;
+        newRegion->blockSz = newBlockSz;
+        lmb = (LargeMemoryBlock*)((uintptr_t)newRegion + blockOffset);
+        // the block is in use, so the left lock of the last block stays locked
+        LastFreeBlock *lastBl =
+            static_cast<LastFreeBlock*>(((FreeBlock*)lmb)->rightNeig(newBlockSz));
+        lastBl->initHeader();
+        lastBl->setMeFree(GuardedSize::LAST_REGION_BLOCK);
+        lastBl->myBin = NO_BIN;
+        lastBl->memRegion = newRegion;
+    }
+    {
+        newRegion->prev = NULL;
+        MallocMutex::scoped_lock lock(regionListLock);
+        newRegion->next = regionList;
+        regionList = newRegion;
+        if (regionList->next)
+            regionList->next->prev = regionList;
+    }
+    regionBounds.add((uintptr_t)newRegion, (uintptr_t)newRegion+newRegion->allocSz);
+    if (newRegion == region)
+        return NULL;
+
+    void *object = (void*)((uintptr_t)lmb + objectOffset);
+    header = (LargeObjectHdr*)object - 1;
+    header->memoryBlock = lmb;
+    setBackRef(header->backRefIdx, header);
+    lmb->unalignedSize = newBlockSz;
+    lmb->objectSize = newSize;
+    MALLOC_ASSERT((uintptr_t)lmb + lmb->unalignedSize >= (uintptr_t)object + newSize,
+                  "Object doesn't fit the block.");
+    return object;
+}
+
 void Backend::releaseRegion(MemRegion *memRegion)
 {
     {
@@ -1173,14 +1334,31 @@ FreeBlock *Backend::addNewRegion(size_t size, MemRegionType memRegType, bool add
         if (regionList->next)
             regionList->next->prev = regionList;
     }
+    regionBounds.add((uintptr_t)region, (uintptr_t)region+rawSize);
+    if (inUserPool())
+        userRegionBounds.add((uintptr_t)region, (uintptr_t)region+rawSize);
     startUseBlock(region, fBlock, addToBin);
     bkndSync.binsModified();
     return addToBin? (FreeBlock*)VALID_BLOCK_IN_BIN : fBlock;
 }
 
+RegionBounds Backend::userRegionBounds = { UINTPTR_MAX, 0 };
+
+bool Backend::ptrInRegions(const void *ptr)
+{
+    if (!regionBounds.inRange(ptr))
+        return false;
+    MallocMutex::scoped_lock lock(regionListLock);
+    for (MemRegion *curr = regionList; curr; curr = curr->next)
+        if ((uintptr_t)curr <= (uintptr_t)ptr && (uintptr_t)ptr < (uintptr_t)curr+curr->allocSz)
+            return true;
+    return false;
+}
+
 bool Backend::bootstrap(ExtMemoryPool *extMemoryPool)
 {
     extMemPool = extMemoryPool;
+    regionBounds.init();
     return addNewRegion(2*1024*1024, MEMREG_FLEXIBLE_SIZE, /*addToBin=*/true);
 }
 
@@ -1255,6 +1433,20 @@ void Backend::IndexedBins::verify()
     }
 }
 
+// Blocks being taken from the bins right now are not counted.
+size_t Backend::IndexedBins::getFreeSize()
+{
+    size_t size = 0;
+    for (int i=0; i<freeBinsNum; i++) {
+        if (freeBins[i].empty())
+            continue;
+        MallocMutex::scoped_lock lock(freeBins[i].tLock);
+        for (FreeBlock *fb = freeBins[i].head; fb; fb = fb->next)
+            size += fb->getFreeSize();
+    }
+    return size;
+}
+
 // For correct operation, it must be called when no other threads
 // is changing backend.
 void Backend::verify()
@@ -33,6 +33,14 @@
     #define GetMyTID() pthread_self()
     #include <sched.h>
     inline void do_yield() {sched_yield();}
+    #if __linux__
+    #include <unistd.h>   /* for sysconf */
+    // glibc registers rseq area for every thread since 2.35
+    #if __GLIBC__ > 2 || __GLIBC__ == 2 && __GLIBC_MINOR__ >= 35
+    #include <sys/rseq.h>
+    #define MALLOC_RSEQ_PRESENT (__GNUC__ >= 11 && !__INTEL_COMPILER)
+    #endif
+    #endif
     extern "C" { static void mallocThreadShutdownNotification(void*); }
     #if __sun || __SUNPRO_CC
     #define __asm__ asm
@@ -60,6 +68,14 @@
 
 #define FREELIST_NONBLOCKING 1
 
+#if __linux__ || __APPLE__ || __sun || __FreeBSD__
+#include <sys/mman.h>   /* for mprotect */
+#include <unistd.h>     /* for sysconf */
+#define GUARD_PAGES_SUPPORTED 1
+#else
+#define GUARD_PAGES_SUPPORTED 0
+#endif
+
 namespace rml {
 class MemoryPool;
 namespace internal {
@@ -87,7 +103,7 @@ const uint16_t startupAllocObjSizeMark = ~(uint16_t)0;
 /*
  * This number of bins in the TLS that leads to blocks that we can allocate in.
  */
-const uint32_t numBlockBinLimit = 31;
+const uint32_t numBlockBinLimit = 36;
 
 /*
  * The following constant is used to define the size of struct Block, the block header.
@@ -266,6 +282,7 @@ public:
     inline LifoList();
     inline void push(Block *block);
     inline Block *pop();
+    void addSlabStats(MemPoolStats *stats);
 
 private:
     Block *top;
@@ -288,6 +305,7 @@ public:
     Block *get(TLSData *tls, unsigned int size);
     void put(Bin *bin, Block *block);
     void reset();
+    void addSlabStats(MemPoolStats *stats);
 };
 
 class MemoryPool {
@@ -322,6 +340,8 @@ public:
     // get/put large object to/from local large object cache
     void *getFromLLOCache(TLSData *tls, size_t size, size_t alignment);
     void putToLLOCache(TLSData *tls, void *object);
+
+    void getStats(MemPoolStats *stats);
 };
 
 static char defaultMemPool_space[sizeof(MemoryPool)];
@@ -339,6 +359,7 @@ class GlobalBlockFields : public BlockI {
 protected:
     FreeObject  *publicFreeList;
     Block       *nextPrivatizable;
+    MemoryPool  *pool;  // the owner, to release objects of a thread default pool
 };
 
 template<size_t padd>
@@ -381,11 +402,15 @@ class Block : public LocalBlockFields {
              sizeof(LocalBlockFields))/sizeof(size_t)> pad_public;
 public:
     bool empty() const { return allocatedCount==0 && publicFreeList==NULL; }
+    // objects in the public free list are still counted as allocated
+    size_t getAllocatedSize() const { return (size_t)allocatedCount*objectSize; }
     inline FreeObject* allocate();
+    inline size_t allocateBatch(void **objects, size_t num);
     inline FreeObject *allocateFromFreeList();
     inline bool emptyEnoughToUse();
     bool freeListNonNull() { return freeList; }
-    void freePublicObject(FreeObject *objectToFree);
+    void freePublicObject(FreeObject *objectToFree) { freePublicObjects(objectToFree, objectToFree); }
+    void freePublicObjects(FreeObject *head, FreeObject *tail);
     inline void freeOwnObject(MemoryPool *memPool, TLSData *tls, void *object);
     void makeEmpty();
     void privatizePublicFreeList();
@@ -398,6 +423,7 @@ public:
         return isStartupAllocObject()? 0 : objectSize;
     }
     const BackRefIdx *getBackRefIdx() const { return &backRefIdx; }
+    MemoryPool *getMemPool() const { return pool; }
     inline TLSData *ownBlock() const;
     bool isStartupAllocObject() const { return objectSize == startupAllocObjSizeMark; }
     inline FreeObject *findObjectToFree(const void *object) const;
@@ -483,13 +509,14 @@ public:
     void outofTLSBin (Block* block);
     void verifyTLSBin (size_t size) const;
     void pushTLSBin(Block* block);
+    void addSlabStats(MemPoolStats *stats) const;
 
     void verifyInitState() const {
         MALLOC_ASSERT( activeBlk == 0, ASSERT_TEXT );
         MALLOC_ASSERT( mailbox == 0, ASSERT_TEXT );
     }
 
-    friend void Block::freePublicObject (FreeObject *objectToFree);
+    friend void Block::freePublicObjects (FreeObject *head, FreeObject *tail);
 };
 
 /********* End of the data structures                    **************/
@@ -510,33 +537,40 @@ const uint32_t numSegregatedObjectBins = 16;
 const uint32_t maxSegregatedObjectSize = 1024;
 
 /*
- * And there are 5 bins with allocation sizes that are multiples of estimatedCacheLineSize
- * and selected to fit 9, 6, 4, 3, and 2 allocations in a block.
+ * And there are 11 bins with allocation sizes that are multiples of estimatedCacheLineSize
+ * and selected to fit 14, 12, 10, 9, 8, 7, 6, 5, 4, 3, and 2 allocations in a block.
  */
 const uint32_t minFittingIndex = minSegregatedObjectIndex+numSegregatedObjectBins;
-const uint32_t numFittingBins = 5;
+const uint32_t numFittingBins = 11;
 
 const uint32_t fittingAlignment = estimatedCacheLineSize;
 
 #define SET_FITTING_SIZE(N) ( (slabSize-sizeof(Block))/N ) & ~(fittingAlignment-1)
 // For blockSize=16*1024, sizeof(Block)=2*estimatedCacheLineSize and fittingAlignment=estimatedCacheLineSize,
 // the comments show the fitting sizes and the amounts left unused for estimatedCacheLineSize=64/128:
-const uint32_t fittingSize1 = SET_FITTING_SIZE(9); // 1792/1792 128/000
-const uint32_t fittingSize2 = SET_FITTING_SIZE(6); // 2688/2688 128/000
-const uint32_t fittingSize3 = SET_FITTING_SIZE(4); // 4032/3968 128/256
-const uint32_t fittingSize4 = SET_FITTING_SIZE(3); // 5376/5376 128/000
-const uint32_t fittingSize5 = SET_FITTING_SIZE(2); // 8128/8064 000/000
+const uint32_t fittingSize1  = SET_FITTING_SIZE(14); // 1152/1152 128/000
+const uint32_t fittingSize2  = SET_FITTING_SIZE(12); // 1344/1280 128/768
+const uint32_t fittingSize3  = SET_FITTING_SIZE(10); // 1600/1536 256/768
+const uint32_t fittingSize4  = SET_FITTING_SIZE(9);  // 1792/1792 128/000
+const uint32_t fittingSize5  = SET_FITTING_SIZE(8);  // 1984/1920 384/768
+const uint32_t fittingSize6  = SET_FITTING_SIZE(7);  // 2304/2304 128/000
+const uint32_t fittingSize7  = SET_FITTING_SIZE(6);  // 2688/2688 128/000
+const uint32_t fittingSize8  = SET_FITTING_SIZE(5);  // 3200/3200 256/128
+const uint32_t fittingSize9  = SET_FITTING_SIZE(4);  // 4032/3968 128/256
+const uint32_t fittingSize10 = SET_FITTING_SIZE(3);  // 5376/5376 128/000
+const uint32_t fittingSize11 = SET_FITTING_SIZE(2);  // 8128/8064 000/000
 #undef SET_FITTING_SIZE
 
 /*
  * The total number of thread-specific Block-based bins
  */
 const uint32_t numBlockBins = minFittingIndex+numFittingBins;
+MALLOC_STATIC_ASSERT(numBlockBins <= numBlockBinLimit, "Not enough bins in TLS for all size classes.");
 
 /*
  * Objects of this size and larger are considered large objects.
  */
-const uint32_t minLargeObjectSize = fittingSize5 + 1;
+const uint32_t minLargeObjectSize = fittingSize11 + 1;
 
 /*
  * Default granularity of memory pools
@@ -553,6 +587,7 @@ const size_t scalableMallocPoolGranularity = 4*1024;  // page size, for mmap use
  * threads memory that are likely in local cache(s) of our CPU.
  */
 class FreeBlockPool {
+private:
     Block      *head;
     int         size;
     Backend    *backend;
@@ -574,11 +609,13 @@ public:
     ResOfGet getBlock();
     void returnBlock(Block *block);
     bool externalCleanup(); // can be called by another thread
+    size_t getCachedSize() const { return (size_t)size*slabSize; }
 };
 
 template<int LOW_MARK, int HIGH_MARK>
 class LocalLOCImpl {
-    static const size_t MAX_TOTAL_SIZE = 4*1024*1024;
+private:
+    static const size_t MAX_TOTAL_SIZE = 8*1024*1024;
     // TODO: can single-linked list be faster here?
     LargeMemoryBlock *head,
                      *tail; // need it when do releasing on overflow
@@ -588,6 +625,7 @@ public:
     bool put(LargeMemoryBlock *object, ExtMemoryPool *extMemPool);
     LargeMemoryBlock *get(size_t size);
     bool externalCleanup(ExtMemoryPool *extMemPool);
+    size_t getCachedSize() const { return totalSize; }
 #if __TBB_MALLOC_WHITEBOX_TEST
     LocalLOCImpl() : head(NULL), tail(NULL), totalSize(0), numOfBlocks(0) {}
     static size_t getMaxSize() { return MAX_TOTAL_SIZE; }
@@ -597,7 +635,118 @@ public:
 #endif
 };
 
-typedef LocalLOCImpl<8,32> LocalLOC; // set production code parameters
+typedef LocalLOCImpl<16,48> LocalLOC; // set production code parameters
+
+/*
+ * Per-CPU caches of empty slab blocks and large objects for the default pool.
+ * When enabled, they are used instead of freeSlabBlocks and lloc from TLS,
+ * so the amount of cached memory depends on the number of CPUs rather than
+ * threads. The current CPU is taken from the rseq area registered by glibc,
+ * or from sched_getcpu() otherwise. A slot is owned by the thread that
+ * locked it; if it is busy (the owner was preempted), the cache is bypassed.
+ * If the current CPU is unknown, thread-local caches are used.
+ */
+class PerCpuCaches {
+private:
+    class SlotFields {
+    public:
+        __TBB_atomic_flag busy;
+        FreeBlockPool     freeSlabBlocks;
+        LocalLOC          lloc;
+
+        SlotFields(Backend *bknd) : busy(0), freeSlabBlocks(bknd) {}
+    };
+    class Slot : public SlotFields {
+        Padding<(2*estimatedCacheLineSize - sizeof(SlotFields))/sizeof(size_t)> pad;
+    public:
+        Slot(Backend *bknd) : SlotFields(bknd) {}
+    };
+
+    Slot               *slots;
+    unsigned            numOfSlots;
+    bool                rawMemUsed;
+    AllocControlledMode requestedMode; // changed only by user
+    MallocMutex         setModeLock;
+
+    bool allocateSlots(Backend *backend);
+    static int currentCpu();
+public:
+    intptr_t            enabled;
+
+    // Locks the slot of the current CPU, if the mode applies to the pool
+    class CurrentSlot : tbb::internal::no_copy {
+    private:
+        Slot *slot;
+        bool  inUse;
+    public:
+        CurrentSlot(PerCpuCaches &caches, ExtMemoryPool *extMemPool);
+        ~CurrentSlot() { if (slot) __TBB_UnlockByte(slot->busy); }
+        // caches to be used by the current thread, NULL if none
+        FreeBlockPool *freeSlabBlocks(TLSData *tls) const;
+        LocalLOC *lloc(TLSData *tls) const;
+    };
+
+    void init() {
+        MallocMutex::scoped_lock lock(setModeLock);
+        requestedMode.initReadEnv("TBB_MALLOC_USE_PERCPU_CACHES", 0);
+        enabled = requestedMode.get();
+    }
+    void setMode(intptr_t newVal) {
+        MallocMutex::scoped_lock lock(setModeLock);
+        requestedMode.set(newVal);
+        enabled = newVal;
+    }
+    bool cleanup(ExtMemoryPool *extMemPool); // can be called by any thread
+    void reset(Backend *backend);
+    // sizes of empty slabs and large object blocks kept by the caches
+    void getCachedSizes(size_t *slabsSize, size_t *largeSize) const;
+};
+
+/*
+ * Per-thread buffers for objects released to slabs owned by other threads,
+ * one buffer per size class. Consecutive objects from the same slab are chained
+ * and passed to the slab's public free list at once, so a producer/consumer pair
+ * pays for one CAS per batch rather than per object. Buffers are flushed
+ * only by the owning thread: when full, after FLUSH_PERIOD objects, on
+ * the allocation slow path and at thread shutdown, so a thread that frees
+ * remotely only now and then does not keep the objects from their owners.
+ */
+class RemoteFreeCache {
+    class Batch {
+    public:
+        Block      *block;
+        FreeObject *head,
+                   *tail;
+        int         num;
+    };
+    Batch batches[numBlockBinLimit];
+    int   pending; // objects put since the last flush
+public:
+    static const int MAX_BATCH_SIZE = 64;
+    static const int FLUSH_PERIOD = 4*MAX_BATCH_SIZE;
+
+    // allocated in zero-initialized memory
+    inline void put(Block *block, FreeObject *object, unsigned index);
+    bool flush();
+};
+
+/*
+ * Per-thread quarantine of released guarded objects. The objects are linked
+ * through their first words, the oldest are released when the total size
+ * exceeds the limit.
+ */
+class GuardedQuarantine {
+private:
+    FreeObject *head,
+               *tail;
+    size_t      totalSize;
+public:
+    static const size_t MAX_TOTAL_SIZE = 4*1024*1024;
+
+    // allocated in zero-initialized memory
+    void put(void *object, size_t size);
+    bool drain();
+};
 
 class TLSData : public TLSRemote {
 #if USE_PTHREAD
@@ -607,7 +756,13 @@ public:
     Bin           bin[numBlockBinLimit];
     FreeBlockPool freeSlabBlocks;
     LocalLOC      lloc;
+    RemoteFreeCache remoteFree;
+    GuardedQuarantine guardedQuarantine;
     unsigned      currCacheIdx;
+    // guarded objects allocated since the last one placed on guard pages
+    intptr_t      guardedSampleCnt;
+    // set by pool_set_thread_default, used only in TLS of the default pool
+    MemoryPool   *threadDefaultPool;
 private:
     bool unused;
 public:
@@ -629,6 +784,202 @@ public:
     void markUnused() { unused =  true; } // can be called by not owner thread
 };
 
+// zero-initialized
+static PerCpuCaches perCpuCaches;
+
+/*
+ * Guarded mode of scalable_malloc and friends, to catch heap misuse where
+ * a debug build or an address sanitizer is too slow to run. A guarded object
+ * is preceded by a header, whose canary is overwritten by underflows,
+ * and followed by a redzone filled with a pattern. Both are checked when
+ * the object is released. Released objects are filled with another pattern
+ * and stay in a per-thread quarantine; the pattern is checked when they leave
+ * it, to find writes after free. Optionally, 1 of sampleRate objects is placed
+ * right before an inaccessible page, and its pages are made inaccessible on
+ * releasing, so an overflow or a use after free faults in the culprit code.
+ * Guarded objects are taken from the default pool; objects allocated while
+ * the mode is off are served as usual, so the mode can be switched anytime.
+ * A header is always on the page of its object, so it can be read for
+ * foreign pointers; objects aligned to a page or more are not guarded.
+ */
+class GuardedHdr {
+public:
+    uintptr_t magic;  // keyed by the address, tells a guarded object and its state
+    void     *base;   // the allocation holding the object
+    size_t    size;   // requested by user
+    uintptr_t canary; // right before the object, overwritten by underflows
+};
+
+MALLOC_STATIC_ASSERT(sizeof(GuardedHdr) % 16 == 0, "Guarded objects must be 16-byte aligned.");
+
+static const uintptr_t guardedLiveTag   = (uintptr_t)0x6a09e667f3bcc908ULL,
+                       guardedPagedTag  = (uintptr_t)0xbb67ae8584caa73bULL,
+                       guardedFreedTag  = (uintptr_t)0x3c6ef372fe94f82bULL,
+                       guardedCanaryTag = (uintptr_t)0xa54ff53a5f1d36f1ULL;
+static const unsigned char redzoneFill = 0xAB,
+                           releasedFill = 0xDD;
+static const size_t guardedRedzoneSize = 16,
+                    // released objects are filled and checked up to this size
+                    maxReleasedFillSize = 4*1024;
+
+class GuardedMode {
+private:
+    // mappings of released objects that were placed on guard pages
+    struct Mapping {
+        void  *base;
+        size_t size;
+    };
+    static const unsigned pagedQuarantineSize = 256;
+
+    Mapping     pagedQuarantine[pagedQuarantineSize];
+    unsigned    pagedQuarantinePos;
+    MallocMutex pagedLock;
+    bool        setDone;
+public:
+    intptr_t enabled,     // new objects are guarded
+             everEnabled, // guarded objects can exist
+             sampleRate;  // if > 1, 1 of sampleRate objects is put on guard pages
+    size_t   pageSize;
+
+    void init() {
+        pageSize = 4*1024;
+#if GUARD_PAGES_SUPPORTED
+        pageSize = sysconf(_SC_PAGESIZE);
+#endif
+        if (setDone)
+            return;
+#if !_XBOX && !__TBB_WIN8UI_SUPPORT
+        if (const char *envVal = getenv("TBB_MALLOC_USE_GUARDED_MODE"))
+            setMode(strtol(envVal, NULL, 10));
+#endif
+    }
+    void setMode(intptr_t value) {
+        setDone = true;
+        sampleRate = value;
+        if (value)
+            FencedStore(everEnabled, 1);
+        FencedStore(enabled, value);
+    }
+    void putPagedMapping(void *base, size_t size) {
+        Mapping evicted = {NULL, 0};
+        {
+            MallocMutex::scoped_lock lock(pagedLock);
+            evicted = pagedQuarantine[pagedQuarantinePos];
+            pagedQuarantine[pagedQuarantinePos].base = base;
+            pagedQuarantine[pagedQuarantinePos].size = size;
+            pagedQuarantinePos = (pagedQuarantinePos+1) % pagedQuarantineSize;
+        }
+        if (evicted.base)
+            freeRawMemory(evicted.base, evicted.size);
+    }
+};
+
+// zero-initialized
+static GuardedMode guardedMode;
+
+int PerCpuCaches::currentCpu()
+{
+#if MALLOC_RSEQ_PRESENT
+    if (__rseq_size) {
+        const volatile struct rseq *area = (const volatile struct rseq*)
+            ((char*)__builtin_thread_pointer() + __rseq_offset);
+        int cpu = (int)area->cpu_id;
+        if (cpu >= 0) // negative when registration is not done or failed
+            return cpu;
+    }
+#endif
+#if __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+bool PerCpuCaches::allocateSlots(Backend *backend)
+{
+    MallocMutex::scoped_lock lock(setModeLock);
+    if (slots)
+        return true;
+#if __linux__
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpus <= 0)
+        return false;
+    bool rawMem;
+    Slot *s = (Slot*)backend->getBackRefSpace(cpus*sizeof(Slot), &rawMem);
+    if (!s)
+        return false;
+    for (long i=0; i<cpus; i++)
+        new (s+i) Slot(backend);
+    numOfSlots = cpus;
+    rawMemUsed = rawMem;
+    FencedStore((intptr_t&)slots, (intptr_t)s);
+    return true;
+#else
+    suppress_unused_warning(backend);
+    return false;
+#endif
+}
+
+bool PerCpuCaches::cleanup(ExtMemoryPool *extMemPool)
+{
+    bool released = false;
+    Slot *s = (Slot*)FencedLoad((intptr_t&)slots);
+
+    for (unsigned i=0; s && i<numOfSlots; i++)
+        // both cleanups to be called, and the order is not important
+        released |= s[i].lloc.externalCleanup(extMemPool)
+                  | s[i].freeSlabBlocks.externalCleanup();
+    return released;
+}
+
+void PerCpuCaches::getCachedSizes(size_t *slabsSize, size_t *largeSize) const
+{
+    Slot *s = (Slot*)FencedLoad((intptr_t&)slots);
+
+    for (unsigned i=0; s && i<numOfSlots; i++) {
+        *slabsSize += s[i].freeSlabBlocks.getCachedSize();
+        *largeSize += s[i].lloc.getCachedSize();
+    }
+}
+
+void PerCpuCaches::reset(Backend *backend)
+{
+    if (slots)
+        backend->putBackRefSpace(slots, numOfSlots*sizeof(Slot), rawMemUsed);
+    slots = NULL;
+    numOfSlots = 0;
+    enabled = 0;
+}
+
+PerCpuCaches::CurrentSlot::CurrentSlot(PerCpuCaches &caches, ExtMemoryPool *extMemPool) :
+    slot(NULL), inUse(false)
+{
+    if (!FencedLoad(caches.enabled) || extMemPool->userPool())
+        return;
+    if (!FencedLoad((intptr_t&)caches.slots) && !caches.allocateSlots(&extMemPool->backend))
+        return;
+    int cpu = currentCpu();
+    if (cpu < 0 || (unsigned)cpu >= caches.numOfSlots)
+        return;
+    inUse = true;
+    if (__TBB_TryLockByte(caches.slots[cpu].busy))
+        slot = caches.slots+cpu;
+}
+
+FreeBlockPool *PerCpuCaches::CurrentSlot::freeSlabBlocks(TLSData *tls) const
+{
+    if (inUse)
+        return slot? &slot->freeSlabBlocks : NULL;
+    return tls? &tls->freeSlabBlocks : NULL;
+}
+
+LocalLOC *PerCpuCaches::CurrentSlot::lloc(TLSData *tls) const
+{
+    if (inUse)
+        return slot? &slot->lloc : NULL;
+    return tls? &tls->lloc : NULL;
+}
+
 TLSData *TLSKey::createTLS(MemoryPool *memPool, Backend *backend)
 {
     MALLOC_ASSERT( sizeof(TLSData) >= sizeof(Bin) * numBlockBins + sizeof(FreeBlockPool), ASSERT_TEXT );
@@ -667,6 +1018,8 @@ bool TLSData::cleanUnusedActiveBlocks(Backend *backend, bool userPool)
 bool ExtMemoryPool::releaseAllLocalCaches()
 {
     bool released = allLocalCaches.cleanup(this, /*cleanOnlyUnused=*/false);
+    if (!userPool())
+        released |= perCpuCaches.cleanup(this);
 
     if (TLSData *tlsData = tlsPointerKey.getThreadMallocTLS())
         // released only for current thread for now
@@ -773,47 +1126,65 @@ ALWAYSINLINE( bool isMallocInitialized() );
 /********* Now some rough utility code to deal with indexing the size bins. **************/
 
 /*
- * Given a number return the highest non-zero bit in it. It is intended to work with 32-bit values only.
- * Moreover, on IPF, for sake of simplicity and performance, it is narrowed to only serve for 64 to 1023.
- * This is enough for current algorithm of distribution of sizes among bins.
- * __TBB_Log2 is not used here to minimize dependencies on TBB specific sources.
+ * The size-to-bin mapping is precomputed at compile time into two lookup tables:
+ * one with 8 byte granularity for small and segregated sizes, and another with
+ * 64 byte granularity for fitting sizes. All bin boundaries are multiples of
+ * the respective granularity, so the bin of a granule is the bin of its upper bound.
  */
-#if _WIN64 && _MSC_VER>=1400 && !__INTEL_COMPILER
-extern "C" unsigned char _BitScanReverse( unsigned long* i, unsigned long w );
-#pragma intrinsic(_BitScanReverse)
-#endif
-static inline unsigned int highestBitPos(unsigned int n)
-{
-    MALLOC_ASSERT( n>=64 && n<1024, ASSERT_TEXT ); // only needed for bsr array lookup, but always true
-    unsigned int pos;
-#if __ARCH_x86_32||__ARCH_x86_64
+template<unsigned int n>
+struct HighestBitPos { enum { value = 1 + HighestBitPos<(n>>1)>::value }; };
+template<>
+struct HighestBitPos<1> { enum { value = 0 }; };
 
-# if __linux__||__APPLE__||__FreeBSD__||__NetBSD__||__sun||__MINGW32__
-    __asm__ ("bsr %1,%0" : "=r"(pos) : "r"(n));
-# elif (_WIN32 && (!_WIN64 || __INTEL_COMPILER))
-    __asm
-    {
-        bsr eax, n
-        mov pos, eax
-    }
-# elif _WIN64 && _MSC_VER>=1400
-    _BitScanReverse((unsigned long*)&pos, (unsigned long)n);
-# else
-#   error highestBitPos() not implemented for this platform
-# endif
-#elif __arm__
-    __asm__ __volatile__
-    (
-       "clz %0, %1\n"
-       "rsb %0, %0, %2\n"
-       :"=r" (pos) :"r" (n), "I" (31)
-    );
-#else
-    static unsigned int bsr[16] = {0/*N/A*/,6,7,7,8,8,8,8,9,9,9,9,9,9,9,9};
-    pos = bsr[ n>>6 ];
-#endif /* __ARCH_* */
-    return pos;
-}
+template<unsigned int size,
+         int kind = (size<=maxSmallObjectSize)? 0 : (size<=maxSegregatedObjectSize)? 1 : 2>
+struct BinIndex;
+
+template<unsigned int size>
+struct BinIndex<size, 0> { // 8/16/24/32/40/48/56/64
+    enum { value = (size-1) >> 3 };
+};
+
+template<unsigned int size>
+struct BinIndex<size, 1> { // 80/96/112/128 / 160/192/224/256 / 320/384/448/512 / 640/768/896/1024
+    enum { order = HighestBitPos<size-1>::value, // which group of bin sizes?
+           value = minSegregatedObjectIndex + 4*(order-6) + ((size-1)>>(order-2)) - 4 };
+};
+
+template<unsigned int size>
+struct BinIndex<size, 2> {
+    enum { value = size<=fittingSize1?  minFittingIndex   : size<=fittingSize2?  minFittingIndex+1 :
+                   size<=fittingSize3?  minFittingIndex+2 : size<=fittingSize4?  minFittingIndex+3 :
+                   size<=fittingSize5?  minFittingIndex+4 : size<=fittingSize6?  minFittingIndex+5 :
+                   size<=fittingSize7?  minFittingIndex+6 : size<=fittingSize8?  minFittingIndex+7 :
+                   size<=fittingSize9?  minFittingIndex+8 : size<=fittingSize10? minFittingIndex+9 :
+                   size<=fittingSize11? minFittingIndex+10 : numBlockBins /* large object */ };
+};
+
+#define SMALL_BIN_INDEX(i)   BinIndex<((i)+1)*8>::value
+#define FITTING_BIN_INDEX(i) BinIndex<((i)+1)*64>::value
+#define REPEAT_8(M, i)   M(i), M(i+1), M(i+2), M(i+3), M(i+4), M(i+5), M(i+6), M(i+7)
+#define REPEAT_128(M)    REPEAT_8(M,0),  REPEAT_8(M,8),   REPEAT_8(M,16),  REPEAT_8(M,24),  \
+                         REPEAT_8(M,32), REPEAT_8(M,40),  REPEAT_8(M,48),  REPEAT_8(M,56),  \
+                         REPEAT_8(M,64), REPEAT_8(M,72),  REPEAT_8(M,80),  REPEAT_8(M,88),  \
+                         REPEAT_8(M,96), REPEAT_8(M,104), REPEAT_8(M,112), REPEAT_8(M,120)
+
+// indexed by (size-1)>>3 for sizes up to maxSegregatedObjectSize
+static const uint8_t smallBinIndex[maxSegregatedObjectSize/8] = { REPEAT_128(SMALL_BIN_INDEX) };
+// indexed by (size-1)>>6 for sizes from maxSegregatedObjectSize+1 up to 8KB
+static const uint8_t fittingBinIndex[8*1024/64] = { REPEAT_128(FITTING_BIN_INDEX) };
+
+#undef REPEAT_128
+#undef REPEAT_8
+#undef FITTING_BIN_INDEX
+#undef SMALL_BIN_INDEX
+
+static const uint16_t binObjectSize[numBlockBins] = {
+    8, 16, 24, 32, 40, 48, 56, 64,
+    80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024,
+    fittingSize1, fittingSize2, fittingSize3, fittingSize4, fittingSize5, fittingSize6,
+    fittingSize7, fittingSize8, fittingSize9, fittingSize10, fittingSize11
+};
 
 /*
  * Depending on indexRequest, for a given size return either the index into the bin
@@ -822,42 +1193,10 @@ static inline unsigned int highestBitPos(unsigned int n)
 template<bool indexRequest>
 static unsigned int getIndexOrObjectSize (unsigned int size)
 {
-    if (size <= maxSmallObjectSize) { // selection from 4/8/16/24/32/40/48/56/64
-         /* Index 0 holds up to 8 bytes, Index 1 16 and so forth */
-        return indexRequest ? (size - 1) >> 3 : alignUp(size,8);
-    }
-    else if (size <= maxSegregatedObjectSize ) { // 80/96/112/128 / 160/192/224/256 / 320/384/448/512 / 640/768/896/1024
-        unsigned int order = highestBitPos(size-1); // which group of bin sizes?
-        MALLOC_ASSERT( 6<=order && order<=9, ASSERT_TEXT );
-        if (indexRequest)
-            return minSegregatedObjectIndex - (4*6) - 4 + (4*order) + ((size-1)>>(order-2));
-        else {
-            unsigned int alignment = 128 >> (9-order); // alignment in the group
-            MALLOC_ASSERT( alignment==16 || alignment==32 || alignment==64 || alignment==128, ASSERT_TEXT );
-            return alignUp(size,alignment);
-        }
-    }
-    else {
-        if( size <= fittingSize3 ) {
-            if( size <= fittingSize2 ) {
-                if( size <= fittingSize1 )
-                    return indexRequest ? minFittingIndex : fittingSize1;
-                else
-                    return indexRequest ? minFittingIndex+1 : fittingSize2;
-            } else
-                return indexRequest ? minFittingIndex+2 : fittingSize3;
-        } else {
-            if( size <= fittingSize5 ) {
-                if( size <= fittingSize4 )
-                    return indexRequest ? minFittingIndex+3 : fittingSize4;
-                else
-                    return indexRequest ? minFittingIndex+4 : fittingSize5;
-            } else {
-                MALLOC_ASSERT( 0,ASSERT_TEXT ); // this should not happen
-                return ~0U;
-            }
-        }
-    }
+    MALLOC_ASSERT( size && size < minLargeObjectSize, ASSERT_TEXT );
+    unsigned int index = size <= maxSegregatedObjectSize ?
+        smallBinIndex[(size-1)>>3] : fittingBinIndex[(size-1)>>6];
+    return indexRequest ? index : binObjectSize[index];
 }
 
 static unsigned int getIndex (unsigned int size)
@@ -968,6 +1307,15 @@ done:
     return block;
 }
 
+void LifoList::addSlabStats(MemPoolStats *stats)
+{
+    MallocMutex::scoped_lock scoped_cs(lock);
+    for (Block *block = top; block; block = block->next) {
+        stats->slabs += slabSize;
+        stats->smallObjects += block->getAllocatedSize();
+    }
+}
+
 #endif /* FINE_GRAIN_LOCKS     */
 
 /********* Thread and block related code      *************/
@@ -1014,9 +1362,11 @@ inline Bin* TLSData::getAllocationBin(size_t size)
 Block *MemoryPool::getEmptyBlock(size_t size)
 {
     TLSData* tls = extMemPool.tlsPointerKey.getThreadMallocTLS();
-    // try to use per-thread cache, if TLS available
-    FreeBlockPool::ResOfGet resOfGet = tls?
-        tls->freeSlabBlocks.getBlock() : FreeBlockPool::ResOfGet(NULL, false);
+    PerCpuCaches::CurrentSlot cpuSlot(perCpuCaches, &extMemPool);
+    // try to use per-CPU or per-thread cache, if available
+    FreeBlockPool *localPool = cpuSlot.freeSlabBlocks(tls);
+    FreeBlockPool::ResOfGet resOfGet = localPool?
+        localPool->getBlock() : FreeBlockPool::ResOfGet(NULL, false);
     Block *result = resOfGet.block;
 
     if (!result) { // not found in local cache, asks backend for slabs
@@ -1050,10 +1400,11 @@ Block *MemoryPool::getEmptyBlock(size_t size)
                 b->backRefIdx = backRefIdx[i];
             }
             b->tlsPtr = tls;
-            // all but first one go to per-thread pool
+            b->pool = this;
+            // all but first one go to local pool
             if (i > 0) {
-                MALLOC_ASSERT(tls, ASSERT_TEXT);
-                tls->freeSlabBlocks.returnBlock(b);
+                MALLOC_ASSERT(localPool, ASSERT_TEXT);
+                localPool->returnBlock(b);
             }
         }
     }
@@ -1067,14 +1418,17 @@ void MemoryPool::returnEmptyBlock(Block *block, bool poolTheBlock)
 {
     block->makeEmpty();
     if (poolTheBlock) {
-        extMemPool.tlsPointerKey.getThreadMallocTLS()->freeSlabBlocks.returnBlock(block);
-    }
-    else {
-        // slab blocks in user's pools do not have valid backRefIdx
-        if (!extMemPool.userPool())
-            removeBackRef(*(block->getBackRefIdx()));
-        extMemPool.backend.putSlabBlock(block);
+        PerCpuCaches::CurrentSlot cpuSlot(perCpuCaches, &extMemPool);
+        if (FreeBlockPool *localPool =
+            cpuSlot.freeSlabBlocks(extMemPool.tlsPointerKey.getThreadMallocTLS())) {
+            localPool->returnBlock(block);
+            return;
+        }
     }
+    // slab blocks in user's pools do not have valid backRefIdx
+    if (!extMemPool.userPool())
+        removeBackRef(*(block->getBackRefIdx()));
+    extMemPool.backend.putSlabBlock(block);
 }
 
 bool ExtMemoryPool::init(intptr_t poolId, rawAllocType rawAlloc,
@@ -1160,6 +1514,38 @@ void MemoryPool::processThreadShutdown(TLSData *tlsData)
     clearTLS();
 }
 
+class CollectThreadStats {
+    MemPoolStats *stats;
+    size_t       *llocSize;
+public:
+    CollectThreadStats(MemPoolStats *st, size_t *lloc) : stats(st), llocSize(lloc) {}
+    void operator()(TLSRemote *tlsRemote) {
+        TLSData *tls = static_cast<TLSData*>(tlsRemote);
+        for (uint32_t i=0; i<numBlockBins; i++)
+            tls->bin[i].addSlabStats(stats);
+        stats->emptySlabs += tls->freeSlabBlocks.getCachedSize();
+        *llocSize += tls->lloc.getCachedSize();
+    }
+};
+
+void MemoryPool::getStats(MemPoolStats *stats)
+{
+    memset(stats, 0, sizeof(MemPoolStats));
+    size_t llocSize = 0, locUsedSize, locCachedSize;
+
+    CollectThreadStats collect(stats, &llocSize);
+    extMemPool.allLocalCaches.forEach(collect);
+    orphanedBlocks.addSlabStats(stats);
+    if (!extMemPool.userPool())
+        perCpuCaches.getCachedSizes(&stats->emptySlabs, &llocSize);
+    // blocks in local large object caches are used from the LOC point of view
+    extMemPool.loc.getStats(&locUsedSize, &locCachedSize);
+    stats->largeObjects = locUsedSize > llocSize? locUsedSize - llocSize : 0;
+    stats->largeCached = locCachedSize + llocSize;
+    stats->backendFree = extMemPool.backend.getFreeSize();
+    stats->mapped = extMemPool.backend.getTotalMemSize();
+}
+
 #if MALLOC_DEBUG
 void Bin::verifyTLSBin (size_t size) const
 {
@@ -1256,6 +1642,21 @@ void Bin::outofTLSBin(Block* block)
     verifyTLSBin(size);
 }
 
+// Blocks in the mailbox are in the bin list as well
+void Bin::addSlabStats(MemPoolStats *stats) const
+{
+    if (!activeBlk)
+        return;
+    for (Block *block = activeBlk; block; block = block->previous) {
+        stats->slabs += slabSize;
+        stats->smallObjects += block->getAllocatedSize();
+    }
+    for (Block *block = activeBlk->next; block; block = block->next) {
+        stats->slabs += slabSize;
+        stats->smallObjects += block->getAllocatedSize();
+    }
+}
+
 Block* Bin::getPublicFreeListBlock()
 {
     Block* block;
@@ -1346,7 +1747,8 @@ void Block::freeOwnObject(MemoryPool *memPool, TLSData *tls, void *object)
     }
 }
 
-void Block::freePublicObject (FreeObject *objectToFree)
+/* Objects from head to tail are linked via next and all belong to this block */
+void Block::freePublicObjects (FreeObject *head, FreeObject *tail)
 {
     FreeObject *localPublicFreeList;
 
@@ -1354,18 +1756,18 @@ void Block::freePublicObject (FreeObject *objectToFree)
 #if FREELIST_NONBLOCKING
     FreeObject *temp = publicFreeList;
     do {
-        localPublicFreeList = objectToFree->next = temp;
+        localPublicFreeList = tail->next = temp;
         temp = (FreeObject*)AtomicCompareExchange(
                                 (intptr_t&)publicFreeList,
-                                (intptr_t)objectToFree, (intptr_t)localPublicFreeList );
+                                (intptr_t)head, (intptr_t)localPublicFreeList );
         // no backoff necessary because trying to make change, not waiting for a change
     } while( temp != localPublicFreeList );
 #else
     STAT_increment(getThreadId(), ThreadCommonCounters, lockPublicFreeList);
     {
         MallocMutex::scoped_lock scoped_cs(publicFreeListLock);
-        localPublicFreeList = objectToFree->next = publicFreeList;
-        publicFreeList = objectToFree;
+        localPublicFreeList = tail->next = publicFreeList;
+        publicFreeList = head;
     }
 #endif
 
@@ -1389,6 +1791,43 @@ void Block::freePublicObject (FreeObject *objectToFree)
     STAT_increment(owner, getIndex(objectSize), freeByOtherThread);
 }
 
+void RemoteFreeCache::put(Block *block, FreeObject *object, unsigned index)
+{
+    Batch *b = batches + index;
+    if (b->block != block || b->num == MAX_BATCH_SIZE) {
+        if (b->block)
+            b->block->freePublicObjects(b->head, b->tail);
+        b->block = block;
+        b->head = NULL;
+        b->tail = object;
+        b->num = 0;
+    }
+    object->next = b->head;
+    b->head = object;
+    b->num++;
+    if (++pending == FLUSH_PERIOD)
+        flush();
+}
+
+bool RemoteFreeCache::flush()
+{
+    if (!pending)
+        return false;
+    pending = 0;
+    bool released = false;
+    for (uint32_t i=0; i<numBlockBinLimit; i++) {
+        Batch *b = batches + i;
+        if (b->block) {
+            b->block->freePublicObjects(b->head, b->tail);
+            b->block = NULL;
+            b->head = b->tail = NULL;
+            b->num = 0;
+            released = true;
+        }
+    }
+    return released;
+}
+
 void Block::privatizePublicFreeList()
 {
     FreeObject *temp, *localPublicFreeList;
@@ -1555,6 +1994,12 @@ void OrphanedBlocks::reset()
         new (bins+i) LifoList();
 }
 
+void OrphanedBlocks::addSlabStats(MemPoolStats *stats)
+{
+    for (uint32_t i=0; i<numBlockBinLimit; i++)
+        bins[i].addSlabStats(stats);
+}
+
 FreeBlockPool::ResOfGet FreeBlockPool::getBlock()
 {
     Block *b = (Block*)AtomicFetchStore(&head, 0);
@@ -1686,7 +2131,11 @@ FreeObject *Block::findObjectToFree(const void *object) const
 
 void TLSData::release(MemoryPool *mPool)
 {
+    // released guarded objects return to the slabs of this thread
+    guardedQuarantine.drain();
     mPool->extMemPool.allLocalCaches.unregisterThread(this);
+    // objects of other threads' slabs must reach them before TLS goes away
+    remoteFree.flush();
     externalCleanup(&mPool->extMemPool, /*cleanOnlyUnused=*/false);
 
     for (unsigned index = 0; index < numBlockBins; index++) {
@@ -1757,6 +2206,7 @@ StartupBlock *StartupBlock::getBlock()
     if (!block) return NULL;
 
     block->cleanBlockHeader();
+    block->pool = defaultMemPool;
     setBackRef(backRefIdx, block);
     block->backRefIdx = backRefIdx;
     // use startupAllocObjSizeMark to mark objects from startup block marker
@@ -1912,6 +2362,8 @@ void MemoryPool::initDefaultPool()
     }
 #endif
     hugePages.init(hugePageSize);
+    perCpuCaches.init();
+    guardedMode.init();
 }
 
 #if USE_PTHREAD && (__TBB_SOURCE_DIRECTLY_INCLUDED || __TBB_USE_DLOPEN_REENTRANCY_WORKAROUND)
@@ -2088,6 +2540,29 @@ inline FreeObject* Block::allocate()
     return NULL;
 }
 
+/* Take up to num objects at once, the free list is walked only to its needed part */
+inline size_t Block::allocateBatch(void **objects, size_t num)
+{
+    MALLOC_ASSERT( ownBlock(), ASSERT_TEXT );
+    size_t n = 0;
+
+    FreeObject *curr = freeList;
+    for (; curr && n<num; curr = curr->next)
+        objects[n++] = curr;
+    freeList = curr;
+    for (; bumpPtr && n<num; n++) {
+        objects[n] = bumpPtr;
+        bumpPtr = (FreeObject *) ((uintptr_t) bumpPtr - objectSize);
+        if ( (uintptr_t)bumpPtr < (uintptr_t)this+sizeof(Block) )
+            bumpPtr = NULL;
+    }
+    allocatedCount += n;
+    MALLOC_ASSERT( allocatedCount <= (slabSize-sizeof(Block))/objectSize, ASSERT_TEXT );
+    if (n < num) // all objects are taken, the block is full as after allocate()
+        isFull = 1;
+    return n;
+}
+
 size_t Block::findObjectSize(void *object) const
 {
     size_t blSize = getSize();
@@ -2219,12 +2694,16 @@ void *MemoryPool::getFromLLOCache(TLSData* tls, size_t size, size_t alignment)
         return NULL;
     MALLOC_ASSERT(allocationSize >= alignment, "Overflow must be checked before.");
 
-    if (tls)
-        lmb = tls->lloc.get(allocationSize);
+    {
+        PerCpuCaches::CurrentSlot cpuSlot(perCpuCaches, &extMemPool);
+        if (LocalLOC *lloc = cpuSlot.lloc(tls))
+            lmb = lloc->get(allocationSize);
+    }
     if (!lmb)
         lmb = extMemPool.mallocLargeObject(allocationSize);
 
     if (lmb) {
+        lmb->pool = this;
         // doing shuffle we suppose that alignment offset guarantees
         // that different cache lines are in use
         MALLOC_ASSERT(alignment >= estimatedCacheLineSize, ASSERT_TEXT);
@@ -2272,8 +2751,15 @@ void MemoryPool::putToLLOCache(TLSData *tls, void *object)
     LargeObjectHdr *header = (LargeObjectHdr*)object - 1;
     // overwrite backRefIdx to simplify double free detection
     header->backRefIdx = BackRefIdx();
+    header->memoryBlock->knownZero = false;
 
-    if (!tls || !tls->lloc.put(header->memoryBlock, &extMemPool))
+    bool cached = false;
+    {
+        PerCpuCaches::CurrentSlot cpuSlot(perCpuCaches, &extMemPool);
+        if (LocalLOC *lloc = cpuSlot.lloc(tls))
+            cached = lloc->put(header->memoryBlock, &extMemPool);
+    }
+    if (!cached)
         extMemPool.freeLargeObject(header->memoryBlock);
 }
 
@@ -2332,10 +2818,18 @@ static void *reallocAligned(MemoryPool *memPool, void *ptr,
     if (isLargeObject<ourMem>(ptr)) {
         LargeMemoryBlock* lmb = ((LargeObjectHdr *)ptr - 1)->memoryBlock;
         copySize = lmb->unalignedSize-((uintptr_t)ptr-(uintptr_t)lmb);
-        if (size <= copySize && (0==alignment || isAligned(ptr, alignment))) {
+        // Shrinking below minLargeObjectSize moves the object to a small block,
+        // so for non-aligned allocations the requested size always tells
+        // whether the object is large. scalable_free_sized() relies on that.
+        if (size <= copySize && (0==alignment || isAligned(ptr, alignment))
+            && (alignment || size >= minLargeObjectSize)) {
             lmb->objectSize = size;
             return ptr;
         } else {
+            // growing a huge object by moving its pages is cheaper than copying
+            if (size > copySize && (result = memPool->extMemPool.remap(ptr, size,
+                                       alignment? alignment : largeObjectAlignment)))
+                return result;
             copySize = lmb->objectSize;
             result = alignment ? allocateAligned(memPool, size, alignment) :
                 internalPoolMalloc(memPool, size);
@@ -2448,7 +2942,10 @@ static inline void freeSmallObject(MemoryPool *memPool, void *object)
         block->freeOwnObject(memPool, tls, object);
     else { /* Slower path to add to the shared list, the allocatedCount is updated by the owner thread in malloc. */
         FreeObject *objectToFree = block->findObjectToFree(object);
-        block->freePublicObject(objectToFree);
+        if (TLSData *myTls = memPool->extMemPool.tlsPointerKey.getThreadMallocTLS())
+            myTls->remoteFree.put(block, objectToFree, getIndex(block->getSize()));
+        else
+            block->freePublicObject(objectToFree);
     }
 }
 
@@ -2483,6 +2980,11 @@ static void *internalPoolMalloc(MemoryPool* memPool, size_t size)
             return result;
     }
 
+    /*
+     * objects kept for slabs of other threads might be what their owners are short of
+     */
+    tls->remoteFree.flush();
+
     /*
      * else privatize publicly freed objects in some block and allocate from it
      */
@@ -2531,6 +3033,41 @@ static void *internalPoolMalloc(MemoryPool* memPool, size_t size)
     return NULL;
 }
 
+// Allocate count objects of the same size, the bin and the active block
+// are looked up once, and the block gives out its free objects at once.
+// Returns the number of allocated objects, it's less than count only
+// if there is no more memory.
+static size_t internalPoolMallocBatch(MemoryPool* memPool, size_t size,
+                                      size_t count, void **objects)
+{
+    size_t n = 0;
+
+    if (!memPool) return 0;
+
+    if (!size) size = sizeof(size_t);
+
+    if (size >= minLargeObjectSize) {
+        for (; n<count; n++)
+            if (!(objects[n] = internalPoolMalloc(memPool, size)))
+                break;
+        return n;
+    }
+    Bin *bin = memPool->getTLS(/*create=*/true)->getAllocationBin(size);
+    if ( !bin ) return 0;
+    while (n < count) {
+        if (Block *mallocBlock = bin->getActiveBlock())
+            n += mallocBlock->allocateBatch(objects+n, count-n);
+        if (n == count)
+            break;
+        // the active block is exhausted, so go the regular way for a single
+        // object, as it's able to find a block and makes it active
+        if (!(objects[n] = internalPoolMalloc(memPool, size)))
+            break;
+        n++;
+    }
+    return n;
+}
+
 // When size==0 (i.e. unknown), detect here whether the object is large.
 // For size is known and < minLargeObjectSize, we still need to check
 // if the actual object is large, because large objects might be used
@@ -2552,6 +3089,338 @@ static bool internalPoolFree(MemoryPool *memPool, void *object, size_t size)
     return true;
 }
 
+// non-zero since the 1st pool_set_thread_default call with non-NULL pool
+static intptr_t threadDefaultPoolsUsed;
+
+// The pool serving scalable_malloc and friends in the current thread
+static inline MemoryPool *threadMallocPool()
+{
+    if (FencedLoad(threadDefaultPoolsUsed))
+        if (TLSData *tls = defaultMemPool->getTLS(/*create=*/false))
+            if (tls->threadDefaultPool)
+                return tls->threadDefaultPool;
+    return defaultMemPool;
+}
+
+// The pool an object released by scalable_free and friends belongs to
+static inline MemoryPool *objectPool(void *object)
+{
+    if (!FencedLoad(threadDefaultPoolsUsed))
+        return defaultMemPool;
+    MemoryPool *memPool = isLargeObject<ourMem>(object)?
+        ((LargeObjectHdr*)object - 1)->memoryBlock->pool :
+        ((Block*)alignDown(object, slabSize))->getMemPool();
+    MALLOC_ASSERT(memPool, ASSERT_TEXT);
+    return memPool;
+}
+
+// Small objects of user pools have no backreferences, so to be recognized
+// by the safer entries, they are searched in regions of all user pools.
+// Objects out of the bounds of these regions are rejected without locks.
+static bool isUserPoolObject(void *object)
+{
+    if (!FencedLoad(threadDefaultPoolsUsed) || !Backend::ptrInUserRegionBounds(object))
+        return false;
+    MallocMutex::scoped_lock lock(MemoryPool::memPoolListLock);
+    for (MemoryPool *memPool = defaultMemPool->next; memPool; memPool = memPool->next)
+        if (memPool->extMemPool.backend.ptrInRegions(object))
+            return true;
+    return false;
+}
+
+/********* Guarded mode      *************/
+
+static void reportHeapError(const char *error, const void *object)
+{
+    fprintf(stderr, "TBBmalloc: %s detected for object %p\n", error, object);
+    abort();
+}
+
+static inline uintptr_t guardedKey(const GuardedHdr *hdr, uintptr_t tag)
+{
+    return (uintptr_t)hdr ^ tag;
+}
+
+static inline bool guardedFor(MemoryPool *memPool)
+{
+    return FencedLoad(guardedMode.enabled) && memPool == defaultMemPool;
+}
+
+// The freed tag is left only in headers of objects in quarantine, whose
+// allocations still hold the headers. Check it before reporting a double free,
+// so data that happens to match the key is not taken for a released object.
+static bool heldByGuardedBase(const GuardedHdr *hdr)
+{
+    if (hdr->canary != guardedKey(hdr, guardedCanaryTag))
+        return false;
+    void *base = hdr->base;
+    // the header is never farther than a page from the allocation start
+    if ((uintptr_t)base > (uintptr_t)hdr || (uintptr_t)hdr-(uintptr_t)base > guardedMode.pageSize)
+        return false;
+    if (isLargeObject<unknownMem>(base))
+        return true;
+    Block *block = (Block*)alignDown(hdr, slabSize);
+    return (Block*)alignDown(base, slabSize) == block
+        && block == getBackRef(safer_dereference(block->getBackRef()));
+}
+
+// Returns the header of a guarded object or NULL for other objects.
+// Must be called only if guarded objects can exist.
+static GuardedHdr *guardedHeader(void *object)
+{
+    if (!isAligned(object, 16))
+        return NULL;
+    GuardedHdr *hdr = (GuardedHdr*)object - 1;
+    uintptr_t magic = hdr->magic;
+    if (magic == guardedKey(hdr, guardedLiveTag) || magic == guardedKey(hdr, guardedPagedTag))
+        return hdr;
+    if (magic == guardedKey(hdr, guardedFreedTag) && heldByGuardedBase(hdr))
+        reportHeapError("double free", object);
+    return NULL;
+}
+
+static inline GuardedHdr *guardedObject(void *object)
+{
+    return FencedLoad(guardedMode.everEnabled)? guardedHeader(object) : NULL;
+}
+
+// Guarded objects are never placed closer than a header size to the start of
+// a page, see guardedMalloc and guardedPagedMalloc
+static inline bool headerOnObjectPage(void *object)
+{
+    return ((uintptr_t)object & (guardedMode.pageSize-1)) >= sizeof(GuardedHdr);
+}
+
+// For pointers that can be foreign. The header is read only if it is on the
+// object's page, so an unmapped page is never touched.
+static inline GuardedHdr *safeGuardedObject(void *object)
+{
+    if (!FencedLoad(guardedMode.everEnabled) || !headerOnObjectPage(object))
+        return NULL;
+    return guardedHeader(object);
+}
+
+static void initGuardedObject(GuardedHdr *hdr, void *base, size_t size,
+                              uintptr_t tag, void *redzoneEnd)
+{
+    hdr->base = base;
+    hdr->size = size;
+    hdr->canary = guardedKey(hdr, guardedCanaryTag);
+    memset((char*)(hdr+1)+size, redzoneFill, (char*)redzoneEnd-((char*)(hdr+1)+size));
+    hdr->magic = guardedKey(hdr, tag);
+}
+
+// end of the redzone for objects not placed on guard pages
+static inline void *guardedRedzoneEnd(const GuardedHdr *hdr)
+{
+    size_t offset = (uintptr_t)(hdr+1) - (uintptr_t)hdr->base;
+    return (char*)hdr->base + alignUp(offset+hdr->size+guardedRedzoneSize, 16);
+}
+
+static void *guardedPagedMalloc(size_t size)
+{
+#if GUARD_PAGES_SUPPORTED
+    // room to move the header to the object's page, see safeGuardedObject
+    size_t dataSize = alignUp(2*sizeof(GuardedHdr)+size+15, guardedMode.pageSize);
+    void *base = getRawMemory(dataSize+guardedMode.pageSize, /*hugePages=*/false);
+    if (!base)
+        return NULL;
+    void *guardPage = (char*)base+dataSize;
+    if (mprotect(guardPage, guardedMode.pageSize, PROT_NONE)) {
+        freeRawMemory(base, dataSize+guardedMode.pageSize);
+        return NULL;
+    }
+    GuardedHdr *hdr = (GuardedHdr*)alignDown((char*)guardPage-size, 16) - 1;
+    if (!headerOnObjectPage(hdr+1))
+        hdr--;
+    initGuardedObject(hdr, base, size, guardedPagedTag, guardPage);
+    return hdr+1;
+#else
+    suppress_unused_warning(size);
+    return NULL;
+#endif
+}
+
+static void *guardedMalloc(size_t size, size_t alignment)
+{
+    if (size > (size_t)-1/2)
+        return NULL;
+    // such objects always start a page, so their headers could not be found
+    // for foreign pointers by the safer entries
+    if (alignment >= guardedMode.pageSize)
+        return allocateAligned(defaultMemPool, size, alignment);
+    // room for the quarantine link
+    if (size < sizeof(FreeObject))
+        size = sizeof(FreeObject);
+    if (guardedMode.sampleRate > 1 && alignment <= 16)
+        if (TLSData *tls = defaultMemPool->getTLS(/*create=*/true))
+            if (++tls->guardedSampleCnt >= guardedMode.sampleRate) {
+                tls->guardedSampleCnt = 0;
+                if (void *object = guardedPagedMalloc(size))
+                    return object;
+            }
+    // an object at the start of a page is moved by another offset,
+    // so its header is on its page
+    size_t offset = alignUp(sizeof(GuardedHdr), alignment>16? alignment : 16),
+           allocSize = alignUp(2*offset+size+guardedRedzoneSize, 16);
+    // the size is multiple of 16, so is alignment of small objects
+    void *base = alignment>16? allocateAligned(defaultMemPool, allocSize, alignment)
+        : internalPoolMalloc(defaultMemPool, allocSize);
+    if (!base)
+        return NULL;
+    char *object = (char*)base+offset;
+    if (!headerOnObjectPage(object))
+        object += offset;
+    GuardedHdr *hdr = (GuardedHdr*)object - 1;
+    initGuardedObject(hdr, base, size, guardedLiveTag,
+                      (char*)base+alignUp(object-(char*)base+size+guardedRedzoneSize, 16));
+    return object;
+}
+
+static void checkGuardedObject(GuardedHdr *hdr, void *redzoneEnd)
+{
+    if (hdr->canary != guardedKey(hdr, guardedCanaryTag))
+        reportHeapError("buffer underflow", hdr+1);
+    for (unsigned char *p = (unsigned char*)(hdr+1)+hdr->size; p < redzoneEnd; p++)
+        if (*p != redzoneFill)
+            reportHeapError("buffer overflow", hdr+1);
+}
+
+static inline size_t releasedFillSize(const GuardedHdr *hdr)
+{
+    return (hdr->size < maxReleasedFillSize? hdr->size : maxReleasedFillSize)
+        - sizeof(FreeObject);
+}
+
+// Check the released object and return its memory to the pool
+static void releaseQuarantined(void *object)
+{
+    GuardedHdr *hdr = (GuardedHdr*)object - 1;
+    unsigned char *fill = (unsigned char*)object + sizeof(FreeObject);
+    for (size_t i=0; i<releasedFillSize(hdr); i++)
+        if (fill[i] != releasedFill)
+            reportHeapError("write after free", object);
+    // the memory can be reused for any object
+    hdr->magic = 0;
+    internalPoolFree(defaultMemPool, hdr->base, 0);
+}
+
+static void guardedFree(GuardedHdr *hdr)
+{
+    void *object = hdr+1;
+    if (hdr->magic == guardedKey(hdr, guardedPagedTag)) {
+#if GUARD_PAGES_SUPPORTED
+        void *guardPage = alignUp((char*)object+hdr->size, guardedMode.pageSize);
+        checkGuardedObject(hdr, guardPage);
+        hdr->magic = guardedKey(hdr, guardedFreedTag);
+        size_t dataSize = (char*)guardPage - (char*)hdr->base;
+        void *base = hdr->base;
+        mprotect(base, dataSize, PROT_NONE);
+        guardedMode.putPagedMapping(base, dataSize+guardedMode.pageSize);
+#endif
+        return;
+    }
+    checkGuardedObject(hdr, guardedRedzoneEnd(hdr));
+    hdr->magic = guardedKey(hdr, guardedFreedTag);
+    memset((char*)object + sizeof(FreeObject), releasedFill, releasedFillSize(hdr));
+    if (TLSData *tls = defaultMemPool->getTLS(/*create=*/true))
+        tls->guardedQuarantine.put(object, hdr->size);
+    else
+        releaseQuarantined(object);
+}
+
+void GuardedQuarantine::put(void *object, size_t size)
+{
+    FreeObject *obj = (FreeObject*)object;
+    obj->next = NULL;
+    if (tail)
+        tail->next = obj;
+    else
+        head = obj;
+    tail = obj;
+    totalSize += size;
+    while (totalSize > MAX_TOTAL_SIZE) {
+        FreeObject *oldest = head;
+        head = oldest->next;
+        if (!head)
+            tail = NULL;
+        totalSize -= ((GuardedHdr*)oldest - 1)->size;
+        releaseQuarantined(oldest);
+    }
+}
+
+bool GuardedQuarantine::drain()
+{
+    bool released = head;
+    while (head) {
+        FreeObject *oldest = head;
+        head = oldest->next;
+        releaseQuarantined(oldest);
+    }
+    tail = NULL;
+    totalSize = 0;
+    return released;
+}
+
+/********* End of guarded mode      *************/
+
+// Release count objects. Neighbors in objects[] from the same block are
+// released together, for a foreign block by a single publication.
+// If memPool is NULL, the pool of every object is detected.
+static void internalFreeBatch(MemoryPool *memPool, void **objects, size_t count)
+{
+    for (size_t i=0; i<count; ) {
+        void *object = objects[i];
+        if (!object) {
+            i++;
+            continue;
+        }
+        if (!memPool)
+            if (GuardedHdr *hdr = guardedObject(object)) {
+                guardedFree(hdr);
+                i++;
+                continue;
+            }
+        MemoryPool *pool = memPool? memPool : objectPool(object);
+        MALLOC_ASSERT(pool->extMemPool.userPool() || isRecognized(object),
+                      "Invalid pointer during object releasing is detected.");
+        if (isLargeObject<ourMem>(object)) {
+            pool->putToLLOCache(pool->getTLS(/*create=*/false), object);
+            i++;
+            continue;
+        }
+        Block *block = (Block *)alignDown(object, slabSize);
+        size_t end = i+1;
+        while (end<count && objects[end] && block == alignDown(objects[end], slabSize)
+               && !isLargeObject<ourMem>(objects[end]) && (memPool || !guardedObject(objects[end])))
+            end++;
+#if MALLOC_CHECK_RECURSION
+        if (block->isStartupAllocObject()) {
+            for (; i<end; i++)
+                freeSmallObject(pool, objects[i]);
+            continue;
+        }
+#endif
+        if (TLSData *tls = block->ownBlock()) {
+            for (; i<end; i++) {
+                block->checkFreePrecond(objects[i]);
+                block->freeOwnObject(pool, tls, objects[i]);
+            }
+        } else {
+            FreeObject *head = NULL, *tail = NULL;
+            for (; i<end; i++) {
+                block->checkFreePrecond(objects[i]);
+                FreeObject *objectToFree = block->findObjectToFree(objects[i]);
+                objectToFree->next = head;
+                head = objectToFree;
+                if (!tail)
+                    tail = objectToFree;
+            }
+            block->freePublicObjects(head, tail);
+        }
+    }
+}
+
 static void *internalMalloc(size_t size)
 {
     if (!size) size = sizeof(size_t);
@@ -2566,18 +3435,58 @@ static void *internalMalloc(size_t size)
     if (!isMallocInitialized())
         doInitialization();
 
-    return internalPoolMalloc(defaultMemPool, size);
+    MemoryPool *memPool = threadMallocPool();
+    return guardedFor(memPool)? guardedMalloc(size, 0) : internalPoolMalloc(memPool, size);
+}
+
+static void *internalAlignedMalloc(size_t size, size_t alignment)
+{
+    if (!isMallocInitialized())
+        doInitialization();
+
+    MemoryPool *memPool = threadMallocPool();
+    return guardedFor(memPool)? guardedMalloc(size, alignment)
+        : allocateAligned(memPool, size, alignment);
 }
 
 static void internalFree(void *object)
 {
-    internalPoolFree(defaultMemPool, object, 0);
+    if (!object)
+        return;
+    if (GuardedHdr *hdr = guardedObject(object))
+        guardedFree(hdr);
+    else
+        internalPoolFree(objectPool(object), object, 0);
+}
+
+static void internalFreeSized(void *object, size_t size)
+{
+    if (!object) return;
+
+    MALLOC_ASSERT(isMallocInitialized(), ASSERT_TEXT);
+    if (GuardedHdr *hdr = guardedObject(object)) {
+        guardedFree(hdr);
+        return;
+    }
+    MemoryPool *memPool = objectPool(object);
+    MALLOC_ASSERT(memPool->extMemPool.userPool() || isRecognized(object),
+                  "Invalid pointer during object releasing is detected.");
+    MALLOC_ASSERT(isLargeObject<ourMem>(object) == (size >= minLargeObjectSize),
+                  "Size passed to scalable_free_sized does not match the allocated one.");
+    // no need to check object header and backreference, the size defines the object kind
+    if (size >= minLargeObjectSize)
+        memPool->putToLLOCache(memPool->getTLS(/*create=*/false), object);
+    else
+        freeSmallObject(memPool, object);
 }
 
 static size_t internalMsize(void* ptr)
 {
     if (ptr) {
-        MALLOC_ASSERT(isRecognized(ptr), "Invalid pointer in scalable_msize detected.");
+        if (GuardedHdr *hdr = guardedObject(ptr))
+            return hdr->size;
+        MALLOC_ASSERT(objectPool(ptr)->extMemPool.userPool() || isRecognized(ptr),
+                      "Invalid pointer in scalable_msize detected.");
         if (isLargeObject<ourMem>(ptr)) {
             LargeMemoryBlock* lmb = ((LargeObjectHdr*)ptr - 1)->memoryBlock;
             return lmb->objectSize;
@@ -2590,6 +3499,24 @@ static size_t internalMsize(void* ptr)
     return 0;
 }
 
+// Guarded objects are reallocated by moving, to check and quarantine the old one
+static inline bool reallocByMoving(void *ptr)
+{
+    return FencedLoad(guardedMode.everEnabled)
+        && (FencedLoad(guardedMode.enabled) || guardedHeader(ptr));
+}
+
+static void *guardedRealloc(void *ptr, size_t size, size_t alignment)
+{
+    void *result = alignment? internalAlignedMalloc(size, alignment) : internalMalloc(size);
+    if (result) {
+        size_t copySize = internalMsize(ptr);
+        memcpy(result, ptr, copySize<size? copySize : size);
+        internalFree(ptr);
+    }
+    return result;
+}
+
 } // namespace internal
 
 using namespace rml::internal;
@@ -2625,14 +3552,14 @@ rml::MemPoolError pool_create_v1(intptr_t pool_id, const MemPoolPolicy *policy,
         doInitialization();
 
     rml::internal::MemoryPool *memPool =
-        (rml::internal::MemoryPool*)internalMalloc((sizeof(rml::internal::MemoryPool)));
+        (rml::internal::MemoryPool*)internalPoolMalloc(defaultMemPool, sizeof(rml::internal::MemoryPool));
     if (!memPool) {
         *pool = NULL;
         return NO_MEMORY;
     }
     memset(memPool, 0, sizeof(rml::internal::MemoryPool));
     if (!memPool->init(pool_id, policy)) {
-        internalFree(memPool);
+        internalPoolFree(defaultMemPool, memPool, 0);
         *pool = NULL;
         return NO_MEMORY;
     }
@@ -2645,7 +3572,7 @@ bool pool_destroy(rml::MemoryPool* memPool)
 {
     if (!memPool) return false;
     ((rml::internal::MemoryPool*)memPool)->destroy();
-    internalFree(memPool);
+    internalPoolFree(defaultMemPool, memPool, 0);
 
     return true;
 }
@@ -2663,6 +3590,11 @@ void *pool_malloc(rml::MemoryPool* mPool, size_t size)
     return internalPoolMalloc((rml::internal::MemoryPool*)mPool, size);
 }
 
+size_t pool_malloc_batch(rml::MemoryPool* mPool, size_t size, size_t count, void **objects)
+{
+    return internalPoolMallocBatch((rml::internal::MemoryPool*)mPool, size, count, objects);
+}
+
 void *pool_realloc(rml::MemoryPool* mPool, void *object, size_t size)
 {
     if (!object)
@@ -2705,6 +3637,60 @@ bool pool_free(rml::MemoryPool *mPool, void *object)
     return internalPoolFree((rml::internal::MemoryPool*)mPool, object, 0);
 }
 
+bool pool_free_batch(rml::MemoryPool *mPool, void **objects, size_t count)
+{
+    if (!mPool) return false;
+    internalFreeBatch((rml::internal::MemoryPool*)mPool, objects, count);
+    return true;
+}
+
+rml::MemPoolError pool_set_limit(rml::MemoryPool *mPool, size_t limit, memLimitCallbackType callback)
+{
+    if (!mPool) return INVALID_POLICY;
+    ExtMemoryPool *extMemPool = &((rml::internal::MemoryPool*)mPool)->extMemPool;
+
+    extMemPool->limitCallback = callback;
+    FencedStore((intptr_t&)extMemPool->memLimit, limit);
+    // try to fit into the new limit
+    if (limit && extMemPool->backend.getTotalMemSize() > limit)
+        extMemPool->hardCachesCleanup();
+    return POOL_OK;
+}
+
+bool pool_set_thread_default(rml::MemoryPool *mPool)
+{
+    if (!isMallocInitialized())
+        doInitialization();
+    TLSData *tls = defaultMemPool->getTLS(/*create=*/mPool);
+    if (!tls)
+        return !mPool;
+    if (mPool && !threadDefaultPoolsUsed)
+        FencedStore(threadDefaultPoolsUsed, 1);
+    tls->threadDefaultPool = (rml::internal::MemoryPool*)mPool;
+    return true;
+}
+
+rml::MemoryPool *pool_get_thread_default()
+{
+    if (!FencedLoad(threadDefaultPoolsUsed))
+        return NULL;
+    TLSData *tls = defaultMemPool->getTLS(/*create=*/false);
+    return tls? (rml::MemoryPool*)tls->threadDefaultPool : NULL;
+}
+
+bool pool_get_stats(rml::MemoryPool *mPool, rml::MemPoolStats *stats)
+{
+    if (!stats)
+        return false;
+    if (mPool)
+        ((rml::internal::MemoryPool*)mPool)->getStats(stats);
+    else if (isMallocInitialized())
+        defaultMemPool->getStats(stats);
+    else
+        memset(stats, 0, sizeof(rml::MemPoolStats));
+    return true;
+}
+
 } // namespace rml
 
 using namespace rml::internal;
@@ -2769,6 +3755,7 @@ extern "C" void __TBB_mallocProcessShutdownNotification()
 /* Pthread keys must be deleted as soon as possible to not call key dtor
    on thread termination when then the tbbmalloc code can be already unloaded.
 */
+    perCpuCaches.reset(&defaultMemPool->extMemPool.backend);
     defaultMemPool->destroy();
     destroyBackRefMaster(&defaultMemPool->extMemPool.backend);
     ThreadId::destroy();      // Delete key for thread id
@@ -2807,9 +3794,42 @@ extern "C" void scalable_free (void *object) {
     internalFree(object);
 }
 
+extern "C" void scalable_free_sized (void *object, size_t size) {
+    internalFreeSized(object, size);
+}
+
+extern "C" size_t scalable_malloc_batch(size_t size, size_t count, void **objects)
+{
+    size_t n = 0;
+
+#if MALLOC_CHECK_RECURSION
+    if (RecursiveMallocCallProtector::sameThreadActive()) {
+        // nested allocation, internalMalloc knows how to serve it
+        while (n<count && (objects[n] = internalMalloc(size)))
+            n++;
+    } else
+#endif
+    {
+        if (!isMallocInitialized())
+            doInitialization();
+        n = internalPoolMallocBatch(threadMallocPool(), size, count, objects);
+    }
+    if (n < count) errno = ENOMEM;
+    return n;
+}
+
+extern "C" void scalable_free_batch(void **objects, size_t count) {
+    internalFreeBatch(NULL, objects, count);
+}
+
 #if MALLOC_ZONE_OVERLOAD_ENABLED
 extern "C" void __TBB_malloc_free_definite_size(void *object, size_t size) {
-    internalPoolFree(defaultMemPool, object, size);
+    if (!object)
+        return;
+    if (GuardedHdr *hdr = guardedObject(object))
+        guardedFree(hdr);
+    else
+        internalPoolFree(objectPool(object), object, size);
 }
 #endif
 
@@ -2824,12 +3844,36 @@ extern "C" void __TBB_malloc_safer_free(void *object, void (*original_free)(void
 
     // must check 1st for large object, because small object check touches 4 pages on left,
     // and it can be inaccessible
-    if (isLargeObject<unknownMem>(object)) {
-        TLSData *tls = defaultMemPool->getTLS(/*create=*/false);
+    if (GuardedHdr *hdr = safeGuardedObject(object)) {
+        guardedFree(hdr);
+    } else if (isLargeObject<unknownMem>(object)) {
+        MemoryPool *memPool = objectPool(object);
+
+        memPool->putToLLOCache(memPool->getTLS(/*create=*/false), object);
+    } else if (isSmallObject(object) || isUserPoolObject(object)) {
+        freeSmallObject(objectPool(object), object);
+    } else if (original_free)
+        original_free(object);
+}
+
+/*
+ * Sized variant of __TBB_malloc_safer_free. The object still has to be recognized,
+ * but the size limits the check to one kind of objects.
+ */
+extern "C" void __TBB_malloc_safer_free_sized(void *object, size_t size, void (*original_free)(void*))
+{
+    if (!object)
+        return;
+
+    // large object check must be done even for small sizes, see __TBB_malloc_safer_free
+    if (GuardedHdr *hdr = safeGuardedObject(object)) {
+        guardedFree(hdr);
+    } else if (isLargeObject<unknownMem>(object)) {
+        MemoryPool *memPool = objectPool(object);
 
-        defaultMemPool->putToLLOCache(tls, object);
-    } else if (isSmallObject(object)) {
-        freeSmallObject(defaultMemPool, object);
+        memPool->putToLLOCache(memPool->getTLS(/*create=*/false), object);
+    } else if (size < minLargeObjectSize && (isSmallObject(object) || isUserPoolObject(object))) {
+        freeSmallObject(objectPool(object), object);
     } else if (original_free)
         original_free(object);
 }
@@ -2855,8 +3899,10 @@ extern "C" void* scalable_realloc(void* ptr, size_t size)
     else if (!size) {
         internalFree(ptr);
         return NULL;
-    } else
-        tmp = reallocAligned(defaultMemPool, ptr, size, 0);
+    } else if (reallocByMoving(ptr))
+        tmp = guardedRealloc(ptr, size, 0);
+    else
+        tmp = reallocAligned(objectPool(ptr), ptr, size, 0);
 
     if (!tmp) errno = ENOMEM;
     return tmp;
@@ -2872,12 +3918,14 @@ extern "C" void* __TBB_malloc_safer_realloc(void* ptr, size_t sz, void* original
 
     if (!ptr) {
         tmp = internalMalloc(sz);
-    } else if (isRecognized(ptr)) {
+    } else if (safeGuardedObject(ptr) || isRecognized(ptr) || isUserPoolObject(ptr)) {
         if (!sz) {
             internalFree(ptr);
             return NULL;
+        } else if (reallocByMoving(ptr)) {
+            tmp = guardedRealloc(ptr, sz, 0);
         } else {
-            tmp = reallocAligned(defaultMemPool, ptr, sz, 0);
+            tmp = reallocAligned(objectPool(ptr), ptr, sz, 0);
         }
     }
 #if USE_WINTHREAD
@@ -2934,10 +3982,18 @@ extern "C" void * scalable_calloc(size_t nobj, size_t size)
             return NULL;
         }
     void* result = internalMalloc(arraySize);
-    if (result)
-        memset(result, 0, arraySize);
-    else
+    if (!result)
         errno = ENOMEM;
+    else if (arraySize < minLargeObjectSize || guardedObject(result))
+        memset(result, 0, arraySize);
+    else {
+        MALLOC_ASSERT(isLargeObject<ourMem>(result), ASSERT_TEXT);
+        // memory just got from OS is zeroed already, and huge dirty objects
+        // are zeroed by OS lazily, so pages are touched when used, not here
+        LargeMemoryBlock *lmb = ((LargeObjectHdr*)result - 1)->memoryBlock;
+        if (!lmb->knownZero && !lmb->pool->extMemPool.backend.zeroPages(result, arraySize))
+            memset(result, 0, arraySize);
+    }
     return result;
 }
 
@@ -2949,7 +4005,7 @@ extern "C" int scalable_posix_memalign(void **memptr, size_t alignment, size_t s
 {
     if ( !isPowerOfTwoMultiple(alignment, sizeof(void*)) )
         return EINVAL;
-    void *result = allocateAligned(defaultMemPool, size, alignment);
+    void *result = internalAlignedMalloc(size, alignment);
     if (!result)
         return ENOMEM;
     *memptr = result;
@@ -2962,7 +4018,7 @@ extern "C" void * scalable_aligned_malloc(size_t size, size_t alignment)
         errno = EINVAL;
         return NULL;
     }
-    void *tmp = allocateAligned(defaultMemPool, size, alignment);
+    void *tmp = internalAlignedMalloc(size, alignment);
     if (!tmp) errno = ENOMEM;
     return tmp;
 }
@@ -2976,12 +4032,14 @@ extern "C" void * scalable_aligned_realloc(void *ptr, size_t size, size_t alignm
     void *tmp;
 
     if (!ptr)
-        tmp = allocateAligned(defaultMemPool, size, alignment);
+        tmp = internalAlignedMalloc(size, alignment);
     else if (!size) {
         scalable_free(ptr);
         return NULL;
-    } else
-        tmp = reallocAligned(defaultMemPool, ptr, size, alignment);
+    } else if (reallocByMoving(ptr))
+        tmp = guardedRealloc(ptr, size, alignment);
+    else
+        tmp = reallocAligned(objectPool(ptr), ptr, size, alignment);
 
     if (!tmp) errno = ENOMEM;
     return tmp;
@@ -2997,13 +4055,15 @@ extern "C" void * __TBB_malloc_safer_aligned_realloc(void *ptr, size_t size, siz
     void *tmp = NULL;
 
     if (!ptr) {
-        tmp = allocateAligned(defaultMemPool, size, alignment);
-    } else if (isRecognized(ptr)) {
+        tmp = internalAlignedMalloc(size, alignment);
+    } else if (safeGuardedObject(ptr) || isRecognized(ptr) || isUserPoolObject(ptr)) {
         if (!size) {
             internalFree(ptr);
             return NULL;
+        } else if (reallocByMoving(ptr)) {
+            tmp = guardedRealloc(ptr, size, alignment);
         } else {
-            tmp = reallocAligned(defaultMemPool, ptr, size, alignment);
+            tmp = reallocAligned(objectPool(ptr), ptr, size, alignment);
         }
     }
 #if USE_WINTHREAD
@@ -3014,7 +4074,7 @@ extern "C" void * __TBB_malloc_safer_aligned_realloc(void *ptr, size_t size, siz
             // Just keeping old pointer.
             if ( original_ptrs->orig_msize ){
                 size_t oldSize = original_ptrs->orig_msize(ptr);
-                tmp = allocateAligned(defaultMemPool, size, alignment);
+                tmp = internalAlignedMalloc(size, alignment);
                 if (tmp) {
                     memcpy(tmp, ptr, size<oldSize? size : oldSize);
                     if ( original_ptrs->orig_free ){
@@ -3063,7 +4123,7 @@ extern "C" size_t __TBB_malloc_safer_msize(void *object, size_t (*original_msize
 {
     if (object) {
         // Check if the memory was allocated by scalable_malloc
-        if (isRecognized(object))
+        if (safeGuardedObject(object) || isRecognized(object) || isUserPoolObject(object))
             return internalMsize(object);
         else if (original_msize)
             return original_msize(object);
@@ -3082,7 +4142,7 @@ extern "C" size_t __TBB_malloc_safer_aligned_msize(void *object, size_t alignmen
 {
     if (object) {
         // Check if the memory was allocated by scalable_malloc
-        if (isRecognized(object))
+        if (safeGuardedObject(object) || isRecognized(object) || isUserPoolObject(object))
             return internalMsize(object);
         else if (orig_aligned_msize)
             return orig_aligned_msize(object,alignment,offset);
@@ -3112,6 +4172,28 @@ extern "C" int scalable_allocation_mode(int param, intptr_t value)
 #else
         return TBBMALLOC_NO_EFFECT;
 #endif
+    } else if (param == TBBMALLOC_USE_PERCPU_CACHES) {
+#if __linux__
+        switch (value) {
+        case 0:
+            perCpuCaches.setMode(value);
+            // per-CPU caches are not used anymore, so release them
+            perCpuCaches.cleanup(&defaultMemPool->extMemPool);
+            return TBBMALLOC_OK;
+        case 1:
+            perCpuCaches.setMode(value);
+            return TBBMALLOC_OK;
+        default:
+            return TBBMALLOC_INVALID_PARAM;
+        }
+#else
+        return TBBMALLOC_NO_EFFECT;
+#endif
+    } else if (param == TBBMALLOC_USE_GUARDED_MODE) {
+        if (value < 0)
+            return TBBMALLOC_INVALID_PARAM;
+        guardedMode.setMode(value);
+        return TBBMALLOC_OK;
 #if __TBB_SOURCE_DIRECTLY_INCLUDED
     } else if (param == TBBMALLOC_INTERNAL_SOURCE_INCLUDED) {
         switch (value) {
@@ -3134,8 +4216,10 @@ extern "C" int scalable_allocation_command(int cmd, void *param)
     switch(cmd) {
     case TBBMALLOC_CLEAN_THREAD_BUFFERS:
         if (TLSData *tls = defaultMemPool->getTLS(/*create=*/false))
-            return tls->externalCleanup(&defaultMemPool->extMemPool,
-                                        /*cleanOnlyUnused=*/false)?
+            return tls->guardedQuarantine.drain()
+                | tls->remoteFree.flush()
+                | tls->externalCleanup(&defaultMemPool->extMemPool,
+                                       /*cleanOnlyUnused=*/false)?
                 TBBMALLOC_OK : TBBMALLOC_NO_EFFECT;
         return TBBMALLOC_NO_EFFECT;
     case TBBMALLOC_CLEAN_ALL_BUFFERS:
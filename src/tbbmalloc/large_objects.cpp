@@ -35,7 +35,7 @@ enum CacheBinOperationType {
     CBOP_PUT_LIST,
     CBOP_CLEAN_TO_THRESHOLD,
     CBOP_CLEAN_ALL,
-    CBOP_DECR_USED_SIZE
+    CBOP_UPDATE_USED_SIZE
 };
 
 // The operation status list. CBST_NOWAIT can be specified for non-blocking operations.
@@ -69,9 +69,9 @@ struct OpCleanAll {
     LargeMemoryBlock **res;
 };
 
-struct OpDecrUsedSize {
-    static const CacheBinOperationType type = CBOP_DECR_USED_SIZE;
-    size_t size;
+struct OpUpdateUsedSize {
+    static const CacheBinOperationType type = CBOP_UPDATE_USED_SIZE;
+    size_t size; // signed delta, negative values are wrapped around
 };
 
 union CacheBinOperationData {
@@ -80,7 +80,7 @@ private:
     OpPutList opPutList;
     OpCleanToThreshold opCleanToThreshold;
     OpCleanAll opCleanAll;
-    OpDecrUsedSize opDecrUsedSize;
+    OpUpdateUsedSize opUpdateUsedSize;
 };
 
 // Forward declarations
@@ -232,8 +232,8 @@ template<typename Props> void LargeObjectCacheImpl<Props>::CacheBin::CacheBinFun
             }
             break;
 
-        case CBOP_DECR_USED_SIZE:
-            decrUsedSize += opCast<OpDecrUsedSize>(*op).size;
+        case CBOP_UPDATE_USED_SIZE:
+            updateUsedSize += opCast<OpUpdateUsedSize>(*op).size;
             commitOperation( op );
             break;
 
@@ -334,8 +334,8 @@ template<typename Props> void LargeObjectCacheImpl<Props>::CacheBin::
         }
     }
 
-    if ( size_t decrUsedSize = prep.decrUsedSize )
-        bin->updateUsedSize(-decrUsedSize, bitMask, idx);
+    if ( size_t updateUsedSize = prep.updateUsedSize )
+        bin->updateUsedSize(updateUsedSize, bitMask, idx);
 }
 /* ----------------------------------------------------------------------------------------------------- */
 /* --------------------------- Methods for creating and executing operations --------------------------- */
@@ -419,11 +419,121 @@ template<typename Props> bool LargeObjectCacheImpl<Props>::
 }
 
 template<typename Props> void LargeObjectCacheImpl<Props>::
-    CacheBin::decrUsedSize(ExtMemoryPool *extMemPool, size_t size, BinBitMask *bitMask, int idx) {
-    OpDecrUsedSize data = {size};
+    CacheBin::updateUsedSize(ExtMemoryPool *extMemPool, size_t size, BinBitMask *bitMask, int idx) {
+    OpUpdateUsedSize data = {size};
     CacheBinOperation op(data);
     ExecuteOperation( &op, extMemPool, bitMask, idx );
 }
+/* ----------------------------------------------------------------------------------------------------- */
+/* ----------------------------- Lock-free methods that bypass the aggregator -------------------------- */
+// Pushes the [head;tail] list to the hot stack. Pushing is not prone to ABA,
+// as the list is linked to the block that is on the top at the moment of the push.
+template<typename Props> void LargeObjectCacheImpl<Props>::
+    CacheBin::pushHot(LargeMemoryBlock *head, LargeMemoryBlock *tail)
+{
+    for (;;) {
+        LargeMemoryBlock *top = (LargeMemoryBlock*)FencedLoad((intptr_t&)hotHead);
+        tail->next = top;
+        if ((intptr_t)top == AtomicCompareExchange((intptr_t&)hotHead, (intptr_t)head, (intptr_t)top))
+            return;
+    }
+}
+
+// Returns the blocks of the list that do not fit to the hot stack
+template<typename Props> LargeMemoryBlock *LargeObjectCacheImpl<Props>::
+    CacheBin::putHot(LargeMemoryBlock *head, uintptr_t currTime)
+{
+    const size_t size = head->unalignedSize;
+    const size_t limit = Props::hotLimit(size);
+    // the 1st object of a size is not cached, see putList(), so wait for the bin history
+    if (!limit || !lastCleanedAge)
+        return head;
+    size_t num = 0;
+    for (LargeMemoryBlock *curr = head; curr; curr = curr->next)
+        num++;
+    // reserve the room for as many blocks as fit
+    intptr_t room = (intptr_t)limit - (intptr_t)AtomicAdd(hotSize, num*size);
+    size_t fit = room <= 0? 0 : room/size < num? room/size : num;
+    if (fit < num)
+        AtomicAdd(hotSize, -(intptr_t)((num-fit)*size));
+    if (!fit)
+        return head;
+
+    LargeMemoryBlock *tail = head;
+    // the age is not unique, as the logical time is not incremented here
+    tail->age = currTime;
+    for (size_t i = 1; i < fit; i++) {
+        tail = tail->next;
+        tail->age = currTime;
+    }
+    LargeMemoryBlock *rest = tail->next;
+    pushHot(head, tail);
+#if __TBB_MALLOC_WHITEBOX_TEST
+    AtomicAdd(tbbmalloc_whitebox::locHotPuts, fit);
+#endif
+    return rest;
+}
+
+// Popping a single block would be prone to ABA, so all the blocks are taken,
+// and the rest is put back. A concurrent get sees the stack empty meanwhile,
+// and goes to the aggregated list.
+template<typename Props> LargeMemoryBlock *LargeObjectCacheImpl<Props>::
+    CacheBin::getHot()
+{
+    if (!FencedLoad((intptr_t&)hotHead))
+        return NULL;
+    LargeMemoryBlock *lmb = (LargeMemoryBlock*)AtomicFetchStore(&hotHead, 0);
+    if (!lmb)
+        return NULL;
+    if (LargeMemoryBlock *rest = lmb->next) {
+        // unless a put came meanwhile, the rest is put back at once
+        if (AtomicCompareExchange((intptr_t&)hotHead, (intptr_t)rest, 0)) {
+            LargeMemoryBlock *tail = rest;
+            while (tail->next)
+                tail = tail->next;
+            pushHot(rest, tail);
+        }
+    }
+    AtomicAdd(hotSize, -(intptr_t)lmb->unalignedSize);
+#if __TBB_MALLOC_WHITEBOX_TEST
+    AtomicIncrement(tbbmalloc_whitebox::locHotGets);
+#endif
+    return lmb;
+}
+
+// Hot blocks follow the same age threshold as the blocks in the list,
+// or all of them are released if requested.
+template<typename Props> bool LargeObjectCacheImpl<Props>::
+    CacheBin::releaseHot(ExtMemoryPool *extMemPool, BinBitMask *bitMask, int idx, uintptr_t currTime, bool all)
+{
+    if (!FencedLoad((intptr_t&)hotHead))
+        return false;
+    LargeMemoryBlock *keepHead = NULL, *keepTail = NULL, *helper;
+    size_t releasedSize = 0;
+    for (LargeMemoryBlock *curr = (LargeMemoryBlock*)AtomicFetchStore(&hotHead, 0); curr; curr = helper) {
+        helper = curr->next;
+        if (all || (intptr_t)(currTime - curr->age) > ageThreshold) {
+            releasedSize += curr->unalignedSize;
+            extMemPool->backend.returnLargeObject(curr);
+        } else {
+            // keep the order, so the most recent blocks are taken first still
+            if (keepTail)
+                keepTail->next = curr;
+            else
+                keepHead = curr;
+            keepTail = curr;
+        }
+    }
+    if (keepHead)
+        pushHot(keepHead, keepTail);
+    if (releasedSize) {
+        AtomicAdd(hotSize, -(intptr_t)releasedSize);
+        // hot blocks are counted as used ones
+        updateUsedSize(extMemPool, -releasedSize, bitMask, idx);
+    }
+    return releasedSize;
+}
+
 /* ----------------------------------------------------------------------------------------------------- */
 /* ------------------------------ Unsafe methods used with the aggregator ------------------------------ */
 template<typename Props> LargeMemoryBlock *LargeObjectCacheImpl<Props>::
@@ -607,6 +717,8 @@ bool LargeObjectCacheImpl<Props>::regularCleanup(ExtMemoryPool *extMemPool, uint
             bin[i].decreaseThreshold();
         if (bin[i].cleanToThreshold(extMemPool, &bitMask, currTime, i))
             released = true;
+        if (bin[i].releaseHot(extMemPool, &bitMask, i, currTime, /*all=*/false))
+            released = true;
     }
 
     // We want to find if LOC was too large for some time continuously,
@@ -623,8 +735,10 @@ template<typename Props>
 bool LargeObjectCacheImpl<Props>::cleanAll(ExtMemoryPool *extMemPool)
 {
     bool released = false;
-    for (int i = numBins-1; i >= 0; i--)
+    for (int i = numBins-1; i >= 0; i--) {
+        released |= bin[i].releaseHot(extMemPool, &bitMask, i, 0, /*all=*/true);
         released |= bin[i].releaseAllToBackend(extMemPool, &bitMask, i);
+    }
     return released;
 }
 
@@ -658,6 +772,23 @@ size_t LargeObjectCache::getUsedSize() const
 }
 #endif // __TBB_MALLOC_WHITEBOX_TEST
 
+template<typename Props>
+void LargeObjectCacheImpl<Props>::getStats(size_t *usedSize, size_t *cachedSize) const
+{
+    for (int i = numBins-1; i >= 0; i--) {
+        size_t hotSize = bin[i].getHotSize(), used = bin[i].getUsedSize();
+        *usedSize += used > hotSize? used - hotSize : 0;
+        *cachedSize += bin[i].getSize() + hotSize;
+    }
+}
+
+void LargeObjectCache::getStats(size_t *usedSize, size_t *cachedSize) const
+{
+    *usedSize = *cachedSize = 0;
+    largeCache.getStats(usedSize, cachedSize);
+    hugeCache.getStats(usedSize, cachedSize);
+}
+
 inline bool LargeObjectCache::isCleanupNeededOnRange(uintptr_t range, uintptr_t currTime)
 {
     return range >= cacheCleanupFreq
@@ -695,7 +826,9 @@ LargeMemoryBlock *LargeObjectCacheImpl<Props>::get(ExtMemoryPool *extMemoryPool,
     MALLOC_ASSERT( size%Props::CacheStep==0, ASSERT_TEXT );
     int idx = sizeToIdx(size);
 
-    LargeMemoryBlock *lmb = bin[idx].get(extMemoryPool, size, &bitMask, idx);
+    LargeMemoryBlock *lmb = bin[idx].getHot();
+    if (!lmb)
+        lmb = bin[idx].get(extMemoryPool, size, &bitMask, idx);
 
     if (lmb) {
         MALLOC_ITT_SYNC_ACQUIRED(bin+idx);
@@ -705,11 +838,11 @@ LargeMemoryBlock *LargeObjectCacheImpl<Props>::get(ExtMemoryPool *extMemoryPool,
 }
 
 template<typename Props>
-void LargeObjectCacheImpl<Props>::rollbackCacheState(ExtMemoryPool *extMemPool, size_t size)
+void LargeObjectCacheImpl<Props>::updateCacheState(ExtMemoryPool *extMemPool, DecreaseOrIncrease op, size_t size)
 {
     int idx = sizeToIdx(size);
     MALLOC_ASSERT(idx<numBins, ASSERT_TEXT);
-    bin[idx].decrUsedSize(extMemPool, size, &bitMask, idx);
+    bin[idx].updateUsedSize(extMemPool, op==decrease? -size : size, &bitMask, idx);
 }
 
 #if __TBB_MALLOC_LOCACHE_STAT
@@ -735,15 +868,23 @@ void LargeObjectCacheImpl<Props>::putList(ExtMemoryPool *extMemPool, LargeMemory
     int toBinIdx = sizeToIdx(toCache->unalignedSize);
 
     MALLOC_ITT_SYNC_RELEASING(bin+toBinIdx);
-    bin[toBinIdx].putList(extMemPool, toCache, &bitMask, toBinIdx);
+    if ((toCache = bin[toBinIdx].putHot(toCache, extMemPool->loc.peekCurrTime())))
+        bin[toBinIdx].putList(extMemPool, toCache, &bitMask, toBinIdx);
 }
 
-void LargeObjectCache::rollbackCacheState(size_t size)
+void LargeObjectCache::updateCacheState(DecreaseOrIncrease op, size_t size)
 {
     if (size < maxLargeSize)
-        largeCache.rollbackCacheState(extMemPool, size);
+        largeCache.updateCacheState(extMemPool, op, size);
     else if (size < maxHugeSize)
-        hugeCache.rollbackCacheState(extMemPool, size);
+        hugeCache.updateCacheState(extMemPool, op, size);
+}
+
+// the block was resized in place, so move its usage to the bin of the new size
+void LargeObjectCache::registerRealloc(size_t oldSize, size_t newSize)
+{
+    updateCacheState(decrease, oldSize);
+    updateCacheState(increase, newSize);
 }
 
 // return artifical bin index, it's used only during sorting and never saved
@@ -770,7 +911,7 @@ void LargeObjectCache::putList(LargeMemoryBlock *list)
 
         // Find all blocks fitting to same bin. Not use more efficient sorting
         // algorithm because list is short (commonly,
-        // LocalLOC's HIGH_MARK-LOW_MARK, i.e. 24 items).
+        // LocalLOC's HIGH_MARK-LOW_MARK, i.e. 32 items).
         for (LargeMemoryBlock *b = toProcess; b; b = n) {
             n = b->next;
             if (sizeToIdx(b->unalignedSize) == currIdx) {
@@ -834,7 +975,7 @@ LargeMemoryBlock *ExtMemoryPool::mallocLargeObject(size_t allocationSize)
         lmb = backend.getLargeBlock(allocationSize);
         if (!lmb) {
             removeBackRef(backRefIdx);
-            loc.rollbackCacheState(allocationSize);
+            loc.updateCacheState(decrease, allocationSize);
             return NULL;
         }
         lmb->backRefIdx = backRefIdx;
@@ -858,6 +999,17 @@ void ExtMemoryPool::freeLargeObjectList(LargeMemoryBlock *head)
     loc.putList(head);
 }
 
+void *ExtMemoryPool::remap(void *ptr, size_t newSize, size_t alignment)
+{
+    const size_t oldUnalignedSize = ((LargeObjectHdr*)ptr - 1)->memoryBlock->unalignedSize;
+    void *object = backend.remap(ptr, newSize, alignment);
+    if (object) {
+        LargeMemoryBlock *lmb = ((LargeObjectHdr*)object - 1)->memoryBlock;
+        loc.registerRealloc(oldUnalignedSize, lmb->unalignedSize);
+    }
+    return object;
+}
+
 bool ExtMemoryPool::softCachesCleanup()
 {
     return loc.regularCleanup();
@@ -0,0 +1,314 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#include "tbbmalloc_internal.h"
+#include <errno.h>
+#include <string.h>   /* for memcmp */
+
+#if __linux__ || __APPLE__ || __sun || __FreeBSD__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h> /* for flock */
+#include <fcntl.h>
+#include <unistd.h>
+#define MAPPED_POOL_SUPPORTED 1
+#else
+#define MAPPED_POOL_SUPPORTED 0
+#endif
+
+/********* File-backed pools ************/
+
+/*
+ * A mapped pool keeps its whole heap in a file mapped with MAP_SHARED.
+ * The heap metadata does not depend on the address the file is mapped at:
+ * the header, the free lists and the root refer to objects by offsets from
+ * the mapping start. So a structure built in the pool once can be used
+ * after the next mapping, as long as it links its parts with offsets too.
+ *
+ * Objects are segregated by size classes, with 4 classes per power of 2
+ * above 128 bytes. Freed objects are reused only by requests of the same
+ * class and never coalesced, which suits long-living read-mostly data.
+ * Allocation and releasing are serialized by a lock kept in the header.
+ */
+
+namespace rml {
+namespace internal {
+
+typedef uint64_t MappedOffset;
+
+class MappedObjectHdr {
+public:
+    uint64_t binIdx;
+    uint64_t signature; // distinguishes allocated objects from foreign pointers
+};
+
+class MappedPoolHeader {
+public:
+    static const unsigned numBins = 8 + 4*(8*sizeof(size_t)-7);
+    static const size_t   alignment = 16;
+    static const uint64_t objSignature = 0x6a624f6c6f6f50ULL;
+
+    char         signature[16];
+    uint64_t     version,
+                 size;          // of the file
+    MappedOffset bumpOffset,    // start of never used space
+                 root;          // entry point of user data, 0 if not set
+    MappedOffset freeLists[numBins];
+    MallocMutex  lock;
+
+    static unsigned sizeToBin(size_t size) {
+        if (size <= 128)
+            return size? (size-1)/16 : 0;
+        unsigned pos = BitScanRev(size-1);
+        return 8 + 4*(pos-7) + (((size-1) >> (pos-2)) & 3);
+    }
+    static size_t binToSize(unsigned bin) {
+        if (bin < 8)
+            return 16*(bin+1);
+        unsigned pos = 7 + (bin-8)/4;
+        return size_t(4 + (bin-8)%4 + 1) << (pos-2);
+    }
+};
+
+static const char mappedPoolSignature[16] = "TBBMALLOC_MAPPD";
+static const uint64_t mappedPoolVersion = 1;
+
+MALLOC_STATIC_ASSERT(sizeof(MappedObjectHdr) == MappedPoolHeader::alignment,
+                     "Objects alignment is broken by the header.");
+
+class MappedPoolHandle {
+public:
+    MappedPoolHeader *hdr;
+    size_t            size;
+    int               fd;
+
+    void *fromOffset(MappedOffset offset) const {
+        return offset? (char*)hdr + offset : NULL;
+    }
+    MappedOffset toOffset(const void *ptr) const {
+        return ptr? (const char*)ptr - (const char*)hdr : 0;
+    }
+    MappedObjectHdr *getObjectHdr(void *object) const {
+        uintptr_t begin = (uintptr_t)hdr + alignUp(sizeof(MappedPoolHeader), MappedPoolHeader::alignment);
+        if ((uintptr_t)object < begin + sizeof(MappedObjectHdr)
+            || (uintptr_t)object >= (uintptr_t)hdr + hdr->bumpOffset
+            || !isAligned(object, MappedPoolHeader::alignment))
+            return NULL;
+        MappedObjectHdr *objHdr = (MappedObjectHdr*)object - 1;
+        if (objHdr->signature != MappedPoolHeader::objSignature
+            || objHdr->binIdx >= MappedPoolHeader::numBins)
+            return NULL;
+        return objHdr;
+    }
+};
+
+#if MAPPED_POOL_SUPPORTED
+
+static MemPoolError openMappedPool(const char *path, size_t size, MappedPoolHandle *handle)
+{
+    int fd = open(path, O_RDWR|O_CREAT, 0666);
+    if (fd < 0)
+        return INVALID_POLICY;
+    // a heap modified by two processes would be broken
+    if (flock(fd, LOCK_EX|LOCK_NB)) {
+        close(fd);
+        return INVALID_POLICY;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return INVALID_POLICY;
+    }
+    bool created = !st.st_size;
+    if (created) {
+        size = alignUp(size, 4*1024);
+        if (size < alignUp(sizeof(MappedPoolHeader), MappedPoolHeader::alignment)
+                   + sizeof(MappedObjectHdr) + MappedPoolHeader::binToSize(0)) {
+            close(fd);
+            return INVALID_POLICY;
+        }
+        if (ftruncate(fd, size)) {
+            close(fd);
+            return NO_MEMORY;
+        }
+    } else {
+        // file can be too big to be mapped into a 32-bit process
+        if ((uint64_t)st.st_size > (size_t)-1 || (size_t)st.st_size < sizeof(MappedPoolHeader)) {
+            close(fd);
+            return INVALID_POLICY;
+        }
+        size = st.st_size;
+    }
+    void *base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NO_MEMORY;
+    }
+    MappedPoolHeader *hdr = (MappedPoolHeader*)base;
+    if (created) {
+        // the file is zero-filled, so are the free lists, root and lock
+        memcpy(hdr->signature, mappedPoolSignature, sizeof(hdr->signature));
+        hdr->version = mappedPoolVersion;
+        hdr->size = size;
+        hdr->bumpOffset = alignUp(sizeof(MappedPoolHeader), MappedPoolHeader::alignment);
+    } else if (memcmp(hdr->signature, mappedPoolSignature, sizeof(hdr->signature))
+               || hdr->version != mappedPoolVersion || hdr->size != size) {
+        munmap(base, size);
+        close(fd);
+        return INVALID_POLICY;
+    } else
+        // the file is locked, so the lock can be held only by a crashed process
+        memset(&hdr->lock, 0, sizeof(hdr->lock));
+    handle->hdr = hdr;
+    handle->size = size;
+    handle->fd = fd;
+    return POOL_OK;
+}
+
+static bool closeMappedPool(MappedPoolHandle *handle)
+{
+    bool ok = !msync(handle->hdr, handle->size, MS_SYNC);
+    ok &= !munmap(handle->hdr, handle->size);
+    ok &= !close(handle->fd); // releases the file lock too
+    return ok;
+}
+
+#endif /* MAPPED_POOL_SUPPORTED */
+
+} // namespace internal
+
+using namespace rml::internal;
+
+MemPoolError mapped_pool_open(const char *path, size_t size, rml::MappedPool **pool)
+{
+    *pool = NULL;
+    if (!path)
+        return INVALID_POLICY;
+#if MAPPED_POOL_SUPPORTED
+    MappedPoolHandle *handle = (MappedPoolHandle*)scalable_malloc(sizeof(MappedPoolHandle));
+    if (!handle)
+        return NO_MEMORY;
+    MemPoolError res = openMappedPool(path, size, handle);
+    if (res != POOL_OK) {
+        scalable_free(handle);
+        return res;
+    }
+    *pool = (rml::MappedPool*)handle;
+    return POOL_OK;
+#else
+    suppress_unused_warning(size);
+    return UNSUPPORTED_POLICY;
+#endif
+}
+
+bool mapped_pool_close(rml::MappedPool *pool)
+{
+    if (!pool)
+        return false;
+#if MAPPED_POOL_SUPPORTED
+    bool ret = closeMappedPool((MappedPoolHandle*)pool);
+    scalable_free(pool);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+void *mapped_pool_malloc(rml::MappedPool *pool, size_t size)
+{
+    if (!pool)
+        return NULL;
+    MappedPoolHandle *handle = (MappedPoolHandle*)pool;
+    MappedPoolHeader *hdr = handle->hdr;
+    if (size > handle->size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    unsigned bin = MappedPoolHeader::sizeToBin(size);
+    MappedObjectHdr *objHdr;
+    {
+        MallocMutex::scoped_lock lock(hdr->lock);
+        if (MappedOffset head = hdr->freeLists[bin]) {
+            objHdr = (MappedObjectHdr*)handle->fromOffset(head) - 1;
+            hdr->freeLists[bin] = *(MappedOffset*)(objHdr+1);
+        } else {
+            size_t objSize = sizeof(MappedObjectHdr) + MappedPoolHeader::binToSize(bin);
+            if (hdr->bumpOffset + objSize > handle->size) {
+                errno = ENOMEM;
+                return NULL;
+            }
+            objHdr = (MappedObjectHdr*)handle->fromOffset(hdr->bumpOffset);
+            hdr->bumpOffset += objSize;
+            objHdr->binIdx = bin;
+        }
+        objHdr->signature = MappedPoolHeader::objSignature;
+    }
+    MALLOC_ASSERT(objHdr->binIdx == bin, ASSERT_TEXT);
+    return objHdr+1;
+}
+
+bool mapped_pool_free(rml::MappedPool *pool, void *object)
+{
+    if (!pool)
+        return false;
+    if (!object)
+        return true;
+    MappedPoolHandle *handle = (MappedPoolHandle*)pool;
+    MappedPoolHeader *hdr = handle->hdr;
+
+    MallocMutex::scoped_lock lock(hdr->lock);
+    MappedObjectHdr *objHdr = handle->getObjectHdr(object);
+    if (!objHdr)
+        return false;
+    objHdr->signature = 0; // to detect double free
+    *(MappedOffset*)object = hdr->freeLists[objHdr->binIdx];
+    hdr->freeLists[objHdr->binIdx] = handle->toOffset(object);
+    return true;
+}
+
+void *mapped_pool_base(rml::MappedPool *pool)
+{
+    return pool? ((MappedPoolHandle*)pool)->hdr : NULL;
+}
+
+bool mapped_pool_set_root(rml::MappedPool *pool, void *object)
+{
+    if (!pool)
+        return false;
+    MappedPoolHandle *handle = (MappedPoolHandle*)pool;
+
+    MallocMutex::scoped_lock lock(handle->hdr->lock);
+    if (object && !handle->getObjectHdr(object))
+        return false;
+    handle->hdr->root = handle->toOffset(object);
+    return true;
+}
+
+void *mapped_pool_get_root(rml::MappedPool *pool)
+{
+    if (!pool)
+        return NULL;
+    MappedPoolHandle *handle = (MappedPoolHandle*)pool;
+
+    MallocMutex::scoped_lock lock(handle->hdr->lock);
+    return handle->fromOffset(handle->hdr->root);
+}
+
+} // namespace rml
@@ -267,6 +267,15 @@ void operator delete[](void* ptr, const std::nothrow_t&) throw() {
     InitOrigPointers();
     __TBB_malloc_safer_free(ptr, (void (*)(void*))orig_free);
 }
+// C++14 sized deallocation; the size is known to match the one passed to operator new
+void operator delete(void* ptr, size_t sz) throw() {
+    InitOrigPointers();
+    __TBB_malloc_safer_free_sized(ptr, sz, (void (*)(void*))orig_free);
+}
+void operator delete[](void* ptr, size_t sz) throw() {
+    InitOrigPointers();
+    __TBB_malloc_safer_free_sized(ptr, sz, (void (*)(void*))orig_free);
+}
 
 #endif /* MALLOC_UNIXLIKE_OVERLOAD_ENABLED */
 #endif /* MALLOC_UNIXLIKE_OVERLOAD_ENABLED || MALLOC_ZONE_OVERLOAD_ENABLED */
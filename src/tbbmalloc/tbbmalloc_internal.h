@@ -151,6 +151,29 @@ inline void AtomicUpdate(Arg &location, Arg newVal, const Compare &cmp)
     }
 }
 
+// Address bounds of memory regions, published for checks without locks.
+// The bounds only grow, so an address inside them can be out of any region.
+struct RegionBounds {
+    uintptr_t leftBound, rightBound;
+
+    void init() { leftBound = UINTPTR_MAX; rightBound = 0; }
+    void add(uintptr_t left, uintptr_t right) {
+        AtomicUpdate(leftBound, left, Greater());
+        AtomicUpdate(rightBound, right, Less());
+    }
+    bool inRange(const void *ptr) const {
+        return (uintptr_t)FencedLoad((intptr_t&)leftBound) <= (uintptr_t)ptr
+            && (uintptr_t)ptr < (uintptr_t)FencedLoad((intptr_t&)rightBound);
+    }
+private:
+    struct Greater {
+        bool operator()(uintptr_t a, uintptr_t b) const { return a > b; }
+    };
+    struct Less {
+        bool operator()(uintptr_t a, uintptr_t b) const { return a < b; }
+    };
+};
+
 // TODO: make BitMaskBasic more general
 // (currently, it fits BitMaskMin well, but not as suitable for BitMaskMax)
 template<unsigned NUM>
@@ -230,6 +253,17 @@ public:
     bool cleanup(ExtMemoryPool *extPool, bool cleanOnlyUnused);
     void markUnused();
     void reset() { head = NULL; }
+    // call func(tls) for each registered thread under the list lock
+    template<typename Func> void forEach(Func &func) {
+        MallocMutex::scoped_lock lock(listLock);
+        for (TLSRemote *curr=head; curr; curr=curr->next)
+            func(curr);
+    }
+};
+
+// direction of the change of a bin's usedSize
+enum DecreaseOrIncrease {
+    decrease, increase
 };
 
 /* cache blocks in range [MinSize; MaxSize) in bins with CacheStep
@@ -238,14 +272,23 @@ public:
                  set ageThreshold to OnMissFactor * the difference
                  between current time and last time cache was cleaned.
  LongWaitFactor -- to detect rarely-used bins and forget about their usage history
+ HotBlocks -- how many recently freed blocks a bin keeps in its lock-free stack
+ HotSize -- the limit on bytes in the stack of a bin, so bins of larger blocks keep
+            fewer of them, and bins of blocks larger than HotSize have no stack
 */
 template<size_t MIN_SIZE, size_t MAX_SIZE, uint32_t CACHE_STEP, int TOO_LARGE,
-         int ON_MISS, int LONG_WAIT>
+         int ON_MISS, int LONG_WAIT, int HOT_BLOCKS, size_t HOT_SIZE>
 struct LargeObjectCacheProps {
-    static const size_t MinSize = MIN_SIZE, MaxSize = MAX_SIZE;
+    static const size_t MinSize = MIN_SIZE, MaxSize = MAX_SIZE, HotSize = HOT_SIZE;
     static const uint32_t CacheStep = CACHE_STEP;
     static const int TooLargeFactor = TOO_LARGE, OnMissFactor = ON_MISS,
-        LongWaitFactor = LONG_WAIT;
+        LongWaitFactor = LONG_WAIT, HotBlocks = HOT_BLOCKS;
+
+    // how many bytes the hot stack of the bin of blocks of the size can keep
+    static size_t hotLimit(size_t size) {
+        const size_t blocks = HotSize/size < (size_t)HotBlocks? HotSize/size : HotBlocks;
+        return blocks*size;
+    }
 };
 
 template<typename Props>
@@ -299,6 +342,13 @@ private:
         intptr_t          meanHitRange;
   /* time of last get called for the bin */
         uintptr_t         lastGet;
+  /* Lock-free stack of recently freed blocks, which are put and got bypassing
+     the aggregator. They are not accounted in cachedSize, and usedSize still
+     counts them as used, so that a put/get pair through the stack leaves
+     the bin statistics untouched. The cleanup counts them as cached ones. */
+        LargeMemoryBlock *hotHead;
+  /* total size of the blocks in the hot stack, or reserved for a push to it */
+        intptr_t          hotSize;
 
         /* The functor called by the aggregator for the operation list */
         class CacheBinFunctor {
@@ -337,8 +387,8 @@ private:
                    lastGet - the same meaning as CacheBin::lastGet */
                 uintptr_t lastGetOpTime, lastGet;
 
-                /* The total sum of all usedSize decrements requested with CBOP_DECR_USED_SIZE operations. */
-                size_t decrUsedSize;
+                /* The total sum of all usedSize changes requested with CBOP_UPDATE_USED_SIZE operations. */
+                size_t updateUsedSize;
 
                 /* The list of blocks for the OP_PUT_LIST operation. */
                 LargeMemoryBlock *head, *tail;
@@ -355,7 +405,7 @@ private:
             public:
                 OperationPreprocessor(CacheBin *bin) :
                     bin(bin), lclTime(0), opGet(NULL), opClean(NULL), cleanTime(0),
-                    lastGetOpTime(0), decrUsedSize(0), head(NULL), isCleanAll(false)  {}
+                    lastGetOpTime(0), updateUsedSize(0), head(NULL), isCleanAll(false)  {}
                 void operator()(CacheBinOperation* opList);
                 uintptr_t getTimeRange() const { return -lclTime; }
 
@@ -406,17 +456,24 @@ private:
         LargeMemoryBlock *get(ExtMemoryPool *extMemPool, size_t size, BinBitMask *bitMask, int idx);
         bool cleanToThreshold(ExtMemoryPool *extMemPool, BinBitMask *bitMask, uintptr_t currTime, int idx);
         bool releaseAllToBackend(ExtMemoryPool *extMemPool, BinBitMask *bitMask, int idx);
-        void decrUsedSize(ExtMemoryPool *extMemPool, size_t size, BinBitMask *bitMask, int idx);
+        void updateUsedSize(ExtMemoryPool *extMemPool, size_t size, BinBitMask *bitMask, int idx);
+        inline void pushHot(LargeMemoryBlock *head, LargeMemoryBlock *tail);
+        inline LargeMemoryBlock *putHot(LargeMemoryBlock *head, uintptr_t currTime);
+        inline LargeMemoryBlock *getHot();
+        bool releaseHot(ExtMemoryPool *extMemPool, BinBitMask *bitMask, int idx, uintptr_t currTime, bool all);
 
         void decreaseThreshold() {
             if (ageThreshold)
                 ageThreshold = (ageThreshold + meanHitRange)/2;
         }
         void updateBinsSummary(BinsSummary *binsSummary) const {
-            binsSummary->update(usedSize, cachedSize);
+            // the blocks in the hot stack are cached, not used ones
+            size_t hot = getHotSize();
+            binsSummary->update(usedSize > hot? usedSize - hot : 0, cachedSize + hot);
         }
         size_t getSize() const { return cachedSize; }
         size_t getUsedSize() const { return usedSize; }
+        size_t getHotSize() const { return FencedLoad(hotSize); }
         size_t reportStat(int num, FILE *f);
     };
 
@@ -437,7 +494,7 @@ public:
     void putList(ExtMemoryPool *extMemPool, LargeMemoryBlock *largeBlock);
     LargeMemoryBlock *get(ExtMemoryPool *extMemPool, size_t size);
 
-    void rollbackCacheState(ExtMemoryPool *extMemPool, size_t size);
+    void updateCacheState(ExtMemoryPool *extMemPool, DecreaseOrIncrease op, size_t size);
     bool regularCleanup(ExtMemoryPool *extMemPool, uintptr_t currAge, bool doThreshDecr);
     bool cleanAll(ExtMemoryPool *extMemPool);
     void reset() {
@@ -453,6 +510,7 @@ public:
     size_t getLOCSize() const;
     size_t getUsedSize() const;
 #endif
+    void getStats(size_t *usedSize, size_t *cachedSize) const;
 };
 
 class LargeObjectCache {
@@ -465,8 +523,8 @@ public:
     static const uint32_t largeBlockCacheStep =  8*1024,
                           hugeBlockCacheStep = 512*1024;
 private:
-    typedef LargeObjectCacheProps<minLargeSize, maxLargeSize, largeBlockCacheStep, 2, 2, 16> LargeCacheTypeProps;
-    typedef LargeObjectCacheProps<maxLargeSize, maxHugeSize, hugeBlockCacheStep, 1, 1, 4> HugeCacheTypeProps;
+    typedef LargeObjectCacheProps<minLargeSize, maxLargeSize, largeBlockCacheStep, 2, 2, 16, 4, 1024*1024> LargeCacheTypeProps;
+    typedef LargeObjectCacheProps<maxLargeSize, maxHugeSize, hugeBlockCacheStep, 1, 1, 4, 0, 0> HugeCacheTypeProps;
     typedef LargeObjectCacheImpl< LargeCacheTypeProps > LargeCacheType;
     typedef LargeObjectCacheImpl< HugeCacheTypeProps > HugeCacheType;
 
@@ -497,7 +555,8 @@ public:
     void putList(LargeMemoryBlock *head);
     LargeMemoryBlock *get(size_t size);
 
-    void rollbackCacheState(size_t size);
+    void updateCacheState(DecreaseOrIncrease op, size_t size);
+    void registerRealloc(size_t oldSize, size_t newSize);
     bool isCleanupNeededOnRange(uintptr_t range, uintptr_t currTime);
     bool doCleanup(uintptr_t currTime, bool doThreshDecr);
 
@@ -515,11 +574,14 @@ public:
     size_t getLOCSize() const;
     size_t getUsedSize() const;
 #endif
+    // sizes of the blocks in use and cached, hot blocks are counted as cached
+    void getStats(size_t *usedSize, size_t *cachedSize) const;
     static size_t alignToBin(size_t size) {
         return size<maxLargeSize? alignUp(size, largeBlockCacheStep)
             : alignUp(size, hugeBlockCacheStep);
     }
 
+    uintptr_t peekCurrTime() { return (uintptr_t)FencedLoad((intptr_t&)cacheCurrTime); }
     uintptr_t getCurrTime() { return (uintptr_t)AtomicIncrement((intptr_t&)cacheCurrTime); }
     uintptr_t getCurrTimeRange(uintptr_t range) { return (uintptr_t)AtomicAdd((intptr_t&)cacheCurrTime, range)+1; }
 };
@@ -558,6 +620,9 @@ struct LargeMemoryBlock : public BlockI {
     size_t            objectSize;    // the size requested by a client
     size_t            unalignedSize; // the size requested from getMemory
     BackRefIdx        backRefIdx;    // cached here, used copy is in LargeObjectHdr
+    MemoryPool       *pool;          // the owner, to release objects of a thread default pool
+    bool              knownZero;     // the block is not written since it was mapped,
+                                     // valid until the object is released
 };
 
 // global state of blocks currently in processing
@@ -646,6 +711,10 @@ enum MemRegionType {
     MEMREG_ONE_BLOCK
 };
 
+// memory got from the OS directly, bypassing the backend
+void *getRawMemory(size_t size, bool hugePages);
+bool freeRawMemory(void *object, size_t size);
+
 class Backend {
 private:
 /* Blocks in range [minBinnedSize; getMaxBinnedSize()] are kept in bins,
@@ -714,6 +783,7 @@ public:
             return p == -1 ? Backend::freeBinsNum : p;
         }
         void verify();
+        size_t getFreeSize();
 #if __TBB_MALLOC_BACKEND_STAT
         void reportStat(FILE *f);
 #endif
@@ -740,6 +810,9 @@ private:
     // used for release every region on pool destroying
     MemRegion     *regionList;
     MallocMutex    regionListLock;
+    RegionBounds   regionBounds;
+    // bounds of the regions of all user pools
+    static RegionBounds userRegionBounds;
 
     CoalRequestQ   coalescQ; // queue of coalescing requests
     BackendSync    bkndSync;
@@ -767,7 +840,8 @@ private:
     FreeBlock *askMemFromOS(size_t totalReqSize, intptr_t startModifiedCnt,
                             int *lockedBinsThreshold, int numOfLockedBins,
                             bool *splittable);
-    FreeBlock *genericGetBlock(int num, size_t size, bool resSlabAligned);
+    FreeBlock *genericGetBlock(int num, size_t size, bool resSlabAligned,
+                               bool *newRegion = NULL);
     void genericPutBlock(FreeBlock *fBlock, size_t blockSz);
     FreeBlock *splitUnalignedBlock(FreeBlock *fBlock, int num, size_t size,
                               bool needAlignedRes);
@@ -781,6 +855,7 @@ private:
 
     void removeBlockFromBin(FreeBlock *fBlock);
 
+    bool reserveRawMem(size_t size) const;
     void *allocRawMem(size_t &size) const;
     void freeRawMem(void *object, size_t size) const;
 
@@ -809,19 +884,27 @@ public:
     void putBackRefSpace(void *b, size_t size, bool rawMemUsed);
 
     bool inUserPool() const;
+    bool ptrInRegions(const void *ptr);
+    static bool ptrInUserRegionBounds(const void *ptr) {
+        return userRegionBounds.inRange(ptr);
+    }
 
     LargeMemoryBlock *getLargeBlock(size_t size);
     void returnLargeObject(LargeMemoryBlock *lmb);
+    void *remap(void *ptr, size_t newSize, size_t alignment);
+    bool zeroPages(void *object, size_t size);
 
     void setRecommendedMaxSize(size_t softLimit) {
         memSoftLimit = softLimit;
         releaseCachesToLimit();
     }
     inline size_t getMaxBinnedSize() const;
-
-#if __TBB_MALLOC_WHITEBOX_TEST
     size_t getTotalMemSize() const { return totalMemSize; }
-#endif
+    // total size of the blocks kept in the bins
+    size_t getFreeSize() {
+        return freeLargeBins.getFreeSize() + freeAlignedBins.getFreeSize();
+    }
+
 private:
     static int sizeToBin(size_t size) {
         if (size >= maxBinned_HugePage)
@@ -874,6 +957,9 @@ struct ExtMemoryPool {
     rawAllocType      rawAlloc;
     rawFreeType       rawFree;
     size_t            granularity;
+    // Upper bound of memory that the backend may hold, 0 means no limit
+    size_t            memLimit;
+    memLimitCallbackType limitCallback;
     bool              keepAllMemory,
                       delayRegsReleasing,
     // TODO: implements fixedPool with calling rawFree on destruction
@@ -914,6 +1000,7 @@ struct ExtMemoryPool {
     LargeMemoryBlock *mallocLargeObject(size_t allocationSize);
     void freeLargeObject(LargeMemoryBlock *lmb);
     void freeLargeObjectList(LargeMemoryBlock *head);
+    void *remap(void *ptr, size_t newSize, size_t alignment);
 };
 
 inline bool Backend::inUserPool() const { return extMemPool->userPool(); }
@@ -40,6 +40,7 @@
 #if _MSC_VER
 #include "tbb/machine/windows_api.h"
 #endif /* _MSC_VER */
+#include <list>
 
 typedef static_counting_allocator<tbb::memory_pool_allocator<char> > cnt_alloc_t;
 typedef local_counting_allocator<std::allocator<char> > cnt_provider_t;
@@ -176,6 +177,178 @@ void TestSmallFixedSizePool()
 #endif
 }
 
+static const int fopObjects = 1000;
+static char fopBuf[fopObjects*32+15];
+
+class FixedObjectPoolBody: NoAssign {
+    tbb::fixed_object_pool &pool;
+public:
+    FixedObjectPoolBody(tbb::fixed_object_pool &p) : pool(p) {}
+    void operator()(int id) const {
+        const int num = 50;
+        int *objs[num];
+        for (int iter=0; iter<1000; iter++) {
+            int got = 0;
+            for (; got<num; got++) {
+                if (!(objs[got] = (int*)pool.malloc(sizeof(int))))
+                    break;
+                *objs[got] = id;
+            }
+            for (int i=0; i<got; i++) {
+                ASSERT(*objs[i] == id, "Object is allocated to several threads.");
+                pool.free(objs[i]);
+            }
+        }
+    }
+};
+
+void TestFixedObjectPool()
+{
+    tbb::fixed_object_pool pool(fopBuf, sizeof(fopBuf), 24);
+    ASSERT(pool.object_size() == 32 && pool.capacity() == fopObjects, NULL);
+    ASSERT(!pool.malloc(33), "Objects larger than the pool's are not supported.");
+
+    for (int iter=0; iter<2; iter++) {
+        // at the 2nd iteration objects are taken from the free list
+        static char *objs[fopObjects];
+        for (int i=0; i<fopObjects; i++) {
+            objs[i] = (char*)pool.malloc(i%32 + 1);
+            ASSERT(objs[i] && objs[i]>=fopBuf && objs[i]+32<=fopBuf+sizeof(fopBuf)
+                   && !((uintptr_t)objs[i] % 16), NULL);
+            memset(objs[i], i, 32);
+        }
+        ASSERT(!pool.malloc(1), "The pool is exhausted.");
+        for (int i=0; i<fopObjects; i++) {
+            for (int k=0; k<32; k++)
+                ASSERT(objs[i][k] == (char)i, "Objects overlap.");
+            pool.free(objs[i]);
+        }
+    }
+    pool.recycle();
+
+    for (int p=MaxThread; p>=MinThread; p--)
+        NativeParallelFor(p, FixedObjectPoolBody(pool));
+
+    typedef tbb::memory_pool_allocator<int, tbb::fixed_object_pool> pool_alloc_t;
+    std::list<int, pool_alloc_t> list(( pool_alloc_t(pool) ));
+    for (int i=0; i<fopObjects/2; i++)
+        list.push_back(i);
+    list.clear();
+#if TBB_USE_EXCEPTIONS
+    try {
+        tbb::fixed_object_pool small(fopBuf, 7, 8);
+        ASSERT(0, "Pool without space for a single object must not be created");
+    } catch (std::bad_alloc&) {
+    }
+#endif
+}
+
+#if __linux__ || __APPLE__ || __sun || __FreeBSD__
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct MappedNode {
+    tbb::offset_ptr<MappedNode> next;
+    int value;
+};
+
+static const char *mappedPoolFile = "test_ScalableAllocator_mapped.tmp";
+
+class MappedPoolBody: NoAssign {
+    rml::MappedPool *pool;
+public:
+    MappedPoolBody(rml::MappedPool *p) : pool(p) {}
+    void operator()(int id) const {
+        void *objs[100];
+        for (int iter=0; iter<100; iter++) {
+            for (int i=0; i<100; i++) {
+                objs[i] = rml::mapped_pool_malloc(pool, 1+(i*97)%2000);
+                ASSERT(objs[i], NULL);
+                *(int*)objs[i] = id;
+            }
+            for (int i=0; i<100; i++) {
+                ASSERT(*(int*)objs[i] == id, "Object is allocated to several threads.");
+                ASSERT(rml::mapped_pool_free(pool, objs[i]), NULL);
+            }
+        }
+    }
+};
+
+void TestMappedFilePool()
+{
+    const int num = 10000;
+    const size_t size = 4*1024*1024;
+    remove(mappedPoolFile);
+    {
+        tbb::mapped_file_pool pool(mappedPoolFile, size);
+        ASSERT(!pool.root(), NULL);
+        MappedNode *head = NULL;
+        for (int i=0; i<num; i++) {
+            MappedNode *n = (MappedNode*)pool.malloc(sizeof(MappedNode));
+            ASSERT(n, NULL);
+            n->value = i;
+            n->next = head;
+            head = n;
+        }
+        pool.set_root(head);
+#if TBB_USE_EXCEPTIONS
+        try {
+            tbb::mapped_file_pool locked(mappedPoolFile, size);
+            ASSERT(0, "The file must not be opened by two pools at the same time.");
+        } catch (std::bad_alloc&) {
+        }
+#endif
+    }
+    // make the file mapped at another address
+    void *prevBase;
+    {
+        rml::MappedPool *pool;
+        ASSERT(rml::mapped_pool_open(mappedPoolFile, 0, &pool) == rml::POOL_OK, NULL);
+        prevBase = rml::mapped_pool_base(pool);
+        rml::mapped_pool_close(pool);
+    }
+    void *blocker = mmap(prevBase, size, PROT_NONE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    {
+        tbb::mapped_file_pool pool(mappedPoolFile, 0);
+        int expected = num-1;
+        for (MappedNode *n = (MappedNode*)pool.root(); n; n = n->next, expected--)
+            ASSERT(n->value == expected, "Data is lost after remapping.");
+        ASSERT(expected == -1, "Data is lost after remapping.");
+        for (MappedNode *n = (MappedNode*)pool.root(), *next; n; n = next) {
+            next = n->next;
+            pool.free(n);
+        }
+        pool.set_root(NULL);
+    }
+    munmap(blocker, size);
+    {
+        rml::MappedPool *pool;
+        ASSERT(rml::mapped_pool_open(mappedPoolFile, 0, &pool) == rml::POOL_OK, NULL);
+        char *base = (char*)rml::mapped_pool_base(pool);
+        ASSERT(!rml::mapped_pool_get_root(pool), NULL);
+        ASSERT(!rml::mapped_pool_free(pool, base+size/2), "Foreign object must be rejected.");
+        // released objects are reused
+        void *p = rml::mapped_pool_malloc(pool, sizeof(MappedNode));
+        ASSERT(p && (char*)p < base+size && rml::mapped_pool_free(pool, p), NULL);
+        ASSERT(!rml::mapped_pool_free(pool, p), "Double free must be detected.");
+        ASSERT(!rml::mapped_pool_malloc(pool, size), NULL);
+
+        for (int t=MaxThread; t>=MinThread; t--)
+            NativeParallelFor(t, MappedPoolBody(pool));
+        ASSERT(rml::mapped_pool_close(pool), NULL);
+    }
+    FILE *f = fopen(mappedPoolFile, "w");
+    fputs("not a pool", f);
+    fclose(f);
+    rml::MappedPool *pool;
+    ASSERT(rml::mapped_pool_open(mappedPoolFile, size, &pool) == rml::INVALID_POLICY && !pool,
+           "A file of unknown format must not be opened.");
+    remove(mappedPoolFile);
+}
+#else
+void TestMappedFilePool() {}
+#endif
+
 int TestMain () {
 #if _MSC_VER && !__TBBMALLOC_NO_IMPLICIT_LINKAGE && !__TBB_WIN8UI_SUPPORT
     #ifdef _DEBUG
@@ -206,6 +379,13 @@ int TestMain () {
 
         result += TestMain(tbb::memory_pool_allocator<void>(pool) );
 
+        void *batch[64];
+        size_t got = pool.malloc_batch( 24, 64, batch );
+        ASSERT( got == 64, "batch allocation from fixed_pool failed" );
+        for( size_t i = 0; i < got; i++ )
+            memset( batch[i], 0, 24 );
+        pool.free_batch( batch, got );
+
         // try allocate almost entire buf keeping some reasonable space for internals
         char *p3 = (char*)pool.realloc( p2, sizeof(buf)-128*1024 );
         ASSERT( p3, "defragmentation failed" );
@@ -219,6 +399,8 @@ int TestMain () {
     }
     TestSmallFixedSizePool();
     TestZeroSpaceMemoryPool();
+    TestFixedObjectPool();
+    TestMappedFilePool();
 
     ASSERT( !result, NULL );
     return Harness::Done;
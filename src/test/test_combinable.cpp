@@ -25,6 +25,7 @@
 #include "tbb/combinable.h"
 #include "tbb/task_scheduler_init.h"
 #include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
 #include "tbb/blocked_range.h"
 #include "tbb/tick_count.h"
 #include "tbb/tbb_allocator.h"
@@ -114,6 +115,9 @@ T my_combine( T left, T right) { return left + right; }
 template <typename T>
 T my_combine_ref( const T &left, const T &right) { return left + right; }
 
+template <typename T>
+void my_merge( T &left, const T &right) { left += right; }
+
 template <typename T>
 class CombineEachHelper {
 public:
@@ -243,6 +247,10 @@ void RunParallelScalarTests(const char *test_name) {
 
         T combine_finit_sum(0);
 
+        T combine_parallel_sum(0);
+
+        T combine_in_place_sum(0);
+
         for (int t = -1; t < REPETITIONS; ++t) {
             if (Verbose && t == 0) t0 = tbb::tick_count::now(); 
 
@@ -268,12 +276,18 @@ void RunParallelScalarTests(const char *test_name) {
             assign_sum +=  assigned.combine(my_combine<T>);
 
             combine_finit_sum += finit_combinable.combine(my_combine<T>);
+
+            // Use combine_parallel, then merge the thread-local values in place
+            combine_parallel_sum += sums.combine_parallel(my_combine_ref<T>);
+            combine_in_place_sum += sums.combine_parallel_in_place(my_merge<T>);
         }
 
         ASSERT( EXPECTED_SUM == combine_sum, NULL);
         ASSERT( EXPECTED_SUM == combine_ref_sum, NULL);
         ASSERT( EXPECTED_SUM == assign_sum, NULL);
         ASSERT( EXPECTED_SUM == combine_finit_sum, NULL);
+        ASSERT( EXPECTED_SUM == combine_parallel_sum, NULL);
+        ASSERT( EXPECTED_SUM == combine_in_place_sum, NULL);
 
         REMARK("done\nparallel %s, %d, %g, %g\n", test_name, p, static_cast<double>(combine_sum), 
                                                       ( tbb::tick_count::now() - t0).seconds());
@@ -0,0 +1,220 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#define TBB_PREVIEW_CONCURRENT_FLAT_MAP 1
+#include "tbb/concurrent_flat_map.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "tbb/atomic.h"
+#include "harness.h"
+#include "harness_allocator.h"
+#include <vector>
+
+typedef tbb::concurrent_flat_map<long,long> Map;
+typedef static_counting_allocator<tbb::cache_aligned_allocator<char> > CountingAllocator;
+typedef tbb::concurrent_flat_map<long,long,tbb::tbb_hash_compare<long>,CountingAllocator> CountingMap;
+
+//! Bytes of the tables held by CountingMap instances
+size_t Footprint() {
+    return CountingAllocator::items_allocated - CountingAllocator::items_freed;
+}
+
+void TestSerial() {
+    REMARK("testing serial operations\n");
+    Map map;
+    ASSERT( map.empty() && map.capacity() >= 1, NULL );
+    long v;
+    ASSERT( !map.find( 1, v ) && !map.erase( 1 ), NULL );
+    const long N = 10000;
+    for( long i = 0; i < N; i++ )
+        ASSERT( map.insert( i, -i ), "item is not inserted" );
+    ASSERT( map.size() == size_t(N), NULL );
+    ASSERT( !map.insert( std::make_pair( 5L, 5L ) ), "insert must keep the existing item" );
+    for( long i = 0; i < N; i++ )
+        ASSERT( map.find( i, v ) && v == -i && map.count( i ) == 1, "item is not found" );
+    ASSERT( !map.count( N ), NULL );
+    for( long i = 0; i < N; i += 2 )
+        ASSERT( map.erase( i ), NULL );
+    ASSERT( map.size() == size_t(N/2), NULL );
+    for( long i = 0; i < N; i++ )
+        ASSERT( map.count( i ) == size_t(i % 2), "erased item is found" );
+    // erased slots are reused after migrations, the table does not grow
+    size_t capacity = map.capacity();
+    for( long r = 0; r < 20; r++ )
+        for( long i = 0; i < N; i += 2 ) {
+            ASSERT( map.insert( i, r ), NULL );
+            ASSERT( map.erase( i ), NULL );
+        }
+    ASSERT( map.capacity() <= 2*capacity, "tombstones are not purged" );
+    ASSERT( map.size() == size_t(N/2), NULL );
+    map.clear();
+    ASSERT( map.empty() && !map.count( 1 ), NULL );
+    Map reserved( N );
+    capacity = reserved.capacity();
+    for( long i = 0; i < N; i++ )
+        reserved.insert( i, i );
+    ASSERT( reserved.capacity() == capacity, "constructor does not reserve the capacity" );
+}
+
+//! Every thread inserts every key, erases a half and looks up the others
+class InsertErase: NoAssign {
+    Map &my_map;
+    const long my_n;
+    tbb::atomic<long> &my_inserted, &my_erased;
+public:
+    InsertErase( Map &map, long n, tbb::atomic<long> &inserted, tbb::atomic<long> &erased )
+        : my_map(map), my_n(n), my_inserted(inserted), my_erased(erased) {}
+    void operator()( int id ) const {
+        long inserted = 0, erased = 0, v;
+        for( long k = 0; k < my_n; k++ ) {
+            long i = (k * 7919 + id * 104729) % my_n;
+            if( my_map.insert( i, 3*i ) ) ++inserted;
+            ASSERT( my_map.find( i, v ) || i % 3 == 0, "inserted item is not found" );
+            ASSERT( !my_map.find( i, v ) || v == 3*i, "wrong value" );
+            if( i % 3 == 0 && my_map.erase( i ) ) ++erased;
+        }
+        my_inserted += inserted;
+        my_erased += erased;
+    }
+};
+
+void TestConcurrentModifications( int nthread ) {
+    REMARK("testing concurrent insertions and erasures with %d threads\n", nthread);
+    const long N = 100000;
+    Map map;
+    tbb::atomic<long> inserted, erased;
+    inserted = erased = 0;
+    NativeParallelFor( nthread, InsertErase( map, N, inserted, erased ) );
+    ASSERT( inserted - erased == long(map.size()), "wrong size" );
+    ASSERT( erased <= inserted && inserted - erased == N - (N+2)/3, "items are lost or duplicated" );
+    for( long i = 0; i < N; i++ ) {
+        long v;
+        bool found = map.find( i, v );
+        ASSERT( found == (i % 3 != 0) && (!found || v == 3*i), "wrong content after concurrent operations" );
+    }
+}
+
+//! Thread 0 inserts items, the others check that the published ones are found while the table grows
+class GrowAndFind: NoAssign {
+    Map &my_map;
+    const long my_n;
+    tbb::atomic<long> &my_published;
+public:
+    GrowAndFind( Map &map, long n, tbb::atomic<long> &published ) : my_map(map), my_n(n), my_published(published) {}
+    void operator()( int id ) const {
+        if( id == 0 ) {
+            for( long i = 0; i < my_n; i++ ) {
+                ASSERT( my_map.insert( i, i+1 ), NULL );
+                my_published = i+1;
+            }
+        } else {
+            long v;
+            for( long p, j = id; (p = my_published) < my_n; j += 7919 ) {
+                if( p ) {
+                    long k = j % p;
+                    ASSERT( my_map.find( k, v ) && v == k+1, "item is lost during migration" );
+                }
+                ASSERT( !my_map.find( my_n + j % my_n, v ), NULL );
+            }
+        }
+    }
+};
+
+void TestLookupsDuringGrowth( int nthread ) {
+    REMARK("testing lookups while the table grows with %d threads\n", nthread);
+    const long N = 200000; // migrations of big tables use parallel_for
+    Map map;
+    tbb::atomic<long> published;
+    published = 0;
+    NativeParallelFor( nthread, GrowAndFind( map, N, published ) );
+    ASSERT( map.size() == size_t(N), NULL );
+    ASSERT( map.capacity() >= size_t(N), NULL );
+}
+
+struct ParallelInsert {
+    Map &my_map;
+    ParallelInsert( Map &map ) : my_map(map) {}
+    void operator()( const tbb::blocked_range<long> &r ) const {
+        for( long i = r.begin(); i != r.end(); ++i )
+            ASSERT( my_map.insert( i, i ), NULL );
+    }
+};
+
+//! Migrations started from tasks, helped by the parallel_for of migration
+void TestInsertFromTasks() {
+    REMARK("testing insertions from tasks\n");
+    const long N = 300000;
+    Map map;
+    tbb::parallel_for( tbb::blocked_range<long>( 0, N, 1000 ), ParallelInsert( map ) );
+    ASSERT( map.size() == size_t(N), NULL );
+    for( long i = 0; i < N; i++ )
+        ASSERT( map.count( i ), NULL );
+}
+
+//! Every thread keeps its own keys in the map, and erases and inserts them again
+class Churn: NoAssign {
+    CountingMap &my_map;
+    const long my_n, my_rounds;
+public:
+    Churn( CountingMap &map, long n, long rounds ) : my_map(map), my_n(n), my_rounds(rounds) {}
+    void operator()( int id ) const {
+        long v;
+        for( long r = 0; r < my_rounds; r++ )
+            for( long i = id*my_n; i < (id+1)*my_n; i++ ) {
+                ASSERT( my_map.erase( i ), NULL );
+                ASSERT( my_map.insert( i, r ), NULL );
+                ASSERT( my_map.find( i, v ) && v == r, NULL );
+            }
+    }
+};
+
+//! Replaced tables are freed, so the footprint does not grow with the number of migrations
+void TestChurnFootprint( int nthread ) {
+    REMARK("testing the footprint under churn with %d threads\n", nthread);
+    const long N = 5000;
+    CountingAllocator::init_counters();
+    {
+        CountingMap map;
+        for( long i = 0; i < nthread*N; i++ )
+            map.insert( i, 0 );
+        size_t footprint = Footprint(), migrations = CountingAllocator::allocations;
+        NativeParallelFor( nthread, Churn( map, N, 20 ) );
+        map.insert( -1, 0 ); // frees the tables that were retired last
+        ASSERT( CountingAllocator::allocations - migrations > 10, "tombstones do not cause migrations" );
+        ASSERT( map.size() == size_t(nthread*N+1), NULL );
+        ASSERT( Footprint() <= 3*footprint, "replaced tables are not freed" );
+    }
+    ASSERT( Footprint() == 0, "tables are leaked" );
+}
+
+int TestMain() {
+    if( MinThread < 1 ) MinThread = 1;
+    if( MaxThread < 2 ) MaxThread = 2;
+    TestSerial();
+    for( int p = MinThread; p <= MaxThread; ++p ) {
+        tbb::task_scheduler_init init( p );
+        TestConcurrentModifications( p );
+        TestLookupsDuringGrowth( p < 2 ? 2 : p );
+        TestInsertFromTasks();
+        TestChurnFootprint( p );
+    }
+    return Harness::Done;
+}
@@ -79,10 +79,12 @@ tbb::concurrent_hash_map<std::pair<std::pair<int,std::string>,const char*>,int>
 
 #include "tbb/parallel_for.h"
 #include "tbb/blocked_range.h"
+#include "tbb/concurrent_hash_map_parallel.h"
 #include "tbb/atomic.h"
 #include "tbb/tick_count.h"
 #include "harness.h"
 #include "harness_allocator.h"
+#include <vector>
 
 class MyException : public std::bad_alloc {
 public:
@@ -653,6 +655,183 @@ void TestConcurrency( int nthread ) {
     ASSERT( MyDataCount==0, "memory leak detected" );
 }
 
+namespace OptimisticReads {
+    //! Trivially copyable value, its halves are written separately by writers
+    struct Pair {
+        int first, second;
+    };
+    typedef tbb::concurrent_hash_map<int,Pair> PairTable;
+
+    //! Value copied under the item lock, counts its instances
+    struct Counted {
+        static tbb::atomic<int> instances;
+        int value, negated;
+        Counted() : value(0), negated(0) { ++instances; }
+        Counted( int v ) : value(v), negated(-v) { ++instances; }
+        Counted( const Counted &other ) : value(other.value), negated(other.negated) { ++instances; }
+        ~Counted() { --instances; }
+    };
+    tbb::atomic<int> Counted::instances;
+    typedef tbb::concurrent_hash_map<int,Counted> CountedTable;
+
+    const int KeysNumber = 1000;
+    const int Iterations = 20000;
+
+    //! Thread 0 modifies, erases and inserts items, the others look them up without locks
+    template<typename Table, typename Body>
+    class Worker: NoAssign {
+        Table &my_table;
+        const Body my_body;
+    public:
+        Worker( Table &table ) : my_table(table), my_body() {}
+        void operator()( int id ) const {
+            for( int i = 0; i < Iterations; i++ ) {
+                int key = int( (i * 7919u + id * 104729u) % KeysNumber );
+                if( id == 0 ) {
+                    switch( i % 4 ) {
+                    case 0:
+                        my_table.erase( key );
+                        break;
+                    case 1: {
+                        typename Table::accessor a;
+                        my_table.insert( a, key );
+                        my_body.write( a->second, key + KeysNumber*i );
+                        break;
+                    }
+                    default: {
+                        typename Table::accessor a;
+                        if( my_table.find( a, key ) )
+                            my_body.write( a->second, key + KeysNumber*i );
+                    }
+                    }
+                } else {
+                    typename Table::mapped_type v;
+                    if( my_table.optimistic_find( key, v ) )
+                        my_body.check( v, key );
+                }
+            }
+        }
+    };
+
+    struct PairBody {
+        void write( Pair &p, int v ) const {
+            p.first = v;
+            __TBB_compiler_fence();
+            p.second = -v;
+        }
+        void check( const Pair &p, int key ) const {
+            ASSERT( p.first == -p.second, "torn value read by optimistic_find" );
+            ASSERT( p.first % KeysNumber == key, "value of another item read by optimistic_find" );
+        }
+    };
+
+    struct CountedBody {
+        void write( Counted &c, int v ) const {
+            c.value = v;
+            __TBB_compiler_fence();
+            c.negated = -v;
+        }
+        void check( const Counted &c, int key ) const {
+            ASSERT( c.value == -c.negated, "torn value read by optimistic_find" );
+            ASSERT( c.value % KeysNumber == key, "value of another item read by optimistic_find" );
+        }
+    };
+
+    template<typename Table, typename Body>
+    void TestConcurrentLookups( int nthread ) {
+        Table table;
+        table.enable_optimistic_reads();
+        ASSERT( table.optimistic_reads_enabled(), NULL );
+        for( int k = 0; k < KeysNumber; k += 2 ) {
+            typename Table::accessor a;
+            table.insert( a, k );
+            Body().write( a->second, k );
+        }
+        NativeParallelFor( nthread, Worker<Table,Body>( table ) );
+        for( int k = 0; k < KeysNumber; k++ ) {
+            typename Table::mapped_type v;
+            typename Table::const_accessor a;
+            bool found = table.optimistic_find( k, v );
+            ASSERT( found == table.find( a, k ), "optimistic_find disagrees with find" );
+            if( found )
+                Body().check( v, k );
+        }
+    }
+
+    void TestSerial() {
+        PairTable table;
+        Pair p = { 1, -1 };
+        table.insert( std::make_pair( 1, p ) );
+        ASSERT( !table.optimistic_reads_enabled(), NULL );
+        ASSERT( table.optimistic_find( 1, p ) && p.first == 1, "lookup without optimistic reads failed" );
+        table.enable_optimistic_reads();
+        ASSERT( !table.optimistic_find( 2, p ), NULL );
+        for( int k = 2; k < 10000; k++ ) { // grows the table with splits of buckets
+            p.first = k; p.second = -k;
+            table.insert( std::make_pair( k, p ) );
+        }
+        for( int k = 1; k < 10000; k++ )
+            ASSERT( table.optimistic_find( k, p ) && p.first == k, "item is not found by optimistic_find" );
+        for( int k = 1; k < 10000; k += 2 )
+            table.erase( k );
+        for( int k = 1; k < 10000; k++ )
+            ASSERT( table.optimistic_find( k, p ) == (k % 2 == 0), "erased item is found by optimistic_find" );
+        PairTable copy( table ), other;
+        ASSERT( !copy.optimistic_reads_enabled(), "optimistic reads are not copied" );
+        other.swap( table );
+        ASSERT( other.optimistic_reads_enabled() && !table.optimistic_reads_enabled(), "swap must exchange the mode" );
+        other.clear();
+        ASSERT( other.optimistic_reads_enabled() && !other.optimistic_find( 2, p ), NULL );
+    }
+}
+
+//! Test lock-free lookups concurrently with updates, erasures and growth of the table
+void TestOptimisticReads( int nthread ) {
+    REMARK("testing optimistic_find with %d threads\n", nthread);
+    using namespace OptimisticReads;
+    if( nthread == 1 ) TestSerial();
+    TestConcurrentLookups<PairTable,PairBody>( nthread < 2 ? 2 : nthread );
+    TestConcurrentLookups<CountedTable,CountedBody>( nthread < 2 ? 2 : nthread );
+    ASSERT( Counted::instances == 0, "memory leak detected" );
+}
+
+//! Test tbb::parallel_build() and tbb::parallel_rehash()
+void TestParallelBuildAndRehash( int nthread ) {
+    REMARK("testing parallel construction and rehash with %d threads\n", nthread);
+    typedef tbb::concurrent_hash_map<int,int> IntTable;
+    const int n = 100000;
+    std::vector<std::pair<int,int> > items;
+    for( int i = 0; i < n; i++ )
+        items.push_back( std::make_pair( i, i*3 ) );
+    // duplicates are inserted as separate items, as the range constructor does
+    for( int i = 0; i < n; i += 10 )
+        items.push_back( std::make_pair( i, i*3 ) );
+    IntTable table;
+    tbb::parallel_build( table, items.begin(), items.end() );
+    ASSERT( table.size() == items.size(), "wrong size of the table built in parallel" );
+    for( int i = 0; i < n; i++ ) {
+        IntTable::const_accessor a;
+        ASSERT( table.find( a, i ) && a->second == i*3, "item is not found in the table built in parallel" );
+        ASSERT( table.count( i ) == 1, NULL );
+    }
+    ASSERT( !table.count( n ), NULL );
+    size_t iterated = 0;
+    for( IntTable::const_iterator it = table.begin(); it != table.end(); ++it )
+        iterated++;
+    ASSERT( iterated == items.size(), "wrong number of items iterated" );
+
+    // items pile in lower buckets while the table grows, so most of them move on rehash
+    IntTable grown;
+    for( int i = 0; i < n; i++ )
+        grown.insert( std::make_pair( i, -i ) );
+    tbb::parallel_rehash( grown, 16*n ); // checks placement of the items if TBB_USE_ASSERT
+    ASSERT( grown.bucket_count() >= size_t(16*n) && grown.size() == size_t(n), NULL );
+    for( int i = 0; i < n; i++ ) {
+        IntTable::const_accessor a;
+        ASSERT( grown.find( a, i ) && a->second == -i, "item is lost by rehash" );
+    }
+}
+
 void TestTypes() {
     AssertSameType( static_cast<MyTable::key_type*>(0), static_cast<MyKey*>(0) );
     AssertSameType( static_cast<MyTable::mapped_type*>(0), static_cast<MyData*>(0) );
@@ -1368,6 +1547,8 @@ int TestMain () {
         tbb::task_scheduler_init init( nthread );
         TestInsertFindErase( nthread );
         TestConcurrency( nthread );
+        TestOptimisticReads( nthread );
+        TestParallelBuildAndRehash( nthread );
     }
     // check linking
     if(bad_hashing) { //should be false
@@ -27,6 +27,7 @@
 #include "harness_barrier.h"
 
 #include <utility>
+#include <map>
 
 #ifdef TEST_COARSE_GRAINED_LOCK_IMPLEMENTATION
     #include "../perf/coarse_grained_raii_lru_cache.h"
@@ -402,3 +403,129 @@ namespace concurrency_tests{
         }
     }
 }
+
+#ifndef TEST_COARSE_GRAINED_LOCK_IMPLEMENTATION
+namespace implementation_specific_tests{
+    using namespace helpers;
+    typedef tbb::concurrent_lru_cache<size_t,size_t> cache_type;
+
+    namespace helpers{
+        tbb::atomic<size_t> calls_count;
+        size_t counting_identity(size_t key){
+            ++calls_count;
+            return key;
+        }
+        size_t value_as_weight(size_t const&, size_t const& value){
+            return value;
+        }
+        size_t slow_identity(size_t key){
+            ++calls_count;
+            ::helpers::busy_wait(10000);
+            return key;
+        }
+    }
+
+    TEST_CASE_WITH_FIXTURE(test_capacity_is_total_weight_of_unused_values,empty_fixture){
+        helpers::calls_count = 0;
+        cache_type cache(&helpers::counting_identity, 10, &helpers::value_as_weight);
+        for (size_t i=1; i<=4; ++i)
+            cache[i];
+        cache[1]; cache[2]; cache[3]; cache[4];
+        ASSERT(helpers::calls_count==4, "values of total weight up to the capacity should be kept");
+        // weight of 1..5 is 15, so 1, 2 and 3 have to be evicted
+        cache[5];
+        cache[4];
+        ASSERT(helpers::calls_count==5, "recently used value should not be evicted");
+        cache[3];
+        ASSERT(helpers::calls_count==6, "values over the capacity should be evicted in lru order");
+    }
+
+    struct concurrent_miss_body:NoAssign{
+        cache_type& my_cache;
+        Harness::SpinBarrier& my_barrier;
+        concurrent_miss_body(cache_type& cache, Harness::SpinBarrier& barrier):my_cache(cache),my_barrier(barrier){}
+        void operator()(int) const{
+            my_barrier.wait();
+            cache_type::handle h = my_cache[42];
+            ASSERT(h.value()==42, "waiting thread should get the computed value");
+        }
+    };
+
+    TEST_CASE_WITH_FIXTURE(test_value_is_computed_once_for_concurrent_misses,empty_fixture){
+        helpers::calls_count = 0;
+        cache_type cache(&helpers::slow_identity, 8);
+        const int number_of_threads = 4;
+        Harness::SpinBarrier barrier(number_of_threads);
+        NativeParallelFor(number_of_threads, concurrent_miss_body(cache, barrier));
+        ASSERT(helpers::calls_count==1, "threads missed the same key should wait for a single computation");
+    }
+
+#if TBB_USE_EXCEPTIONS
+    namespace helpers{
+        bool should_throw;
+        size_t throwing_identity(size_t key){
+            if (should_throw)
+                throw key;
+            return key;
+        }
+    }
+
+    TEST_CASE_WITH_FIXTURE(test_value_function_exception_is_propagated,empty_fixture){
+        cache_type cache(&helpers::throwing_identity, 8);
+        helpers::should_throw = true;
+        bool is_caught = false;
+        try {
+            cache[1];
+        } catch (size_t){
+            is_caught = true;
+        }
+        ASSERT(is_caught, "exception from value function should be propagated to caller");
+        helpers::should_throw = false;
+        ASSERT(cache[1].value()==1, "value should be computed again after failure");
+    }
+#endif /* TBB_USE_EXCEPTIONS */
+
+    TEST_CASE_WITH_FIXTURE(test_sharded_cache_respects_capacity,empty_fixture){
+        helpers::calls_count = 0;
+        const size_t capacity = 1024;
+        cache_type cache(&helpers::counting_identity, capacity);
+        for (size_t i=0; i<4*capacity; ++i)
+            cache[i];
+        helpers::calls_count = 0;
+        for (size_t i=4*capacity; i-- > 0; )
+            cache[i];
+        // shards evict independently, so somewhat less than the capacity can be kept
+        ASSERT(helpers::calls_count >= 3*capacity && helpers::calls_count < 3*capacity + capacity/2,
+               "cache should keep at most but close to capacity unused values");
+    }
+
+    namespace helpers{
+        int counting_dereference(int const* p){
+            ++calls_count;
+            return *p;
+        }
+    }
+
+    TEST_CASE_WITH_FIXTURE(test_sharded_cache_spreads_realistic_keys,empty_fixture){
+        // each of 16 shards keeps 64 values, so a half of the capacity fits only if all shards are used
+        const size_t capacity = 1024, number_of_keys = capacity/2;
+        cache_type cache(&helpers::counting_identity, capacity);
+        helpers::calls_count = 0;
+        for (size_t i=0; i<number_of_keys; ++i)
+            cache[i];
+        for (size_t i=0; i<number_of_keys; ++i)
+            cache[i];
+        ASSERT(helpers::calls_count==number_of_keys, "small integer keys should be spread over the shards");
+
+        // hash values of pointers differ in low bits only
+        std::vector<int> objects(number_of_keys);
+        tbb::concurrent_lru_cache<int const*,int> pointer_cache(&helpers::counting_dereference, capacity);
+        helpers::calls_count = 0;
+        for (size_t i=0; i<number_of_keys; ++i)
+            pointer_cache[&objects[i]];
+        for (size_t i=0; i<number_of_keys; ++i)
+            pointer_cache[&objects[i]];
+        ASSERT(helpers::calls_count==number_of_keys, "pointer keys should be spread over the shards");
+    }
+}
+#endif /* TEST_COARSE_GRAINED_LOCK_IMPLEMENTATION */
@@ -819,6 +819,159 @@ void TestMoveSupportInPushPop() {
 }
 #endif /* __TBB_CPP11_RVALUE_REF_PRESENT */
 
+void TestCapacity() {
+    REMARK("Testing capacity.\n");
+    concurrent_priority_queue<int, std::less<int> > q;
+    ASSERT(q.capacity()==~size_t(0), "FAILED: the queue must be unbounded by default.");
+    q.set_capacity(3);
+    ASSERT(q.capacity()==3, "FAILED capacity test.");
+    for (int i=0; i<3; ++i)
+        ASSERT(q.try_push(i), "FAILED try_push to the queue below its capacity.");
+    ASSERT(!q.try_push(42), "FAILED: try_push to the full queue succeeded.");
+    ASSERT(q.size()==3, "FAILED push/size test.");
+    int e;
+    q.pop(e);
+    ASSERT(e==2, "FAILED pop/priority test.");
+    ASSERT(q.try_push(42), "FAILED try_push after pop.");
+    q.set_capacity(5);
+    q.push(1);
+    q.push(4);
+    ASSERT(!q.try_push(3) && q.size()==5, "FAILED: try_push to the full queue succeeded.");
+    // lowering the capacity keeps the elements, only further pushes fail
+    q.set_capacity(1);
+    ASSERT(q.size()==5, "FAILED set_capacity/size test.");
+    const int expected[] = {42, 4, 1, 1, 0};
+    for (int i=0; i<5; ++i) {
+        q.pop(e);
+        ASSERT(e==expected[i], "FAILED pop/priority test.");
+        ASSERT(q.try_push(7)==(i==4), "FAILED try_push after lowering the capacity.");
+    }
+    concurrent_priority_queue<int, std::less<int> > q2(q);
+    ASSERT(q2.capacity()==1 && q2.size()==1, "FAILED: copy constructor must copy the capacity.");
+}
+
+class BlockingBody : NoAssign {
+    concurrent_priority_queue<int, std::less<int> > &my_q;
+    const int my_producers;
+    const size_t my_capacity;
+    tbb::atomic<long> &my_sum;
+public:
+    static const int n_items = 10000;
+    BlockingBody(concurrent_priority_queue<int, std::less<int> > &q, int producers, size_t capacity, tbb::atomic<long> &sum) :
+        my_q(q), my_producers(producers), my_capacity(capacity), my_sum(sum) {}
+    void operator()(int id) const {
+        if (id < my_producers) {
+            for (int i=0; i<n_items; ++i) {
+                my_q.push(i);
+                ASSERT(my_q.size()<=my_capacity, "FAILED: the queue holds more elements than its capacity.");
+            }
+        } else {
+            long sum = 0;
+            int e;
+            for (int i=0; i<n_items; ++i) {
+                my_q.pop(e);
+                sum += e;
+            }
+            my_sum += sum;
+        }
+    }
+};
+
+//! Producers fill a small queue while consumers empty it, both threads block in push and pop
+void TestBlockingPushPop(int nThreads) {
+    REMARK("Testing blocking push and pop.\n");
+    const size_t capacities[] = {1, 4, 100};
+    for (size_t c=0; c<sizeof(capacities)/sizeof(capacities[0]); ++c) {
+        concurrent_priority_queue<int, std::less<int> > q;
+        q.set_capacity(capacities[c]);
+        tbb::atomic<long> sum;
+        sum = 0;
+        NativeParallelFor(2*nThreads, BlockingBody(q, nThreads, capacities[c], sum));
+        ASSERT(q.empty(), "FAILED: elements are left in the queue.");
+        ASSERT(sum==long(nThreads)*(BlockingBody::n_items-1)*BlockingBody::n_items/2, "FAILED: elements are lost.");
+    }
+}
+
+class FirstWaitBody : NoAssign {
+    concurrent_priority_queue<int, std::less<int> > &my_q;
+    const int my_item;
+public:
+    FirstWaitBody(concurrent_priority_queue<int, std::less<int> > &q, int item) : my_q(q), my_item(item) {}
+    void operator()(int id) const {
+        if (id) {
+            // vary the moment of the push relative to the first wait of the pop
+            for (int i=0; i<my_item%64; ++i)
+                __TBB_Pause(1);
+            my_q.push(my_item);
+        } else {
+            int e;
+            my_q.pop(e);
+            ASSERT(e==my_item, "FAILED: a wrong element is popped.");
+        }
+    }
+};
+
+//! A pop blocks on a fresh queue, whose monitor is not allocated yet, while a push races it
+void TestFirstWait() {
+    REMARK("Testing the first wait on a queue.\n");
+    for (int i=0; i<2000; ++i) {
+        concurrent_priority_queue<int, std::less<int> > q;
+        NativeParallelFor(2, FirstWaitBody(q, i));
+        ASSERT(q.empty(), NULL);
+    }
+}
+
+#if TBB_USE_EXCEPTIONS
+class AbortBody : NoAssign {
+    concurrent_priority_queue<int, std::less<int> > &my_q;
+    const int my_waiters;
+    tbb::atomic<int> &my_aborted;
+public:
+    AbortBody(concurrent_priority_queue<int, std::less<int> > &q, int waiters, tbb::atomic<int> &aborted) :
+        my_q(q), my_waiters(waiters), my_aborted(aborted) {}
+    void operator()(int id) const {
+        if (id == my_waiters) {
+            // a waiter may come after an abort, so abort until all of them are gone
+            while (my_aborted < my_waiters) {
+                Harness::Sleep(10);
+                my_q.abort();
+            }
+            return;
+        }
+        try {
+            if (id % 2) {
+                int e;
+                my_q.pop(e);
+            } else {
+                my_q.push(42);
+            }
+        } catch (tbb::user_abort&) {
+            ++my_aborted;
+            return;
+        }
+        ASSERT(false, "FAILED: the operation must be aborted.");
+    }
+};
+
+void TestAbort(int nThreads) {
+    REMARK("Testing abort.\n");
+    concurrent_priority_queue<int, std::less<int> > q;
+    q.abort(); // nobody waits yet
+    q.set_capacity(0);
+    tbb::atomic<int> aborted;
+    aborted = 0;
+    // odd threads wait in pop of the empty queue, even threads in push to the full queue
+    NativeParallelFor(nThreads+1, AbortBody(q, nThreads, aborted));
+    ASSERT(aborted==nThreads, "FAILED: all the waiting threads must be aborted.");
+    ASSERT(q.empty(), "FAILED: an aborted push must not add an element.");
+    q.set_capacity(1);
+    q.push(1);
+    int e;
+    q.pop(e);
+    ASSERT(e==1, "FAILED: the queue must be usable after abort.");
+}
+#endif /* TBB_USE_EXCEPTIONS */
+
 void TestCpqOnNThreads( int nThreads ) {
     std::less<int> int_compare;
     my_less data_compare;
@@ -834,6 +987,8 @@ void TestCpqOnNThreads( int nThreads ) {
     TestFlogger( nThreads, INT_MAX, int_compare );
     TestFlogger( nThreads, (unsigned char)CHAR_MAX, int_compare );
     TestFlogger( nThreads, DATA_MAX, data_compare );
+    TestBlockingPushPop( nThreads );
+    TestFirstWait();
 #if __TBB_CPP11_RVALUE_REF_PRESENT
     MoveOperationTracker::copy_assignment_called_times = 0;
     TestFlogger( nThreads, MoveOperationTracker(), std::less<MoveOperationTracker>() );
@@ -842,6 +997,7 @@ void TestCpqOnNThreads( int nThreads ) {
 
 #if TBB_USE_EXCEPTIONS && !__TBB_THROW_ACROSS_MODULE_BOUNDARY_BROKEN
     TestExceptions();
+    TestAbort( nThreads );
 #else
     REPORT( "Known issue: exception handling tests are skipped.\n" );
 #endif
@@ -1069,6 +1225,7 @@ int TestMain() {
 #endif
 
     TestTypes();
+    TestCapacity();
 
 #if __TBB_CPP11_RVALUE_REF_PRESENT
     TestgMoveConstructor();
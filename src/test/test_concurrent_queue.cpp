@@ -26,6 +26,7 @@
 #include "harness_allocator.h"
 
 #include <vector>
+#include <algorithm>
 
 static tbb::atomic<long> FooConstructed;
 static tbb::atomic<long> FooDestroyed;
@@ -1669,6 +1670,130 @@ void TestTypes() {
 #endif /* __TBB_CPP11_SMART_POINTERS_PRESENT */
 }
 
+template<typename CQ>
+void TestBatchesSerial() {
+    Foo::clear_counters();
+    {
+        CQ q;
+        std::vector<Foo> src( 100 ), dst;
+        for( int i=0; i<100; ++i )
+            src[i].serial = i;
+        q.push_range( src.begin(), src.begin() );
+        ASSERT( q.empty(), "empty range must not push" );
+        q.push_range( src.begin(), src.end() );
+        Foo f;
+        f.serial = 100;
+        q.push( f );
+        ASSERT( q.try_pop_many( std::back_inserter(dst), 0 )==0, NULL );
+        ASSERT( q.try_pop_many( std::back_inserter(dst), 30 )==30 && dst.size()==30, "wrong number of items popped" );
+        ASSERT( q.try_pop_many( std::back_inserter(dst), 1000 )==71 && dst.size()==101, "wrong number of items popped" );
+        ASSERT( q.empty() && q.try_pop_many( std::back_inserter(dst), 10 )==0, "empty queue must not pop" );
+        for( int i=0; i<101; ++i )
+            ASSERT( dst[i].serial==i, "items must be popped in order" );
+        // The output iterator can be a plain array
+        q.push_range( src.begin(), src.begin()+10 );
+        Foo array[10];
+        ASSERT( q.try_pop_many( array, 10 )==10 && array[9].serial==9 && q.empty(), NULL );
+    }
+    ASSERT( Foo::get_n_constructed()==Foo::get_n_destroyed(), "items leaked" );
+}
+
+template<typename CQ>
+struct BatchBody: NoAssign {
+    CQ& my_queue;
+    const int my_producers;
+    const int my_items;
+    tbb::atomic<long>& my_popped;
+    BatchBody( CQ& q, int producers, int items, tbb::atomic<long>& popped ) :
+        my_queue(q), my_producers(producers), my_items(items), my_popped(popped) {}
+    void operator()( int id ) const {
+        std::vector<Foo> batch;
+        if( id<my_producers ) {
+            for( int i=0; i<my_items; ) {
+                batch.resize( std::min( 1 + (i*7+id)%64, my_items-i ) );
+                for( size_t j=0; j<batch.size(); ++j ) {
+                    batch[j].thread_id = id;
+                    batch[j].serial = i++;
+                }
+                my_queue.push_range( batch.begin(), batch.end() );
+            }
+        } else {
+            std::vector<int> last( my_producers, -1 );
+            for( long total = long(my_producers)*my_items; my_popped<total; ) {
+                batch.clear();
+                size_t n = my_queue.try_pop_many( std::back_inserter(batch), 1 + id%50 );
+                ASSERT( n==batch.size(), NULL );
+                for( size_t j=0; j<n; ++j ) {
+                    ASSERT( 0<=batch[j].thread_id && batch[j].thread_id<my_producers, NULL );
+                    ASSERT( batch[j].serial>last[batch[j].thread_id], "items of a producer must be popped in order" );
+                    last[batch[j].thread_id] = batch[j].serial;
+                }
+                if( n )
+                    my_popped += long(n);
+                else
+                    __TBB_Yield();
+            }
+        }
+    }
+};
+
+template<typename CQ>
+void TestBatchesConcurrent( CQ& q, int producers, int consumers ) {
+    const int items = 5000;
+    tbb::atomic<long> popped;
+    popped = 0;
+    NativeParallelFor( producers+consumers, BatchBody<CQ>( q, producers, items, popped ) );
+    ASSERT( popped==long(producers)*items && q.empty(), "items are lost" );
+}
+
+#if TBB_USE_EXCEPTIONS
+template<typename CQ>
+void TestBatchException() {
+    FooExConstructed = FooExDestroyed = 0;
+    {
+        CQ q;
+        std::vector<FooEx> src( 10 ), dst;
+        for( int i=0; i<10; ++i )
+            src[i].serial = i;
+        // The 5th copy throws; the items left of the range are not pushed
+        MaxFooCount = 15;
+        bool thrown = false;
+        try {
+            q.push_range( src.begin(), src.end() );
+        } catch( Foo_exception& ) {
+            thrown = true;
+        }
+        MaxFooCount = 0;
+        ASSERT( thrown, "the exception must be propagated" );
+        ASSERT( q.try_pop_many( std::back_inserter(dst), 100 )==4 && q.empty(), "only the items copied must be popped" );
+        for( int i=0; i<4; ++i )
+            ASSERT( dst[i].serial==i, NULL );
+        q.push_range( src.begin(), src.end() );
+        ASSERT( q.try_pop_many( std::back_inserter(dst), 100 )==10, "the queue must work after the exception" );
+    }
+    ASSERT( FooExConstructed==FooExDestroyed+1, "items leaked" ); // the throwing copy is not destroyed
+}
+#endif /* TBB_USE_EXCEPTIONS */
+
+void TestBatches() {
+    REMARK("Testing push_range and try_pop_many\n");
+    TestBatchesSerial<tbb::concurrent_queue<Foo> >();
+    TestBatchesSerial<tbb::concurrent_bounded_queue<Foo> >();
+#if TBB_USE_EXCEPTIONS
+    TestBatchException<tbb::concurrent_queue<FooEx> >();
+    TestBatchException<tbb::concurrent_bounded_queue<FooEx> >();
+#endif
+    for( int p=MinThread<1 ? 1 : MinThread; p<=MaxThread; ++p ) {
+        tbb::concurrent_queue<Foo> q;
+        TestBatchesConcurrent( q, p, p );
+        tbb::concurrent_bounded_queue<Foo> bq;
+        TestBatchesConcurrent( bq, p, 1 );
+        // Batches exceed the capacity, so producers wait in the middle of a batch
+        bq.set_capacity( 10 );
+        TestBatchesConcurrent( bq, p, p );
+    }
+}
+
 int TestMain () {
     TestEmptiness();
 
@@ -1703,5 +1828,7 @@ int TestMain () {
 
     TestTypes();
 
+    TestBatches();
+
     return Harness::Done;
 }
@@ -0,0 +1,261 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#define TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE 1
+#include "tbb/concurrent_relaxed_priority_queue.h"
+#include "tbb/atomic.h"
+#include "harness.h"
+#include <vector>
+#include <algorithm>
+
+//! Item which counts its instances and can throw from the copy constructor
+class Item {
+    int my_priority;
+public:
+    static tbb::atomic<long> instances;
+    static tbb::atomic<long> copies_before_throw;
+
+    Item() : my_priority(-1) { ++instances; }
+    explicit Item( int priority ) : my_priority(priority) { ++instances; }
+    Item( const Item &item ) : my_priority(item.my_priority) {
+#if TBB_USE_EXCEPTIONS
+        if( copies_before_throw > 0 && --copies_before_throw == 0 )
+            throw 42;
+#endif
+        ++instances;
+    }
+    ~Item() { --instances; }
+    int priority() const { return my_priority; }
+    bool operator<( const Item &item ) const { return my_priority < item.my_priority; }
+};
+
+tbb::atomic<long> Item::instances;
+tbb::atomic<long> Item::copies_before_throw;
+
+typedef tbb::concurrent_relaxed_priority_queue<Item> queue_type;
+
+const size_t n_heaps = queue_type::heaps_per_thread * tbb::task_scheduler_init::default_num_threads();
+
+void TestSerial() {
+    REMARK("testing serial operations\n");
+    const int n = 10000;
+    {
+        std::vector<int> priorities;
+        for( int i = 0; i < n; ++i )
+            priorities.push_back( i );
+        std::random_shuffle( priorities.begin(), priorities.end() );
+
+        queue_type q;
+        ASSERT( q.empty() && q.size() == 0, NULL );
+        Item item;
+        ASSERT( !q.try_pop( item ), "empty queue must not pop" );
+        for( int i = 0; i < n; ++i )
+            q.push( Item( priorities[i] ) );
+        ASSERT( q.size() == size_t(n) && !q.empty(), NULL );
+
+        // the popped elements must be close to the top of the queue
+        std::vector<bool> popped( n, false );
+        int top = n-1;
+        size_t total_rank = 0;
+        for( int i = 0; i < n; ++i ) {
+            ASSERT( q.try_pop( item ), "non-empty queue must pop" );
+            int p = item.priority();
+            ASSERT( 0 <= p && p < n && !popped[p], "an element is popped twice" );
+            popped[p] = true;
+            total_rank += top - p;
+            while( top >= 0 && popped[top] )
+                --top;
+            ASSERT( q.size() == size_t(n-i-1), NULL );
+        }
+        ASSERT( !q.try_pop( item ) && q.empty(), NULL );
+        REMARK("average rank of the popped elements is %g with %d heaps\n", double(total_rank)/n, int(n_heaps));
+        ASSERT( total_rank <= 4*n_heaps*n, "the ordering is too relaxed" );
+
+        for( int i = 0; i < 100; ++i )
+            q.push( item );
+        ASSERT( Item::instances == 101, NULL );
+        q.clear();
+        ASSERT( q.empty() && Item::instances == 1, "clear must destroy the elements" );
+        q.push( item );
+    }
+    ASSERT( Item::instances == 0, "the destructor must destroy the elements" );
+}
+
+void TestConstructors() {
+    REMARK("testing constructors\n");
+    std::vector<Item> items;
+    for( int i = 0; i < 1000; ++i )
+        items.push_back( Item( i%100 ) );
+    {
+        queue_type q( items.begin(), items.end() );
+        ASSERT( q.size() == items.size(), NULL );
+        std::vector<int> counts( 100, 0 );
+        Item item;
+        while( q.try_pop( item ) )
+            ++counts[item.priority()];
+        for( int i = 0; i < 100; ++i )
+            ASSERT( counts[i] == 10, "the elements of the range must be popped" );
+        queue_type q2( 1000 );
+        ASSERT( q2.empty(), "the reserved capacity must not add elements" );
+        q2.push( item );
+        ASSERT( q2.size() == 1, NULL );
+    }
+    items.clear();
+    ASSERT( Item::instances == 0, NULL );
+#if __TBB_INITIALIZER_LISTS_PRESENT
+    tbb::concurrent_relaxed_priority_queue<int> q = { 3, 1, 2 };
+    ASSERT( q.size() == 3, NULL );
+    int sum = 0, e;
+    while( q.try_pop( e ) )
+        sum += e;
+    ASSERT( sum == 6, NULL );
+#endif
+}
+
+class ProducerConsumerBody : NoAssign {
+    tbb::concurrent_relaxed_priority_queue<int> &my_queue;
+    const int my_producers;
+    const int my_items;
+    tbb::atomic<int> &my_popped;
+    tbb::atomic<char> *my_seen;
+public:
+    ProducerConsumerBody( tbb::concurrent_relaxed_priority_queue<int> &q, int producers, int items,
+                          tbb::atomic<int> &popped, tbb::atomic<char> *seen )
+        : my_queue(q), my_producers(producers), my_items(items), my_popped(popped), my_seen(seen) {}
+    void operator()( int id ) const {
+        if( id < my_producers ) {
+            for( int i = id; i < my_producers*my_items; i += my_producers )
+                my_queue.push( i );
+        } else {
+            int e;
+            while( my_popped < my_producers*my_items ) {
+                if( !my_queue.try_pop( e ) ) {
+                    __TBB_Yield();
+                    continue;
+                }
+                ASSERT( 0 <= e && e < my_producers*my_items, NULL );
+                ASSERT( my_seen[e].fetch_and_increment() == 0, "an element is popped twice" );
+                ++my_popped;
+            }
+        }
+    }
+};
+
+void TestProducersConsumers( int producers, int consumers ) {
+    REMARK("testing %d producers and %d consumers\n", producers, consumers);
+    const int items = 20000;
+    std::vector<tbb::atomic<char> > seen( producers*items );
+    for( size_t i = 0; i < seen.size(); ++i )
+        seen[i] = 0;
+    tbb::atomic<int> popped;
+    popped = 0;
+    tbb::concurrent_relaxed_priority_queue<int> q;
+    NativeParallelFor( producers+consumers, ProducerConsumerBody( q, producers, items, popped, &seen[0] ) );
+    ASSERT( popped == producers*items && q.empty(), "elements are lost" );
+}
+
+#if TBB_USE_EXCEPTIONS
+void TestExceptions() {
+    REMARK("testing exception safety\n");
+    {
+        queue_type q;
+        for( int i = 0; i < 10; ++i ) {
+            Item item( i );
+            Item::copies_before_throw = i == 5 ? 1 : 0;
+            bool thrown = false;
+            try {
+                q.push( item );
+            } catch( int ) {
+                thrown = true;
+            }
+            ASSERT( thrown == (i == 5), NULL );
+        }
+        Item::copies_before_throw = 0;
+        ASSERT( q.size() == 9, "the failed push must not add an element" );
+        Item item;
+        int sum = 0;
+        while( q.try_pop( item ) )
+            sum += item.priority();
+        ASSERT( sum == 45-5, NULL );
+
+        std::vector<Item> items( 10, Item( 1 ) );
+        Item::copies_before_throw = 7;
+        bool thrown = false;
+        try {
+            queue_type q2( items.begin(), items.end() );
+        } catch( int ) {
+            thrown = true;
+        }
+        Item::copies_before_throw = 0;
+        ASSERT( thrown, NULL );
+    }
+    ASSERT( Item::instances == 0, "the elements must be destroyed after the failures" );
+}
+#endif /* TBB_USE_EXCEPTIONS */
+
+#if __TBB_CPP11_RVALUE_REF_PRESENT && __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
+//! Element which can only be moved
+class MoveOnly {
+    int my_priority;
+    MoveOnly( const MoveOnly& );
+    MoveOnly& operator=( const MoveOnly& );
+public:
+    MoveOnly() : my_priority(-1) {}
+    MoveOnly( int priority, int bonus ) : my_priority(priority+bonus) {}
+    MoveOnly( MoveOnly &&src ) : my_priority(src.my_priority) { src.my_priority = -1; }
+    MoveOnly& operator=( MoveOnly &&src ) { my_priority = src.my_priority; src.my_priority = -1; return *this; }
+    int priority() const { return my_priority; }
+    bool operator<( const MoveOnly &src ) const { return my_priority < src.my_priority; }
+};
+
+void TestMoveOnly() {
+    REMARK("testing move-only elements\n");
+    tbb::concurrent_relaxed_priority_queue<MoveOnly> q;
+    for( int i = 0; i < 100; ++i ) {
+        if( i%2 )
+            q.emplace( i, 1 );
+        else
+            q.push( MoveOnly( i, 1 ) );
+    }
+    MoveOnly e;
+    int sum = 0;
+    while( q.try_pop( e ) )
+        sum += e.priority();
+    ASSERT( sum == 99*100/2 + 100, NULL );
+}
+#endif /* __TBB_CPP11_RVALUE_REF_PRESENT && __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT */
+
+int TestMain() {
+    if( MinThread < 1 ) MinThread = 1;
+    TestSerial();
+    TestConstructors();
+#if TBB_USE_EXCEPTIONS
+    TestExceptions();
+#endif
+#if __TBB_CPP11_RVALUE_REF_PRESENT && __TBB_CPP11_VARIADIC_TEMPLATES_PRESENT
+    TestMoveOnly();
+#endif
+    for( int p = MinThread; p <= MaxThread; ++p ) {
+        TestProducersConsumers( p, 1 );
+        TestProducersConsumers( 1, p );
+        TestProducersConsumers( p, p );
+    }
+    return Harness::Done;
+}
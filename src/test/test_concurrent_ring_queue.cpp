@@ -0,0 +1,201 @@
+/*
+    Copyright 2005-2015 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks. Threading Building Blocks is free software;
+    you can redistribute it and/or modify it under the terms of the GNU General Public License
+    version 2  as  published  by  the  Free Software Foundation.  Threading Building Blocks is
+    distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+    implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See  the GNU General Public License for more details.   You should have received a copy of
+    the  GNU General Public License along with Threading Building Blocks; if not, write to the
+    Free Software Foundation, Inc.,  51 Franklin St,  Fifth Floor,  Boston,  MA 02110-1301 USA
+
+    As a special exception,  you may use this file  as part of a free software library without
+    restriction.  Specifically,  if other files instantiate templates  or use macros or inline
+    functions from this file, or you compile this file and link it with other files to produce
+    an executable,  this file does not by itself cause the resulting executable to be covered
+    by the GNU General Public License. This exception does not however invalidate any other
+    reasons why the executable file might be covered by the GNU General Public License.
+*/
+
+#define TBB_PREVIEW_CONCURRENT_RING_QUEUE 1
+#include "tbb/concurrent_ring_queue.h"
+#include "tbb/atomic.h"
+#include "harness.h"
+#include "harness_allocator.h"
+#include <vector>
+
+//! Item which counts its instances and can throw from the copy constructor
+class Item {
+    long my_producer, my_serial;
+public:
+    static tbb::atomic<long> instances;
+    static tbb::atomic<long> copies_before_throw;
+
+    Item() : my_producer(-1), my_serial(-1) { ++instances; }
+    Item( long producer, long serial ) : my_producer(producer), my_serial(serial) { ++instances; }
+    Item( const Item &item ) : my_producer(item.my_producer), my_serial(item.my_serial) {
+#if TBB_USE_EXCEPTIONS
+        if( copies_before_throw > 0 && --copies_before_throw == 0 )
+            throw 42;
+#endif
+        ++instances;
+    }
+    ~Item() { --instances; }
+    long producer() const { return my_producer; }
+    long serial() const { return my_serial; }
+};
+
+tbb::atomic<long> Item::instances;
+tbb::atomic<long> Item::copies_before_throw;
+
+template<tbb::ring_queue_kind Kind>
+void TestSerial() {
+    typedef tbb::concurrent_ring_queue<Item, Kind> queue_type;
+    REMARK("testing serial operations, kind %d\n", int(Kind));
+    {
+        queue_type q( 5 );
+        ASSERT( q.capacity() == 8, "capacity must be rounded up to a power of two" );
+        ASSERT( q.empty() && q.size() == 0, NULL );
+        Item item;
+        ASSERT( !q.try_pop( item ), "empty queue must not pop" );
+        for( int r = 0; r < 3; r++ ) {
+            for( long i = 0; i < 8; i++ )
+                ASSERT( q.try_push( Item( 0, i ) ), NULL );
+            ASSERT( q.size() == 8 && !q.try_push( Item( 0, 8 ) ), "full queue must not push" );
+            for( long i = 0; i < 5; i++ ) {
+                q.pop( item );
+                ASSERT( item.serial() == i, "items must be popped in order" );
+            }
+            ASSERT( q.size() == 3, NULL );
+            for( long i = 8; i < 13; i++ )
+                q.push( Item( 0, i ) );
+            for( long i = 5; i < 13; i++ ) {
+                ASSERT( q.try_pop( item ) && item.serial() == i, "items must be popped in order" );
+            }
+            ASSERT( q.empty(), NULL );
+        }
+        for( long i = 0; i < 6; i++ )
+            q.push( Item( 0, i ) );
+        ASSERT( Item::instances == 7, NULL );
+        q.clear();
+        ASSERT( q.empty() && Item::instances == 1, "clear must destroy the items" );
+        q.push( item );
+        q.push( item );
+    }
+    ASSERT( Item::instances == 0, "the destructor must destroy the items" );
+}
+
+template<typename Queue>
+class ProducerConsumerBody : NoAssign {
+    Queue &my_queue;
+    const int my_producers;
+    const long my_items;
+    tbb::atomic<long> &my_popped;
+public:
+    ProducerConsumerBody( Queue &q, int producers, long items, tbb::atomic<long> &popped )
+        : my_queue(q), my_producers(producers), my_items(items), my_popped(popped) {}
+    void operator()( int id ) const {
+        if( id < my_producers ) {
+            for( long i = 0; i < my_items; i++ ) {
+                Item item( id, i );
+                if( i % 2 )
+                    my_queue.push( item );
+                else
+                    while( !my_queue.try_push( item ) ) __TBB_Yield();
+            }
+        } else {
+            std::vector<long> last( my_producers, -1 );
+            Item item;
+            for( long total = my_producers*my_items; my_popped < total; ) {
+                if( !my_queue.try_pop( item ) ) {
+                    __TBB_Yield();
+                    continue;
+                }
+                ASSERT( 0 <= item.producer() && item.producer() < my_producers, NULL );
+                ASSERT( item.serial() > last[item.producer()], "items of a producer must be popped in order" );
+                last[item.producer()] = item.serial();
+                ++my_popped;
+            }
+        }
+    }
+};
+
+template<tbb::ring_queue_kind Kind>
+void TestProducersConsumers( int producers, int consumers ) {
+    typedef tbb::concurrent_ring_queue<Item, Kind> queue_type;
+    REMARK("testing %d producers and %d consumers, kind %d\n", producers, consumers, int(Kind));
+    const long items = 20000;
+    tbb::atomic<long> popped;
+    popped = 0;
+    {
+        queue_type q( 16 );
+        NativeParallelFor( producers+consumers, ProducerConsumerBody<queue_type>( q, producers, items, popped ) );
+        ASSERT( popped == producers*items && q.empty(), "items are lost" );
+    }
+    ASSERT( Item::instances == 0, NULL );
+}
+
+#if TBB_USE_EXCEPTIONS
+template<tbb::ring_queue_kind Kind>
+void TestExceptions() {
+    typedef tbb::concurrent_ring_queue<Item, Kind> queue_type;
+    REMARK("testing exception safety, kind %d\n", int(Kind));
+    {
+        queue_type q( 4 );
+        Item item;
+        for( long i = 0; i < 4; i++ ) {
+            Item::copies_before_throw = i == 1 ? 1 : 0;
+            bool thrown = false;
+            try {
+                q.try_push( Item( 0, i ) );
+            } catch( int ) {
+                thrown = true;
+            }
+            ASSERT( thrown == (i == 1), NULL );
+        }
+        Item::copies_before_throw = 0;
+        // the position of the failed push is skipped, it does not take a slot for long
+        ASSERT( q.try_pop( item ) && item.serial() == 0, NULL );
+        ASSERT( q.try_pop( item ) && item.serial() == 2, "the failed item must be skipped" );
+        ASSERT( q.try_pop( item ) && item.serial() == 3, NULL );
+        ASSERT( !q.try_pop( item ), NULL );
+        for( long i = 0; i < 4; i++ )
+            ASSERT( q.try_push( Item( 0, i ) ), "slots must be reused after the failure" );
+    }
+    ASSERT( Item::instances == 0, NULL );
+}
+#endif /* TBB_USE_EXCEPTIONS */
+
+void TestAllocator() {
+    typedef local_counting_allocator<std::allocator<Item> > allocator_type;
+    typedef tbb::concurrent_ring_queue<Item, tbb::ring_queue_mpmc, allocator_type> queue_type;
+    REMARK("testing allocations\n");
+    queue_type q( 100 );
+    ASSERT( q.capacity() == 128, NULL );
+    Item item;
+    for( long i = 0; i < 10000; i++ ) {
+        q.push( Item( 0, i ) );
+        q.pop( item );
+    }
+    allocator_type a = q.get_allocator();
+    ASSERT( a.allocations == 1 && a.frees == 0, "memory must be allocated only on construction" );
+}
+
+int TestMain() {
+    if( MinThread < 1 ) MinThread = 1;
+    TestSerial<tbb::ring_queue_mpmc>();
+    TestSerial<tbb::ring_queue_spsc>();
+    TestProducersConsumers<tbb::ring_queue_spsc>( 1, 1 );
+#if TBB_USE_EXCEPTIONS
+    TestExceptions<tbb::ring_queue_mpmc>();
+    TestExceptions<tbb::ring_queue_spsc>();
+#endif
+    TestAllocator();
+    for( int p = MinThread; p <= MaxThread; ++p ) {
+        TestProducersConsumers<tbb::ring_queue_mpmc>( p, 1 );
+        TestProducersConsumers<tbb::ring_queue_mpmc>( 1, p );
+        TestProducersConsumers<tbb::ring_queue_mpmc>( p, p );
+    }
+    return Harness::Done;
+}
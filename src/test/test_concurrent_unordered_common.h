@@ -20,6 +20,7 @@
 
 /* Some tests in this source file are based on PPL tests provided by Microsoft. */
 #include "tbb/parallel_for.h"
+#include "tbb/task_scheduler_init.h"
 #include "tbb/tick_count.h"
 #include "harness.h"
 #include "test_container_move_support.h"
@@ -41,13 +42,14 @@ inline void CheckAllocator(MyTable &table, size_t expected_allocs, size_t expect
     typename MyTable::allocator_type a = table.get_allocator();
     REMARK("#%d checking allocators: items %u/%u, allocs %u/%u\n", line,
         unsigned(a.items_allocated), unsigned(a.items_freed), unsigned(a.allocations), unsigned(a.frees) );
-    ASSERT( a.items_allocated == a.allocations, NULL); ASSERT( a.items_freed == a.frees, NULL);
+    // nodes are allocated by chunks, so the expected numbers are of items; every item left is a separate allocation
     if(exact) {
-        ASSERT( a.allocations == expected_allocs, NULL); ASSERT( a.frees == expected_frees, NULL);
+        ASSERT( a.items_allocated == expected_allocs, NULL); ASSERT( a.items_freed == expected_frees, NULL);
     } else {
-        ASSERT( a.allocations >= expected_allocs, NULL); ASSERT( a.frees >= expected_frees, NULL);
-        ASSERT( a.allocations - a.frees == expected_allocs - expected_frees, NULL );
+        ASSERT( a.items_allocated >= expected_allocs, NULL); ASSERT( a.items_freed >= expected_frees, NULL);
     }
+    ASSERT( a.items_allocated - a.items_freed == expected_allocs - expected_frees, NULL );
+    ASSERT( a.allocations - a.frees == expected_allocs - expected_frees, NULL );
 }
 
 template<typename T>
@@ -665,6 +667,141 @@ void test_concurrent(const char *tablename, bool asymptotic = false) {
     }
 }
 
+template<typename T>
+class EraseBody: NoAssign {
+    T &table;
+    const int items, threads;
+public:
+    EraseBody( T &t, int i, int n ) : table(t), items(i), threads(n) {}
+    void operator()( int thread ) const {
+        const size_t copies = T::allow_multimapping ? 2 : 1;
+        for( int round = 0; round < 4; round++ ) {
+            // each thread inserts and erases its own keys, and looks up the keys of others
+            for( int k = thread; k < items; k += threads ) {
+                for( size_t c = 0; c < copies; c++ )
+                    table.insert( Value<T>::make(k) );
+                ASSERT( table.count(k) == copies, "inserted item is not found" );
+                // items erased concurrently must not be accessed, so only their number is checked
+                ASSERT( table.count( (k*7 + round) % items ) <= copies, NULL );
+                if( round < 3 || k % 3 )
+                    ASSERT( table.erase(k) == copies, "wrong number of erased items" );
+                ASSERT( (round == 3 && k % 3 == 0) || table.find(k) == table.end(), "erased item is found" );
+            }
+        }
+    }
+};
+
+template<typename T>
+void test_concurrent_erase(const char *tablename) {
+#if TBB_USE_ASSERT
+    const int items = 2000;
+#else
+    const int items = 20000;
+#endif
+    const int nThreads = 8;
+    const size_t copies = T::allow_multimapping ? 2 : 1;
+    REMARK("testing concurrent erase of %s\n", tablename);
+    // TBB worker threads do not register their operations, unlike native threads
+    for( int on_workers = 0; on_workers < 2; on_workers++ ) {
+        T table;
+        ASSERT( !table.concurrent_erase_enabled(), "concurrent erase must be opt-in" );
+        // without concurrent erase, erase() destroys the elements at once
+        table.insert( Value<T>::make(1) );
+        ASSERT( table.erase(1) == 1 && table.erase(1) == 0 && table.empty(), NULL );
+        table.enable_concurrent_erase();
+        ASSERT( table.concurrent_erase_enabled(), NULL );
+        if( on_workers ) {
+            tbb::task_scheduler_init init( nThreads );
+            tbb::parallel_for( 0, nThreads, EraseBody<T>(table, items, nThreads) );
+        } else
+            NativeParallelFor( nThreads, EraseBody<T>(table, items, nThreads) );
+        ASSERT( table.size() == copies * ((items+2)/3), "wrong size after concurrent erase" );
+        for( typename T::iterator it = table.begin(); it != table.end(); ++it ) {
+            int k = Value<T>::key(*it);
+            ASSERT( k % 3 == 0, "erased item is in the table" );
+        }
+        for( int k = 0; k < items; k++ )
+            ASSERT( table.count(k) == (k % 3 ? 0 : copies), NULL );
+        table.clear();
+        CheckAllocatorA(table, 1, 0); // only the dummy head is left, erased items are reclaimed
+    }
+}
+
+template<typename T>
+class GuardedLookupBody: NoAssign {
+    T &table;
+    const int items;
+public:
+    GuardedLookupBody( T &t, int i ) : table(t), items(i) {}
+    void operator()( int thread ) const {
+        if( thread % 2 ) {
+            // erased nodes are reused soon, so an element destroyed too early would change;
+            // all these threads erase and insert the same odd keys
+            for( int round = 0; round < 20; round++ )
+                for( int k = 1; k < items; k += 2 ) {
+                    table.erase(k);
+                    table.insert( Value<T>::make(k) );
+                }
+        } else {
+            for( int round = 0; round < 20; round++ )
+                for( int k = 1; k < items; k += 2 ) {
+                    typename T::lookup_guard guard( table );
+                    typename T::iterator it = table.find(k);
+                    if( it == table.end() )
+                        continue;
+                    ASSERT( Value<T>::key(*it) == k, NULL );
+                    if( k % 16 == 1 )
+                        __TBB_Yield(); // let the erasing threads run while the element is accessed
+                    ASSERT( Value<T>::key(*it) == k && Value<T>::get(*it) == k, "guarded element is destroyed" );
+                    // the range itself is not stable under concurrent erasure, so only its first element is checked
+                    std::pair<typename T::iterator, typename T::iterator> range = table.equal_range(k);
+                    if( range.first != range.second )
+                        ASSERT( Value<T>::key(*range.first) == k && Value<T>::get(*range.first) == k, "guarded element is destroyed" );
+                }
+        }
+    }
+};
+
+//! Lookups on native threads dereference the found elements while other threads erase them
+template<typename T>
+void test_guarded_lookups(const char *tablename) {
+    const int items = 1000;
+    const int nThreads = 4;
+    REMARK("testing guarded lookups concurrent with erase of %s\n", tablename);
+    T table;
+    table.enable_concurrent_erase();
+    for( int k = 0; k < items; k++ )
+        table.insert( Value<T>::make(k) );
+    NativeParallelFor( nThreads, GuardedLookupBody<T>(table, items) );
+    // each key is inserted last by every thread which erases it
+    for( int k = 0; k < items; k++ )
+        ASSERT( table.count(k) == 1 || (T::allow_multimapping && table.count(k) > 1), NULL );
+    table.clear();
+    CheckAllocatorA(table, 1, 0);
+}
+
+template<typename T>
+void test_node_pool(const char *tablename) {
+    const int items = 10000;
+    REMARK("testing node pool of %s\n", tablename);
+    T table;
+    for( int i = 0; i < items; i++ )
+        table.insert( Value<T>::make(i) );
+    typename T::allocator_type a = table.get_allocator();
+    ASSERT( a.items_allocated > size_t(items), NULL );
+    ASSERT( a.allocations < 32, "element and dummy nodes are not allocated by chunks" );
+    for( int i = 0; i < items; i += 2 )
+        table.unsafe_erase(i);
+    for( int i = 0; i < items; i += 2 )
+        table.insert( Value<T>::make(i) );
+    ASSERT( table.get_allocator().allocations == a.allocations, "nodes of erased elements are not reused" );
+    ASSERT( table.size() == size_t(items), NULL );
+    for( int i = 0; i < items; i++ )
+        ASSERT( table.count(i) == 1, NULL );
+    table.clear();
+    CheckAllocatorA(table, 1, 0); // all the chunks are freed, only the dummy head is left
+}
+
 // The helper to call a function only when a doCall == true.
 template <bool doCall> struct CallIf {
     template<typename FuncType> void operator() ( FuncType func ) const { func(); }
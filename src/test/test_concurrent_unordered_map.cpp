@@ -302,6 +302,15 @@ int TestMain() {
     { Check<MyCheckedMultiMap::value_type> checkit; test_basic<MyCheckedMultiMap>( "concurrent unordered MultiMap (checked)" ); }
     { Check<MyCheckedMultiMap::value_type> checkit; test_concurrent<MyCheckedMultiMap>( "concurrent unordered MultiMap (checked)" ); }
 
+    test_concurrent_erase<MyMap>( "concurrent unordered Map" );
+    test_concurrent_erase<MyMultiMap>( "concurrent unordered MultiMap" );
+    test_guarded_lookups<MyMap>( "concurrent unordered Map" );
+    test_guarded_lookups<MyMultiMap>( "concurrent unordered MultiMap" );
+    test_node_pool<MyMap>( "concurrent unordered Map" );
+    test_node_pool<MyMultiMap>( "concurrent unordered MultiMap" );
+    { Check<MyCheckedMap::value_type> checkit; test_concurrent_erase<MyCheckedMap>( "concurrent unordered map (checked)" ); }
+    { Check<MyCheckedMap::value_type> checkit; test_guarded_lookups<MyCheckedMap>( "concurrent unordered map (checked)" ); }
+
 #if __TBB_INITIALIZER_LISTS_PRESENT
     TestInitList< tbb::concurrent_unordered_map<int, int>,
                   tbb::concurrent_unordered_multimap<int, int> >( {{1,1},{2,2},{3,3},{4,4},{5,5}} );
@@ -210,6 +210,15 @@ int TestMain() {
     { Check<MyCheckedMultiSet::value_type> checkit; test_basic<MyCheckedMultiSet>("concurrent_unordered_multiset (checked)"); }
     { Check<MyCheckedMultiSet::value_type> checkit; test_concurrent<MyCheckedMultiSet>( "concurrent unordered multiset (checked)" ); }
 
+    test_concurrent_erase<MySet>( "concurrent unordered Set" );
+    test_concurrent_erase<MyMultiSet>( "concurrent unordered MultiSet" );
+    test_guarded_lookups<MySet>( "concurrent unordered Set" );
+    test_guarded_lookups<MyMultiSet>( "concurrent unordered MultiSet" );
+    test_node_pool<MySet>( "concurrent unordered Set" );
+    test_node_pool<MyMultiSet>( "concurrent unordered MultiSet" );
+    { Check<MyCheckedSet::value_type> checkit; test_concurrent_erase<MyCheckedSet>( "concurrent unordered set (checked)" ); }
+    { Check<MyCheckedSet::value_type> checkit; test_guarded_lookups<MyCheckedSet>( "concurrent unordered set (checked)" ); }
+
     test_initialization_time_operations( );
 #if !__TBB_CPP11_STD_PLACEHOLDERS_LINKAGE_BROKEN
     test_initialization_time_operations_external( );
@@ -43,6 +43,8 @@
 #include <list>
 #include <map>
 #include <utility>
+#include <string>
+#include <algorithm>
 
 #if !TBB_USE_EXCEPTIONS && _MSC_VER
     #pragma warning (pop)
@@ -521,6 +523,9 @@ void run_parallel_scalar_tests(const char *test_name, const char *allocator_name
             T combine_ref_sum;
             test_helper<T>::init(combine_ref_sum);
 
+            T combine_parallel_sum;
+            test_helper<T>::init(combine_parallel_sum);
+
             T accumulator_sum;
             test_helper<T>::init(accumulator_sum);
 
@@ -557,6 +562,7 @@ void run_parallel_scalar_tests(const char *test_name, const char *allocator_name
                         test_helper<T>::sum(combine_sum, sums.combine(FunctionAdd<T>));
                         test_helper<T>::sum(combine_ref_sum, sums.combine(FunctionAddByRef<T>));
                         test_helper<T>::sum(static_sum, static_sums.combine(FunctionAdd<T>));
+                        test_helper<T>::sum(combine_parallel_sum, sums.combine_parallel(FunctionAddByRef<T>));
 
                         // Accumulate with combine_each
                         sums.combine_each(Accumulator<T>(accumulator_sum));
@@ -576,6 +582,7 @@ void run_parallel_scalar_tests(const char *test_name, const char *allocator_name
 
             ASSERT( EXPECTED_SUM == test_helper<T>::get(combine_sum) || exception_caught, NULL);
             ASSERT( EXPECTED_SUM == test_helper<T>::get(combine_ref_sum) || exception_caught, NULL);
+            ASSERT( EXPECTED_SUM == test_helper<T>::get(combine_parallel_sum) || exception_caught, NULL);
             ASSERT( EXPECTED_SUM == test_helper<T>::get(static_sum) || exception_caught, NULL);
             ASSERT( EXPECTED_SUM == test_helper<T>::get(accumulator_sum) || exception_caught, NULL);
             ASSERT( EXPECTED_SUM == test_helper<T>::get(clearing_accumulator_sum) || exception_caught, NULL);
@@ -1278,12 +1285,188 @@ void TestInstantiation(const char *allocator_name) {
 #endif
 }
 
+//! Local copy which remembers the thread that created it
+struct OwnedCounter {
+    tbb::tbb_thread::id owner;
+    long count;
+    OwnedCounter() : owner(tbb::this_tbb_thread::get_id()), count(0) {}
+};
+
+typedef tbb::enumerable_thread_specific<OwnedCounter, tbb::cache_aligned_allocator<OwnedCounter>, tbb::ets_worker_index> worker_ets_type;
+
+class OwnedCounterBody : NoAssign {
+    worker_ets_type &my_ets;
+public:
+    OwnedCounterBody( worker_ets_type &ets ) : my_ets(ets) {}
+    void operator()( const tbb::blocked_range<int> &r ) const {
+        bool exists;
+        OwnedCounter &c = my_ets.local(exists);
+        ASSERT( c.owner == tbb::this_tbb_thread::get_id(), "a thread got the copy of another thread" );
+        ASSERT( exists || c.count == 0, "a new copy must be reported as not existing" );
+        ASSERT( &my_ets.local() == &c, "a thread got another copy on the next lookup" );
+        c.count += long(r.size());
+    }
+    void operator()( int ) const {
+        for( int i = 0; i < N; i += RANGE_MIN )
+            (*this)( tbb::blocked_range<int>( i, i+RANGE_MIN ) );
+    }
+};
+
+long OwnedCount( const worker_ets_type &ets ) {
+    long count = 0;
+    for( worker_ets_type::const_iterator i = ets.begin(); i != ets.end(); ++i ) {
+        for( worker_ets_type::const_iterator j = ets.begin(); j != i; ++j )
+            ASSERT( i->owner != j->owner, "a thread has two copies" );
+        count += i->count;
+    }
+    return count;
+}
+
+//! Tests the copies looked up by the index of the worker threads, and by the hash table for other threads
+void TestWorkerIndexKey( int p ) {
+    REMARK("Testing worker index key on %d thread(s)\n", p);
+    tbb::task_scheduler_init init(p);
+    worker_ets_type ets;
+    for( int t = 0; t < 3; ++t ) {
+        tbb::parallel_for( tbb::blocked_range<int>( 0, N, RANGE_MIN ), OwnedCounterBody( ets ) );
+        ASSERT( OwnedCount( ets ) == long(t+1)*N, NULL );
+    }
+    // the threads which are not TBB workers use the hash table
+    NativeParallelFor( p, OwnedCounterBody( ets ) );
+    ASSERT( OwnedCount( ets ) == long(3+p)*N, NULL );
+
+    // the copy has all the locals, found through the hash table by any thread
+    tbb::enumerable_thread_specific<OwnedCounter> copy( ets );
+    ASSERT( copy.size() == ets.size(), NULL );
+    worker_ets_type copy_back;
+    copy_back = copy;
+    ASSERT( OwnedCount( copy_back ) == long(3+p)*N, NULL );
+
+    ets.clear();
+    ASSERT( ets.empty(), NULL );
+    tbb::parallel_for( tbb::blocked_range<int>( 0, N, RANGE_MIN ), OwnedCounterBody( ets ) );
+    ASSERT( OwnedCount( ets ) == N, "the worker copies must be looked up again after clear" );
+    tbb::parallel_for( tbb::blocked_range<int>( 0, N, RANGE_MIN ), OwnedCounterBody( copy_back ) );
+    ASSERT( OwnedCount( copy_back ) == long(4+p)*N, "the copied locals must be found by their threads" );
+}
+
+typedef tbb::enumerable_thread_specific<int> hashed_ets_type;
+typedef tbb::enumerable_thread_specific<int*, tbb::cache_aligned_allocator<int*>, tbb::ets_worker_index> indexed_ets_type;
+
+//! Makes the copy of ets_worker_index point to the copy of the thread in ets_no_key
+class HashedLocal {
+    hashed_ets_type *my_ets;
+public:
+    HashedLocal( hashed_ets_type &ets ) : my_ets(&ets) {}
+    int* operator()() const { return &my_ets->local(); }
+};
+
+class SameCopyBody : NoAssign {
+    indexed_ets_type &my_indexed;
+    hashed_ets_type &my_hashed;
+public:
+    SameCopyBody( indexed_ets_type &indexed, hashed_ets_type &hashed ) : my_indexed(indexed), my_hashed(hashed) {}
+    void operator()( const tbb::blocked_range<int> &r ) const {
+        for( int i = r.begin(); i != r.end(); ++i )
+            ASSERT( my_indexed.local() == &my_hashed.local(), "a worker got the copy of a finished worker" );
+    }
+};
+
+//! Workers of a restarted scheduler reuse the indices of the finished ones, but not their copies
+void TestWorkerIndexAfterRestart( int p ) {
+    REMARK("Testing worker index key with restarts of the scheduler on %d thread(s)\n", p);
+    hashed_ets_type hashed;
+    indexed_ets_type indexed( (HashedLocal( hashed )) );
+    for( int r = 0; r < 5; ++r ) {
+        {
+            tbb::task_scheduler_init init( p );
+            // small chunks, so that the new workers join the loop
+            for( int t = 0; t < 10; ++t )
+                tbb::parallel_for( tbb::blocked_range<int>( 0, N, 10 ), SameCopyBody( indexed, hashed ) );
+        }
+        // let the workers finish, so that the next scheduler creates new ones
+        Harness::Sleep( 200 );
+    }
+    ASSERT( indexed.size() == hashed.size(), NULL );
+}
+
 class BigType {
 public:
     BigType() { /* avoid cl warning C4345 about default initialization of POD types */ }
     char my_data[12 * 1024 * 1024];
 };
 
+//// tests for combine_parallel and combine_parallel_in_place
+
+const int HistogramSize = 64;
+typedef std::vector<int> histogram_type;
+typedef tbb::enumerable_thread_specific<histogram_type> histogram_ets_type;
+
+class HistogramBody : NoAssign {
+    histogram_ets_type &my_ets;
+public:
+    HistogramBody( histogram_ets_type &ets ) : my_ets(ets) {}
+    void operator()( const tbb::blocked_range<int> &r ) const {
+        histogram_type &h = my_ets.local();
+        for( int i = r.begin(); i != r.end(); ++i )
+            ++h[i%HistogramSize];
+    }
+};
+
+void MergeHistogram( histogram_type &left, const histogram_type &right ) {
+    for( int i = 0; i < HistogramSize; ++i )
+        left[i] += right[i];
+}
+
+histogram_type AddHistograms( const histogram_type &left, const histogram_type &right ) {
+    histogram_type result( left );
+    MergeHistogram( result, right );
+    return result;
+}
+
+//! Concatenation is associative but not commutative, so it checks that the order of the copies is kept
+std::string Concatenate( const std::string &left, const std::string &right ) { return left+right; }
+
+//! Creates the copy of the calling thread
+template<typename T>
+class LocalTouchBody : NoAssign {
+    tbb::enumerable_thread_specific<T> &my_ets;
+public:
+    LocalTouchBody( tbb::enumerable_thread_specific<T> &ets ) : my_ets(ets) {}
+    void operator()( int ) const { my_ets.local(); }
+};
+
+void TestCombineParallel( int p ) {
+    REMARK("Testing combine_parallel on %d thread(s)\n", p);
+    tbb::task_scheduler_init init(p);
+    histogram_ets_type ets( histogram_type( HistogramSize, 0 ) );
+    ASSERT( ets.combine_parallel( AddHistograms ) == histogram_type( HistogramSize, 0 ), "the exemplar must be returned for no copies" );
+    for( int t = 0; t < 3; ++t ) {
+        tbb::parallel_for( tbb::blocked_range<int>( 0, N, RANGE_MIN ), HistogramBody( ets ) );
+        const size_t copies = ets.size();
+        histogram_type expected = ets.combine( AddHistograms );
+        for( int i = 0; i < HistogramSize; ++i )
+            ASSERT( expected[i] == (t+1)*(N/HistogramSize + (i < N%HistogramSize)), NULL );
+        ASSERT( ets.combine_parallel( AddHistograms ) == expected, NULL );
+        histogram_type &merged = ets.combine_parallel_in_place( MergeHistogram );
+        ASSERT( merged == expected, NULL );
+        ASSERT( ets.size() == copies, "combine_parallel_in_place must not add or remove copies" );
+        // leave the result in a single copy, so the next round counts on top of it
+        for( histogram_ets_type::iterator i = ets.begin(); i != ets.end(); ++i )
+            if( &*i != &merged )
+                std::fill( i->begin(), i->end(), 0 );
+    }
+
+    tbb::enumerable_thread_specific<std::string> strings;
+    NativeParallelFor( 26, LocalTouchBody<std::string>( strings ) );
+    ASSERT( strings.size() == 26, NULL );
+    for( int i = 0; i < 26; ++i )
+        *(strings.begin()+i) = char('a'+i);
+    const std::string expected = "abcdefghijklmnopqrstuvwxyz";
+    ASSERT( strings.combine( Concatenate ) == expected, NULL );
+    ASSERT( strings.combine_parallel( Concatenate ) == expected, "combine_parallel must keep the order of the copies" );
+}
+
 template<template<class> class Allocator>
 void TestConstructorWithBigType(const char *allocator_name) {
     typedef tbb::enumerable_thread_specific<BigType, Allocator<BigType> > CounterBigType;
@@ -1333,6 +1516,11 @@ int TestMain () {
         AlignMask = tbb_allocator_mask;
         run_parallel_tests<tbb::tbb_allocator>("tbb::tbb_allocator");
         run_cross_type_tests();
+        for (int p = MinThread; p <= MaxThread; ++p)
+            TestWorkerIndexKey(p);
+        TestWorkerIndexAfterRestart(MaxThread < 2 ? 2 : MaxThread);
+        for (int p = MinThread; p <= MaxThread; ++p)
+            TestCombineParallel(p);
     }
 
     AlignMask = cache_allocator_mask;
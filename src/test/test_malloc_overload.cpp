@@ -175,9 +175,9 @@ struct LargeObjectHdr {
 const uintptr_t blockSize = 16*1024;
 const uint32_t fittingAlignment = rml::internal::estimatedCacheLineSize;
 #define SET_FITTING_SIZE(N) ( (blockSize-2*rml::internal::estimatedCacheLineSize)/N ) & ~(fittingAlignment-1)
-const uint32_t fittingSize5 = SET_FITTING_SIZE(2); // 8128/8064
+const uint32_t fittingSize11 = SET_FITTING_SIZE(2); // 8128/8064
 #undef SET_FITTING_SIZE
-const uint32_t minLargeObjectSize = fittingSize5 + 1;
+const uint32_t minLargeObjectSize = fittingSize11 + 1;
 
 /* end of code replicated from src/tbbmalloc */
 
@@ -23,7 +23,14 @@
 #define HARNESS_TBBMALLOC_THREAD_SHUTDOWN 1
 #include "harness.h"
 #include "harness_barrier.h"
-#if !__TBB_SOURCE_DIRECTLY_INCLUDED
+#if TEST_USES_TBB
+// arena_pool_binding is tested with the TBB scheduler
+#define TBB_PREVIEW_MEMORY_POOL 1
+#define TBB_PREVIEW_LOCAL_OBSERVER 1
+#include "tbb/memory_pool.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/parallel_for.h"
+#elif !__TBB_SOURCE_DIRECTLY_INCLUDED
 #include "harness_tbb_independence.h"
 #endif
 
@@ -495,6 +502,253 @@ static void TestPoolCreation()
     ASSERT(putMemCalls == getMemCalls, "no leaks after pool_destroy");
 }
 
+static rml::MemoryPool *limitedPool;
+static int limitCallbacks;
+static size_t limitRaisesLeft;
+
+static bool raiseLimit(intptr_t /*pool_id*/, size_t limit, size_t bytes)
+{
+    limitCallbacks++;
+    ASSERT(bytes, NULL);
+    if (!limitRaisesLeft)
+        return false;
+    limitRaisesLeft--;
+    pool_set_limit(limitedPool, limit+4*1024*1024, raiseLimit);
+    return true;
+}
+
+static void TestPoolLimit()
+{
+    using namespace rml;
+    const size_t LIMIT = 8*1024*1024, OBJ_SZ = 64*1024;
+    const int MAX_OBJS = 1024;
+    void *objs[MAX_OBJS];
+    MemPoolPolicy pol(getMallocMem, putMallocMem);
+    int num;
+
+    pool_create_v1(0, &pol, &limitedPool);
+    ASSERT(pool_set_limit(limitedPool, LIMIT, NULL) == POOL_OK, NULL);
+    for (num=0; num<MAX_OBJS; num++)
+        if (!(objs[num] = pool_malloc(limitedPool, OBJ_SZ)))
+            break;
+    ASSERT(num && num*OBJ_SZ < LIMIT, "Pool limit must be respected");
+    ASSERT(!pool_malloc(limitedPool, LIMIT), NULL);
+    // the callback can raise the limit and ask to retry
+    limitCallbacks = 0;
+    limitRaisesLeft = 1;
+    ASSERT(pool_set_limit(limitedPool, LIMIT, raiseLimit) == POOL_OK, NULL);
+    void *obj = pool_malloc(limitedPool, 3*1024*1024);
+    ASSERT(obj && limitCallbacks == 1, NULL);
+    ASSERT(!pool_malloc(limitedPool, LIMIT), NULL);
+    ASSERT(limitCallbacks > 1, NULL);
+    pool_free(limitedPool, obj);
+    // no limit
+    ASSERT(pool_set_limit(limitedPool, 0, NULL) == POOL_OK, NULL);
+    obj = pool_malloc(limitedPool, LIMIT);
+    ASSERT(obj, NULL);
+    pool_free(limitedPool, obj);
+    for (int i=0; i<num; i++)
+        pool_free(limitedPool, objs[i]);
+    pool_destroy(limitedPool);
+    ASSERT(!liveRegions, "Expected all regions were released.");
+}
+
+class ThreadDefaultPoolRun: NoAssign {
+    rml::MemoryPool *pool;
+    void        **objs;
+public:
+    static const int OBJ_CNT = 100;
+    ThreadDefaultPoolRun(rml::MemoryPool *p, void **o) : pool(p), objs(o) {}
+    void operator()( int id ) const {
+        if (id % 2)
+            ASSERT(rml::pool_set_thread_default(pool), NULL);
+        for (int i=0; i<OBJ_CNT; i++) {
+            size_t sz = i%10? 8*i+1 : 64*1024*i;
+            void *o = scalable_malloc(sz);
+            ASSERT(o && scalable_msize(o) >= sz, NULL);
+            memset(o, 1, sz);
+            // released by other thread
+            objs[id*OBJ_CNT+i] = scalable_realloc(o, sz+8);
+        }
+        if (id % 2)
+            ASSERT(rml::pool_set_thread_default(NULL), NULL);
+    }
+};
+
+// scalable_malloc served by a user pool
+static void TestThreadDefaultPool()
+{
+    using namespace rml;
+    const size_t LIMIT = 8*1024*1024;
+    MemPoolPolicy pol(getMallocMem, putMallocMem);
+    MemoryPool *pool;
+
+    pool_create_v1(0, &pol, &pool);
+    pool_set_limit(pool, LIMIT, NULL);
+    ASSERT(!pool_get_thread_default(), NULL);
+    ASSERT(pool_set_thread_default(pool), NULL);
+    ASSERT(pool_get_thread_default() == pool, NULL);
+    void *small = scalable_malloc(16),
+         *aligned = scalable_aligned_malloc(1000, 4096);
+    ASSERT(small && aligned && !((uintptr_t)aligned & 4095), NULL);
+    // the limit of the pool, not of the default one, is applied
+    ASSERT(!scalable_malloc(LIMIT), NULL);
+    ASSERT(pool_set_thread_default(NULL), NULL);
+    ASSERT(!pool_get_thread_default(), NULL);
+    void *large = scalable_malloc(LIMIT);
+    ASSERT(large, NULL);
+    scalable_free(large);
+    scalable_free(small);
+    scalable_aligned_free(aligned);
+
+    pool_set_limit(pool, 0, NULL);
+    for (int p=MinThread; p<=MaxThread; p++) {
+        void **objs = new void*[p*ThreadDefaultPoolRun::OBJ_CNT];
+        NativeParallelFor( p, ThreadDefaultPoolRun(pool, objs) );
+        for (int i=0; i<p*ThreadDefaultPoolRun::OBJ_CNT; i++)
+            scalable_free(objs[i]);
+        delete []objs;
+    }
+    pool_destroy(pool);
+    ASSERT(!liveRegions, "Expected all regions were released.");
+}
+
+#if TEST_USES_TBB && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+static bool inBuffer(void *obj, const char *buf, size_t size)
+{
+    return (char*)obj >= buf && (char*)obj < buf+size;
+}
+
+static const size_t BINDING_BUF_SIZE = 1024*1024;
+static char bindingBuf1[BINDING_BUF_SIZE], bindingBuf2[BINDING_BUF_SIZE];
+
+// scalable_malloc is served from the buffer of the pool bound to the current arena
+static void checkDefaultIn(const char *buf)
+{
+    void *obj = scalable_malloc(100);
+    ASSERT(obj, NULL);
+    ASSERT(buf? inBuffer(obj, buf, BINDING_BUF_SIZE)
+           : !inBuffer(obj, bindingBuf1, BINDING_BUF_SIZE) && !inBuffer(obj, bindingBuf2, BINDING_BUF_SIZE),
+           "scalable_malloc is served by a wrong pool.");
+    scalable_free(obj);
+}
+
+class CheckDefaultIn: NoAssign {
+    const char *buf;
+public:
+    CheckDefaultIn(const char *b) : buf(b) {}
+    void operator()() const { checkDefaultIn(buf); }
+    void operator()(int) const { checkDefaultIn(buf); }
+};
+
+class ParallelForEach: NoAssign {
+    const char *buf;
+public:
+    ParallelForEach(const char *b) : buf(b) {}
+    void operator()() const { tbb::parallel_for(0, 1000, CheckDefaultIn(buf)); }
+};
+
+class NestedEntry: NoAssign {
+    tbb::task_arena &inner;
+public:
+    NestedEntry(tbb::task_arena &a) : inner(a) {}
+    void operator()() const {
+        checkDefaultIn(bindingBuf1);
+        inner.execute(CheckDefaultIn(bindingBuf2));
+        // back to the pool of the outer arena
+        checkDefaultIn(bindingBuf1);
+    }
+};
+
+// Threads entering an arena get the bound pool as their default, and get back
+// their previous default on leaving it, also from nested entries
+static void TestArenaPoolBinding()
+{
+    using namespace rml;
+    MemPoolPolicy pol(getMallocMem, putMallocMem);
+    MemoryPool *prevDefault;
+    pool_create_v1(0, &pol, &prevDefault);
+
+    tbb::task_scheduler_init init(MaxThread);
+    // arenas without workers, so only the calling thread enters them
+    tbb::task_arena outer(1), inner(1), shared(MaxThread);
+    {
+        tbb::fixed_pool pool1(bindingBuf1, BINDING_BUF_SIZE), pool2(bindingBuf2, BINDING_BUF_SIZE);
+        tbb::arena_pool_binding outerBinding(outer, pool1), innerBinding(inner, pool2);
+
+        ASSERT(!pool_get_thread_default(), NULL);
+        outer.execute(CheckDefaultIn(bindingBuf1));
+        ASSERT(!pool_get_thread_default(), "The default pool was not restored on leaving the arena.");
+        outer.execute(NestedEntry(inner));
+        ASSERT(!pool_get_thread_default(), NULL);
+
+        ASSERT(pool_set_thread_default(prevDefault), NULL);
+        outer.execute(NestedEntry(inner));
+        ASSERT(pool_get_thread_default() == prevDefault, "The previous default pool was not restored.");
+        ASSERT(pool_set_thread_default(NULL), NULL);
+
+        // workers entering the arena
+        tbb::arena_pool_binding sharedBinding(shared, pool1);
+        shared.execute(CheckDefaultIn(bindingBuf1));
+        for (int i=0; i<10; i++)
+            shared.execute(ParallelForEach(bindingBuf1));
+        // the binding waits for the workers to leave the arena on destruction
+    }
+    // the pools and the bindings are destroyed, threads entering the arenas
+    // must not use them anymore
+    outer.execute(CheckDefaultIn(NULL));
+    for (int i=0; i<10; i++)
+        shared.execute(ParallelForEach(NULL));
+    ASSERT(!pool_get_thread_default(), NULL);
+    pool_destroy(prevDefault);
+}
+#endif
+
+static size_t statsTotal(const rml::MemPoolStats &st)
+{
+    return st.slabs + st.emptySlabs + st.largeObjects + st.largeCached + st.backendFree;
+}
+
+static void TestPoolStats()
+{
+    using namespace rml;
+    const int SMALL_CNT = 1000, LARGE_CNT = 10;
+    const size_t SMALL_SZ = 100, LARGE_SZ = 100*1024;
+    void *small[SMALL_CNT], *large[LARGE_CNT];
+    MemPoolPolicy pol(getMallocMem, putMallocMem);
+    MemoryPool *pool;
+    MemPoolStats st;
+
+    pool_create_v1(0, &pol, &pool);
+    ASSERT(!pool_get_stats(pool, NULL), NULL);
+    for (int i=0; i<SMALL_CNT; i++)
+        small[i] = pool_malloc(pool, SMALL_SZ);
+    for (int i=0; i<LARGE_CNT; i++)
+        large[i] = pool_malloc(pool, LARGE_SZ);
+    ASSERT(pool_get_stats(pool, &st), NULL);
+    ASSERT(st.smallObjects >= SMALL_CNT*SMALL_SZ && st.smallObjects <= st.slabs, NULL);
+    ASSERT(st.largeObjects >= LARGE_CNT*LARGE_SZ && !st.largeCached, NULL);
+    ASSERT(statsTotal(st) <= st.mapped, NULL);
+
+    for (int i=0; i<SMALL_CNT; i++)
+        pool_free(pool, small[i]);
+    for (int i=0; i<LARGE_CNT; i++)
+        pool_free(pool, large[i]);
+    MemPoolStats freed;
+    ASSERT(pool_get_stats(pool, &freed), NULL);
+    ASSERT(!freed.smallObjects && !freed.largeObjects, NULL);
+    ASSERT(freed.emptySlabs + freed.largeCached + freed.backendFree
+           >= st.emptySlabs + st.largeCached + st.backendFree + LARGE_CNT*LARGE_SZ, NULL);
+    ASSERT(statsTotal(freed) <= freed.mapped, NULL);
+    pool_destroy(pool);
+
+    // the pool of scalable_malloc
+    void *obj = scalable_malloc(SMALL_SZ);
+    ASSERT(pool_get_stats(NULL, &st), NULL);
+    ASSERT(st.smallObjects >= SMALL_SZ && statsTotal(st) <= st.mapped, NULL);
+    scalable_free(obj);
+}
+
 int TestMain () {
     TestTooSmallBuffer();
     TestPoolReset();
@@ -505,6 +759,12 @@ int TestMain () {
     TestPoolKeepTillDestroy();
     TestEntries();
     TestPoolCreation();
+    TestPoolLimit();
+    TestThreadDefaultPool();
+    TestPoolStats();
+#if TEST_USES_TBB && __TBB_ARENA_OBSERVER && __TBB_TASK_ARENA
+    TestArenaPoolBinding();
+#endif
 
     return Harness::Done;
 }
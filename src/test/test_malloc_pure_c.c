@@ -81,6 +81,25 @@ int main(void) {
             printf("Warning: there should be memory but scalable_malloc returned NULL\n");
         scalable_free(p1);
     }
+    /* sized deallocation of objects got in different ways */
+    for( i=1; i<=1<<16; i*=2 ) {
+        p1 = scalable_malloc(i);
+        scalable_free_sized(p1, i);
+        p1 = scalable_calloc(i, 3);
+        scalable_free_sized(p1, 3*i);
+        p1 = scalable_realloc(scalable_malloc(1<<16), i);
+        scalable_free_sized(p1, i);
+    }
+    scalable_free_sized(NULL, 0);
+    {
+        /* batch allocation and deallocation */
+        void *batch[100];
+        for( i=1; i<=1<<16; i*=4 ) {
+            j = scalable_malloc_batch(i, 100, batch);
+            assert(j == 100);
+            scalable_free_batch(batch, j);
+        }
+    }
     p1 = p2 = NULL;
     for( i=1024*1024; ; i/=2 )
     {
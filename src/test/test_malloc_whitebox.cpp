@@ -55,6 +55,8 @@
 namespace tbbmalloc_whitebox {
     size_t locGetProcessed = 0;
     size_t locPutProcessed = 0;
+    intptr_t locHotGets = 0;
+    intptr_t locHotPuts = 0;
 }
 #include "../tbbmalloc/large_objects.cpp"
 #include "../tbbmalloc/tbbmalloc.cpp"
@@ -678,6 +680,131 @@ void TestBitMask()
     ASSERT(mask.getMinTrue(201) == -1, NULL);
 }
 
+void TestSizeClasses()
+{
+    unsigned prevIndex = 0;
+    for (unsigned size = 1; size < minLargeObjectSize; size++) {
+        unsigned index = getIndex(size), objSize = getObjectSize(size);
+        ASSERT(index < numBlockBins, "Bin index is out of range.");
+        ASSERT(index >= prevIndex, "Bin indices are not monotonic.");
+        ASSERT(size <= objSize && objSize < minLargeObjectSize, "Object does not fit into its size class.");
+        ASSERT(getIndex(objSize) == index && getObjectSize(objSize) == objSize,
+               "Size class is not mapped to itself.");
+        if (size > 1 && index != prevIndex)
+            ASSERT(getObjectSize(size-1) == size-1, "Size class boundary is skipped.");
+        if (objSize <= maxSmallObjectSize)
+            ASSERT(objSize % 8 == 0, NULL);
+        else if (objSize > maxSegregatedObjectSize)
+            ASSERT(objSize % fittingAlignment == 0, "Fitting size is not properly aligned.");
+        prevIndex = index;
+    }
+    ASSERT(prevIndex == numBlockBins-1, "Not all bins are used.");
+}
+
+// Large objects are placed at varying offsets in their blocks, so the block identifies the memory
+static void *objectMemory(void *object)
+{
+    return isLargeObject<ourMem>(object)? (void*)((LargeObjectHdr*)object-1)->memoryBlock : object;
+}
+
+void TestSizedFree()
+{
+    const size_t largeSize = 64*1024;
+
+    // with the matching size, objects are released to the caches they are taken from
+    const size_t sizes[] = {16, 1000, minLargeObjectSize-1, minLargeObjectSize, largeSize};
+    for (unsigned i=0; i<sizeof(sizes)/sizeof(size_t); i++) {
+        void *p = scalable_malloc(sizes[i]);
+        ASSERT(isLargeObject<ourMem>(p) == (sizes[i] >= minLargeObjectSize), NULL);
+        void *mem = objectMemory(p);
+        scalable_free_sized(p, sizes[i]);
+        void *q = scalable_malloc(sizes[i]);
+        ASSERT(mem == objectMemory(q), "Memory of an object released with its size is not reused.");
+        scalable_free_sized(q, sizes[i]);
+    }
+    scalable_free_sized(NULL, 0);
+
+    void *p = scalable_malloc(largeSize);
+    ASSERT(isLargeObject<ourMem>(p), NULL);
+    // shrinking a large object below minLargeObjectSize must result in a small one
+    p = scalable_realloc(p, minLargeObjectSize-1);
+    ASSERT(!isLargeObject<ourMem>(p), "Large object is kept by realloc for a small size.");
+    scalable_free_sized(p, minLargeObjectSize-1);
+
+    p = scalable_realloc(scalable_malloc(largeSize), minLargeObjectSize);
+    ASSERT(isLargeObject<ourMem>(p), NULL);
+    scalable_free_sized(p, minLargeObjectSize);
+
+    // aligned allocations are still shrunk in place
+    p = scalable_aligned_malloc(largeSize, 4096);
+    void *q = scalable_aligned_realloc(p, 100, 4096);
+    ASSERT(p == q, NULL);
+    scalable_aligned_free(q);
+}
+
+void TestReallocGrowth()
+{
+    const LargeObjectCache *loc = &defaultMemPool->extMemPool.loc;
+    const size_t usedBefore = loc->getUsedSize();
+    const size_t startSize = 16*1024*1024;
+
+    for (size_t alignment = 0; alignment <= 4096; alignment += 4096) {
+        unsigned char *p = (unsigned char*)(alignment?
+            scalable_aligned_malloc(startSize, alignment) : scalable_malloc(startSize));
+        for (size_t i=0; i<startSize; i+=997)
+            p[i] = (unsigned char)i;
+        // huge objects can be grown in place, check that content and accounting survive
+        for (size_t size = 2*startSize; size <= 8*startSize; size *= 2) {
+            p = (unsigned char*)(alignment? scalable_aligned_realloc(p, size, alignment)
+                                 : scalable_realloc(p, size));
+            ASSERT(p && scalable_msize(p) >= size, NULL);
+            ASSERT(!alignment || isAligned(p, alignment), NULL);
+            memset(p+size/2, 0, size/2);
+        }
+        for (size_t i=0; i<startSize; i+=997)
+            ASSERT(p[i] == (unsigned char)i, "Content is lost by realloc.");
+        if (alignment)
+            scalable_aligned_free(p);
+        else
+            scalable_free(p);
+        // hot blocks left by previous tests can be released meanwhile,
+        // but moving the block to a new size must not underflow the counter
+        ASSERT(loc->getUsedSize() <= usedBefore, "Used size of the cache is broken by realloc.");
+    }
+}
+
+static bool isZeroed(const void *p, size_t size)
+{
+    for (size_t i=0; i<size; i++)
+        if (((const char*)p)[i])
+            return false;
+    return true;
+}
+
+void TestCalloc()
+{
+    const size_t sizes[] = { minLargeObjectSize, 3*1024*1024+5, 200*1024*1024 };
+
+    for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+        const size_t size = sizes[i];
+        // a block from the cache is dirty, so it must be zeroed
+        void *p = scalable_malloc(size);
+        memset(p, 0xFF, size);
+        scalable_free(p);
+        p = scalable_calloc(1, size);
+        ASSERT(p && isZeroed(p, size), "Object is not zeroed by calloc.");
+        ASSERT(!((LargeObjectHdr*)p - 1)->memoryBlock->knownZero || size >= 128*1024*1024,
+               "Reused block must not be treated as just mapped one.");
+        memset(p, 0xFF, size);
+        scalable_free(p);
+    }
+    // memory just mapped is not written by calloc
+    void *p = scalable_calloc(1, 200*1024*1024);
+    ASSERT(p && ((LargeObjectHdr*)p - 1)->memoryBlock->knownZero, NULL);
+    ASSERT(isZeroed(p, 200*1024*1024), "Object is not zeroed by calloc.");
+    scalable_free(p);
+}
+
 size_t getMemSize()
 {
     return defaultMemPool->extMemPool.backend.getTotalMemSize();
@@ -810,6 +937,343 @@ void TestCleanAllBuffers() {
     size_t memory_leak = memory_in_use_after - memory_in_use_before;
     ASSERT( memory_leak == 0, "The backend has not processed the queue of postponed coalescing requests during cleanup." );
 }
+
+const int remoteFreeObjNum = RemoteFreeCache::MAX_BATCH_SIZE/2;
+void *remoteFreeObjs[remoteFreeObjNum];
+// objects of another size class, kept in the cache until the flush period is over
+void *remotePeriodObjs[remoteFreeObjNum];
+// objects of a third size class, which complete the flush period
+const int remoteFillerObjNum = RemoteFreeCache::FLUSH_PERIOD - remoteFreeObjNum;
+void *remoteFillerObjs[remoteFillerObjNum];
+
+class TestRemoteFreeBody: NoAssign {
+    rml::MemoryPool *pool;
+public:
+    TestRemoteFreeBody(rml::MemoryPool *p) : pool(p) {}
+    void operator()( int /*mynum*/ ) const {
+        Block *block = (Block*)alignDown(remoteFreeObjs[0], slabSize);
+        // the cache is a part of TLS, so make sure TLS exists
+        pool_free(pool, pool_malloc(pool, sizeof(int)));
+        // all objects are owned by the main thread, so they are buffered
+        for (int i=0; i<remoteFreeObjNum; i++)
+            pool_free(pool, remoteFreeObjs[i]);
+        ASSERT(!block->publicFreeList,
+               "Objects of a foreign slab must be kept in the remote free cache.");
+
+        // the cache is flushed when the active block of this thread is exhausted
+        const int localObjNum = 2*slabSize/sizeof(int);
+        void **localObjs = (void**)pool_malloc(pool, localObjNum*sizeof(void*));
+        int n = 0;
+        while (n<localObjNum && !block->publicFreeList)
+            localObjs[n++] = pool_malloc(pool, sizeof(int));
+        ASSERT(block->publicFreeList, "The remote free cache must be flushed on the allocation slow path.");
+        for (int i=0; i<n; i++)
+            pool_free(pool, localObjs[i]);
+        pool_free(pool, localObjs);
+
+        // and after a limited number of objects, even if no batch is full
+        Block *periodBlock = (Block*)alignDown(remotePeriodObjs[0], slabSize);
+        for (int i=0; i<remoteFreeObjNum; i++)
+            pool_free(pool, remotePeriodObjs[i]);
+        for (int i=0; i<remoteFillerObjNum-1; i++)
+            pool_free(pool, remoteFillerObjs[i]);
+        ASSERT(!periodBlock->publicFreeList, "The flush period is not over yet.");
+        pool_free(pool, remoteFillerObjs[remoteFillerObjNum-1]);
+        ASSERT(periodBlock->publicFreeList, "The remote free cache must be flushed after the flush period.");
+    }
+};
+
+// Objects released by a thread that does not own their slab are passed
+// to the slab in batches. Check that they are buffered and then flushed
+// on the allocation slow path, after the flush period and on thread shutdown.
+void TestRemoteFreeBatching() {
+    rml::MemPoolPolicy pol(getMallocMem, putMallocMem);
+    rml::MemoryPool *pool;
+    pool_create_v1(0, &pol, &pool);
+
+    for (int i=0; i<remoteFreeObjNum; i++) {
+        remoteFreeObjs[i] = pool_malloc(pool, sizeof(int));
+        remotePeriodObjs[i] = pool_malloc(pool, 4*sizeof(int));
+        ASSERT(remoteFreeObjs[i] && remotePeriodObjs[i], NULL);
+    }
+    for (int i=0; i<remoteFillerObjNum; i++) {
+        remoteFillerObjs[i] = pool_malloc(pool, 16*sizeof(int));
+        ASSERT(remoteFillerObjs[i], NULL);
+    }
+    Block *block = (Block*)alignDown(remoteFreeObjs[0], slabSize);
+    ASSERT(block == (Block*)alignDown(remoteFreeObjs[remoteFreeObjNum-1], slabSize),
+           "Objects are expected to be in the same slab of a new pool.");
+    ASSERT((Block*)alignDown(remotePeriodObjs[0], slabSize) == (Block*)alignDown(remotePeriodObjs[remoteFreeObjNum-1], slabSize),
+           "Objects are expected to be in the same slab of a new pool.");
+    NativeParallelFor(1, TestRemoteFreeBody(pool));
+    ASSERT(block->publicFreeList, "Released objects must reach public free list of the slab.");
+    for (int i=0; i<remoteFreeObjNum; i++) {
+        remoteFreeObjs[i] = pool_malloc(pool, sizeof(int));
+        ASSERT(remoteFreeObjs[i], NULL);
+    }
+    pool_destroy(pool);
+}
+
+const int batchObjNum = 1000;
+void *batchObjs[batchObjNum];
+
+class TestBatchFreeBody: NoAssign {
+    rml::MemoryPool *pool;
+public:
+    TestBatchFreeBody(rml::MemoryPool *p) : pool(p) {}
+    void operator()(int) const {
+        Block *block = (Block*)alignDown(batchObjs[0], slabSize);
+        // objects of a foreign slab are published at once, bypassing the remote free cache
+        pool_free_batch(pool, batchObjs, batchObjNum);
+        ASSERT(block->publicFreeList, "Objects released by a batch must reach the slab.");
+    }
+};
+
+void TestBatchAllocation() {
+    rml::MemPoolPolicy pol(getMallocMem, putMallocMem);
+    rml::MemoryPool *pool;
+    pool_create_v1(0, &pol, &pool);
+
+    for (int iter=0; iter<2; iter++) {
+        // the 2nd time the objects are taken from the public free lists
+        size_t n = pool_malloc_batch(pool, sizeof(int), batchObjNum, batchObjs);
+        ASSERT(n == batchObjNum, NULL);
+        for (int i=0; i<batchObjNum; i++) {
+            Block *block = (Block*)alignDown(batchObjs[i], slabSize);
+            ASSERT(block->getSize() >= sizeof(int) && block->getMemPool() == (MemoryPool*)pool, NULL);
+            *(int*)batchObjs[i] = i;
+        }
+        for (int i=0; i<batchObjNum; i++)
+            ASSERT(*(int*)batchObjs[i] == i, "Objects got by a batch overlap.");
+        NativeParallelFor(1, TestBatchFreeBody(pool));
+    }
+    pool_destroy(pool);
+
+    // objects of different kinds and a NULL in the same batch
+    const size_t sizes[] = { 8, 1000, minLargeObjectSize, 1024*1024 };
+    for (size_t k=0; k<sizeof(sizes)/sizeof(sizes[0]); k++) {
+        void *objs[20];
+        ASSERT(scalable_malloc_batch(sizes[k], 10, objs) == 10, NULL);
+        ASSERT(scalable_malloc_batch(sizes[(k+1)%4], 9, objs+10) == 9, NULL);
+        objs[19] = NULL;
+        for (int i=0; i<19; i++)
+            ASSERT(scalable_msize(objs[i]) >= sizes[(k+i/10)%4], NULL);
+        scalable_free_batch(objs, 20);
+    }
+}
+
+class TestPerCpuCachesBody: public SimpleBarrier {
+public:
+    void operator()(int) const {
+        const int num = 4*slabSize/64;
+        void *objs[num];
+
+        for (int i=0; i<num; i++)
+            objs[i] = scalable_malloc(64);
+        for (int i=0; i<num; i++)
+            scalable_free(objs[i]);
+        scalable_free(scalable_malloc(minLargeObjectSize));
+
+        PerCpuCaches::CurrentSlot cpuSlot(perCpuCaches, &defaultMemPool->extMemPool);
+        if (cpuSlot.inUse) {
+            TLSData *tls = defaultMemPool->getTLS(/*create=*/false);
+            ASSERT(!tls->freeSlabBlocks.head && !tls->lloc.head,
+                   "Per-thread caches must be bypassed in per-CPU mode.");
+        }
+        // threads stay alive, like idle threads of a server
+        barrier.wait();
+    }
+};
+
+void TestPerCpuCaches() {
+    int ret = scalable_allocation_mode(TBBMALLOC_USE_PERCPU_CACHES, 1);
+#if __linux__
+    ASSERT(ret == TBBMALLOC_OK, NULL);
+#else
+    ASSERT(ret == TBBMALLOC_NO_EFFECT, NULL);
+#endif
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_PERCPU_CACHES, 2) == TBBMALLOC_INVALID_PARAM, NULL);
+
+    for (int p=MaxThread; p>=MinThread; p--) {
+        TestPerCpuCachesBody::initBarrier(p);
+        NativeParallelFor(p, TestPerCpuCachesBody());
+    }
+#if __linux__
+    ASSERT(perCpuCaches.slots, "Per-CPU caches must be created on first use.");
+#endif
+    if (perCpuCaches.slots) {
+        bool cached = false;
+        for (unsigned i=0; i<perCpuCaches.numOfSlots; i++)
+            cached |= perCpuCaches.slots[i].freeSlabBlocks.head || perCpuCaches.slots[i].lloc.head;
+        ASSERT(cached, "Empty slabs and large objects must be cached per CPU.");
+        scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, 0);
+        for (unsigned i=0; i<perCpuCaches.numOfSlots; i++)
+            ASSERT(!perCpuCaches.slots[i].freeSlabBlocks.head && !perCpuCaches.slots[i].lloc.head,
+                   "Per-CPU caches must be released by buffers cleanup.");
+    }
+    scalable_allocation_mode(TBBMALLOC_USE_PERCPU_CACHES, 0);
+}
+
+static int foreignCalls;
+
+static void countingFree(void *) { foreignCalls++; }
+static void *countingRealloc(void *, size_t) { foreignCalls++; return NULL; }
+static size_t countingMsize(void *) { foreignCalls++; return 0; }
+
+// The sized safer entry must release own objects of both kinds,
+// and pass foreign pointers of any size to the original function
+void TestSaferFreeSized() {
+    const size_t sizes[] = {16, 1000, minLargeObjectSize-1, minLargeObjectSize, 64*1024};
+    // zeroed memory from outside the allocator, with room for the headers checked on both sides
+    char *foreign = (char*)malloc(3*slabSize);
+    ASSERT(foreign, NULL);
+    memset(foreign, 0, 3*slabSize);
+    void *foreignObj = (char*)alignUp((uintptr_t)foreign, slabSize) + slabSize/2;
+
+    foreignCalls = 0;
+    for (unsigned i=0; i<sizeof(sizes)/sizeof(size_t); i++) {
+        void *p = scalable_malloc(sizes[i]);
+        void *mem = objectMemory(p);
+        __TBB_malloc_safer_free_sized(p, sizes[i], countingFree);
+        void *q = scalable_malloc(sizes[i]);
+        ASSERT(mem == objectMemory(q), "Memory of an object released with its size is not reused.");
+        __TBB_malloc_safer_free_sized(q, sizes[i], countingFree);
+        ASSERT(!foreignCalls, "Own objects must not be passed to the original function.");
+
+        __TBB_malloc_safer_free_sized(foreignObj, sizes[i], countingFree);
+        ASSERT(foreignCalls == 1, "Foreign pointers must be passed to the original function.");
+        foreignCalls = 0;
+    }
+    __TBB_malloc_safer_free_sized(NULL, 0, countingFree);
+    ASSERT(!foreignCalls, NULL);
+    free(foreign);
+}
+
+// Guarded objects carved out of large and aligned allocations must be
+// recognized by the entries that accept foreign pointers
+void TestGuardedSaferEntries() {
+    for (size_t sz=100; sz<=1024*1024; sz*=10)
+        for (size_t align=16; align<=8*1024; align*=2) {
+            foreignCalls = 0;
+            void *p = scalable_aligned_malloc(sz, align);
+            ASSERT(__TBB_malloc_safer_msize(p, countingMsize) >= sz, NULL);
+            p = __TBB_malloc_safer_realloc(p, sz+100, (void*)countingRealloc);
+            ASSERT(p && __TBB_malloc_safer_msize(p, countingMsize) >= sz+100, NULL);
+            __TBB_malloc_safer_free(p, countingFree);
+            p = scalable_aligned_malloc(sz, align);
+            p = __TBB_malloc_safer_aligned_realloc(p, 2*sz, align, (void*)countingRealloc);
+            ASSERT(p && isAligned(p, align), NULL);
+            __TBB_malloc_safer_free(p, countingFree);
+            ASSERT(!foreignCalls, "Guarded objects must not be passed to the original functions.");
+        }
+}
+
+// Memory of objects released from quarantine is reused by objects allocated
+// with the mode off, and must not be taken for released guarded objects
+void TestGuardedReleasedMemoryReuse() {
+    const int num = 3000;
+    void *objs[num];
+    scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, 1);
+    for (int i=0; i<num; i++)
+        objs[i] = scalable_aligned_malloc(100, 32<<i%4);
+    for (int i=0; i<num; i++)
+        scalable_aligned_free(objs[i]);
+    scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, 0);
+    scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, 0);
+    for (int r=0; r<20; r++) {
+        for (int i=0; i<num; i++)
+            objs[i] = scalable_malloc(8+(i+r)%64*16);
+        for (int i=0; i<num; i++)
+            scalable_free(objs[r%2? i : num-1-i]);
+    }
+    // a value equal to the key of a released header in a plain object
+    char *p = (char*)scalable_malloc(128);
+    GuardedHdr *fake = (GuardedHdr*)(p+32);
+    fake->magic = guardedKey(fake, guardedFreedTag);
+    fake->base = p+64;
+    ASSERT(!guardedObject(fake+1), "Only objects released in guarded mode can be double freed.");
+    fake->base = p;
+    ASSERT(!guardedObject(fake+1), NULL);
+    scalable_free(p);
+    scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, 0);
+}
+
+void TestGuardedMode() {
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, -1) == TBBMALLOC_INVALID_PARAM, NULL);
+    void *notGuarded = scalable_malloc(100);
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, 1) == TBBMALLOC_OK, NULL);
+    ASSERT(!guardedObject(notGuarded), "Objects allocated before must be served as usual.");
+
+    for (size_t sz=1; sz<=512*1024; sz*=3) {
+        char *p = (char*)scalable_malloc(sz);
+        ASSERT(p && isAligned(p, 16), NULL);
+        GuardedHdr *hdr = guardedObject(p);
+        ASSERT(hdr && hdr->size == max(sz, sizeof(FreeObject)), "Object must be guarded.");
+        ASSERT(scalable_msize(p) == hdr->size, NULL);
+        memset(p, 1, sz);
+        for (char *r = p+hdr->size; r < (char*)guardedRedzoneEnd(hdr); r++)
+            ASSERT(*(unsigned char*)r == redzoneFill, "Redzone must be filled.");
+        ASSERT(guardedRedzoneEnd(hdr) >= p+hdr->size+guardedRedzoneSize, NULL);
+
+        p = (char*)scalable_realloc(p, 2*sz);
+        ASSERT(guardedObject(p) && scalable_msize(p) >= 2*sz, NULL);
+        for (size_t i=0; i<sz; i++)
+            ASSERT(p[i] == 1, "Content must be kept by realloc.");
+        scalable_free(p);
+    }
+    void *old = scalable_malloc(64);
+    scalable_free(old);
+    void *next = scalable_malloc(64);
+    ASSERT(old != next, "Released objects must stay in quarantine.");
+    scalable_free(next);
+
+    char *zeroed = (char*)scalable_calloc(10, 30);
+    ASSERT(guardedObject(zeroed), NULL);
+    for (int i=0; i<300; i++)
+        ASSERT(!zeroed[i], "calloc must return zeroed memory.");
+    scalable_free(zeroed);
+
+    for (size_t align=32; align<=8*1024; align*=4) {
+        const bool guarded = align < guardedMode.pageSize;
+        void *p = scalable_aligned_malloc(100, align);
+        ASSERT(!guardedObject(p) == !guarded && isAligned(p, align), NULL);
+        p = scalable_aligned_realloc(p, 1000, align);
+        ASSERT(!guardedObject(p) == !guarded && isAligned(p, align), NULL);
+        scalable_aligned_free(p);
+    }
+    TestGuardedSaferEntries();
+    ASSERT(defaultMemPool->getTLS(/*create=*/false)->guardedQuarantine.head, NULL);
+    scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, 0);
+    ASSERT(!defaultMemPool->getTLS(/*create=*/false)->guardedQuarantine.head,
+           "Quarantine must be drained by buffers cleanup.");
+
+#if GUARD_PAGES_SUPPORTED
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, 4) == TBBMALLOC_OK, NULL);
+    int paged = 0;
+    for (size_t sz=8; sz<=64*1024; sz+=sz/2+8) {
+        char *p = (char*)scalable_malloc(sz);
+        GuardedHdr *hdr = guardedObject(p);
+        ASSERT(hdr, NULL);
+        if (hdr->magic == guardedKey(hdr, guardedPagedTag)) {
+            paged++;
+            void *guardPage = alignUp(p+hdr->size, guardedMode.pageSize);
+            ASSERT((char*)guardPage - (p+hdr->size) < 16+(intptr_t)sizeof(GuardedHdr),
+                   "Object must end right before the guard page.");
+            ASSERT(safeGuardedObject(p) == hdr, "Header must be on the object's page.");
+        }
+        scalable_free(p);
+    }
+    ASSERT(paged, "Some objects must be placed on guard pages.");
+#endif
+    scalable_allocation_mode(TBBMALLOC_USE_GUARDED_MODE, 0);
+    void *p = scalable_malloc(100);
+    ASSERT(!guardedObject(p), "Guarded mode must be switchable off.");
+    scalable_free(p);
+    scalable_free(notGuarded);
+    scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, 0);
+    TestGuardedReleasedMemoryReuse();
+}
+
 /*---------------------------------------------------------------------------*/
 /*------------------------- Large Object Cache tests ------------------------*/
 #if _MSC_VER==1600 || _MSC_VER==1500
@@ -838,12 +1302,19 @@ class CacheBinModel {
 
     // save only current time
     std::list<uintptr_t> objects;
+    // ages of blocks in the hot stack, the top is at the back
+    std::vector<uintptr_t> hotAges;
 
     void doCleanup() {
-        if ( cacheBinModel.cachedSize > Props::TooLargeFactor*cacheBinModel.usedSize ) tooLargeLOC++;
+        // the blocks in the hot stack count as cached ones
+        const size_t hotSize = hotAges.size()*size;
+        if ( cacheBinModel.cachedSize + hotSize > Props::TooLargeFactor*(cacheBinModel.usedSize - hotSize) ) tooLargeLOC++;
         else tooLargeLOC = 0;
 
-        if (tooLargeLOC>3 && cacheBinModel.ageThreshold)
+        const bool threshDecr = tooLargeLOC>3;
+        // cleanup visits only bins with used or cached objects
+        const bool binVisited = cacheBinModel.usedSize || !objects.empty();
+        if (threshDecr && cacheBinModel.ageThreshold)
             cacheBinModel.ageThreshold = (cacheBinModel.ageThreshold + cacheBinModel.meanHitRange)/2;
 
         uintptr_t currTime = cacheCurrTime;
@@ -854,6 +1325,23 @@ class CacheBinModel {
         }
 
         cacheBinModel.oldest = objects.empty() ? 0 : objects.front();
+
+        if (!binVisited)
+            return;
+        for (size_t i=0; i<hotAges.size(); )
+            if ((intptr_t)(currTime - hotAges[i]) > cacheBinModel.ageThreshold) {
+                cacheBinModel.usedSize -= size;
+                hotAges.erase(hotAges.begin()+i);
+            } else
+                i++;
+    }
+
+    void checkHotStack() {
+        std::vector<uintptr_t>::reverse_iterator it = hotAges.rbegin();
+        for (rml::internal::LargeMemoryBlock *curr = cacheBin.hotHead; curr; curr = curr->next, ++it)
+            ASSERT(it != hotAges.rend() && *it == curr->age, ASSERT_TEXT);
+        ASSERT(it == hotAges.rend(), ASSERT_TEXT);
+        ASSERT((size_t)cacheBin.hotSize == hotAges.size()*size, ASSERT_TEXT);
     }
 
 public:
@@ -865,8 +1353,15 @@ public:
         cacheBinModel.cachedSize = cacheBin.cachedSize;
         cacheBinModel.meanHitRange = cacheBin.meanHitRange;
         cacheBinModel.lastGet = cacheBin.lastGet;
+        for (rml::internal::LargeMemoryBlock *curr = cacheBin.hotHead; curr; curr = curr->next)
+            hotAges.insert(hotAges.begin(), curr->age);
     }
     void get() {
+        if ( !hotAges.empty() ) {
+            // taken from the hot stack, the bin state is untouched
+            hotAges.pop_back();
+            return;
+        }
         uintptr_t currTime = ++cacheCurrTime;
 
         if ( objects.empty() ) {
@@ -895,6 +1390,12 @@ public:
     }
 
     void putList( int num ) {
+        if ( cacheBinModel.lastCleanedAge ) {
+            // the blocks that fit to the hot stack bypass the bin
+            for ( ; num && (hotAges.size()+1)*size <= Props::hotLimit(size); num--)
+                hotAges.push_back(cacheCurrTime);
+            if ( !num ) return;
+        }
         uintptr_t currTime = cacheCurrTime;
         cacheCurrTime += num;
 
@@ -928,6 +1429,7 @@ public:
         ASSERT(cacheBinModel.cachedSize == cacheBin.cachedSize, ASSERT_TEXT);
         ASSERT(cacheBinModel.meanHitRange == cacheBin.meanHitRange, ASSERT_TEXT);
         ASSERT(cacheBinModel.lastGet == cacheBin.lastGet, ASSERT_TEXT);
+        checkHotStack();
     }
 
     static uintptr_t cacheCurrTime;
@@ -1040,7 +1542,9 @@ public:
     }
 
     void check() {
-        ASSERT( tbbmalloc_whitebox::locGetProcessed == tbbmalloc_whitebox::locPutProcessed, ASSERT_TEXT );
+        // a get from the hot stack collapses with the put to the stack
+        ASSERT( tbbmalloc_whitebox::locGetProcessed + tbbmalloc_whitebox::locHotGets
+                == tbbmalloc_whitebox::locPutProcessed + tbbmalloc_whitebox::locHotPuts, ASSERT_TEXT );
         ASSERT( tbbmalloc_whitebox::locGetProcessed < num_threads*NUM_ALLOCS, "No one Malloc/Free pair was collapsed." );
     }
 };
@@ -1079,7 +1583,8 @@ public:
     }
 
     void check() {
-        ASSERT( tbbmalloc_whitebox::locGetProcessed == tbbmalloc_whitebox::locPutProcessed, ASSERT_TEXT );
+        ASSERT( !tbbmalloc_whitebox::locHotGets, ASSERT_TEXT );
+        ASSERT( tbbmalloc_whitebox::locGetProcessed == tbbmalloc_whitebox::locPutProcessed + tbbmalloc_whitebox::locHotPuts, ASSERT_TEXT );
         ASSERT( tbbmalloc_whitebox::locGetProcessed == num_threads*NUM_ALLOCS, ASSERT_TEXT );
     }
 };
@@ -1088,6 +1593,8 @@ template <typename Scenario>
 void LOCCollapsingTester( int num_threads ) {
     tbbmalloc_whitebox::locGetProcessed = 0;
     tbbmalloc_whitebox::locPutProcessed = 0;
+    tbbmalloc_whitebox::locHotGets = 0;
+    tbbmalloc_whitebox::locHotPuts = 0;
     defaultMemPool->extMemPool.loc.cleanAll();
     defaultMemPool->extMemPool.loc.reset();
 
@@ -1097,7 +1604,24 @@ void LOCCollapsingTester( int num_threads ) {
     scen.check();
 }
 
+// The hot stacks of all bins together keep a bounded amount of memory
+void TestLOCHotLimit() {
+    typedef rml::internal::LargeObjectCache::LargeCacheTypeProps Props;
+    size_t total = 0;
+    for ( size_t size = Props::MinSize; size < Props::MaxSize; size += Props::CacheStep ) {
+        const size_t limit = Props::hotLimit(size);
+        ASSERT( limit <= Props::HotBlocks*size && limit <= Props::HotSize && limit%size == 0, ASSERT_TEXT );
+        total += limit;
+    }
+    ASSERT( Props::hotLimit(Props::MinSize) == Props::HotBlocks*Props::MinSize, ASSERT_TEXT );
+    ASSERT( !Props::hotLimit(Props::MaxSize-Props::CacheStep), ASSERT_TEXT );
+    ASSERT( total <= 128*1024*1024, "The hot stacks may keep too much memory." );
+    typedef rml::internal::LargeObjectCache::HugeCacheTypeProps HugeProps;
+    ASSERT( !HugeProps::hotLimit(HugeProps::MinSize), ASSERT_TEXT );
+}
+
 void TestLOC() {
+    TestLOCHotLimit();
     LOCModelTester<TestBootstrap>();
     LOCModelTester<TestRandom>();
 
@@ -1137,8 +1661,17 @@ int TestMain () {
     TestLargeObjectCache();
     TestObjectRecognition();
     TestBitMask();
+    TestSizeClasses();
+    TestSizedFree();
+    TestSaferFreeSized();
+    TestReallocGrowth();
+    TestCalloc();
     TestHeapLimit();
     TestCleanAllBuffers();
+    TestRemoteFreeBatching();
+    TestBatchAllocation();
+    TestPerCpuCaches();
+    TestGuardedMode();
     TestLOC();
     return Harness::Done;
 }
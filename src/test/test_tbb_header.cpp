@@ -27,7 +27,10 @@
 #if __TBB_CPF_BUILD
 // Add testing of preview features
 #define TBB_PREVIEW_AGGREGATOR 1
+#define TBB_PREVIEW_CONCURRENT_FLAT_MAP 1
 #define TBB_PREVIEW_CONCURRENT_LRU_CACHE 1
+#define TBB_PREVIEW_CONCURRENT_RING_QUEUE 1
+#define TBB_PREVIEW_CONCURRENT_RELAXED_PRIORITY_QUEUE 1
 #define TBB_PREVIEW_VARIADIC_PARALLEL_INVOKE 1
 #define TBB_PREVIEW_FLOW_GRAPH_NODES 1 
 #endif
@@ -150,7 +153,10 @@ struct Handler {
 static void TestPreviewNames() {
     TestTypeDefinitionPresence( aggregator );
     TestTypeDefinitionPresence( aggregator_ext<Handler> );
+    TestTypeDefinitionPresence2(concurrent_flat_map<int, int> );
     TestTypeDefinitionPresence2(concurrent_lru_cache<int, int> );
+    TestTypeDefinitionPresence2(concurrent_ring_queue<int, tbb::ring_queue_spsc> );
+    TestTypeDefinitionPresence( concurrent_relaxed_priority_queue<int> );
     #if __TBB_PREVIEW_COMPOSITE_NODE
     TestTypeDefinitionPresence2( composite_node<tbb::flow::tuple<int>, tbb::flow::tuple<int> > );
     #endif
@@ -242,6 +248,8 @@ int TestMain ()
     TestFuncDefinitionPresence( parallel_deterministic_reduce, (const tbb::blocked_range<int>&, Body2&), void );
     TestFuncDefinitionPresence( parallel_scan, (const tbb::blocked_range2d<int>&, Body3&, const tbb::auto_partitioner&), void );
     TestFuncDefinitionPresence( parallel_sort, (int*, int*), void );
+    TestFuncDefinitionPresence( parallel_build, (tbb::concurrent_hash_map<int,int>&, std::pair<int,int>*, std::pair<int,int>*), void );
+    TestFuncDefinitionPresence( parallel_rehash, (tbb::concurrent_hash_map<int,int>&, size_t), void );
     TestTypeDefinitionPresence( pipeline );
     TestFuncDefinitionPresence( parallel_pipeline, (size_t, const tbb::filter_t<void,void>&), void );
     TestTypeDefinitionPresence( task );